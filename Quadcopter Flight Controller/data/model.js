@@ -0,0 +1,120 @@
+// Loads the drone model into a parent group in stages:
+//   1. the box placeholder already in the scene stays until something better loads
+//   2. droneModel.lod.glb (simplified, meshopt-compressed) replaces it
+//   3. droneModel.glb replaces the LOD
+// Downloaded files are cached in IndexedDB together with their ETag. A cached
+// copy is shown straight away and revalidated in the background with
+// If-None-Match, so a reload costs one empty 304 instead of the full model.
+// The ESP32 serves files from its control loop, one request at a time, and
+// refuses the models while armed (503, see static_files.h), so every model
+// request waits until the /arm poll has seen the drone disarmed.
+
+const MODEL_DB = "drone-models";
+const MODEL_STORE = "files";
+const MODEL_SIZE = 2.0;   // fit the model to the same width as the placeholder
+
+function openModelDb() {
+  return new Promise((resolve, reject) => {
+    const req = indexedDB.open(MODEL_DB, 1);
+    req.onupgradeneeded = () => req.result.createObjectStore(MODEL_STORE);
+    req.onsuccess = () => resolve(req.result);
+    req.onerror = () => reject(req.error);
+  });
+}
+
+function dbGet(db, key) {
+  return new Promise(resolve => {
+    const req = db.transaction(MODEL_STORE).objectStore(MODEL_STORE).get(key);
+    req.onsuccess = () => resolve(req.result);
+    req.onerror = () => resolve(undefined);
+  });
+}
+
+function dbPut(db, key, value) {
+  return new Promise(resolve => {
+    const tx = db.transaction(MODEL_STORE, "readwrite");
+    tx.objectStore(MODEL_STORE).put(value, key);
+    tx.oncomplete = tx.onerror = () => resolve();
+  });
+}
+
+// Returns { buffer, etag, fresh } where fresh means it came off the network
+async function fetchCached(db, url, cached) {
+  const headers = cached ? { "If-None-Match": cached.etag } : {};
+  const res = await fetch(url, { headers, cache: "no-store" });
+  if (res.status === 304 && cached) return { ...cached, fresh: false };
+  if (!res.ok) throw Object.assign(new Error(`${url}: ${res.status}`), { status: res.status });
+  const entry = { buffer: await res.arrayBuffer(), etag: res.headers.get("ETag") || "" };
+  if (db) await dbPut(db, url, entry);
+  return { ...entry, fresh: true };
+}
+
+// A 503 means the drone was armed after whenDisarmed() resolved: wait again
+async function fetchDisarmed(db, url, cached, whenDisarmed) {
+  for (;;) {
+    await whenDisarmed();
+    try {
+      return await fetchCached(db, url, cached);
+    } catch (e) {
+      if (e.status !== 503) throw e;
+    }
+  }
+}
+
+function parseModel(loader, buffer) {
+  return new Promise((resolve, reject) => loader.parse(buffer, "", gltf => resolve(gltf.scene), reject));
+}
+
+function fitModel(model) {
+  const box = new THREE.Box3().setFromObject(model);
+  const size = box.getSize(new THREE.Vector3());
+  const center = box.getCenter(new THREE.Vector3());
+  const scale = MODEL_SIZE / Math.max(size.x, size.z, 1e-6);
+  model.scale.setScalar(scale);
+  model.position.copy(center).multiplyScalar(-scale);
+  return model;
+}
+
+function showModel(parent, model) {
+  parent.clear();
+  parent.add(fitModel(model));
+}
+
+// whenDisarmed() returns a promise that resolves once the drone is seen
+// disarmed
+async function loadDroneModel(parent, whenDisarmed) {
+  const loader = new THREE.GLTFLoader();
+  loader.setMeshoptDecoder(THREE.MeshoptDecoder);
+
+  let db = null;
+  try {
+    db = await openModelDb();
+  } catch (e) {
+    console.warn("IndexedDB unavailable, model will not be cached", e);
+  }
+
+  const fullUrl = "/droneModel.glb";
+  const lodUrl = "/droneModel.lod.glb";
+  const cachedFull = db ? await dbGet(db, fullUrl) : undefined;
+
+  if (cachedFull) {
+    // Show the cached model now, then swap only if the ESP32 has a newer one
+    showModel(parent, await parseModel(loader, cachedFull.buffer));
+    const latest = await fetchDisarmed(db, fullUrl, cachedFull, whenDisarmed);
+    if (latest.fresh) showModel(parent, await parseModel(loader, latest.buffer));
+    return;
+  }
+
+  // One after the other, as the server would serialise them anyway: the LOD
+  // shows something quickly, then the full model replaces it
+  try {
+    const cachedLod = db ? await dbGet(db, lodUrl) : undefined;
+    const lod = await fetchDisarmed(db, lodUrl, cachedLod, whenDisarmed);
+    showModel(parent, await parseModel(loader, lod.buffer));
+  } catch (e) {
+    console.warn("LOD model not available", e);
+  }
+
+  const full = await fetchDisarmed(db, fullUrl, undefined, whenDisarmed);
+  showModel(parent, await parseModel(loader, full.buffer));
+}
@@ -1,54 +1,222 @@
-let scene = new THREE.Scene();
-let camera = new THREE.PerspectiveCamera(75, 1.5, 0.1, 1000);
-let renderer = new THREE.WebGLRenderer({ canvas: document.getElementById('three-canvas') });
-renderer.setSize(document.getElementById("render-area").clientWidth, document.getElementById("render-area").clientHeight);
+// The firmware refuses three.min.js while armed unless the browser has it
+// cached (see static_files.h); the charts and controls work without the 3D
+// view, which then stays empty until a reload once disarmed
+let scene = null, camera = null, renderer = null, drone = null;
+if (typeof THREE !== "undefined") {
+  scene = new THREE.Scene();
+  camera = new THREE.PerspectiveCamera(75, 1.5, 0.1, 1000);
+  renderer = new THREE.WebGLRenderer({ canvas: document.getElementById('three-canvas'), antialias: true });
+  // Full device resolution costs too much fill rate on phones to hold 60 fps
+  renderer.setPixelRatio(Math.min(window.devicePixelRatio, 1.5));
+  renderer.setSize(document.getElementById("render-area").clientWidth, document.getElementById("render-area").clientHeight);
 
-let cube = new THREE.Mesh(new THREE.BoxGeometry(2, 0.2, 2), new THREE.MeshNormalMaterial());
-scene.add(cube);
-camera.position.z = 5;
+  scene.add(new THREE.AmbientLight(0xffffff, 0.6));
+  let sun = new THREE.DirectionalLight(0xffffff, 0.8);
+  sun.position.set(3, 5, 4);
+  scene.add(sun);
 
-function animate() {
+  // The box stays as a placeholder until loadDroneModel() swaps in the GLB
+  drone = new THREE.Group();
+  drone.add(new THREE.Mesh(new THREE.BoxGeometry(2, 0.2, 2), new THREE.MeshNormalMaterial()));
+  scene.add(drone);
+  camera.position.z = 5;
+
+  loadDroneModel(drone, whenDisarmed).catch(e => console.warn("Drone model failed to load", e));
+}
+
+const attitudeChart = new StripChart(document.getElementById("chart-attitude"), [
+  { name: "yaw", color: "#4fc3f7" },
+  { name: "pitch", color: "#aed581" },
+  { name: "roll", color: "#ff8a65" },
+]);
+const motorChart = new StripChart(document.getElementById("chart-motors"), [
+  { name: "m1", color: "#e57373" },
+  { name: "m2", color: "#81c784" },
+  { name: "m3", color: "#64b5f6" },
+  { name: "m4", color: "#ffd54f" },
+]);
+const loopChart = new StripChart(document.getElementById("chart-loop"), [
+  { name: "loop us", color: "#ce93d8" },
+]);
+
+// Telemetry arrives from the worker in bursts as the firmware's history ring
+// drains. Attitude is drawn RENDER_DELAY_MS behind the newest sample on the
+// device clock and slerped between the two samples either side of that time,
+// so the model moves at the display rate instead of jumping once per poll.
+const RENDER_DELAY_MS = 100;
+const INTERP_CAPACITY = 256;                      // power of two
+const interpTime = new Float64Array(INTERP_CAPACITY);
+const interpQuat = new Float32Array(INTERP_CAPACITY * 4);
+let interpHead = 0;
+let interpCount = 0;
+let clockOffset = null;   // device ms minus page ms, lowest seen (least delayed)
+let latestSample = null;
+let lastOverlay = 0;
+
+const telemetryWorker = new Worker("/telemetry-worker.js");
+telemetryWorker.onmessage = e => {
+  const { samples, count, base, stride, received } = e.data;
+  for (let s = 0; s < count; s++) {
+    const o = s * stride;
+    const i = interpHead;
+    interpTime[i] = base + samples[o];
+    interpQuat.set(samples.subarray(o + 9, o + 13), i * 4);
+    interpHead = (i + 1) & (INTERP_CAPACITY - 1);
+    if (interpCount < INTERP_CAPACITY) interpCount++;
+  }
+
+  // The newest sample left the device no later than it arrived here; the
+  // smallest offset seen is the best estimate. Let it relax slowly so clock
+  // drift between the ESP32 and the browser does not build up.
+  // A jump of more than a second means the ESP32 rebooted: start over.
+  const newest = base + samples[(count - 1) * stride];
+  // received is absolute; the worker's performance.now() has its own origin
+  const offset = newest - (received - performance.timeOrigin);
+  if (clockOffset !== null && Math.abs(offset - clockOffset) > 1000) {
+    interpCount = count;
+    clockOffset = offset;
+  } else if (clockOffset === null || offset < clockOffset) {
+    clockOffset = offset;
+  } else {
+    clockOffset += 0.01;
+  }
+
+  latestSample = samples.subarray((count - 1) * stride, count * stride);
+  attitudeChart.pushBatch(samples, count, stride, 1);
+  motorChart.pushBatch(samples, count, stride, 4);
+  loopChart.pushBatch(samples, count, stride, 8);
+};
+
+function slerpInto(target, a, b, t) {
+  let ax = interpQuat[a], ay = interpQuat[a + 1], az = interpQuat[a + 2], aw = interpQuat[a + 3];
+  const bx = interpQuat[b], by = interpQuat[b + 1], bz = interpQuat[b + 2], bw = interpQuat[b + 3];
+  let dot = ax * bx + ay * by + az * bz + aw * bw;
+  if (dot < 0) { ax = -ax; ay = -ay; az = -az; aw = -aw; dot = -dot; }
+  let wa = 1 - t, wb = t;
+  if (dot < 0.9995) {
+    const theta = Math.acos(dot), sin = Math.sin(theta);
+    wa = Math.sin((1 - t) * theta) / sin;
+    wb = Math.sin(t * theta) / sin;
+  }
+  target.set(ax * wa + bx * wb, ay * wa + by * wb, az * wa + bz * wb, aw * wa + bw * wb).normalize();
+}
+
+function updateOrientation(now) {
+  if (interpCount === 0) return;
+  const renderTime = now + clockOffset - RENDER_DELAY_MS;
+  const mask = INTERP_CAPACITY - 1;
+  const newest = (interpHead - 1) & mask;
+  const oldest = (interpHead - interpCount) & mask;
+
+  // Walk back from the newest sample to the pair that brackets renderTime
+  let b = newest;
+  while (b !== oldest && interpTime[(b - 1) & mask] > renderTime) b = (b - 1) & mask;
+  const a = b === oldest ? b : (b - 1) & mask;
+  const span = interpTime[b] - interpTime[a];
+  const t = span > 0 ? Math.min(1, Math.max(0, (renderTime - interpTime[a]) / span)) : 1;
+  if (drone) slerpInto(drone.quaternion, a * 4, b * 4, t);
+
+  // The text overlay does not need to change at the display rate
+  if (latestSample && now - lastOverlay > 100) {
+    lastOverlay = now;
+    document.getElementById("yaw").textContent = latestSample[1].toFixed(1);
+    document.getElementById("pitch").textContent = latestSample[2].toFixed(1);
+    document.getElementById("roll").textContent = latestSample[3].toFixed(1);
+  }
+}
+
+let firstFrame = true;
+
+function animate(now) {
   requestAnimationFrame(animate);
-  renderer.render(scene, camera);
+  updateOrientation(now);
+  if (renderer) renderer.render(scene, camera);
+  attitudeChart.draw();
+  motorChart.draw();
+  loopChart.draw();
+  if (firstFrame) {
+    firstFrame = false;
+    console.log("First render at " + performance.now().toFixed(0) + " ms");
+  }
 }
-animate();
-
-function updateOrientation(yaw, pitch, roll) {
-  // cube.rotation.y = yaw * Math.PI / 180;
-  cube.rotation.z = pitch * Math.PI / 180;
-  cube.rotation.x = roll * Math.PI / 180;
-
-  document.getElementById("yaw").textContent = yaw.toFixed(1);
-  document.getElementById("pitch").textContent = pitch.toFixed(1);
-  document.getElementById("roll").textContent = roll.toFixed(1);
-
-  const time = new Date().toLocaleTimeString();
-  let row = document.createElement("tr");
-  row.innerHTML = `<td>${time}</td><td>${yaw.toFixed(1)}</td><td>${pitch.toFixed(1)}</td><td>${roll.toFixed(1)}</td>`;
-  let logBody = document.getElementById("log-body");
-  logBody.appendChild(row);
-  if (logBody.rows.length > 15) logBody.removeChild(logBody.firstChild);
+requestAnimationFrame(animate);
+
+// Motor commands are coalesced: slider events only record the latest values,
+// and at most one /setPWM request is in flight. Each command carries a
+// sequence number so the firmware can drop any that arrive out of order.
+const pwmSession = Math.floor(Math.random() * 0x7fffffff) + 1;
+let pwmSeq = 0;
+let pendingPWM = null;
+let pwmInFlight = false;
+let pwmFlushScheduled = false;
+let lastPWM = [0, 0, 0, 0];
+let lastPWMSent = 0;
+
+function sendPWM(values) {
+  const seq = ++pwmSeq;
+  const sent = performance.now();
+  lastPWM = values;
+  lastPWMSent = sent;
+  pwmInFlight = true;
+  return fetch(`/setPWM?m1=${values[0]}&m2=${values[1]}&m3=${values[2]}&m4=${values[3]}&seq=${seq}&sid=${pwmSession}`)
+    .then(res => res.json())
+    .then(ack => {
+      if (ack.failsafe) {
+        failsafeTripped();
+        return;
+      }
+      if (!ack.applied) return;
+      // latencyUs is the firmware's handler-to-ledcWrite time for the previous command
+      const rtt = performance.now() - sent;
+      document.getElementById("cmdLatency").textContent =
+        `${rtt.toFixed(0)} ms round trip, ${(ack.latencyUs / 1000).toFixed(1)} ms to motors`;
+    })
+    .catch(() => {})
+    .finally(() => {
+      pwmInFlight = false;
+      if (pendingPWM) schedulePWMFlush();
+    });
 }
 
-function fetchData() {
-  fetch("/data").then(res => res.json()).then(data => {
-    updateOrientation(data.yaw, data.pitch, data.roll);
-  });
+// The firmware stops the motors when commands stop arriving (link-loss
+// failsafe), so while any motor runs the last command is repeated
+const PWM_HEARTBEAT_MS = 200;
+
+setInterval(() => {
+  if (pwmInFlight || pendingPWM || performance.now() - lastPWMSent < PWM_HEARTBEAT_MS) return;
+  if (lastPWM.some(v => Number(v) > 0)) sendPWM(lastPWM);
+}, PWM_HEARTBEAT_MS / 2);
+
+// The link dropped long enough for the failsafe to stop the motors. It only
+// accepts an all-zero command now, so bring the sliders down and send one.
+function failsafeTripped() {
+  emergencyStop();
+  document.getElementById("cmdLatency").textContent = "failsafe: link lost, motors stopped";
+}
+
+function flushPWM() {
+  pwmFlushScheduled = false;
+  if (pwmInFlight || !pendingPWM) return;
+  const values = pendingPWM;
+  pendingPWM = null;
+  sendPWM(values);
+}
+
+function schedulePWMFlush() {
+  if (pwmFlushScheduled) return;
+  pwmFlushScheduled = true;
+  requestAnimationFrame(flushPWM);
 }
-setInterval(fetchData, 100);
 
 function updatePWM() {
-  let m1 = document.getElementById("m1").value;
-  let m2 = document.getElementById("m2").value;
-  let m3 = document.getElementById("m3").value;
-  let m4 = document.getElementById("m4").value;
+  let values = ['m1', 'm2', 'm3', 'm4'].map(id => document.getElementById(id).value);
 
-  document.getElementById("label1").textContent = Math.round(m1 / 255 * 100) + "%";
-  document.getElementById("label2").textContent = Math.round(m2 / 255 * 100) + "%";
-  document.getElementById("label3").textContent = Math.round(m3 / 255 * 100) + "%";
-  document.getElementById("label4").textContent = Math.round(m4 / 255 * 100) + "%";
+  values.forEach((v, i) => {
+    document.getElementById("label" + (i + 1)).textContent = Math.round(v / 255 * 100) + "%";
+  });
 
-  fetch(`/setPWM?m1=${m1}&m2=${m2}&m3=${m3}&m4=${m4}`);
+  pendingPWM = values;
+  schedulePWMFlush();
 }
 
 function syncAll(val) {
@@ -71,8 +239,44 @@ function recalibrate() {
     btn.disabled = false;
     btn.textContent = originalText;
   });
-}s
+}
+
+
+// Motors only run armed. The firmware arms from a background task once
+// every pre-arm check passes, so the state is polled rather than taken from
+// the reply.
+let armState = "disarmed";
+let disarmedWaiters = [];
+
+// Resolves on the next poll that reports the drone disarmed. The model
+// loader waits on it, as the firmware refuses large files while armed.
+function whenDisarmed() {
+  return new Promise(resolve => disarmedWaiters.push(resolve));
+}
+
+function showArmStatus(status) {
+  armState = status.state;
+  if (armState === "disarmed") {
+    disarmedWaiters.forEach(resolve => resolve());
+    disarmedWaiters = [];
+  }
+  const failing = status.failing.length ? ` (not ready: ${status.failing.join(", ")})` : "";
+  document.getElementById("armState").textContent = status.state + failing;
+  document.getElementById("armBtn").textContent = status.state === "disarmed" ? "Arm" : "Disarm";
+}
+
+function armRequest(query) {
+  return fetch(`/arm${query}`, { cache: "no-store" })
+    .then(res => res.json())
+    .then(showArmStatus)
+    .catch(() => {});
+}
+
+function toggleArm() {
+  armRequest(armState === "disarmed" ? "?arm=1" : "?disarm=1");
+}
 
+setInterval(() => armRequest(""), 500);
 
 function emergencyStop() {
   ['m1', 'm2', 'm3', 'm4'].forEach((id, i) => {
@@ -81,5 +285,9 @@ function emergencyStop() {
   });
   document.getElementById("master").value = 0;
   document.getElementById("labelMaster").textContent = "0%";
-  fetch("/setPWM?m1=0&m2=0&m3=0&m4=0");
+  // Sent immediately, bypassing coalescing; its newer seq makes the firmware
+  // ignore any slider command still in flight
+  pendingPWM = null;
+  sendPWM([0, 0, 0, 0]);
+  armRequest("?disarm=1");
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+// Strip chart drawn to a canvas from fixed typed-array ring buffers.
+//
+// Samples are stored in one Float32Array per series, allocated once, so
+// pushing data never creates garbage. When there are more samples than pixel
+// columns each column is drawn as its min/max span, so tens of thousands of
+// points cost one pass over the buffer per frame and the canvas is only
+// redrawn when new data arrived.
+class StripChart {
+  constructor(canvas, series, capacity = 20000) {
+    this.canvas = canvas;
+    this.ctx = canvas.getContext("2d");
+    this.series = series;              // [{ name, color }]
+    this.capacity = capacity;
+    this.data = series.map(() => new Float32Array(capacity));
+    this.colMin = null;
+    this.colMax = null;
+    this.head = 0;                     // next write index
+    this.count = 0;
+    this.dirty = true;
+  }
+
+  // One sample; values are passed as arguments to avoid allocating an array
+  push(a, b, c, d) {
+    const i = this.head;
+    const data = this.data;
+    if (data.length > 0) data[0][i] = a;
+    if (data.length > 1) data[1][i] = b;
+    if (data.length > 2) data[2][i] = c;
+    if (data.length > 3) data[3][i] = d;
+    this.head = (i + 1) % this.capacity;
+    if (this.count < this.capacity) this.count++;
+    this.dirty = true;
+  }
+
+  // n samples from interleaved values (series-major per sample), e.g. a batch
+  // decoded in a worker; this chart's series start at offset in each sample
+  pushBatch(values, n, stride, offset = 0) {
+    const k = this.data.length;
+    for (let s = 0; s < n; s++) {
+      const i = this.head;
+      for (let j = 0; j < k; j++) this.data[j][i] = values[s * stride + offset + j];
+      this.head = (i + 1) % this.capacity;
+    }
+    this.count = Math.min(this.capacity, this.count + n);
+    this.dirty = true;
+  }
+
+  resize() {
+    const w = this.canvas.clientWidth * devicePixelRatio | 0;
+    const h = this.canvas.clientHeight * devicePixelRatio | 0;
+    if (w !== this.canvas.width || h !== this.canvas.height) {
+      this.canvas.width = w;
+      this.canvas.height = h;
+      this.colMin = new Float32Array(w);
+      this.colMax = new Float32Array(w);
+      this.dirty = true;
+    }
+  }
+
+  draw() {
+    this.resize();
+    if (!this.dirty) return;
+    this.dirty = false;
+
+    const ctx = this.ctx;
+    const w = this.canvas.width, h = this.canvas.height;
+    ctx.fillStyle = "#111";
+    ctx.fillRect(0, 0, w, h);
+    const n = this.count;
+    if (n < 2) return;
+
+    const start = (this.head - n + this.capacity) % this.capacity;
+    const cap = this.capacity;
+
+    // Shared y range over all visible series
+    let lo = Infinity, hi = -Infinity;
+    for (const buf of this.data) {
+      for (let k = 0; k < n; k++) {
+        const v = buf[(start + k) % cap];
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+      }
+    }
+    if (hi - lo < 1e-3) { hi += 1; lo -= 1; }
+    const pad = (hi - lo) * 0.05;
+    lo -= pad; hi += pad;
+    const scale = (h - 1) / (hi - lo);
+    const y = v => h - 1 - (v - lo) * scale;
+
+    ctx.lineWidth = devicePixelRatio;
+    this.data.forEach((buf, j) => {
+      ctx.strokeStyle = this.series[j].color;
+      ctx.beginPath();
+      if (n <= w) {
+        for (let k = 0; k < n; k++) {
+          const x = k * (w - 1) / (n - 1);
+          const v = y(buf[(start + k) % cap]);
+          if (k === 0) ctx.moveTo(x, v); else ctx.lineTo(x, v);
+        }
+      } else {
+        const colMin = this.colMin, colMax = this.colMax;
+        colMin.fill(Infinity);
+        colMax.fill(-Infinity);
+        for (let k = 0; k < n; k++) {
+          const x = (k * w / n) | 0;
+          const v = buf[(start + k) % cap];
+          if (v < colMin[x]) colMin[x] = v;
+          if (v > colMax[x]) colMax[x] = v;
+        }
+        for (let x = 0; x < w; x++) {
+          ctx.moveTo(x + 0.5, y(colMax[x]));
+          ctx.lineTo(x + 0.5, y(colMin[x]) + 1);
+        }
+      }
+      ctx.stroke();
+    });
+
+    // Legend with the latest values
+    ctx.font = `${11 * devicePixelRatio}px sans-serif`;
+    const last = (this.head - 1 + cap) % cap;
+    this.series.forEach((s, j) => {
+      ctx.fillStyle = s.color;
+      ctx.fillText(`${s.name} ${this.data[j][last].toFixed(1)}`, 4 * devicePixelRatio, (j + 1) * 13 * devicePixelRatio);
+    });
+  }
+}
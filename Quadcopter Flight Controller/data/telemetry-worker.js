@@ -0,0 +1,76 @@
+// Polls /telemetry off the main thread and decodes the packed TelemetrySample
+// records (see include/telemetry_frame.h) into one Float32Array per batch,
+// which is transferred to the page without copying.
+//
+// Device time is posted as base, a double in ms (device clock, unwrapped),
+// and each sample's offset from it: a float32 holds only 24 bits, which
+// after a few hours of absolute milliseconds is coarser than 1 ms.
+//
+// Each sample in the batch is SAMPLE_STRIDE floats:
+//   0 time (ms after base)
+//   1-3 yaw, pitch, roll (deg)
+//   4-7 motor outputs
+//   8 loop time (us)
+//   9-12 attitude quaternion x, y, z, w in three.js axes
+
+const SAMPLE_BYTES = 22;
+const SAMPLE_STRIDE = 13;
+const POLL_MS = 50;
+
+let since = 0;
+let lastRawUs = null;
+let wrapMs = 0;       // added to device time each time micros() wraps
+
+// Same mapping the viewer used with Euler angles: roll about x, pitch about z
+// (three.js XYZ order), yaw left out because it drifts
+function attitudeQuaternion(pitchDeg, rollDeg, out, o) {
+  const p = pitchDeg * Math.PI / 360, r = rollDeg * Math.PI / 360;
+  const cp = Math.cos(p), sp = Math.sin(p), cr = Math.cos(r), sr = Math.sin(r);
+  out[o] = sr * cp;
+  out[o + 1] = -sr * sp;
+  out[o + 2] = cr * sp;
+  out[o + 3] = cr * cp;
+}
+
+function decode(buffer) {
+  const view = new DataView(buffer);
+  since = view.getUint32(0, true);
+  const n = Math.floor((buffer.byteLength - 4) / SAMPLE_BYTES);
+  const out = new Float32Array(n * SAMPLE_STRIDE);
+  let base = null;
+
+  for (let i = 0; i < n; i++) {
+    const b = 4 + i * SAMPLE_BYTES;
+    const o = i * SAMPLE_STRIDE;
+    const rawUs = view.getUint32(b, true);
+    // micros() wraps every ~71 minutes; a smaller backwards step is a reboot
+    if (lastRawUs !== null && lastRawUs - rawUs > 0x80000000) wrapMs += 4294967.296;
+    lastRawUs = rawUs;
+
+    const ms = wrapMs + rawUs / 1000;
+    if (base === null) base = ms;
+    out[o] = ms - base;
+    for (let k = 0; k < 3; k++) out[o + 1 + k] = view.getInt16(b + 4 + k * 2, true) / 100;
+    for (let k = 0; k < 4; k++) out[o + 4 + k] = view.getUint16(b + 10 + k * 2, true);
+    out[o + 8] = view.getUint16(b + 18, true);
+    attitudeQuaternion(out[o + 2], out[o + 3], out, o + 9);
+  }
+  return { samples: out, count: n, base };
+}
+
+async function poll() {
+  try {
+    const res = await fetch(`/telemetry?since=${since}`, { cache: "no-store" });
+    if (res.ok) {
+      const { samples, count, base } = decode(await res.arrayBuffer());
+      if (count > 0) {
+        self.postMessage({ samples, count, base, stride: SAMPLE_STRIDE, received: performance.timeOrigin + performance.now() }, [samples.buffer]);
+      }
+    }
+  } catch (e) {
+    // Link hiccup: keep polling
+  }
+  setTimeout(poll, POLL_MS);
+}
+
+poll();
@@ -0,0 +1,33 @@
+#ifndef _ARMING_H_
+#define _ARMING_H_
+
+#include "flight_core.h"
+
+// Arming state machine and pre-arm checks (flight_core.h), run by a low
+// priority task on core 0. The control loop publishes its inputs once per
+// sample; the task evaluates one check per pass, round robin, and keeps the
+// state and the failing checks in a single atomic word. The control loop
+// only ever loads that word, through armingState().
+
+#define ARMING_TASK_PERIOD_MS  10
+#define ARMING_HOLD_MS         500   // checks must keep passing this long
+
+class CommandWatchdog;
+
+// watchdog is the link-loss failsafe: a trip while armed is an arming
+// failsafe too. clock times the sample age and the arming hold.
+void armingBegin(const PreArmLimits &limits, const CommandWatchdog &watchdog, Clock &clock);
+
+// Control loop side, cheap: relaxed stores
+void armingPublishSample(uint32_t timeUs, float rateHz, float nominalHz, const float ypr[3]);
+void armingPublishThrottle(const uint16_t motor[4]);
+void armingSetCalibrated(bool calibrated);
+
+// Handed to the task, which refuses to arm if a check fails
+void armingRequest(bool arm);
+
+ArmState armingState();
+// Failing pre-arm checks as (1 << PreArmCheck) bits, as of the last pass
+uint8_t armingFailing();
+
+#endif /* _ARMING_H_ */
@@ -0,0 +1,27 @@
+#ifndef _BLACKBOX_H_
+#define _BLACKBOX_H_
+
+#include "blackbox_format.h"
+#include "hal.h"
+
+#define BLACKBOX_RING_SIZE   512   // records buffered in RAM (~28 KB)
+#define BLACKBOX_MAX_FILES   8
+#define BLACKBOX_FLASH_RESERVE (64 * 1024)  // stop logging when SPIFFS gets this full
+
+// Opens the next /bbN.bbl file on SPIFFS, replacing the oldest once all
+// BLACKBOX_MAX_FILES exist, and starts the flush task, which times its
+// partial block writes and syncs by clock. SPIFFS must already be mounted.
+bool blackboxBegin(Clock &clock);
+
+// Queues a record for the flush task. Never blocks; if the ring is full the
+// record is dropped and counted.
+void blackboxLog(const BlackboxRecord &record);
+// The estimator's level reference in radians, written into every block
+// header from then on
+void blackboxSetLevel(const float offset[3]);
+
+uint32_t blackboxDropped();
+uint32_t blackboxWritten();
+const char *blackboxFileName();
+
+#endif /* _BLACKBOX_H_ */
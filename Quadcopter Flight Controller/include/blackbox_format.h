@@ -0,0 +1,56 @@
+#ifndef _BLACKBOX_FORMAT_H_
+#define _BLACKBOX_FORMAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// On-flash blackbox log format. This header has no Arduino dependencies so the
+// host-side tools decode logs with exactly the same structs as the firmware.
+//
+// A log file is a sequence of independent blocks:
+//   BlackboxBlockHeader | payload (payloadBytes)
+// The first record of every block is encoded against an all-zero record and
+// every following record against its predecessor, so each block can be
+// decoded on its own. Each field is stored as a zigzag varint of its delta.
+// Version 1 headers end after droppedRecords (BLACKBOX_V1_HEADER_BYTES).
+
+#define BLACKBOX_MAGIC            0x4242514Eu  // "NQBB" little endian
+#define BLACKBOX_VERSION          2
+#define BLACKBOX_V1_HEADER_BYTES  16
+#define BLACKBOX_BLOCK_RECORDS    64
+#define BLACKBOX_FIELD_COUNT      27
+#define BLACKBOX_MAX_FIELD_BYTES  5
+#define BLACKBOX_MAX_PAYLOAD      (BLACKBOX_BLOCK_RECORDS * BLACKBOX_FIELD_COUNT * BLACKBOX_MAX_FIELD_BYTES)
+
+struct BlackboxRecord {
+  uint32_t timeUs;
+  int16_t gyro[3];        // raw DMP gyro
+  int16_t accel[3];       // raw DMP accel
+  int16_t quat[4];        // DMP quaternion w, x, y, z (1.0 = 16384)
+  int16_t setpoint[3];    // yaw, pitch, roll setpoints in centidegrees
+  int16_t pid[3][3];      // [axis][P, I, D] rate controller terms, 0.1 motor duty units
+  uint16_t motor[4];      // motor outputs as written to the PWM driver
+};
+
+struct BlackboxBlockHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordCount;
+  uint32_t payloadBytes;
+  uint32_t droppedRecords;  // running total of records dropped before this block
+  // The estimator's level reference, yaw, pitch, roll in centidegrees: the
+  // setpoints are in the calibrated frame, the quaternions are not
+  int16_t level[3];
+  uint16_t reserved;
+};
+
+static_assert(sizeof(BlackboxRecord) == 56, "BlackboxRecord layout changed");
+static_assert(sizeof(BlackboxBlockHeader) == 24, "BlackboxBlockHeader layout changed");
+
+// Encodes count records into out. Returns the payload size, or 0 if out is too small.
+size_t blackboxEncodeBlock(const BlackboxRecord *records, uint16_t count, uint8_t *out, size_t outSize);
+
+// Decodes count records from a block payload. Returns false on a truncated or corrupt payload.
+bool blackboxDecodeBlock(const uint8_t *payload, size_t payloadBytes, uint16_t count, BlackboxRecord *out);
+
+#endif /* _BLACKBOX_FORMAT_H_ */
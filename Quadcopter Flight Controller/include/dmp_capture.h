@@ -0,0 +1,33 @@
+#ifndef _DMP_CAPTURE_H_
+#define _DMP_CAPTURE_H_
+
+#include "dmp_capture_format.h"
+#include "hal.h"
+
+// Records the raw DMP FIFO packets the control loop reads, with their read
+// times, to /dmp.cap on SPIFFS for bit-exact replay on the host
+// (tools/dmp_replay). Off until started; each start overwrites the last
+// capture. Like the blackbox, the control loop only pushes into a ring and a
+// task on core 0 encodes and writes whole blocks.
+
+#define DMP_CAPTURE_RING_SIZE      256          // packets buffered in RAM (~13 KB)
+#define DMP_CAPTURE_FILE           "/dmp.cap"
+#define DMP_CAPTURE_FLASH_RESERVE  (64 * 1024)  // stop writing when SPIFFS gets this full
+
+// Opens the capture file for packets of this profile and layout and starts
+// taking them. SPIFFS must be mounted. False if a capture is still running
+// or finishing, or the file could not be opened.
+bool dmpCaptureStart(DmpProfile profile, const DmpLayout &layout, Clock &clock);
+// Stops taking packets; the task writes what is buffered and closes the file
+void dmpCaptureStop();
+// True from start until the file is closed
+bool dmpCaptureActive();
+
+// Control loop side: queues the packet just read if a capture is running.
+// Never blocks; if the ring is full the packet is dropped and counted.
+void dmpCaptureLog(uint32_t timeUs, const uint8_t *packet);
+
+uint32_t dmpCaptureWritten();
+uint32_t dmpCaptureDropped();
+
+#endif /* _DMP_CAPTURE_H_ */
@@ -0,0 +1,64 @@
+#ifndef _DMP_CAPTURE_FORMAT_H_
+#define _DMP_CAPTURE_FORMAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dmp_device.h"
+
+// Raw DMP FIFO packet capture format, shared by the firmware (dmp_capture.h)
+// and the host replay tool. No Arduino dependencies.
+//
+// A capture file is a sequence of independent blocks:
+//   DmpCaptureBlockHeader | payload (payloadBytes)
+// Every block carries the profile and packet layout, so a block decodes on
+// its own and a capture needs no file header. Packets keep their exact bytes:
+// each is stored as deltas against the packet before it in the block (the
+// first against all zeros), as zigzag varints: the timestamp, the
+// quaternion as four big endian 32-bit words, then the rest of the packet as
+// big endian 16-bit words (a trailing odd byte on its own). Gyro and accel
+// words move little between samples, so a 42 byte packet takes about 25.
+
+#define DMP_CAPTURE_MAGIC          0x4344514Eu  // "NQDC" little endian
+#define DMP_CAPTURE_VERSION        1
+#define DMP_CAPTURE_BLOCK_PACKETS  64
+#define DMP_CAPTURE_MAX_PACKET     48           // MotionApps 4.1
+// Worst case per packet: 5 byte varints for the timestamp and quaternion
+// words, 3 for each 16-bit word
+#define DMP_CAPTURE_MAX_PACKET_BYTES  (5 + 4 * 5 + (DMP_CAPTURE_MAX_PACKET - 16 + 1) / 2 * 3)
+#define DMP_CAPTURE_MAX_PAYLOAD    (DMP_CAPTURE_BLOCK_PACKETS * DMP_CAPTURE_MAX_PACKET_BYTES)
+
+struct DmpCapturePacket {
+  uint32_t timeUs;                        // when the packet was read
+  uint8_t data[DMP_CAPTURE_MAX_PACKET];   // as dmpGetCurrentFIFOPacket returned it
+};
+
+struct DmpCaptureBlockHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t packetCount;
+  uint32_t payloadBytes;
+  uint32_t droppedPackets;  // running total of packets dropped before this block
+  uint8_t profile;          // DmpProfile
+  DmpLayout layout;         // layout.size bytes per packet
+};
+
+static_assert(sizeof(DmpCapturePacket) == 52, "DmpCapturePacket layout changed");
+static_assert(sizeof(DmpLayout) == 7, "DmpLayout layout changed");
+static_assert(sizeof(DmpCaptureBlockHeader) == 24, "DmpCaptureBlockHeader layout changed");
+
+// Encodes count packets of packetSize bytes into out. Returns the payload
+// size, or 0 if out is too small or packetSize out of range.
+size_t dmpCaptureEncodeBlock(const DmpCapturePacket *packets, uint16_t count, uint8_t packetSize, uint8_t *out,
+                             size_t outSize);
+
+// Decodes count packets from a block payload. Returns false on a truncated or
+// corrupt payload.
+bool dmpCaptureDecodeBlock(const uint8_t *payload, size_t payloadBytes, uint16_t count, uint8_t packetSize,
+                           DmpCapturePacket *out);
+
+// True if the header is one this code writes: magic, version, and a layout
+// whose fields all lie within a packet that fits in DmpCapturePacket
+bool dmpCaptureHeaderValid(const DmpCaptureBlockHeader &header);
+
+#endif /* _DMP_CAPTURE_FORMAT_H_ */
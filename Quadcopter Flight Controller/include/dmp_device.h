@@ -0,0 +1,100 @@
+#ifndef _DMP_DEVICE_H_
+#define _DMP_DEVICE_H_
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// The MPU6050 DMP behind one interface, with the firmware image chosen at
+// boot instead of by which MotionApps header main.cpp includes.
+//
+// Each MotionApps header takes over the MPU6050 typedef, so the three cannot
+// share a translation unit: every profile lives in its own dmp_<profile>.cpp
+// and only this header is included elsewhere. Builds for the ESP32 and for
+// the host (I2CDEV_HOST_SIM).
+
+enum DmpProfile : uint8_t {
+  DMP_MOTIONAPPS20 = 0,     // 6-axis fusion, 42 byte packets
+  DMP_MOTIONAPPS612 = 1,    // 6-axis fusion with continuous gyro calibration
+  DMP_MOTIONAPPS41 = 2,     // 9-axis fusion with an AK8975 on the aux bus
+  DMP_PROFILE_COUNT
+};
+
+// Fields a FIFO packet can carry
+#define DMP_FIELD_QUAT   0x01
+#define DMP_FIELD_GYRO   0x02
+#define DMP_FIELD_ACCEL  0x04
+#define DMP_FIELD_MAG    0x08
+
+// Where the fields sit in a packet. The quaternion is always first, as four
+// big endian Q30 words; the other fields are big endian int16 values, one per
+// axis every *Step bytes (the DMP pads some to 32 bits).
+struct DmpLayout {
+  uint8_t size;
+  uint8_t fields;       // DMP_FIELD_* present
+  uint8_t gyro, gyroStep;
+  uint8_t accel, accelStep;
+  uint8_t mag;          // always 2 bytes apart
+};
+
+class MPU6050_Base;
+
+class DmpDevice {
+public:
+  virtual ~DmpDevice() {}
+
+  virtual DmpProfile profile() const = 0;
+  virtual MPU6050_Base &mpu() = 0;
+
+  // Resets the chip and loads the profile's DMP image. Returns 0 on success,
+  // or the driver's dmpInitialize() error code. The DMP is left disabled.
+  virtual uint8_t initialize() = 0;
+
+  // Asks the DMP to put only these fields in each packet, after initialize()
+  // and before enabling the DMP. The quaternion is always kept. Profiles that
+  // cannot change their packet keep the full one. Returns the fields the
+  // packets now carry.
+  virtual uint8_t selectFields(uint8_t fields) { (void)fields; return layout_.fields; }
+
+  const DmpLayout &layout() const { return layout_; }
+  // Decode packets captured elsewhere with the layout they were captured
+  // with (dmp_capture_format.h). Does not touch the chip.
+  void useLayout(const DmpLayout &layout) { layout_ = layout; }
+
+  // Changes the output rate while running. The chip samples at 1 kHz (8 kHz
+  // with the DLPF off) divided by 1 + sampleDiv, and the DMP writes a packet
+  // every 1 + fifoDiv samples; fifoDiv is the word dmpInitialize() leaves in
+  // DMP memory at bank 2, offset 0x16. The DMP's fusion is tuned for the
+  // 200 Hz the images set up (sampleDiv 4), so slow the output with fifoDiv
+  // rather than sampleDiv. The FIFO is reset afterwards, dropping packets
+  // from the old rate. Returns false if the divisor did not read back.
+  bool setRate(uint8_t sampleDiv, uint16_t fifoDiv);
+  uint8_t sampleDivisor();
+  uint16_t fifoDivisor();
+  // Packet rate the chip is configured for
+  float rateHz();
+
+  // Newest complete packet, see MPU6050_Base::GetCurrentFIFOPacket. packet
+  // must hold layout().size bytes.
+  bool readLatest(uint8_t *packet);
+
+  // Fills s from a packet; fields the packet does not carry are zeroed
+  void decode(const uint8_t *packet, ImuSample &s) const;
+
+  // Yaw, pitch and roll in radians the way the MotionApps library works them
+  // out from a packet: dmpGetQuaternion, dmpGetGravity, dmpGetYawPitchRoll
+  virtual void libraryYawPitchRoll(const uint8_t *packet, float ypr[3]) = 0;
+
+protected:
+  DmpLayout layout_ = {};
+};
+
+// address and wireObj as for the MPU6050 driver classes
+DmpDevice *createDmpDevice(DmpProfile profile, uint8_t address = 0x68, void *wireObj = 0);
+
+const char *dmpProfileName(DmpProfile profile);
+// Accepts the names above and the bare numbers "20", "612" and "41". Returns
+// DMP_PROFILE_COUNT for anything else.
+DmpProfile dmpProfileFromName(const char *name);
+
+#endif /* _DMP_DEVICE_H_ */
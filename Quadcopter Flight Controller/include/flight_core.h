@@ -0,0 +1,442 @@
+#ifndef _FLIGHT_CORE_H_
+#define _FLIGHT_CORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hal.h"
+#include "telemetry_frame.h"
+#include "blackbox_format.h"
+
+// Hardware-independent flight logic: attitude estimation, PID control, motor
+// mixing and building telemetry/blackbox records. Builds for the ESP32 and
+// for the host ([env:native] runs the tests in test/); hardware is reached only
+// through the hal.h interfaces.
+
+// Motor command range used by the mixer and the web UI; scaleMotors turns
+// commands into the finer MotorOutput scale
+#define MOTOR_MIN 0
+#define MOTOR_MAX 255
+
+// Yaw, pitch and roll in radians from a DMP quaternion (w, x, y, z), using
+// the same formulas as MPU6050::dmpGetYawPitchRoll
+void quaternionToYawPitchRoll(const float q[4], float ypr[3]);
+
+// Hard and soft iron correction for ImuSample::mag: the field is
+// (mag - offset) * scale, which puts it on a sphere of the given radius
+struct MagCalibration {
+  float offset[3];
+  float scale[3];
+  float radius;     // 0 = not calibrated
+};
+
+// Collects magnetometer samples while the airframe is turned through every
+// orientation and fits the per-axis offset and scale from the extremes
+class MagCalibrator {
+public:
+  void begin();
+  void addSample(const int16_t mag[3]);
+  int count() const { return count_; }
+  // False if too few samples, or some axis was not swept through the field
+  bool finish(MagCalibration &cal) const;
+
+private:
+  int16_t min_[3];
+  int16_t max_[3];
+  int count_ = 0;
+};
+
+// Attitude from the DMP quaternion, relative to a level reference captured
+// by calibration. With a magnetometer calibration, updateMag() slowly pulls
+// the DMP's yaw towards the magnetic heading, so it no longer drifts.
+class AttitudeEstimator {
+public:
+  // quat is w, x, y, z with 1.0 = 16384
+  void update(const int16_t quat[4]);
+
+  void setMagCalibration(const MagCalibration &cal);
+  // Magnetometer reading that came with the last update(). Readings whose
+  // magnitude is far from the calibrated field (motors, steel nearby) are
+  // ignored.
+  void updateMag(const int16_t mag[3]);
+  bool magAided() const { return headingValid_; }
+
+  // Calibrated yaw, pitch, roll in radians
+  const float *ypr() const { return ypr_; }
+  // Level reference subtracted from the DMP's angles, radians
+  const float *levelOffset() const { return offset_; }
+
+  // Averages the next samples passed to addCalibrationSample() and uses them
+  // as the new level reference
+  void beginCalibration();
+  void addCalibrationSample();
+  bool finishCalibration();
+
+private:
+  void applyHeading();
+
+  float q_[4] = {1, 0, 0, 0};
+  float dmpYaw_ = 0;
+  float raw_[3] = {0, 0, 0};
+  float ypr_[3] = {0, 0, 0};
+  MagCalibration mag_ = {};
+  // Low-passed unit vector of the DMP's yaw error against the magnetometer
+  float headingCos_ = 1, headingSin_ = 0;
+  bool headingValid_ = false;
+  float offset_[3] = {0, 0, 0};
+  float sum_[3] = {0, 0, 0};
+  int sumCount_ = 0;
+};
+
+// Reads samples samples from imu, intervalMs apart, and captures them as the
+// estimator's level reference (with the magnetic heading, if it has a
+// magnetometer calibration). Gives up after four times as many attempts
+// without a sample. Returns false if no sample arrived.
+bool calibrateLevel(Imu &imu, Clock &clock, AttitudeEstimator &estimator, int samples = 20, uint32_t intervalMs = 50);
+
+// Rate of a sample stream measured from arrival times, for the controller's
+// dt. PID gains are per second (PidController::update scales by dt), so a
+// new DMP rate needs no retuning as long as dt follows it. Until a few
+// samples have arrived at a new rate the nominal rate is reported.
+class SampleRate {
+public:
+  // Starts over at a new expected rate
+  void setNominal(float hz);
+  void sample(uint32_t timeUs);
+  float nominalHz() const { return nominalHz_; }
+  float hz() const;
+  float dt() const { return 1.0f / hz(); }
+
+private:
+  float nominalHz_ = 100;
+  float periodUs_ = 0;      // smoothed sample interval
+  uint32_t lastUs_ = 0;
+  int count_ = 0;
+};
+
+// Notches on the gyro that follow each motor's rotation frequency and its
+// harmonics, from the RPM the ESCs report, so motor vibration is taken out
+// of the gyro without the delay of a low-pass filter
+#define RPM_NOTCH_HARMONICS 3
+
+class RpmNotchFilter {
+public:
+  // q is the notch quality (centre / width). Notches below minHz are off,
+  // so a stopped or idling motor does not notch out real motion.
+  explicit RpmNotchFilter(float q = 5, float minHz = 40) : q_(q), minHz_(minHz) {}
+
+  // Moves the notches for new motor speeds; rpm 0 turns a motor's notches
+  // off. Notches the gyro sample rate cannot resolve (above 0.45 of it) are
+  // off too.
+  void update(const float rpm[4], float sampleHz);
+  // Filters one gyro sample, x, y, z, in place
+  void apply(float gyro[3]);
+  int active() const;
+
+private:
+  struct Notch {
+    bool on;
+    float b0, b1, a2;     // b2 = b0 and a1 = b1 for a notch
+    float x1[3], x2[3], y1[3], y2[3];
+  };
+  Notch notch_[4][RPM_NOTCH_HARMONICS] = {};
+  float q_, minHz_;
+};
+
+// Mechanical RPM from the eRPM an ESC reports
+static inline float erpmToRpm(uint32_t erpm, int motorPoles) {
+  return erpm / (motorPoles / 2.0f);
+}
+
+struct PidGains {
+  float kp;
+  float ki;
+  float kd;
+  float iLimit;   // clamp on the integral term's contribution
+  float dCutoffHz; // first order low-pass on the derivative term, 0 = off
+};
+
+class PidController {
+public:
+  explicit PidController(const PidGains &gains = PidGains{0, 0, 0, 0, 0}) : gains_(gains) {}
+
+  void setGains(const PidGains &gains) { gains_ = gains; }
+  const PidGains &gains() const { return gains_; }
+  void reset();
+
+  // Derivative is taken on the measurement, so setpoint steps do not kick
+  float update(float setpoint, float measured, float dt);
+
+  // Terms of the last update(), e.g. for the blackbox
+  float p() const { return p_; }
+  float i() const { return i_; }
+  float d() const { return d_; }
+
+private:
+  PidGains gains_;
+  float p_ = 0, i_ = 0, d_ = 0;
+  float lastMeasured_ = 0;
+  bool first_ = true;
+};
+
+// DMP packet gyro scale: 2000 dps full scale
+#define GYRO_LSB_PER_DPS 16.4f
+
+// Body rates in rad/s from the packet gyro, as yaw, pitch and roll rates
+// signed like ypr (exact while level, close at small tilts)
+void gyroRates(const int16_t gyro[3], float rates[3]);
+
+// Cascaded attitude control, per axis: the angle error times angleKp is a
+// rate setpoint, limited to maxRate, and a rate PID on the gyro turns that
+// into the axis command for mixQuadX. Axes are yaw, pitch, roll.
+struct AttitudeGains {
+  float angleKp[3];     // rad/s per rad
+  float maxRate[3];     // rad/s
+  PidGains rate[3];     // motor duty units per rad/s
+};
+
+// Tuned in the simulator (tools/sitl) for the brushed 1S airframe
+extern const AttitudeGains DEFAULT_ATTITUDE_GAINS;
+
+class AttitudeController {
+public:
+  explicit AttitudeController(const AttitudeGains &gains = DEFAULT_ATTITUDE_GAINS) { setGains(gains); }
+
+  void setGains(const AttitudeGains &gains);
+  const AttitudeGains &gains() const { return gains_; }
+  void reset();
+
+  // setpoint and ypr in radians (yaw errors wrap), rates from gyroRates();
+  // writes the axis commands
+  void update(const float setpoint[3], const float ypr[3], const float rates[3], float dt, float axis[3]);
+
+  // Of the last update(), e.g. for the blackbox
+  const float *setpoint() const { return setpoint_; }
+  const float *rateSetpoint() const { return rateSetpoint_; }
+  const PidController &ratePid(int axis) const { return rate_[axis]; }
+
+private:
+  AttitudeGains gains_;
+  PidController rate_[3];
+  float setpoint_[3] = {0, 0, 0};
+  float rateSetpoint_[3] = {0, 0, 0};
+};
+
+// Relay feedback autotune of one axis in hover (Astrom-Hagglund).
+//
+// While it runs, the axis command is a relay: trim plus or minus the
+// amplitude, switching on the sign of the rate error with a little
+// hysteresis, where the rate setpoint is a weak hold on the angle so the
+// attitude stays put. The airframe settles into a small limit cycle; its
+// period and rate amplitude, averaged over a few cycles as they happen, fit
+// the rate plant K e^(-theta s) / s: K in rad/s^2 per duty unit, theta the
+// lumped motor lag, filter and sample delay. SIMC rules then give the rate
+// PI (closed loop time constant closedLoopRatio * theta) and the angle gain
+// for the loop around it, and the rate limit is lowered if the rate P term
+// at that limit would need more than the headroom the mixer has. The
+// derivative, its cutoff and the integral limit are kept.
+struct AutotuneConfig {
+  float amplitude[3];     // relay output per axis, motor duty units
+  float hysteresis;       // rad/s of rate error, above the gyro noise
+  float guardKp;          // angle hold while the relay runs, rad/s per rad
+  float maxAngle;         // abort past this angle error, rad
+  int settleCycles;       // cycles left out while the oscillation builds
+  int measureCycles;      // cycles averaged
+  float timeoutS;
+  float closedLoopRatio;  // rate loop time constant over theta; lower is faster
+  float headroom;         // axis command the mixer has above hover, duty units
+};
+
+// Checked in the simulator (tools/sitl/scenarios/autotune.txt)
+extern const AutotuneConfig DEFAULT_AUTOTUNE;
+
+enum AutotuneState : uint8_t {
+  AUTOTUNE_IDLE = 0,
+  AUTOTUNE_RUNNING,
+  AUTOTUNE_DONE,
+  AUTOTUNE_FAILED,
+};
+
+const char *autotuneStateName(AutotuneState state);
+
+struct AutotuneResult {
+  float periodS;          // limit cycle
+  float rateAmplitude;    // rad/s, of the fundamental
+  float plantGain;        // K, rad/s^2 per duty unit
+  float delayS;           // theta
+  int cycles;
+  float angleKp;          // proposed
+  float maxRate;          // proposed
+  PidGains rate;          // proposed
+};
+
+class RelayAutotune {
+public:
+  explicit RelayAutotune(const AutotuneConfig &config = DEFAULT_AUTOTUNE) : config_(config) {}
+
+  void setConfig(const AutotuneConfig &config) { config_ = config; }
+  const AutotuneConfig &config() const { return config_; }
+
+  // Starts on axis (0 yaw, 1 pitch, 2 roll) from gains; trim is the axis
+  // command that holds the airframe, e.g. the rate integrator
+  void begin(int axis, const AttitudeGains &gains, float trim);
+  void cancel();
+
+  AutotuneState state() const { return state_; }
+  bool running() const { return state_ == AUTOTUNE_RUNNING; }
+  int axis() const { return axis_; }
+  float elapsedS() const { return elapsedS_; }
+
+  // One sample while running: angle error (setpoint - measured, rad) and
+  // rate (gyroRates) on the axis. Returns the axis command. Constant time;
+  // the fit runs once, on the last measured cycle.
+  float update(float angleError, float rate, float dt);
+
+  // Valid once state() is AUTOTUNE_DONE
+  const AutotuneResult &result() const { return result_; }
+  // gains with the result on the tuned axis
+  AttitudeGains proposed(const AttitudeGains &gains) const;
+
+private:
+  void finish();
+
+  AutotuneConfig config_;
+  AutotuneState state_ = AUTOTUNE_IDLE;
+  int axis_ = 0;
+  PidGains base_ = {0, 0, 0, 0, 0};
+  float baseMaxRate_ = 0;
+  float trim_ = 0;
+  bool high_ = true;
+  float elapsedS_ = 0;
+  float lastRiseS_ = -1;
+  float lastPeriodS_ = 0;
+  float sinSum_ = 0, cosSum_ = 0;   // error's fundamental over this cycle
+  int cycles_ = 0;
+  float periodSum_ = 0, amplitudeSum_ = 0;
+  AutotuneResult result_ = {};
+};
+
+// One stabilised control tick, as the firmware runs it per IMU sample (and
+// the simulator with it): attitude control on the estimate and the sample's
+// gyro, then the mixer at this throttle and gain. Writes motor commands.
+// With an autotune running, its relay drives the axis it tunes.
+void stabilizeTick(AttitudeController &controller, const ImuSample &sample, const float ypr[3],
+                   const float setpoint[3], float throttle, float dt, float gain, uint16_t command[4],
+                   RelayAutotune *autotune = nullptr);
+
+// Quad X mixer. Motor order is front left, front right, rear right, rear
+// left; front left and rear right spin the same way. axis is yaw, pitch,
+// roll in motor duty units. gain scales the whole command (see
+// sagCompensationGain). If a motor would exceed MOTOR_MAX the whole set is
+// shifted down so the attitude correction is kept, then clamped.
+void mixQuadX(float throttle, const float axis[3], uint16_t out[4], float gain = 1);
+
+// Motor speed follows duty times pack voltage, so as the pack sags the same
+// duty gives less thrust. Scaling duty by referenceVolts / volts holds it.
+struct SagCompensation {
+  float referenceVolts;   // pack voltage the outputs are tuned at
+  float minVolts;         // the gain stops growing below this
+  float maxGain;
+};
+
+// Gain for mixQuadX / scaleMotors at the given (filtered) pack voltage; 1
+// without a reading
+float sagCompensationGain(const SagCompensation &c, float volts);
+
+// Direct motor commands (MOTOR_MIN to MOTOR_MAX) times gain, as motor
+// outputs (0 to MOTOR_OUTPUT_MAX), clamped. The finer output scale keeps the
+// fraction of a command step the gain adds.
+void scaleMotors(const uint16_t in[4], float gain, uint16_t out[4]);
+
+// Link-loss failsafe. Motor commands have to keep arriving: timeoutUs after
+// the last one the output starts ramping down, and it reaches zero rampUs
+// later, the cutoff. rampUs 0 cuts at the timeout.
+struct FailsafeConfig {
+  uint32_t timeoutUs;
+  uint32_t rampUs;
+};
+
+enum FailsafeState : uint8_t {
+  FAILSAFE_IDLE = 0,    // no motor commanded, nothing to watch
+  FAILSAFE_OK,
+  FAILSAFE_RAMP,
+  FAILSAFE_CUT,         // motors stopped until commanded back to zero
+};
+
+// Output gain sinceUs after the last command: 1 until the timeout, then
+// falling linearly to 0 at the cutoff
+float failsafeGain(const FailsafeConfig &c, uint32_t sinceUs);
+
+// Arming. Motors only run ARMED. Arming needs every pre-arm check to pass,
+// and to keep passing while ARMING; losing the IMU or the link while armed
+// is a failsafe, which only a disarm leaves.
+enum ArmState : uint8_t {
+  ARM_DISARMED = 0,
+  ARM_ARMING,
+  ARM_ARMED,
+  ARM_FAILSAFE,
+};
+
+enum PreArmCheck : uint8_t {
+  PREARM_IMU = 0,       // IMU delivering samples
+  PREARM_CALIBRATION,   // level calibration done and not running
+  PREARM_LOOP_RATE,     // sample rate close to nominal
+  PREARM_LEVEL,
+  PREARM_THROTTLE,      // every motor command at zero
+  PREARM_CHECK_COUNT
+};
+
+const char *armStateName(ArmState state);
+const char *preArmCheckName(PreArmCheck check);
+
+struct PreArmInputs {
+  uint32_t sampleAgeUs;   // since the last IMU sample
+  bool calibrated;
+  float rateHz, nominalHz;
+  float pitch, roll;      // radians
+  uint16_t throttle;      // highest motor command
+};
+
+struct PreArmLimits {
+  uint32_t maxSampleAgeUs;  // at least three nominal sample periods is allowed
+  float maxRateError;       // fraction of the nominal rate
+  float maxTilt;            // radians, pitch and roll
+  uint16_t maxThrottle;
+};
+
+bool preArmPasses(PreArmCheck check, const PreArmInputs &in, const PreArmLimits &limits);
+
+// Age of a sample stamped sampleUs at nowUs. A sample published after nowUs
+// was read (another core stamping it in between) counts as age 0 rather
+// than wrapping to a huge age.
+uint32_t sampleAgeUs(uint32_t nowUs, uint32_t sampleUs);
+
+// failing arguments are masks of (1 << PreArmCheck) for the checks failing
+class ArmingStateMachine {
+public:
+  explicit ArmingStateMachine(uint32_t holdMs = 500) : holdMs_(holdMs) {}
+  ArmState state() const { return state_; }
+
+  // Starts arming. Refused, returning false, unless disarmed with nothing
+  // failing.
+  bool requestArm(uint8_t failing, uint32_t nowMs);
+  void disarm() { state_ = ARM_DISARMED; }
+  // Link lost while the motors may run
+  void failsafe();
+  // Advances with the checks failing now: ARMING becomes ARMED after holdMs,
+  // or DISARMED if a check fails; ARMED becomes FAILSAFE without the IMU
+  ArmState update(uint8_t failing, uint32_t nowMs);
+
+private:
+  uint32_t holdMs_;
+  ArmState state_ = ARM_DISARMED;
+  uint32_t armingMs_ = 0;
+};
+
+// Records for the telemetry link and the blackbox from the current state
+void fillTelemetrySample(TelemetrySample &s, uint32_t timeUs, const float ypr[3], const uint16_t motor[4], uint16_t loopUs);
+// controller, when one is flying, fills the setpoints and rate PID terms
+void fillBlackboxRecord(BlackboxRecord &r, uint32_t timeUs, const ImuSample &imu, const uint16_t motor[4],
+                        const AttitudeController *controller = nullptr);
+
+#endif /* _FLIGHT_CORE_H_ */
@@ -0,0 +1,92 @@
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include <stdint.h>
+
+// Thin interfaces between the flight core and the hardware. The firmware
+// implements them with Arduino calls (hal_esp32.h); host builds plug in their
+// own, so nothing in flight_core.cpp touches ledcWrite, Wire, micros or delay.
+
+struct ImuSample {
+  int16_t quat[4];    // DMP quaternion w, x, y, z (1.0 = 16384)
+  int16_t gyro[3];    // DMP packet gyro, zero if the packet leaves it out
+  int16_t accel[3];   // DMP packet accel, scale depends on the DMP profile
+  int16_t mag[3];     // magnetometer in the same axes, 0.3 uT per LSB; zero
+                      // without one (only MotionApps 4.1 carries it)
+};
+
+// Time source. The firmware's is esp_timer (hal_esp32.h); host builds use
+// VirtualClock or one driven by their simulation, so hours of flight run in
+// seconds and the same way every time.
+class Clock {
+public:
+  virtual ~Clock() {}
+  // Microseconds since start; 64 bits, so it never wraps
+  virtual uint64_t nowUs() = 0;
+  // Returns after ms milliseconds. A virtual clock just moves forward.
+  virtual void delay(uint32_t ms) = 0;
+  // Wrapping views of nowUs(), as the Arduino calls of the same names
+  uint32_t micros() { return (uint32_t)nowUs(); }
+  uint32_t millis() { return (uint32_t)(nowUs() / 1000); }
+};
+
+// Clock that only moves when told to
+class VirtualClock : public Clock {
+public:
+  explicit VirtualClock(uint64_t startUs = 0) : nowUs_(startUs) {}
+  uint64_t nowUs() override { return nowUs_; }
+  void delay(uint32_t ms) override { nowUs_ += (uint64_t)ms * 1000; }
+  void advance(uint64_t us) { nowUs_ += us; }
+
+private:
+  uint64_t nowUs_;
+};
+
+// Full scale of a motor output. Backends map it onto their own resolution
+// (PWM duty, pulse width, DShot throttle).
+#define MOTOR_OUTPUT_MAX 2000
+
+class MotorOutput {
+public:
+  virtual ~MotorOutput() {}
+  virtual void begin() = 0;
+  // Output per motor, 0 (stopped) to MOTOR_OUTPUT_MAX, all four taking
+  // effect together. Called once per control tick.
+  virtual void write(const uint16_t output[4]) = 0;
+  // Latest electrical RPM per motor reported by the ESCs (bidirectional
+  // DShot). Returns false if the backend has no motor telemetry.
+  virtual bool readErpm(uint32_t erpm[4]) { (void)erpm; return false; }
+  // All motors to zero now. The failsafe calls this from a timer interrupt,
+  // possibly in the middle of a write(), so it must not block and must leave
+  // the motors stopped whatever write() was doing.
+  virtual void stop() {
+    const uint16_t off[4] = {0, 0, 0, 0};
+    write(off);
+  }
+};
+
+class Imu {
+public:
+  virtual ~Imu() {}
+  // Returns true when the sensor is ready to deliver samples
+  virtual bool begin() = 0;
+  // Returns true and fills s when a new sample was available
+  virtual bool read(ImuSample &s) = 0;
+};
+
+struct BatterySample {
+  float volts;        // pack voltage
+  float amps;         // pack current, zero without a current sensor
+};
+
+// Pack voltage and current, sampled and filtered in the background so
+// read() costs the control loop nothing
+class Battery {
+public:
+  virtual ~Battery() {}
+  virtual bool begin() = 0;
+  // Latest filtered reading; returns false until there is one
+  virtual bool read(BatterySample &s) = 0;
+};
+
+#endif /* _HAL_H_ */
@@ -0,0 +1,184 @@
+#ifndef _HAL_ESP32_H_
+#define _HAL_ESP32_H_
+
+#include <atomic>
+
+#include "hal.h"
+#include "dmp_device.h"
+#include "flight_core.h"
+#include "motor_protocol.h"
+
+// Arduino implementations of the hal.h interfaces used by the firmware
+
+// esp_timer, which Arduino's micros() reads too; delay() blocks the task
+// and lets the others run
+class EspTimerClock : public Clock {
+public:
+  uint64_t nowUs() override;
+  void delay(uint32_t ms) override;
+};
+
+// Brushed motors on LEDC channels. All four run off one LEDC timer, so new
+// duties latch together at the start of its next period. bits is the duty
+// resolution; freqHz << bits must stay within the 80 MHz clock (13 bits at
+// 5 kHz, 11 at 20 kHz).
+class LedcMotors : public MotorOutput {
+public:
+  LedcMotors(const int pins[4], const int channels[4], uint32_t freqHz = 5000, uint8_t bits = 13)
+      : pins_(pins), channels_(channels), freqHz_(freqHz), bits_(bits) {}
+  void begin() override;
+  void write(const uint16_t output[4]) override;
+  void stop() override;
+
+private:
+  const int *pins_;
+  const int *channels_;
+  uint32_t freqHz_;
+  uint8_t bits_;
+  uint32_t duty_[4] = {0, 0, 0, 0};
+  bool started_ = false;
+};
+
+// ESCs on RMT channels 0-3, one OneShot125, Multishot or DShot frame per
+// write(), encoded by motor_protocol.h. The classic ESP32 cannot start RMT
+// channels in hardware sync, so all four frames are loaded first and then
+// started back to back, well under a microsecond apart. Frames must not be
+// sent faster than they last (252 us for OneShot125). begin() waits on
+// clock for the setup task, and gives up after a second.
+//
+// With bidirectional DShot each pin is open drain and also feeds RMT
+// receive channels 4-7, which capture the frame and the ESC's eRPM reply
+// into ring buffers. A task on core 0 decodes them, and the RMT interrupt
+// is installed from there too, so the control core only loads the results.
+// stop() stops the channels and parks the pins at their idle level without
+// sending a frame, so the failsafe interrupt can call it.
+class RmtMotors : public MotorOutput {
+public:
+  RmtMotors(const int pins[4], MotorProtocol protocol, Clock &clock)
+      : pins_(pins), protocol_(protocol), clock_(clock) {}
+  void begin() override;
+  void write(const uint16_t output[4]) override;
+  bool readErpm(uint32_t erpm[4]) override;
+  void stop() override;
+
+  uint32_t replies() const { return replies_.load(std::memory_order_relaxed); }
+  uint32_t replyErrors() const { return replyErrors_.load(std::memory_order_relaxed); }
+
+private:
+  static void rmtTask(void *arg);
+  bool setup();
+  void decodeReplies();
+
+  const int *pins_;
+  MotorProtocol protocol_;
+  Clock &clock_;
+  std::atomic<int> state_{0};   // 0 starting, 1 running, -1 failed
+  std::atomic<bool> stopped_{false};  // pins parked by stop()
+  std::atomic<uint32_t> erpm_[4] = {};
+  std::atomic<uint32_t> replies_{0};
+  std::atomic<uint32_t> replyErrors_{0};
+};
+
+// MPU6050 with the DMP on the default Wire bus. The DMP profile and packet
+// fields are picked before begin(); the default is MotionApps 2.0 with
+// everything it sends.
+class Mpu6050Imu : public Imu {
+public:
+  Mpu6050Imu(int sda, int scl, Clock &clock) : sda_(sda), scl_(scl), clock_(clock) {}
+  void configure(DmpProfile profile, uint8_t fields) { profile_ = profile; fields_ = fields; }
+  bool begin() override;
+  bool read(ImuSample &s) override;
+  // Sensor offset registers (accel x, y, z, gyro x, y, z) for begin() to
+  // write; without them the chip's power-up values stay
+  void setOffsets(const int16_t offsets[6]);
+  // Calibrates the offset registers with the frame still and level, and
+  // returns them. Takes about half a second; false before begin().
+  bool calibrateOffsets(int16_t offsets[6]);
+  const uint8_t *packet() const { return fifoBuffer_; }
+  // Null before begin()
+  DmpDevice *dmp() { return dmp_; }
+
+private:
+  DmpDevice *dmp_ = nullptr;
+  DmpProfile profile_ = DMP_MOTIONAPPS20;
+  uint8_t fields_ = DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL;
+  int sda_, scl_;
+  Clock &clock_;
+  bool dmpReady_ = false;
+  int16_t offsets_[6];
+  bool haveOffsets_ = false;
+  uint8_t fifoBuffer_[64];
+};
+
+// Pack voltage (through a divider) and optionally current (a hall or shunt
+// amplifier with a voltage output) on ADC1 pins. The ADC runs continuously
+// into DMA and a low priority task averages each DMA frame and low-passes
+// the result, so nothing on the control path waits for a conversion. ADC1
+// only: ADC2 is not available while Wi-Fi is on.
+class AdcDmaBattery : public Battery {
+public:
+  // voltsPin/ampsPin are GPIO 32-39; ampsPin -1 for no current sensor.
+  // dividerRatio is pack volts per ADC volt; amps = (adc - ampsZeroVolts) *
+  // ampsPerVolt.
+  AdcDmaBattery(int voltsPin, float dividerRatio, int ampsPin = -1, float ampsPerVolt = 0, float ampsZeroVolts = 0)
+      : voltsPin_(voltsPin), ampsPin_(ampsPin), dividerRatio_(dividerRatio), ampsPerVolt_(ampsPerVolt),
+        ampsZeroVolts_(ampsZeroVolts) {}
+  bool begin() override;
+  bool read(BatterySample &s) override;
+
+private:
+  static void sampleTask(void *arg);
+  void run();
+
+  int voltsPin_, ampsPin_;
+  float dividerRatio_, ampsPerVolt_, ampsZeroVolts_;
+  std::atomic<float> volts_{0};
+  std::atomic<float> amps_{0};
+};
+
+// Link-loss failsafe on hardware timer group 0, timer 0. Its interrupt checks
+// the time since the last motor command every FAILSAFE_TICK_US and at the
+// cutoff stops the motors itself, and keeps stopping them, so a stalled web
+// server or control loop cannot keep them running. Before that the control
+// loop ramps its output down with gain(). Once tripped, commands stay
+// blocked until one sets every motor to zero.
+#define FAILSAFE_TICK_US  1000
+
+class CommandWatchdog {
+public:
+  CommandWatchdog(MotorOutput &motors, Clock &clock) : motors_(motors), clock_(clock) {}
+  // Call from the control loop's core: the interrupt is allocated there
+  bool begin(const FailsafeConfig &config);
+  void configure(const FailsafeConfig &config);
+  FailsafeConfig config() const;
+
+  // A motor command was applied; active if it leaves any motor running
+  void feed(bool active);
+  // Lets commands through again after a trip
+  void clear();
+  bool tripped() const { return tripped_.load(std::memory_order_relaxed); }
+
+  FailsafeState state() const;
+  // Output gain for the control loop, see failsafeGain
+  float gain() const;
+  uint32_t sinceUs() const;
+  // Last trip: from the cutoff to the interrupt stopping the motors
+  uint32_t reactionUs() const { return reactionUs_.load(std::memory_order_relaxed); }
+  uint32_t trips() const { return trips_.load(std::memory_order_relaxed); }
+
+private:
+  static bool onTimer(void *arg);
+  void check();
+
+  MotorOutput &motors_;
+  Clock &clock_;
+  std::atomic<uint32_t> timeoutUs_{0};
+  std::atomic<uint32_t> rampUs_{0};
+  std::atomic<uint32_t> lastUs_{0};
+  std::atomic<bool> active_{false};
+  std::atomic<bool> tripped_{false};
+  std::atomic<uint32_t> reactionUs_{0};
+  std::atomic<uint32_t> trips_{0};
+};
+
+#endif /* _HAL_ESP32_H_ */
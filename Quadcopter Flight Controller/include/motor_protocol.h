@@ -0,0 +1,87 @@
+#ifndef _MOTOR_PROTOCOL_H_
+#define _MOTOR_PROTOCOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hal.h"
+
+// ESC signal encoding, shared by the firmware's RMT motor backend and host
+// tools.
+//
+// The encoders take a motor output, 0 to MOTOR_OUTPUT_MAX (hal.h), and
+// produce RMT items as 32-bit words in the hardware's rmt_item32_t layout:
+// duration0 (15 bits), level0, duration1 (15 bits), level1, with durations in
+// ticks of MOTOR_RMT_TICK_HZ. A zero word ends the transmission.
+
+#define MOTOR_RMT_TICK_HZ    80000000   // APB clock, RMT divider 1
+#define MOTOR_MAX_ITEMS      17         // a DShot frame and its end marker
+
+enum MotorProtocol : uint8_t {
+  MOTOR_PWM = 0,        // LEDC duty cycle, for brushed motors
+  MOTOR_ONESHOT125,     // 125-250 us pulse per update
+  MOTOR_MULTISHOT,      // 5-25 us pulse per update
+  MOTOR_DSHOT300,       // digital, 300 kbit/s
+  MOTOR_DSHOT600,       // digital, 600 kbit/s
+  MOTOR_DSHOT300_BIDIR, // inverted DShot300, ESC replies with eRPM
+  MOTOR_DSHOT600_BIDIR, // inverted DShot600, ESC replies with eRPM
+  MOTOR_PROTOCOL_COUNT
+};
+
+const char *motorProtocolName(MotorProtocol protocol);
+bool motorProtocolBidirectional(MotorProtocol protocol);
+
+// DShot: 11-bit value, telemetry request bit, 4-bit checksum, MSB first.
+// Values 1-47 are commands; 48-2047 are throttle and 0 is motor stop.
+#define DSHOT_THROTTLE_MIN   48
+#define DSHOT_THROTTLE_MAX   2047
+
+// Motor output to a DShot value: 0 stays 0 (stop), 1..MOTOR_OUTPUT_MAX map
+// one to one onto the 2000 throttle steps
+uint16_t dshotValue(uint16_t output);
+// Bidirectional DShot inverts the checksum, which is how the ESC knows to
+// answer
+uint16_t dshotFrame(uint16_t value, bool telemetry, bool bidirectional = false);
+
+// Bidirectional DShot: the line idles high and the frame is sent inverted.
+// About 30 us after each frame the ESC drives the same wire with a reply at
+// 5/4 of the bit rate: 21 bits, the first a start bit, that after NRZI and
+// GCR decoding give 16 bits: a 3-bit exponent and 9-bit mantissa of the
+// eRPM period in microseconds (period = mantissa << exponent), then a 4-bit
+// checksum. A period of 0xFFF means stopped.
+enum DshotReplyStatus : uint8_t {
+  DSHOT_REPLY_OK = 0,
+  DSHOT_REPLY_MISSING,    // no gap after the frame, or nothing after it
+  DSHOT_REPLY_FRAMING,    // runs do not add up to 21 bits
+  DSHOT_REPLY_GCR,        // a 5-bit group that is not a GCR code
+  DSHOT_REPLY_CHECKSUM,
+};
+
+// Decodes a capture of the wire taken from the start of the frame, as RMT
+// receive items at MOTOR_RMT_TICK_HZ ending with a zero duration: the
+// frame, the gap and the reply. Sets erpm (electrical RPM, 0 when stopped)
+// on DSHOT_REPLY_OK.
+DshotReplyStatus dshotDecodeReply(MotorProtocol protocol, const uint32_t *items, size_t count, uint32_t &erpm);
+
+// The 21 line bits an ESC sends for this eRPM, MSB first, 1 meaning the
+// level changes at the start of the bit. For host tools that synthesize
+// replies.
+uint32_t dshotReplyBits(uint32_t erpm);
+// Reply bit length in RMT ticks
+float dshotReplyBitTicks(MotorProtocol protocol);
+
+// RMT items for one update at this output. Returns the number of words
+// written to items (MOTOR_MAX_ITEMS at most), including the end marker, or
+// 0 for MOTOR_PWM, which does not go through the RMT.
+size_t motorEncodeRmt(MotorProtocol protocol, uint16_t output, uint32_t items[MOTOR_MAX_ITEMS]);
+
+static inline uint32_t motorRmtItem(uint16_t highTicks, uint16_t lowTicks) {
+  return (uint32_t)(highTicks & 0x7FFF) | 1u << 15 | (uint32_t)(lowTicks & 0x7FFF) << 16;
+}
+
+// Low first, for the inverted bidirectional signal
+static inline uint32_t motorRmtItemInverted(uint16_t lowTicks, uint16_t highTicks) {
+  return (uint32_t)(lowTicks & 0x7FFF) | (uint32_t)(highTicks & 0x7FFF) << 16 | 1u << 31;
+}
+
+#endif /* _MOTOR_PROTOCOL_H_ */
@@ -0,0 +1,20 @@
+#ifndef _STATIC_FILES_H_
+#define _STATIC_FILES_H_
+
+#include <WebServer.h>
+
+#define STATIC_FILES_MAX 16
+#define STATIC_FILES_ARMED_MAX_BYTES  (16 * 1024)  // largest .gz sent while armed
+#define STATIC_FILES_RETRY_S          5
+
+// Registers a GET handler for every file listed in /etags.txt (written by
+// tools/data_gzip.py). Files are sent from their precompressed .gz copy with
+// Content-Encoding: gzip, a strong ETag and Cache-Control: no-cache, so the
+// browser revalidates and gets an empty 304 when nothing changed.
+// "/" serves index.html. While armed, files over STATIC_FILES_ARMED_MAX_BYTES
+// compressed (the three.js bundle and the drone models) get a 503 with
+// Retry-After instead: the synchronous server would stall the control loop
+// for the whole transfer. A 304 is always sent.
+void staticFilesBegin(WebServer &server);
+
+#endif /* _STATIC_FILES_H_ */
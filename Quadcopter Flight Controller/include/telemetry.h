@@ -0,0 +1,39 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include "telemetry_frame.h"
+
+#ifndef TELEMETRY_BAUD
+#define TELEMETRY_BAUD        115200
+#endif
+#ifndef TELEMETRY_RATE_HZ
+#define TELEMETRY_RATE_HZ     50
+#endif
+#define TELEMETRY_TX_BUFFER   1024  // UART driver TX ring, drained by the UART ISR
+#define TELEMETRY_HISTORY     64    // samples kept for /telemetry, power of two
+
+// Starts Serial with a large TX ring. Call instead of Serial.begin().
+void telemetryBegin(uint32_t baud = TELEMETRY_BAUD, uint16_t rateHz = TELEMETRY_RATE_HZ);
+
+void telemetrySetRate(uint16_t rateHz);
+
+// Sends the sample if the rate period has elapsed since the last one sent,
+// by the samples' timeUs, and the TX ring has room.
+// Never waits on the UART; frames that do not fit are counted and skipped.
+void telemetryUpdate(TelemetrySample &sample);
+
+uint16_t telemetryDropped();
+
+// Motor speeds and failsafe status to send along with the next samples
+void telemetrySetRpm(const TelemetryRpm &rpm);
+void telemetrySetFailsafe(const TelemetryFailsafe &failsafe);
+
+// Keeps a sample for web clients polling /telemetry. Samples are numbered in
+// the order they were recorded.
+void telemetryRecord(const TelemetrySample &sample);
+
+// Copies the retained samples numbered since or later into out, oldest first.
+// Returns how many were copied; next is the number to ask for next time.
+size_t telemetryHistorySince(uint32_t since, TelemetrySample *out, size_t maxCount, uint32_t &next);
+
+#endif /* _TELEMETRY_H_ */
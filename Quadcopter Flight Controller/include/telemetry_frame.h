@@ -0,0 +1,83 @@
+#ifndef _TELEMETRY_FRAME_H_
+#define _TELEMETRY_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary serial telemetry framing, shared by the firmware and host tools.
+//
+// Frame on the wire: 0x00 | COBS(type | seq | payload | crc16) | 0x00
+// The CRC is CRC-16/CCITT-FALSE over type, seq and payload, little endian.
+// The leading delimiter lets the reader resynchronise after any text that
+// Serial.println writes on the same UART.
+
+#define TELEMETRY_TYPE_SAMPLE     1
+#define TELEMETRY_TYPE_RPM        2
+#define TELEMETRY_TYPE_FAILSAFE   3
+#define TELEMETRY_MAX_PAYLOAD     64
+#define TELEMETRY_MAX_FRAME       (TELEMETRY_MAX_PAYLOAD + 4 + (TELEMETRY_MAX_PAYLOAD + 4) / 254 + 3)
+
+struct __attribute__((packed)) TelemetrySample {
+  uint32_t timeUs;
+  int16_t ypr[3];          // centidegrees
+  uint16_t motor[4];
+  uint16_t loopUs;         // time of the last loop() pass
+  uint16_t droppedFrames;  // frames skipped because the UART buffer was full
+};
+
+static_assert(sizeof(TelemetrySample) == 22, "TelemetrySample layout changed");
+
+// Motor speeds from bidirectional DShot, sent after a sample when the ESCs
+// report them
+struct __attribute__((packed)) TelemetryRpm {
+  uint32_t timeUs;
+  uint16_t rpm[4];         // mechanical RPM
+  uint16_t replyErrors;    // eRPM replies that failed to decode, wrapping
+  uint8_t notches;         // active gyro notches
+};
+
+static_assert(sizeof(TelemetryRpm) == 15, "TelemetryRpm layout changed");
+
+// Link-loss failsafe status, sent after each sample
+struct __attribute__((packed)) TelemetryFailsafe {
+  uint32_t timeUs;
+  uint16_t linkAgeMs;      // since the last motor command, saturating
+  uint32_t reactionUs;     // last trip: cutoff to motors stopped
+  uint16_t trips;
+  uint8_t state;           // FailsafeState
+};
+
+static_assert(sizeof(TelemetryFailsafe) == 13, "TelemetryFailsafe layout changed");
+
+uint16_t telemetryCrc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF);
+
+// Builds a complete frame including both delimiters. Returns its length, or 0
+// if the payload is too large.
+size_t telemetryEncodeFrame(uint8_t type, uint8_t seq, const void *payload, size_t len, uint8_t *out);
+
+// Incremental frame parser for the receiving side
+class TelemetryDecoder {
+public:
+  // Feeds one byte. Returns true when a frame with a valid CRC is complete;
+  // type(), seq(), payload() and payloadLength() then describe it.
+  bool push(uint8_t b);
+
+  uint8_t type() const { return decoded_[0]; }
+  uint8_t seq() const { return decoded_[1]; }
+  const uint8_t *payload() const { return decoded_ + 2; }
+  size_t payloadLength() const { return decodedLen_ - 4; }
+
+  uint32_t crcErrors() const { return crcErrors_; }
+  uint32_t framingErrors() const { return framingErrors_; }
+
+private:
+  uint8_t raw_[TELEMETRY_MAX_FRAME];
+  size_t rawLen_ = 0;
+  bool overflow_ = false;
+  uint8_t decoded_[TELEMETRY_MAX_FRAME];
+  size_t decodedLen_ = 0;
+  uint32_t crcErrors_ = 0;
+  uint32_t framingErrors_ = 0;
+};
+
+#endif /* _TELEMETRY_FRAME_H_ */
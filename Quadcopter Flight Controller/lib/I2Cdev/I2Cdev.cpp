@@ -296,6 +296,11 @@ int8_t I2Cdev::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8
             count = -1; // error
         }
 
+    #elif (I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM)
+
+        // Simulated bus: one transaction for the whole burst
+        count = i2cdevSimRead(devAddr, regAddr, data, length) ? length : -1;
+
     #endif
 
     // check for timeout
@@ -442,6 +447,18 @@ int8_t I2Cdev::readWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint1
             count = -1; // error
         }
 
+    #elif (I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM)
+
+        uint8_t intermediate[(uint8_t)length*2];
+        if (i2cdevSimRead(devAddr, regAddr, intermediate, (uint8_t)(length * 2))) {
+            count = length;
+            for (uint8_t i = 0; i < length; i++) {
+                data[i] = (intermediate[2*i] << 8) | intermediate[2*i + 1];
+            }
+        } else {
+            count = -1;
+        }
+
     #endif
 
     if (timeout > 0 && millis() - t1 >= timeout && count < length) count = -1; // timeout
@@ -621,6 +638,8 @@ bool I2Cdev::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_
     #elif (I2CDEV_IMPLEMENTATION == I2CDEV_BUILTIN_FASTWIRE)
         Fastwire::stop();
         //status = Fastwire::endTransmission();
+    #elif (I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM)
+        status = i2cdevSimWrite(devAddr, regAddr, data, length) ? 0 : 1;
     #endif
     #ifdef I2CDEV_SERIAL_DEBUG
         Serial.println(". Done.");
@@ -692,6 +711,13 @@ bool I2Cdev::writeWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16
     #elif (I2CDEV_IMPLEMENTATION == I2CDEV_BUILTIN_FASTWIRE)
         Fastwire::stop();
         //status = Fastwire::endTransmission();
+    #elif (I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM)
+        uint8_t intermediate[(uint8_t)length*2];
+        for (uint8_t i = 0; i < length; i++) {
+            intermediate[2*i] = (uint8_t)(data[i] >> 8);
+            intermediate[2*i + 1] = (uint8_t)data[i];
+        }
+        status = i2cdevSimWrite(devAddr, regAddr, intermediate, (uint8_t)(length * 2)) ? 0 : 1;
     #endif
     #ifdef I2CDEV_SERIAL_DEBUG
         Serial.println(". Done.");
@@ -78,6 +78,7 @@ THE SOFTWARE.
 #define I2CDEV_I2CMASTER_LIBRARY    4 // I2C object from DSSCircuits I2C-Master Library at https://github.com/DSSCircuits/I2C-Master-Library
 #define I2CDEV_BUILTIN_SBWIRE	    5 // I2C object from Shuning (Steve) Bian's SBWire Library at https://github.com/freespace/SBWire 
 #define I2CDEV_TEENSY_3X_WIRE       6 // Teensy 3.x support using i2c_t3 library
+#define I2CDEV_HOST_SIM             7 // Simulated bus for host builds, see I2CdevSim.h
 
 // -----------------------------------------------------------------------------
 // Arduino-style "Serial.print" debug constant (uncomment to enable)
@@ -104,6 +105,10 @@ THE SOFTWARE.
     #endif
 #endif
 
+#if I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM
+    #include "I2CdevSim.h"
+#endif
+
 #ifdef SPARK
     #include "application.h"
     #define ARDUINO 101
@@ -0,0 +1,90 @@
+// I2Cdev simulated bus for host builds, see I2CdevSim.h
+
+#include "I2Cdev.h"
+
+#if I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM
+
+// Bits on the wire per transaction: start, address byte and register byte
+// (each with ACK), a repeated start plus address for reads, and stop
+#define SIM_WRITE_OVERHEAD_BITS  (1 + 9 + 9 + 1)
+#define SIM_READ_OVERHEAD_BITS   (1 + 9 + 9 + 1 + 9 + 1)
+
+I2CdevSimSerial Serial;
+
+static I2CdevSimDevice *devices[128];
+static I2CdevSimStats stats;
+static uint32_t busHz = 400000;
+static uint64_t nowUs = 0;
+static uint64_t busPs = 0;        // sub-microsecond remainder in picoseconds
+
+static void busTime(uint32_t bits) {
+    // Keep the fractional part so many short transfers add up exactly
+    busPs += (uint64_t)bits * 1000000000000ull / busHz;
+    uint64_t us = busPs / 1000000;
+    busPs -= us * 1000000;
+    nowUs += us;
+    stats.busUs += us;
+}
+
+void i2cdevSimAttach(uint8_t devAddr, I2CdevSimDevice *device) {
+    devices[devAddr & 0x7F] = device;
+}
+
+void i2cdevSimSetClock(uint32_t hz) {
+    busHz = hz ? hz : 400000;
+}
+
+void i2cdevSimReset() {
+    memset(devices, 0, sizeof(devices));
+    memset(&stats, 0, sizeof(stats));
+    nowUs = 0;
+    busPs = 0;
+}
+
+I2CdevSimStats i2cdevSimStats() {
+    return stats;
+}
+
+void i2cdevSimResetStats() {
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool i2cdevSimRead(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t length) {
+    I2CdevSimDevice *device = devices[devAddr & 0x7F];
+    stats.readTransactions++;
+    if (!device) {
+        stats.nacks++;
+        busTime(1 + 9 + 1);
+        return false;
+    }
+    device->advance(nowUs);
+    bool ok = device->read(regAddr, data, length);
+    stats.bytesRead += length;
+    busTime(SIM_READ_OVERHEAD_BITS + 9u * length);
+    return ok;
+}
+
+bool i2cdevSimWrite(uint8_t devAddr, uint8_t regAddr, const uint8_t *data, uint8_t length) {
+    I2CdevSimDevice *device = devices[devAddr & 0x7F];
+    stats.writeTransactions++;
+    if (!device) {
+        stats.nacks++;
+        busTime(1 + 9 + 1);
+        return false;
+    }
+    device->advance(nowUs);
+    bool ok = device->write(regAddr, data, length);
+    stats.bytesWritten += length;
+    busTime(SIM_WRITE_OVERHEAD_BITS + 9u * length);
+    return ok;
+}
+
+uint64_t i2cdevSimNowUs() {
+    return nowUs;
+}
+
+void i2cdevSimAdvanceUs(uint64_t us) {
+    nowUs += us;
+}
+
+#endif // I2CDEV_IMPLEMENTATION == I2CDEV_HOST_SIM
@@ -0,0 +1,101 @@
+// I2Cdev simulated bus for host builds
+// Selected with -DI2CDEV_IMPLEMENTATION=I2CDEV_HOST_SIM
+//
+// Instead of driving a Wire peripheral, I2Cdev hands every transfer to the
+// emulated device attached at that address. All timing runs on a virtual
+// clock: each transaction advances it by the time the transfer would take on
+// a real bus, and micros(), millis() and delay() below read and advance the
+// same clock. Runs are therefore deterministic and independent of host speed.
+//
+// This header also stands in for the few Arduino core pieces the I2Cdev and
+// MPU6050 sources use on the target (timing, Serial, PROGMEM, map).
+
+#ifndef _I2CDEVSIM_H_
+#define _I2CDEVSIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Register-addressed I2C slave. Bursts auto-increment the register address
+// the way the device itself does; FIFO style registers may ignore that.
+class I2CdevSimDevice {
+    public:
+        virtual ~I2CdevSimDevice() {}
+        virtual bool read(uint8_t regAddr, uint8_t *data, uint8_t length) = 0;
+        virtual bool write(uint8_t regAddr, const uint8_t *data, uint8_t length) = 0;
+        // Called with the virtual time before every transaction, so the
+        // device can catch up on samples it would have produced meanwhile
+        virtual void advance(uint64_t nowUs) { (void)nowUs; }
+};
+
+struct I2CdevSimStats {
+    uint32_t readTransactions;
+    uint32_t writeTransactions;
+    uint64_t bytesRead;         // payload bytes, excluding address and register
+    uint64_t bytesWritten;
+    uint64_t busUs;             // virtual time spent on the bus
+    uint32_t nacks;             // transfers to an address with no device
+};
+
+void i2cdevSimAttach(uint8_t devAddr, I2CdevSimDevice *device);
+void i2cdevSimSetClock(uint32_t hz);    // bus clock used for timing, default 400 kHz
+void i2cdevSimReset();                  // clears devices, stats and the virtual clock
+I2CdevSimStats i2cdevSimStats();
+void i2cdevSimResetStats();
+
+bool i2cdevSimRead(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t length);
+bool i2cdevSimWrite(uint8_t devAddr, uint8_t regAddr, const uint8_t *data, uint8_t length);
+
+// Virtual clock
+uint64_t i2cdevSimNowUs();
+void i2cdevSimAdvanceUs(uint64_t us);
+
+// ---- Arduino stand-ins ----------------------------------------------------
+
+inline uint32_t micros() { return (uint32_t)i2cdevSimNowUs(); }
+inline uint32_t millis() { return (uint32_t)(i2cdevSimNowUs() / 1000); }
+inline void delay(uint32_t ms) { i2cdevSimAdvanceUs((uint64_t)ms * 1000); }
+inline void delayMicroseconds(uint32_t us) { i2cdevSimAdvanceUs(us); }
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+#ifndef PI
+    #define PI 3.1415926535897932384626433832795
+#endif
+#define DEC 10
+#define HEX 16
+
+// Serial output is discarded unless enabled, so calibration progress dots do
+// not end up in benchmark output
+class I2CdevSimSerial {
+    public:
+        bool enabled = false;
+        void write(char c) { if (enabled) putchar(c); }
+        void print(const char *s) { if (enabled) fputs(s, stdout); }
+        void print(long v, int base = DEC) { if (enabled) printf(base == HEX ? "%lX" : "%ld", v); }
+        void print(int v, int base = DEC) { print((long)v, base); }
+        void print(unsigned v, int base = DEC) { print((long)v, base); }
+        void print(unsigned char v, int base = DEC) { print((long)v, base); }
+        void print(double v, int digits = 2) { if (enabled) printf("%.*f", digits, v); }
+        template<typename T> void println(T v) { print(v); print("\n"); }
+        template<typename T> void println(T v, int fmt) { print(v, fmt); print("\n"); }
+        void println() { print("\n"); }
+};
+extern I2CdevSimSerial Serial;
+
+#ifndef PROGMEM
+    #define PROGMEM
+#endif
+#ifndef pgm_read_byte
+    #define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#endif
+#ifndef F
+    #define F(x) x
+#endif
+
+#endif /* _I2CDEVSIM_H_ */
@@ -3280,31 +3280,118 @@ void MPU6050_Base::setDMPConfig2(uint8_t config) {
 //**********************           Calibration Routines            **********************
 //***************************************************************************************
 /**
-  @brief      Fully calibrate Gyro from ZERO in about 6-7 Loops 600-700 readings
+  @brief      Calibrate Gyro offsets with Calibrate(), Loops kept for the older PID interface
 */
 void MPU6050_Base::CalibrateGyro(uint8_t Loops ) {
-  double kP = 0.3;
-  double kI = 90;
-  float x;
-  x = (100 - map(Loops, 1, 5, 20, 0)) * .01;
-  kP *= x;
-  kI *= x;
-  
-  PID( 0x43,  kP, kI,  Loops);
+	Calibrate(MPU6050_CALIBRATE_GYRO, (Loops + 1) / 2);
 }
 
 /**
-  @brief      Fully calibrate Accel from ZERO in about 6-7 Loops 600-700 readings
+  @brief      Calibrate Accel offsets with Calibrate(), Loops kept for the older PID interface
 */
 void MPU6050_Base::CalibrateAccel(uint8_t Loops ) {
+	Calibrate(MPU6050_CALIBRATE_ACCEL, (Loops + 1) / 2);
+}
+
+/**
+  @brief      Calibrate Accel and Gyro together, about 0.4 s with 3 Rounds
+*/
+void MPU6050_Base::CalibrateMotion6(uint8_t Rounds) {
+	Calibrate(MPU6050_CALIBRATE_ACCEL | MPU6050_CALIBRATE_GYRO, Rounds);
+}
+
+/**
+  @brief      Offset calibration by averaged Newton steps
+  The sensor must be still with Z pointing straight up or down. Each round burst
+  reads all six axes together for a batch of samples (40, then doubling up to 320)
+  and averages them. The offset registers shift the readings linearly, so each
+  round yields an estimate of the zeroing offset per axis: the offset in use minus
+  the mean reading over the register gain. The estimates are averaged over all
+  rounds weighted by batch size, which is the least squares fit with a known
+  slope, and the result is written before the next round. Once the offsets have
+  moved far enough the slope is refitted from the rounds as well, in case a part
+  does not match the nominal register scaling. Accel offsets move in steps of two
+  register LSB, as bit zero is reserved: 16 reading LSB at +-2 g, so up to 8 LSB
+  of accel residual is left before noise.
+*/
+void MPU6050_Base::Calibrate(uint8_t Sensors, uint8_t Rounds) {
+	if (Rounds < 1) Rounds = 1;
+	bool mpu6500 = getDeviceID() >= 0x38;
+	uint8_t AccelAddress = mpu6500 ? 0x77 : MPU6050_RA_XA_OFFS_H;
+	uint8_t AccelShift = mpu6500 ? 3 : 2;
+	int16_t Offset[6];
+	int16_t BitZero[3];
+	float Nominal[6];
+	// Weighted sums over the rounds, offsets taken relative to the start
+	float Sw = 0, So[6] = {0}, Sm[6] = {0}, Soo[6] = {0}, Som[6] = {0};
+	int32_t Gravity = 16384 >> getFullScaleAccelRange();
+	for (int i = 0; i < 3; i++) {
+		Nominal[i] = 8.0f / (1 << getFullScaleAccelRange());	// reading LSB per 1/2048 g register LSB
+		Nominal[3 + i] = 4.0f / (1 << getFullScaleGyroRange());	// reading LSB per 1/32.8 dps register LSB
+	}
+
+	for (int i = 0; i < 3; i++) {
+		I2Cdev::readWords(devAddr, AccelAddress + (i * AccelShift), 1, (uint16_t *)&Offset[i], I2Cdev::readTimeout, wireObj);
+		BitZero[i] = Offset[i] & 1;										 // Bit zero of the accel offsets is reserved
+	}
+	I2Cdev::readWords(devAddr, MPU6050_RA_XG_OFFS_USRH, 3, (uint16_t *)&Offset[3], I2Cdev::readTimeout, wireObj);
+	int16_t Start[6];
+	memcpy(Start, Offset, sizeof(Start));
 
-	float kP = 0.3;
-	float kI = 20;
-	float x;
-	x = (100 - map(Loops, 1, 5, 20, 0)) * .01;
-	kP *= x;
-	kI *= x;
-	PID( 0x3B, kP, kI,  Loops);
+	// Fresh samples every millisecond while calibrating
+	uint8_t Rate = getRate();
+	setRate(0);
+	Serial.write('>');
+	for (uint8_t r = 0; r < Rounds; r++) {
+		uint16_t Samples = 40 << ((r < 3) ? r : 3);
+		int32_t Sum[6] = {0, 0, 0, 0, 0, 0};
+		delay(10);														// let the DLPF catch up with new offsets
+		for (uint16_t s = 0; s < Samples; s++) {
+			I2Cdev::readBytes(devAddr, MPU6050_RA_ACCEL_XOUT_H, 14, buffer, I2Cdev::readTimeout, wireObj);
+			for (int i = 0; i < 3; i++) {
+				Sum[i] += (int16_t)((buffer[2 * i] << 8) | buffer[2 * i + 1]);
+				Sum[3 + i] += (int16_t)((buffer[8 + 2 * i] << 8) | buffer[9 + 2 * i]);
+			}
+			delay(1);
+		}
+		if (r == 0 && Sum[2] < 0) Gravity = -Gravity;					// upside down
+		Sum[2] -= Gravity * Samples;
+
+		Sw += Samples;
+		for (int i = 0; i < 6; i++) {
+			if (!(Sensors & ((i < 3) ? MPU6050_CALIBRATE_ACCEL : MPU6050_CALIBRATE_GYRO))) continue;
+			float o = Offset[i] - Start[i];
+			float m = (float)Sum[i] / Samples;
+			So[i] += Samples * o;
+			Sm[i] += Samples * m;
+			Soo[i] += Samples * o * o;
+			Som[i] += Samples * o * m;
+
+			float MeanO = So[i] / Sw, MeanM = Sm[i] / Sw;
+			float VarO = Soo[i] / Sw - MeanO * MeanO;
+			float Gain = Nominal[i];
+			if (VarO * Nominal[i] * Nominal[i] > 10000) {				// offsets spread over 100+ reading LSB
+				float Fit = (Som[i] / Sw - MeanO * MeanM) / VarO;
+				if (Fit > Nominal[i] * 0.5f && Fit < Nominal[i] * 2) Gain = Fit;
+			}
+			float Root = Start[i] + MeanO - MeanM / Gain;
+			if (Root < -32768) Root = -32768;
+			if (Root > 32766) Root = 32766;
+			if (i < 3) Offset[i] = ((int16_t)lroundf(Root / 2) * 2) | BitZero[i];
+			else Offset[i] = (int16_t)lroundf(Root);
+		}
+
+		if (Sensors & MPU6050_CALIBRATE_ACCEL) {
+			if (mpu6500) {
+				for (int i = 0; i < 3; i++) I2Cdev::writeWords(devAddr, AccelAddress + (i * AccelShift), 1, (uint16_t *)&Offset[i], wireObj);
+			} else I2Cdev::writeWords(devAddr, AccelAddress, 3, (uint16_t *)&Offset[0], wireObj);
+		}
+		if (Sensors & MPU6050_CALIBRATE_GYRO) I2Cdev::writeWords(devAddr, MPU6050_RA_XG_OFFS_USRH, 3, (uint16_t *)&Offset[3], wireObj);
+		Serial.write('.');
+	}
+	setRate(Rate);
+	resetFIFO();
+	resetDMP();
 }
 
 void MPU6050_Base::PID(uint8_t ReadAddress, float kP,float kI, uint8_t Loops){
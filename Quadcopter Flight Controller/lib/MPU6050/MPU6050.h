@@ -437,6 +437,9 @@ THE SOFTWARE.
 
 #define MPU6050_FIFO_DEFAULT_TIMEOUT 11000
 
+#define MPU6050_CALIBRATE_ACCEL     0x01
+#define MPU6050_CALIBRATE_GYRO      0x02
+
 class MPU6050_Base {
     public:
         MPU6050_Base(uint8_t address=MPU6050_DEFAULT_ADDRESS, void *wireObj=0);
@@ -830,7 +833,9 @@ class MPU6050_Base {
 		// Calibration Routines
 		void CalibrateGyro(uint8_t Loops = 15); // Fine tune after setting offsets with less Loops.
 		void CalibrateAccel(uint8_t Loops = 15);// Fine tune after setting offsets with less Loops.
-		void PID(uint8_t ReadAddress, float kP,float kI, uint8_t Loops);  // Does the math
+		void CalibrateMotion6(uint8_t Rounds = 3); // Accel and gyro together, well under a second
+		void Calibrate(uint8_t Sensors, uint8_t Rounds); // Does the math, Sensors is a MPU6050_CALIBRATE_* mask
+		void PID(uint8_t ReadAddress, float kP,float kI, uint8_t Loops);  // Older one axis at a time PI search
 		void PrintActiveOffsets(); // See the results of the Calibration
 		int16_t * GetActiveOffsets();
 
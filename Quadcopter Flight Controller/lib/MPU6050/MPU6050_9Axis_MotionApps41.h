@@ -143,9 +143,14 @@ class MPU6050_9Axis_MotionApps41 : public MPU6050_Base {
         void dmpOverrideQuaternion(long *q);
         uint16_t dmpGetFIFOPacketSize();
 
+        // AK8975 address on the aux bus, 0x0C-0x0F depending on its CAD
+        // pins (0x0C inside an MPU-9150). Set before dmpInitialize().
+        void dmpSetMagAddress(uint8_t address) { magAddress = address; }
+
     private:
         uint8_t *dmpPacketBuffer;
         uint16_t dmpPacketSize;
+        uint8_t magAddress = 0x0E;
 };
 
 typedef MPU6050_9Axis_MotionApps41 MPU6050;
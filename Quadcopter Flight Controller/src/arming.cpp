@@ -0,0 +1,102 @@
+#include <Arduino.h>
+#include <atomic>
+#include "arming.h"
+#include "hal_esp32.h"
+
+#define REQUEST_NONE    0
+#define REQUEST_ARM     1
+#define REQUEST_DISARM  2
+
+// State in the low byte, failing checks in the next
+static std::atomic<uint32_t> stateWord{ARM_DISARMED | ((1u << PREARM_CHECK_COUNT) - 1) << 8};
+static std::atomic<uint8_t> request{REQUEST_NONE};
+
+// Published by the control loop
+static std::atomic<uint32_t> sampleUs{0};
+static std::atomic<float> rateHz{0};
+static std::atomic<float> nominalHz{0};
+static std::atomic<float> pitch{0};
+static std::atomic<float> roll{0};
+static std::atomic<uint16_t> throttle{0};
+static std::atomic<bool> calibrated{false};
+
+static PreArmLimits limits;
+static const CommandWatchdog *watchdog;
+static Clock *timeSource;
+
+static void armingTask(void *) {
+  ArmingStateMachine machine(ARMING_HOLD_MS);
+  // Every check counts as failing until it has run once
+  uint8_t failing = (1 << PREARM_CHECK_COUNT) - 1;
+  int next = 0;
+
+  for (;;) {
+    PreArmInputs in;
+    // Sample time before the clock, so the sample is never newer than now
+    uint32_t lastSampleUs = sampleUs.load(std::memory_order_acquire);
+    in.sampleAgeUs = sampleAgeUs(timeSource->micros(), lastSampleUs);
+    in.calibrated = calibrated.load(std::memory_order_relaxed);
+    in.rateHz = rateHz.load(std::memory_order_relaxed);
+    in.nominalHz = nominalHz.load(std::memory_order_relaxed);
+    in.pitch = pitch.load(std::memory_order_relaxed);
+    in.roll = roll.load(std::memory_order_relaxed);
+    in.throttle = throttle.load(std::memory_order_relaxed);
+
+    // One check per pass, except the IMU, which a flying quad needs to hear
+    // about at once
+    uint8_t bit = 1 << next;
+    if (preArmPasses((PreArmCheck)next, in, limits)) failing &= ~bit;
+    else failing |= bit;
+    if (preArmPasses(PREARM_IMU, in, limits)) failing &= ~(1 << PREARM_IMU);
+    else failing |= 1 << PREARM_IMU;
+    next = (next + 1) % PREARM_CHECK_COUNT;
+
+    uint32_t now = timeSource->millis();
+    uint8_t r = request.exchange(REQUEST_NONE);
+    if (r == REQUEST_ARM) machine.requestArm(failing, now);
+    else if (r == REQUEST_DISARM) machine.disarm();
+    if (watchdog->tripped()) machine.failsafe();
+    machine.update(failing, now);
+
+    stateWord.store(machine.state() | (uint32_t)failing << 8, std::memory_order_relaxed);
+    vTaskDelay(pdMS_TO_TICKS(ARMING_TASK_PERIOD_MS));
+  }
+}
+
+void armingBegin(const PreArmLimits &l, const CommandWatchdog &w, Clock &c) {
+  limits = l;
+  watchdog = &w;
+  timeSource = &c;
+  // Core 0 with Wi-Fi, like the blackbox flush task, below it in priority
+  xTaskCreatePinnedToCore(armingTask, "arming", 3072, NULL, 1, NULL, 0);
+}
+
+void armingPublishSample(uint32_t timeUs, float hz, float nominal, const float ypr[3]) {
+  sampleUs.store(timeUs, std::memory_order_relaxed);
+  rateHz.store(hz, std::memory_order_relaxed);
+  nominalHz.store(nominal, std::memory_order_relaxed);
+  pitch.store(ypr[1], std::memory_order_relaxed);
+  roll.store(ypr[2], std::memory_order_relaxed);
+}
+
+void armingPublishThrottle(const uint16_t motor[4]) {
+  uint16_t highest = 0;
+  for (int i = 0; i < 4; i++) highest = motor[i] > highest ? motor[i] : highest;
+  throttle.store(highest, std::memory_order_relaxed);
+}
+
+void armingSetCalibrated(bool c) {
+  calibrated.store(c, std::memory_order_relaxed);
+}
+
+void armingRequest(bool arm) {
+  request.store(arm ? REQUEST_ARM : REQUEST_DISARM);
+}
+
+ArmState armingState() {
+  return (ArmState)(stateWord.load(std::memory_order_relaxed) & 0xFF);
+}
+
+uint8_t armingFailing() {
+  return stateWord.load(std::memory_order_relaxed) >> 8;
+}
@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include "blackbox.h"
+#include "spsc_ring.h"
+
+static SpscRing<BlackboxRecord, BLACKBOX_RING_SIZE> ring;
+static std::atomic<uint32_t> dropped{0};
+static std::atomic<uint32_t> written{0};
+static std::atomic<int16_t> level[3] = {};
+
+static File logFile;
+static char fileName[16] = "";
+static Clock *timeSource;
+
+// Only touched by the flush task
+static BlackboxRecord block[BLACKBOX_BLOCK_RECORDS];
+static uint8_t payload[BLACKBOX_MAX_PAYLOAD];
+
+static bool writeBlock(uint16_t count) {
+  size_t payloadBytes = blackboxEncodeBlock(block, count, payload, sizeof(payload));
+  if (payloadBytes == 0) return false;
+
+  BlackboxBlockHeader header;
+  header.magic = BLACKBOX_MAGIC;
+  header.version = BLACKBOX_VERSION;
+  header.recordCount = count;
+  header.payloadBytes = payloadBytes;
+  header.droppedRecords = dropped.load(std::memory_order_relaxed);
+  for (int i = 0; i < 3; i++) header.level[i] = level[i].load(std::memory_order_relaxed);
+  header.reserved = 0;
+
+  if (logFile.write((const uint8_t *)&header, sizeof(header)) != sizeof(header)) return false;
+  if (logFile.write(payload, payloadBytes) != payloadBytes) return false;
+  return true;
+}
+
+static void flushTask(void *) {
+  uint32_t lastFlush = timeSource->millis();
+  uint32_t lastSync = lastFlush;
+
+  for (;;) {
+    // Batch into full blocks; a partial block is only written after 250 ms so
+    // flash sees few, large writes
+    size_t pending = ring.size();
+    if (pending >= BLACKBOX_BLOCK_RECORDS || (pending > 0 && timeSource->millis() - lastFlush > 250)) {
+      uint16_t count = 0;
+      while (count < BLACKBOX_BLOCK_RECORDS && ring.pop(block[count])) count++;
+
+      if (logFile && SPIFFS.totalBytes() - SPIFFS.usedBytes() > BLACKBOX_FLASH_RESERVE && writeBlock(count)) {
+        written.fetch_add(count, std::memory_order_relaxed);
+      } else {
+        if (logFile) {
+          Serial.println("Blackbox stopped: flash full or write failed");
+          logFile.close();
+        }
+        dropped.fetch_add(count, std::memory_order_relaxed);
+      }
+      lastFlush = timeSource->millis();
+      continue;
+    }
+
+    if (logFile && timeSource->millis() - lastSync > 2000) {
+      logFile.flush();
+      lastSync = timeSource->millis();
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+}
+
+static void setSlot(uint8_t slot) {
+  snprintf(fileName, sizeof(fileName), "/bb%u.bbl", slot);
+}
+
+bool blackboxBegin(Clock &c) {
+  timeSource = &c;
+
+  // Slots are used round robin from an index kept in NVS, so once all exist
+  // the one replaced is always the oldest. Without a stored index (first
+  // boot, or logs from before it was kept) start at the first free slot.
+  Preferences prefs;
+  prefs.begin("blackbox", false);
+  uint8_t slot = 0;
+  if (prefs.isKey("next")) {
+    slot = prefs.getUChar("next") % BLACKBOX_MAX_FILES;
+  } else {
+    setSlot(slot);
+    while (slot < BLACKBOX_MAX_FILES - 1 && SPIFFS.exists(fileName)) setSlot(++slot);
+  }
+  prefs.putUChar("next", (slot + 1) % BLACKBOX_MAX_FILES);
+  prefs.end();
+
+  setSlot(slot);
+  if (SPIFFS.exists(fileName)) SPIFFS.remove(fileName);
+
+  logFile = SPIFFS.open(fileName, FILE_WRITE);
+  if (!logFile) {
+    Serial.println("Blackbox: could not open log file");
+    return false;
+  }
+
+  // Core 0 at low priority, away from loop() which runs on core 1
+  xTaskCreatePinnedToCore(flushTask, "blackbox", 4096, NULL, 1, NULL, 0);
+  Serial.print("Blackbox logging to ");
+  Serial.println(fileName);
+  return true;
+}
+
+void blackboxLog(const BlackboxRecord &record) {
+  if (!ring.push(record)) dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void blackboxSetLevel(const float offset[3]) {
+  for (int i = 0; i < 3; i++) level[i].store((int16_t)lrintf(offset[i] * (float)(18000 / M_PI)));
+}
+
+uint32_t blackboxDropped() {
+  return dropped.load(std::memory_order_relaxed);
+}
+
+uint32_t blackboxWritten() {
+  return written.load(std::memory_order_relaxed);
+}
+
+const char *blackboxFileName() {
+  return fileName;
+}
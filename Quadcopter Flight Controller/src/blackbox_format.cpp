@@ -0,0 +1,85 @@
+#include "blackbox_format.h"
+
+#include <string.h>
+
+// Flattens a record into signed fields in a fixed order so the codec does not
+// care about the struct layout.
+static void toFields(const BlackboxRecord &r, int32_t *f) {
+  int n = 0;
+  f[n++] = (int32_t)r.timeUs;
+  for (int i = 0; i < 3; i++) f[n++] = r.gyro[i];
+  for (int i = 0; i < 3; i++) f[n++] = r.accel[i];
+  for (int i = 0; i < 4; i++) f[n++] = r.quat[i];
+  for (int i = 0; i < 3; i++) f[n++] = r.setpoint[i];
+  for (int a = 0; a < 3; a++) {
+    for (int t = 0; t < 3; t++) f[n++] = r.pid[a][t];
+  }
+  for (int i = 0; i < 4; i++) f[n++] = r.motor[i];
+}
+
+static void fromFields(const int32_t *f, BlackboxRecord &r) {
+  int n = 0;
+  r.timeUs = (uint32_t)f[n++];
+  for (int i = 0; i < 3; i++) r.gyro[i] = (int16_t)f[n++];
+  for (int i = 0; i < 3; i++) r.accel[i] = (int16_t)f[n++];
+  for (int i = 0; i < 4; i++) r.quat[i] = (int16_t)f[n++];
+  for (int i = 0; i < 3; i++) r.setpoint[i] = (int16_t)f[n++];
+  for (int a = 0; a < 3; a++) {
+    for (int t = 0; t < 3; t++) r.pid[a][t] = (int16_t)f[n++];
+  }
+  for (int i = 0; i < 4; i++) r.motor[i] = (uint16_t)f[n++];
+}
+
+static inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+size_t blackboxEncodeBlock(const BlackboxRecord *records, uint16_t count, uint8_t *out, size_t outSize) {
+  int32_t prev[BLACKBOX_FIELD_COUNT];
+  int32_t cur[BLACKBOX_FIELD_COUNT];
+  memset(prev, 0, sizeof(prev));
+  size_t pos = 0;
+
+  for (uint16_t r = 0; r < count; r++) {
+    toFields(records[r], cur);
+    for (int i = 0; i < BLACKBOX_FIELD_COUNT; i++) {
+      // Wrapping subtraction keeps the timestamp delta exact across micros() rollover
+      uint32_t v = zigzag((int32_t)((uint32_t)cur[i] - (uint32_t)prev[i]));
+      do {
+        if (pos >= outSize) return 0;
+        uint8_t b = v & 0x7F;
+        v >>= 7;
+        out[pos++] = v ? (b | 0x80) : b;
+      } while (v);
+      prev[i] = cur[i];
+    }
+  }
+  return pos;
+}
+
+bool blackboxDecodeBlock(const uint8_t *payload, size_t payloadBytes, uint16_t count, BlackboxRecord *out) {
+  int32_t fields[BLACKBOX_FIELD_COUNT];
+  memset(fields, 0, sizeof(fields));
+  size_t pos = 0;
+
+  for (uint16_t r = 0; r < count; r++) {
+    for (int i = 0; i < BLACKBOX_FIELD_COUNT; i++) {
+      uint32_t v = 0;
+      int shift = 0;
+      uint8_t b;
+      do {
+        if (pos >= payloadBytes || shift > 28) return false;
+        b = payload[pos++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+      } while (b & 0x80);
+      fields[i] = (int32_t)((uint32_t)fields[i] + (uint32_t)unzigzag(v));
+    }
+    fromFields(fields, out[r]);
+  }
+  return pos == payloadBytes;
+}
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <string.h>
+#include "dmp_capture.h"
+#include "spsc_ring.h"
+
+#define CAPTURE_IDLE      0
+#define CAPTURE_RUNNING   1
+#define CAPTURE_STOPPING  2
+
+static SpscRing<DmpCapturePacket, DMP_CAPTURE_RING_SIZE> ring;
+static std::atomic<uint8_t> state{CAPTURE_IDLE};
+static std::atomic<uint32_t> dropped{0};
+static std::atomic<uint32_t> written{0};
+
+// Set by dmpCaptureStart() while idle, then only touched by the flush task
+static File captureFile;
+static uint8_t profile;
+static DmpLayout layout;
+static Clock *timeSource;
+static TaskHandle_t task;
+
+// Only touched by the flush task
+static DmpCapturePacket block[DMP_CAPTURE_BLOCK_PACKETS];
+static uint8_t payload[DMP_CAPTURE_MAX_PAYLOAD];
+
+static bool writeBlock(uint16_t count) {
+  size_t payloadBytes = dmpCaptureEncodeBlock(block, count, layout.size, payload, sizeof(payload));
+  if (payloadBytes == 0) return false;
+
+  DmpCaptureBlockHeader header;
+  header.magic = DMP_CAPTURE_MAGIC;
+  header.version = DMP_CAPTURE_VERSION;
+  header.packetCount = count;
+  header.payloadBytes = payloadBytes;
+  header.droppedPackets = dropped.load(std::memory_order_relaxed);
+  header.profile = profile;
+  header.layout = layout;
+
+  if (captureFile.write((const uint8_t *)&header, sizeof(header)) != sizeof(header)) return false;
+  if (captureFile.write(payload, payloadBytes) != payloadBytes) return false;
+  return true;
+}
+
+static void flushTask(void *) {
+  uint32_t lastFlush = timeSource->millis();
+
+  for (;;) {
+    uint8_t s = state.load(std::memory_order_acquire);
+    if (s == CAPTURE_IDLE) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    // Full blocks, or a partial one after 250 ms or to finish
+    size_t pending = ring.size();
+    bool stopping = s == CAPTURE_STOPPING;
+    if (pending >= DMP_CAPTURE_BLOCK_PACKETS ||
+        (pending > 0 && (stopping || timeSource->millis() - lastFlush > 250))) {
+      uint16_t count = 0;
+      while (count < DMP_CAPTURE_BLOCK_PACKETS && ring.pop(block[count])) count++;
+
+      if (captureFile && SPIFFS.totalBytes() - SPIFFS.usedBytes() > DMP_CAPTURE_FLASH_RESERVE &&
+          writeBlock(count)) {
+        written.fetch_add(count, std::memory_order_relaxed);
+      } else {
+        if (captureFile) {
+          Serial.println("DMP capture stopped: flash full or write failed");
+          captureFile.close();
+        }
+        dropped.fetch_add(count, std::memory_order_relaxed);
+      }
+      lastFlush = timeSource->millis();
+      continue;
+    }
+
+    if (stopping) {
+      if (captureFile) captureFile.close();
+      state.store(CAPTURE_IDLE, std::memory_order_release);
+      continue;
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+}
+
+bool dmpCaptureStart(DmpProfile p, const DmpLayout &l, Clock &clock) {
+  if (state.load(std::memory_order_acquire) != CAPTURE_IDLE) return false;
+  if (l.size > DMP_CAPTURE_MAX_PACKET) return false;
+
+  captureFile = SPIFFS.open(DMP_CAPTURE_FILE, FILE_WRITE);
+  if (!captureFile) {
+    Serial.println("DMP capture: could not open " DMP_CAPTURE_FILE);
+    return false;
+  }
+  profile = p;
+  layout = l;
+  timeSource = &clock;
+  dropped.store(0, std::memory_order_relaxed);
+  written.store(0, std::memory_order_relaxed);
+
+  // Core 0 at low priority, with the blackbox flush task
+  if (!task) xTaskCreatePinnedToCore(flushTask, "dmpcap", 4096, NULL, 1, &task, 0);
+  state.store(CAPTURE_RUNNING, std::memory_order_release);
+  return true;
+}
+
+void dmpCaptureStop() {
+  uint8_t running = CAPTURE_RUNNING;
+  state.compare_exchange_strong(running, CAPTURE_STOPPING);
+}
+
+bool dmpCaptureActive() {
+  return state.load(std::memory_order_relaxed) != CAPTURE_IDLE;
+}
+
+void dmpCaptureLog(uint32_t timeUs, const uint8_t *packet) {
+  if (state.load(std::memory_order_relaxed) != CAPTURE_RUNNING) return;
+  DmpCapturePacket p;
+  p.timeUs = timeUs;
+  memcpy(p.data, packet, layout.size);
+  if (!ring.push(p)) dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t dmpCaptureWritten() {
+  return written.load(std::memory_order_relaxed);
+}
+
+uint32_t dmpCaptureDropped() {
+  return dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,142 @@
+#include "dmp_capture_format.h"
+
+#include <string.h>
+
+// Timestamp, 4 quaternion words, up to 16 words and an odd byte
+#define MAX_FIELDS (1 + 4 + (DMP_CAPTURE_MAX_PACKET - 16 + 1) / 2)
+
+// Splits a packet into unsigned fields of the given bit widths, big endian
+// as the DMP writes them, so deltas between packets stay small
+static int toFields(const DmpCapturePacket &p, uint8_t size, uint32_t *f, uint8_t *bits) {
+  int n = 0;
+  f[n] = p.timeUs;
+  bits[n++] = 32;
+  const uint8_t *d = p.data;
+  uint8_t i = 0;
+  for (; i + 4 <= 16; i += 4) {
+    f[n] = (uint32_t)d[i] << 24 | (uint32_t)d[i + 1] << 16 | (uint32_t)d[i + 2] << 8 | d[i + 3];
+    bits[n++] = 32;
+  }
+  for (; i + 2 <= size; i += 2) {
+    f[n] = (uint32_t)d[i] << 8 | d[i + 1];
+    bits[n++] = 16;
+  }
+  if (i < size) {
+    f[n] = d[i];
+    bits[n++] = 8;
+  }
+  return n;
+}
+
+static void fromFields(const uint32_t *f, uint8_t size, DmpCapturePacket &p) {
+  int n = 0;
+  p.timeUs = f[n++];
+  uint8_t *d = p.data;
+  uint8_t i = 0;
+  for (; i + 4 <= 16; i += 4, n++) {
+    d[i] = f[n] >> 24;
+    d[i + 1] = f[n] >> 16;
+    d[i + 2] = f[n] >> 8;
+    d[i + 3] = f[n];
+  }
+  for (; i + 2 <= size; i += 2, n++) {
+    d[i] = f[n] >> 8;
+    d[i + 1] = f[n];
+  }
+  if (i < size) d[i] = f[n];
+}
+
+// Wrapping difference at the field's width, sign extended
+static inline int32_t delta(uint32_t cur, uint32_t prev, uint8_t bits) {
+  uint32_t d = cur - prev;
+  if (bits == 16) return (int16_t)d;
+  if (bits == 8) return (int8_t)d;
+  return (int32_t)d;
+}
+
+static inline uint32_t mask(uint32_t v, uint8_t bits) {
+  return bits == 32 ? v : v & ((1u << bits) - 1);
+}
+
+static inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static bool packetSizeValid(uint8_t size) {
+  return size >= 16 && size <= DMP_CAPTURE_MAX_PACKET;
+}
+
+size_t dmpCaptureEncodeBlock(const DmpCapturePacket *packets, uint16_t count, uint8_t packetSize, uint8_t *out,
+                             size_t outSize) {
+  if (!packetSizeValid(packetSize)) return 0;
+  uint32_t prev[MAX_FIELDS];
+  uint32_t cur[MAX_FIELDS];
+  uint8_t bits[MAX_FIELDS];
+  memset(prev, 0, sizeof(prev));
+  size_t pos = 0;
+
+  for (uint16_t p = 0; p < count; p++) {
+    int n = toFields(packets[p], packetSize, cur, bits);
+    for (int i = 0; i < n; i++) {
+      uint32_t v = zigzag(delta(cur[i], prev[i], bits[i]));
+      do {
+        if (pos >= outSize) return 0;
+        uint8_t b = v & 0x7F;
+        v >>= 7;
+        out[pos++] = v ? (b | 0x80) : b;
+      } while (v);
+      prev[i] = cur[i];
+    }
+  }
+  return pos;
+}
+
+bool dmpCaptureDecodeBlock(const uint8_t *payload, size_t payloadBytes, uint16_t count, uint8_t packetSize,
+                           DmpCapturePacket *out) {
+  if (!packetSizeValid(packetSize)) return false;
+  uint32_t fields[MAX_FIELDS];
+  uint8_t bits[MAX_FIELDS];
+  memset(fields, 0, sizeof(fields));
+  // Widths depend only on the size
+  DmpCapturePacket zero = {};
+  int n = toFields(zero, packetSize, fields, bits);
+  size_t pos = 0;
+
+  for (uint16_t p = 0; p < count; p++) {
+    for (int i = 0; i < n; i++) {
+      uint32_t v = 0;
+      int shift = 0;
+      uint8_t b;
+      do {
+        if (pos >= payloadBytes || shift > 28) return false;
+        b = payload[pos++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+      } while (b & 0x80);
+      fields[i] = mask(fields[i] + (uint32_t)unzigzag(v), bits[i]);
+    }
+    memset(out[p].data, 0, sizeof(out[p].data));
+    fromFields(fields, packetSize, out[p]);
+  }
+  return pos == payloadBytes;
+}
+
+// Every field the layout claims lies inside the packet, so DmpDevice::decode
+// stays within it
+static bool layoutValid(const DmpLayout &l) {
+  if (!packetSizeValid(l.size)) return false;
+  if ((l.fields & DMP_FIELD_GYRO) && l.gyro + 2 * l.gyroStep + 2 > l.size) return false;
+  if ((l.fields & DMP_FIELD_ACCEL) && l.accel + 2 * l.accelStep + 2 > l.size) return false;
+  if ((l.fields & DMP_FIELD_MAG) && l.mag + 6 > l.size) return false;
+  return true;
+}
+
+bool dmpCaptureHeaderValid(const DmpCaptureBlockHeader &header) {
+  return header.magic == DMP_CAPTURE_MAGIC && header.version == DMP_CAPTURE_VERSION &&
+         header.profile < DMP_PROFILE_COUNT && layoutValid(header.layout) &&
+         header.packetCount <= DMP_CAPTURE_BLOCK_PACKETS && header.payloadBytes <= DMP_CAPTURE_MAX_PAYLOAD;
+}
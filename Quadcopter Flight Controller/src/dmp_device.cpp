@@ -0,0 +1,94 @@
+#include "dmp_device.h"
+
+#include <string.h>
+
+#include "MPU6050.h"
+
+// One factory per profile, each in its own translation unit (dmp_<profile>.cpp)
+DmpDevice *createDmpMotionApps20(uint8_t address, void *wireObj);
+DmpDevice *createDmpMotionApps612(uint8_t address, void *wireObj);
+DmpDevice *createDmpMotionApps41(uint8_t address, void *wireObj);
+
+static const char *const profileNames[DMP_PROFILE_COUNT] = {"MotionApps20", "MotionApps612", "MotionApps41"};
+static const char *const profileNumbers[DMP_PROFILE_COUNT] = {"20", "612", "41"};
+
+DmpDevice *createDmpDevice(DmpProfile profile, uint8_t address, void *wireObj) {
+  switch (profile) {
+    case DMP_MOTIONAPPS20: return createDmpMotionApps20(address, wireObj);
+    case DMP_MOTIONAPPS612: return createDmpMotionApps612(address, wireObj);
+    case DMP_MOTIONAPPS41: return createDmpMotionApps41(address, wireObj);
+    default: return nullptr;
+  }
+}
+
+const char *dmpProfileName(DmpProfile profile) {
+  return profile < DMP_PROFILE_COUNT ? profileNames[profile] : "unknown";
+}
+
+DmpProfile dmpProfileFromName(const char *name) {
+  for (int i = 0; i < DMP_PROFILE_COUNT; i++) {
+    if (!strcmp(name, profileNames[i]) || !strcmp(name, profileNumbers[i])) return (DmpProfile)i;
+  }
+  return DMP_PROFILE_COUNT;
+}
+
+bool DmpDevice::readLatest(uint8_t *packet) {
+  return mpu().GetCurrentFIFOPacket(packet, layout_.size) > 0;
+}
+
+// Where every image keeps its FIFO rate divisor
+#define DMP_FIFO_DIVISOR_BANK  0x02
+#define DMP_FIFO_DIVISOR_ADDR  0x16
+
+bool DmpDevice::setRate(uint8_t sampleDiv, uint16_t fifoDiv) {
+  MPU6050_Base &m = mpu();
+  bool running = m.getDMPEnabled();
+  m.setDMPEnabled(false);
+  m.setRate(sampleDiv);
+  uint8_t word[2] = {(uint8_t)(fifoDiv >> 8), (uint8_t)fifoDiv};
+  bool ok = m.writeMemoryBlock(word, sizeof(word), DMP_FIFO_DIVISOR_BANK, DMP_FIFO_DIVISOR_ADDR);
+  // A packet cut short by the switch would leave the FIFO misaligned
+  m.resetFIFO();
+  m.resetDMP();
+  if (running) m.setDMPEnabled(true);
+  return ok;
+}
+
+uint8_t DmpDevice::sampleDivisor() {
+  return mpu().getRate();
+}
+
+uint16_t DmpDevice::fifoDivisor() {
+  uint8_t word[2];
+  mpu().readMemoryBlock(word, sizeof(word), DMP_FIFO_DIVISOR_BANK, DMP_FIFO_DIVISOR_ADDR);
+  return (word[0] << 8) | word[1];
+}
+
+float DmpDevice::rateHz() {
+  uint8_t dlpf = mpu().getDLPFMode();
+  float gyroHz = (dlpf == 0 || dlpf == 7) ? 8000 : 1000;
+  return gyroHz / (1 + sampleDivisor()) / (1 + fifoDivisor());
+}
+
+static inline int16_t be16(const uint8_t *p) {
+  return (int16_t)((p[0] << 8) | p[1]);
+}
+
+void DmpDevice::decode(const uint8_t *packet, ImuSample &s) const {
+  // High halves of the Q30 words, 1.0 = 16384
+  for (int i = 0; i < 4; i++) s.quat[i] = be16(packet + 4 * i);
+  for (int i = 0; i < 3; i++) {
+    s.gyro[i] = (layout_.fields & DMP_FIELD_GYRO) ? be16(packet + layout_.gyro + i * layout_.gyroStep) : 0;
+    s.accel[i] = (layout_.fields & DMP_FIELD_ACCEL) ? be16(packet + layout_.accel + i * layout_.accelStep) : 0;
+  }
+  if (layout_.fields & DMP_FIELD_MAG) {
+    // AK8975 x and y are the MPU6050's y and x, and its z points the other
+    // way (the MPU-9150 mounting)
+    const uint8_t *m = packet + layout_.mag;
+    s.mag[0] = be16(m + 2);
+    s.mag[1] = be16(m);
+    s.mag[2] = (int16_t)-be16(m + 4);
+  } else {
+    s.mag[0] = s.mag[1] = s.mag[2] = 0;
+  }
+}
@@ -0,0 +1,28 @@
+// MotionApps 2.0 DMP image. Packets are fixed at 42 bytes.
+
+#include "MPU6050_6Axis_MotionApps20.h"
+#include "dmp_device.h"
+
+class DmpMotionApps20 : public DmpDevice {
+public:
+  DmpMotionApps20(uint8_t address, void *wireObj) : mpu_(address, wireObj) {
+    layout_ = {42, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL, 16, 4, 28, 4, 0};
+  }
+  DmpProfile profile() const override { return DMP_MOTIONAPPS20; }
+  MPU6050_Base &mpu() override { return mpu_; }
+  uint8_t initialize() override { return mpu_.dmpInitialize(); }
+  void libraryYawPitchRoll(const uint8_t *packet, float ypr[3]) override {
+    Quaternion q;
+    VectorFloat gravity;
+    mpu_.dmpGetQuaternion(&q, packet);
+    mpu_.dmpGetGravity(&gravity, &q);
+    mpu_.dmpGetYawPitchRoll(ypr, &q, &gravity);
+  }
+
+private:
+  MPU6050_6Axis_MotionApps20 mpu_;
+};
+
+DmpDevice *createDmpMotionApps20(uint8_t address, void *wireObj) {
+  return new DmpMotionApps20(address, wireObj);
+}
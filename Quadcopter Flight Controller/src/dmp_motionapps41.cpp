@@ -0,0 +1,37 @@
+// MotionApps 4.1 DMP image. The MPU6050 reads an AK8975 magnetometer over
+// its aux I2C bus as slave 0 and the DMP puts it in every packet, so the
+// host gets the field without extra transactions. Packets are fixed at 48
+// bytes.
+
+#include "MPU6050_9Axis_MotionApps41.h"
+#include "dmp_device.h"
+
+// AK8975 address on the aux bus; 0x0C for the one inside an MPU-9150
+#ifndef DMP_MAG_ADDRESS
+#define DMP_MAG_ADDRESS 0x0E
+#endif
+
+class DmpMotionApps41 : public DmpDevice {
+public:
+  DmpMotionApps41(uint8_t address, void *wireObj) : mpu_(address, wireObj) {
+    layout_ = {48, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL | DMP_FIELD_MAG, 16, 4, 34, 4, 28};
+    mpu_.dmpSetMagAddress(DMP_MAG_ADDRESS);
+  }
+  DmpProfile profile() const override { return DMP_MOTIONAPPS41; }
+  MPU6050_Base &mpu() override { return mpu_; }
+  uint8_t initialize() override { return mpu_.dmpInitialize(); }
+  void libraryYawPitchRoll(const uint8_t *packet, float ypr[3]) override {
+    Quaternion q;
+    VectorFloat gravity;
+    mpu_.dmpGetQuaternion(&q, packet);
+    mpu_.dmpGetGravity(&gravity, &q);
+    mpu_.dmpGetYawPitchRoll(ypr, &q, &gravity);
+  }
+
+private:
+  MPU6050_9Axis_MotionApps41 mpu_;
+};
+
+DmpDevice *createDmpMotionApps41(uint8_t address, void *wireObj) {
+  return new DmpMotionApps41(address, wireObj);
+}
@@ -0,0 +1,79 @@
+// MotionApps 6.12 DMP image (InvenSense eMD 6.12), with continuous gyro
+// calibration. By default a packet is the quaternion, raw accel and raw gyro,
+// 28 bytes; the accel and gyro can be dropped from it.
+
+#include "MPU6050_6Axis_MotionApps612.h"
+#include "dmp_device.h"
+
+// CFG_15 in the 6.12 image: the DMP code that copies raw accel and gyro into
+// the FIFO. 0xA3 is a no-op, so patching over the copies leaves them out.
+#define DMP612_CFG_15          2727
+#define DMP612_CFG_15_LENGTH   10
+
+class DmpMotionApps612 : public DmpDevice {
+public:
+  DmpMotionApps612(uint8_t address, void *wireObj) : mpu_(address, wireObj) {
+    setLayout(DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL);
+  }
+  DmpProfile profile() const override { return DMP_MOTIONAPPS612; }
+  MPU6050_Base &mpu() override { return mpu_; }
+
+  uint8_t initialize() override {
+    uint8_t status = mpu_.dmpInitialize();
+    if (status == 0) setLayout(DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL);
+    return status;
+  }
+
+  uint8_t selectFields(uint8_t fields) override {
+    fields = (fields & (DMP_FIELD_GYRO | DMP_FIELD_ACCEL)) | DMP_FIELD_QUAT;
+    // writeMemoryBlock() reads the patch back. If it did not stick, put the
+    // current code back so the packets keep matching the layout.
+    if (!writeCfg15(fields)) {
+      writeCfg15(layout_.fields);
+      return layout_.fields;
+    }
+    setLayout(fields);
+    mpu_.resetFIFO();
+    return fields;
+  }
+
+  void libraryYawPitchRoll(const uint8_t *packet, float ypr[3]) override {
+    Quaternion q;
+    VectorFloat gravity;
+    mpu_.dmpGetQuaternion(&q, packet);
+    mpu_.dmpGetGravity(&gravity, &q);
+    mpu_.dmpGetYawPitchRoll(ypr, &q, &gravity);
+  }
+
+private:
+  bool writeCfg15(uint8_t fields) {
+    uint8_t cfg[DMP612_CFG_15_LENGTH] = {0xA3, 0xA3, 0xA3, 0xA3, 0xA3, 0xA3, 0xA3, 0xA3, 0xA3, 0xA3};
+    if (fields & DMP_FIELD_ACCEL) {
+      cfg[1] = 0xC0; cfg[2] = 0xC8; cfg[3] = 0xC2;
+    }
+    if (fields & DMP_FIELD_GYRO) {
+      cfg[4] = 0xC4; cfg[5] = 0xCC; cfg[6] = 0xC6;
+    }
+    return mpu_.writeMemoryBlock(cfg, sizeof(cfg), DMP612_CFG_15 >> 8, DMP612_CFG_15 & 0xFF);
+  }
+
+  // Quaternion, then accel, then gyro, each present one packed after the other
+  void setLayout(uint8_t fields) {
+    uint8_t size = 16;
+    layout_.fields = fields;
+    layout_.accel = size;
+    layout_.accelStep = 2;
+    if (fields & DMP_FIELD_ACCEL) size += 6;
+    layout_.gyro = size;
+    layout_.gyroStep = 2;
+    if (fields & DMP_FIELD_GYRO) size += 6;
+    layout_.mag = 0;
+    layout_.size = size;
+  }
+
+  MPU6050_6Axis_MotionApps612 mpu_;
+};
+
+DmpDevice *createDmpMotionApps612(uint8_t address, void *wireObj) {
+  return new DmpMotionApps612(address, wireObj);
+}
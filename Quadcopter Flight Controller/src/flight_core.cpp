@@ -0,0 +1,578 @@
+#include "flight_core.h"
+
+#include <math.h>
+#include <string.h>
+
+void quaternionToYawPitchRoll(const float q[4], float ypr[3]) {
+  float w = q[0], x = q[1], y = q[2], z = q[3];
+  float gx = 2 * (x * z - w * y);
+  float gy = 2 * (w * x + y * z);
+  float gz = w * w - x * x - y * y + z * z;
+
+  ypr[0] = atan2f(2 * x * y - 2 * w * z, 2 * w * w + 2 * x * x - 1);
+  ypr[1] = atan2f(gx, sqrtf(gy * gy + gz * gz));
+  ypr[2] = atan2f(gy, gz);
+  if (gz < 0) {
+    ypr[1] = ypr[1] > 0 ? (float)M_PI - ypr[1] : (float)-M_PI - ypr[1];
+  }
+}
+
+void AttitudeEstimator::update(const int16_t quat[4]) {
+  for (int i = 0; i < 4; i++) {
+    q_[i] = quat[i] / 16384.0f;
+  }
+  quaternionToYawPitchRoll(q_, raw_);
+  dmpYaw_ = raw_[0];
+  applyHeading();
+  for (int i = 0; i < 3; i++) {
+    ypr_[i] = raw_[i] - offset_[i];
+  }
+}
+
+#define MAG_HEADING_GAIN  0.01f   // per sample; about a second at 100 Hz
+#define MAG_FIELD_MIN     0.6f    // accepted magnitude, times the calibrated one
+#define MAG_FIELD_MAX     1.4f
+
+void AttitudeEstimator::setMagCalibration(const MagCalibration &cal) {
+  mag_ = cal;
+  headingValid_ = false;
+  applyHeading();
+}
+
+void AttitudeEstimator::updateMag(const int16_t mag[3]) {
+  if (mag_.radius <= 0) return;
+  float m[3];
+  float norm2 = 0;
+  for (int i = 0; i < 3; i++) {
+    m[i] = (mag[i] - mag_.offset[i]) * mag_.scale[i];
+    norm2 += m[i] * m[i];
+  }
+  float norm = sqrtf(norm2);
+  if (norm < MAG_FIELD_MIN * mag_.radius || norm > MAG_FIELD_MAX * mag_.radius) return;
+
+  // Into the earth frame with the DMP attitude. Tilt is right, so what is
+  // left of the horizontal field's angle is the DMP's yaw error, plus the
+  // fixed angle between the yaw reference and magnetic north.
+  float w = q_[0], x = q_[1], y = q_[2], z = q_[3];
+  float tx = 2 * (y * m[2] - z * m[1]), ty = 2 * (z * m[0] - x * m[2]), tz = 2 * (x * m[1] - y * m[0]);
+  float ex = m[0] + w * tx + (y * tz - z * ty);
+  float ey = m[1] + w * ty + (z * tx - x * tz);
+  float horizontal = sqrtf(ex * ex + ey * ey);
+  if (horizontal < 1e-3f * norm) return;   // field straight down: no heading
+  float c = ex / horizontal, s = ey / horizontal;
+
+  if (!headingValid_) {
+    headingCos_ = c;
+    headingSin_ = s;
+    headingValid_ = true;
+  } else {
+    headingCos_ += (c - headingCos_) * MAG_HEADING_GAIN;
+    headingSin_ += (s - headingSin_) * MAG_HEADING_GAIN;
+  }
+  applyHeading();
+  ypr_[0] = raw_[0] - offset_[0];
+}
+
+// Yaw is the DMP's, less its error against the magnetometer. The library's
+// yaw turns the other way from the earth frame, hence the addition.
+void AttitudeEstimator::applyHeading() {
+  raw_[0] = dmpYaw_;
+  if (!headingValid_) return;
+  float yaw = dmpYaw_ + atan2f(headingSin_, headingCos_);
+  if (yaw > (float)M_PI) yaw -= 2 * (float)M_PI;
+  if (yaw < (float)-M_PI) yaw += 2 * (float)M_PI;
+  raw_[0] = yaw;
+}
+
+void AttitudeEstimator::beginCalibration() {
+  sum_[0] = sum_[1] = sum_[2] = 0;
+  sumCount_ = 0;
+}
+
+void AttitudeEstimator::addCalibrationSample() {
+  for (int i = 0; i < 3; i++) {
+    sum_[i] += raw_[i];
+  }
+  sumCount_++;
+}
+
+bool AttitudeEstimator::finishCalibration() {
+  if (sumCount_ == 0) return false;
+  for (int i = 0; i < 3; i++) {
+    offset_[i] = sum_[i] / sumCount_;
+    ypr_[i] = raw_[i] - offset_[i];
+  }
+  return true;
+}
+
+#define MAG_CAL_MIN_SAMPLES  200
+#define MAG_CAL_MIN_SPAN     0.6f   // each axis' range, times the widest one
+
+void MagCalibrator::begin() {
+  for (int i = 0; i < 3; i++) {
+    min_[i] = INT16_MAX;
+    max_[i] = INT16_MIN;
+  }
+  count_ = 0;
+}
+
+void MagCalibrator::addSample(const int16_t mag[3]) {
+  if (count_ == 0) begin();
+  for (int i = 0; i < 3; i++) {
+    if (mag[i] < min_[i]) min_[i] = mag[i];
+    if (mag[i] > max_[i]) max_[i] = mag[i];
+  }
+  count_++;
+}
+
+bool MagCalibrator::finish(MagCalibration &cal) const {
+  if (count_ < MAG_CAL_MIN_SAMPLES) return false;
+  float span[3], widest = 0, mean = 0;
+  for (int i = 0; i < 3; i++) {
+    span[i] = (float)max_[i] - min_[i];
+    if (span[i] > widest) widest = span[i];
+    mean += span[i] / 3;
+  }
+  // Turning only about one axis leaves the others short of the full field
+  for (int i = 0; i < 3; i++) {
+    if (span[i] <= 0 || span[i] < MAG_CAL_MIN_SPAN * widest) return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    cal.offset[i] = ((float)max_[i] + min_[i]) / 2;
+    cal.scale[i] = mean / span[i];
+  }
+  cal.radius = mean / 2;
+  return true;
+}
+
+bool calibrateLevel(Imu &imu, Clock &clock, AttitudeEstimator &estimator, int samples, uint32_t intervalMs) {
+  ImuSample s;
+  estimator.beginCalibration();
+  int got = 0;
+  for (int attempt = 0; got < samples && attempt < samples * 4; attempt++) {
+    if (imu.read(s)) {
+      estimator.update(s.quat);
+      estimator.updateMag(s.mag);
+      estimator.addCalibrationSample();
+      got++;
+    }
+    clock.delay(intervalMs);
+  }
+  return estimator.finishCalibration();
+}
+
+#define SAMPLE_RATE_SETTLE 8      // intervals before the measurement is used
+
+void SampleRate::setNominal(float hz) {
+  nominalHz_ = hz > 0 ? hz : 100;
+  periodUs_ = 0;
+  count_ = 0;
+}
+
+void SampleRate::sample(uint32_t timeUs) {
+  uint32_t interval = timeUs - lastUs_;
+  lastUs_ = timeUs;
+  if (count_++ == 0) return;
+
+  // A stall (Wi-Fi, a FIFO reset) is not a rate change; drop intervals far
+  // off the nominal period
+  float nominalUs = 1e6f / nominalHz_;
+  if (interval > 4 * nominalUs) return;
+  if (periodUs_ <= 0) periodUs_ = interval;
+  else periodUs_ += (interval - periodUs_) / 16;
+}
+
+float SampleRate::hz() const {
+  if (count_ <= SAMPLE_RATE_SETTLE || periodUs_ <= 0) return nominalHz_;
+  return 1e6f / periodUs_;
+}
+
+void RpmNotchFilter::update(const float rpm[4], float sampleHz) {
+  for (int m = 0; m < 4; m++) {
+    for (int h = 0; h < RPM_NOTCH_HARMONICS; h++) {
+      Notch &n = notch_[m][h];
+      float hz = rpm[m] / 60 * (h + 1);
+      bool on = hz >= minHz_ && hz < 0.45f * sampleHz;
+      if (on && !n.on) {
+        // Stale history from the last time it ran would ring
+        for (int k = 0; k < 3; k++) n.x1[k] = n.x2[k] = n.y1[k] = n.y2[k] = 0;
+      }
+      n.on = on;
+      if (!on) continue;
+      // Notch biquad (RBJ cookbook), normalised by a0
+      float w = 2 * (float)M_PI * hz / sampleHz;
+      float alpha = sinf(w) / (2 * q_);
+      float a0 = 1 + alpha;
+      n.b0 = 1 / a0;
+      n.b1 = -2 * cosf(w) / a0;
+      n.a2 = (1 - alpha) / a0;
+    }
+  }
+}
+
+void RpmNotchFilter::apply(float gyro[3]) {
+  for (int m = 0; m < 4; m++) {
+    for (int h = 0; h < RPM_NOTCH_HARMONICS; h++) {
+      Notch &n = notch_[m][h];
+      if (!n.on) continue;
+      for (int k = 0; k < 3; k++) {
+        float x = gyro[k];
+        float y = n.b0 * (x + n.x2[k]) + n.b1 * (n.x1[k] - n.y1[k]) - n.a2 * n.y2[k];
+        n.x2[k] = n.x1[k];
+        n.x1[k] = x;
+        n.y2[k] = n.y1[k];
+        n.y1[k] = y;
+        gyro[k] = y;
+      }
+    }
+  }
+}
+
+int RpmNotchFilter::active() const {
+  int count = 0;
+  for (int m = 0; m < 4; m++) {
+    for (int h = 0; h < RPM_NOTCH_HARMONICS; h++) count += notch_[m][h].on;
+  }
+  return count;
+}
+
+void PidController::reset() {
+  p_ = i_ = d_ = 0;
+  first_ = true;
+}
+
+float PidController::update(float setpoint, float measured, float dt) {
+  float error = setpoint - measured;
+  p_ = gains_.kp * error;
+
+  if (dt > 0) {
+    i_ += gains_.ki * error * dt;
+    if (i_ > gains_.iLimit) i_ = gains_.iLimit;
+    if (i_ < -gains_.iLimit) i_ = -gains_.iLimit;
+    float d = first_ ? 0 : -gains_.kd * (measured - lastMeasured_) / dt;
+    if (gains_.dCutoffHz > 0 && !first_) d = d_ + (d - d_) * dt / (dt + 1 / (2 * (float)M_PI * gains_.dCutoffHz));
+    d_ = d;
+  }
+  lastMeasured_ = measured;
+  first_ = false;
+  return p_ + i_ + d_;
+}
+
+void gyroRates(const int16_t gyro[3], float rates[3]) {
+  // Pitch and yaw in dmpGetYawPitchRoll turn against the sensor's y and z
+  const float scale = (float)M_PI / 180 / GYRO_LSB_PER_DPS;
+  rates[0] = -gyro[2] * scale;
+  rates[1] = -gyro[1] * scale;
+  rates[2] = gyro[0] * scale;
+}
+
+// Axes yaw, pitch, roll
+const AttitudeGains DEFAULT_ATTITUDE_GAINS = {
+  {4, 10, 10},
+  {6, 6, 6},
+  {
+    {20, 40, 0, 80, 0},
+    {8, 20, 0.1f, 40, 0},
+    {8, 20, 0.1f, 40, 0},
+  },
+};
+
+void AttitudeController::setGains(const AttitudeGains &gains) {
+  gains_ = gains;
+  for (int k = 0; k < 3; k++) rate_[k].setGains(gains.rate[k]);
+}
+
+void AttitudeController::reset() {
+  for (int k = 0; k < 3; k++) {
+    rate_[k].reset();
+    rateSetpoint_[k] = 0;
+  }
+}
+
+void AttitudeController::update(const float setpoint[3], const float ypr[3], const float rates[3], float dt,
+                                float axis[3]) {
+  for (int k = 0; k < 3; k++) {
+    float error = setpoint[k] - ypr[k];
+    if (k == 0) error = remainderf(error, 2 * (float)M_PI);
+    float rate = gains_.angleKp[k] * error;
+    if (rate > gains_.maxRate[k]) rate = gains_.maxRate[k];
+    if (rate < -gains_.maxRate[k]) rate = -gains_.maxRate[k];
+    setpoint_[k] = setpoint[k];
+    rateSetpoint_[k] = rate;
+    axis[k] = rate_[k].update(rate, rates[k], dt);
+  }
+}
+
+// Per motor contribution of yaw, pitch, roll
+static const float quadXMix[4][3] = {
+  { 1,  1,  1},   // front left
+  {-1,  1, -1},   // front right
+  { 1, -1, -1},   // rear right
+  {-1, -1,  1},   // rear left
+};
+
+void mixQuadX(float throttle, const float axis[3], uint16_t out[4], float gain) {
+  float m[4];
+  float highest = -1e9f;
+  for (int i = 0; i < 4; i++) {
+    m[i] = throttle + quadXMix[i][0] * axis[0] + quadXMix[i][1] * axis[1] + quadXMix[i][2] * axis[2];
+    m[i] *= gain;
+    if (m[i] > highest) highest = m[i];
+  }
+  float shift = highest > MOTOR_MAX ? highest - MOTOR_MAX : 0;
+  for (int i = 0; i < 4; i++) {
+    float v = m[i] - shift;
+    if (v < MOTOR_MIN) v = MOTOR_MIN;
+    if (v > MOTOR_MAX) v = MOTOR_MAX;
+    out[i] = (uint16_t)lrintf(v);
+  }
+}
+
+const AutotuneConfig DEFAULT_AUTOTUNE = {
+  {30, 15, 15},
+  0.02f,
+  2,
+  15 * (float)M_PI / 180,
+  4,
+  6,
+  8,
+  0.6f,
+  80,
+};
+
+const char *autotuneStateName(AutotuneState state) {
+  switch (state) {
+  case AUTOTUNE_IDLE: return "idle";
+  case AUTOTUNE_RUNNING: return "running";
+  case AUTOTUNE_DONE: return "done";
+  case AUTOTUNE_FAILED: return "failed";
+  }
+  return "?";
+}
+
+void RelayAutotune::begin(int axis, const AttitudeGains &gains, float trim) {
+  axis_ = axis < 0 ? 0 : axis > 2 ? 2 : axis;
+  base_ = gains.rate[axis_];
+  baseMaxRate_ = gains.maxRate[axis_];
+  trim_ = trim;
+  high_ = true;
+  elapsedS_ = 0;
+  lastRiseS_ = -1;
+  lastPeriodS_ = 0;
+  sinSum_ = cosSum_ = 0;
+  cycles_ = 0;
+  periodSum_ = amplitudeSum_ = 0;
+  memset(&result_, 0, sizeof(result_));
+  state_ = AUTOTUNE_RUNNING;
+}
+
+void RelayAutotune::cancel() {
+  if (state_ == AUTOTUNE_RUNNING) state_ = AUTOTUNE_IDLE;
+}
+
+float RelayAutotune::update(float angleError, float rate, float dt) {
+  if (state_ != AUTOTUNE_RUNNING) return trim_;
+  elapsedS_ += dt;
+  if (fabsf(angleError) > config_.maxAngle || elapsedS_ > config_.timeoutS) {
+    state_ = AUTOTUNE_FAILED;
+    return trim_;
+  }
+
+  float error = config_.guardKp * angleError - rate;
+  // The fundamental of the error over the cycle, on the last cycle's
+  // period: the describing function wants its amplitude, not the peak of
+  // what is closer to a triangle wave
+  if (lastPeriodS_ > 0) {
+    float phase = 2 * (float)M_PI * (elapsedS_ - lastRiseS_) / lastPeriodS_;
+    sinSum_ += error * sinf(phase) * dt;
+    cosSum_ += error * cosf(phase) * dt;
+  }
+  if (high_ && error < -config_.hysteresis) {
+    high_ = false;
+  } else if (!high_ && error > config_.hysteresis) {
+    // A full cycle ends on each rise
+    high_ = true;
+    if (lastRiseS_ >= 0) {
+      float period = elapsedS_ - lastRiseS_;
+      if (lastPeriodS_ > 0 && ++cycles_ > config_.settleCycles) {
+        periodSum_ += period;
+        amplitudeSum_ += 2 / period * sqrtf(sinSum_ * sinSum_ + cosSum_ * cosSum_);
+        if (cycles_ - config_.settleCycles >= config_.measureCycles) finish();
+      }
+      lastPeriodS_ = period;
+    }
+    lastRiseS_ = elapsedS_;
+    sinSum_ = cosSum_ = 0;
+  }
+  float amplitude = config_.amplitude[axis_];
+  return trim_ + (high_ ? amplitude : -amplitude);
+}
+
+void RelayAutotune::finish() {
+  AutotuneResult &r = result_;
+  r.cycles = config_.measureCycles;
+  r.periodS = periodSum_ / r.cycles;
+  r.rateAmplitude = amplitudeSum_ / r.cycles;
+  float w = 2 * (float)M_PI / r.periodS;
+  float a = r.rateAmplitude;
+  if (r.periodS <= 0 || a <= config_.hysteresis) {
+    state_ = AUTOTUNE_FAILED;
+    return;
+  }
+
+  // The relay sees K e^(-theta s) / s times the angle hold's (1 + guardKp / s).
+  // Its describing function, 4 d / (pi a) lagging by asin(h / a), closes
+  // the loop at the oscillation: unit gain and -180 degrees of phase.
+  float guard = config_.guardKp / w;
+  r.plantGain = (float)M_PI * a * w / (4 * config_.amplitude[axis_] * sqrtf(1 + guard * guard));
+  r.delayS = ((float)M_PI / 2 - asinf(config_.hysteresis / a) - atanf(guard)) / w;
+  if (r.delayS <= 0) {
+    state_ = AUTOTUNE_FAILED;
+    return;
+  }
+
+  // SIMC for an integrating plant with delay: Kp = 1 / (K (tc + theta)),
+  // Ti = 4 (tc + theta). The closed rate loop is close to a delay of
+  // tc + theta, so the angle loop around it is integrating too; with its
+  // time constant as long again, angleKp = 1 / (2 (tc + theta)).
+  float span = (config_.closedLoopRatio + 1) * r.delayS;
+  r.rate = base_;
+  r.rate.kp = 1 / (r.plantGain * span);
+  r.rate.ki = r.rate.kp / (4 * span);
+  r.angleKp = 1 / (2 * span);
+  r.maxRate = baseMaxRate_;
+  if (r.rate.kp * r.maxRate > config_.headroom) r.maxRate = config_.headroom / r.rate.kp;
+  state_ = AUTOTUNE_DONE;
+}
+
+AttitudeGains RelayAutotune::proposed(const AttitudeGains &gains) const {
+  AttitudeGains g = gains;
+  if (state_ != AUTOTUNE_DONE) return g;
+  g.rate[axis_] = result_.rate;
+  g.angleKp[axis_] = result_.angleKp;
+  g.maxRate[axis_] = result_.maxRate;
+  return g;
+}
+
+void stabilizeTick(AttitudeController &controller, const ImuSample &sample, const float ypr[3],
+                   const float setpoint[3], float throttle, float dt, float gain, uint16_t command[4],
+                   RelayAutotune *autotune) {
+  float rates[3], axis[3];
+  gyroRates(sample.gyro, rates);
+  controller.update(setpoint, ypr, rates, dt, axis);
+  if (autotune && autotune->running()) {
+    int k = autotune->axis();
+    float error = setpoint[k] - ypr[k];
+    if (k == 0) error = remainderf(error, 2 * (float)M_PI);
+    axis[k] = autotune->update(error, rates[k], dt);
+  }
+  mixQuadX(throttle, axis, command, gain);
+}
+
+float sagCompensationGain(const SagCompensation &c, float volts) {
+  if (volts <= 0 || c.referenceVolts <= 0) return 1;
+  if (volts < c.minVolts) volts = c.minVolts;
+  float gain = c.referenceVolts / volts;
+  return gain > c.maxGain ? c.maxGain : gain;
+}
+
+float failsafeGain(const FailsafeConfig &c, uint32_t sinceUs) {
+  if (sinceUs < c.timeoutUs) return 1;
+  uint32_t into = sinceUs - c.timeoutUs;
+  if (into >= c.rampUs) return 0;
+  return 1 - (float)into / c.rampUs;
+}
+
+static const char *const armStateNames[] = {"disarmed", "arming", "armed", "failsafe"};
+static const char *const preArmCheckNames[PREARM_CHECK_COUNT] = {"imu", "calibration", "loopRate", "level",
+                                                                 "throttle"};
+
+const char *armStateName(ArmState state) {
+  return state <= ARM_FAILSAFE ? armStateNames[state] : "unknown";
+}
+
+const char *preArmCheckName(PreArmCheck check) {
+  return check < PREARM_CHECK_COUNT ? preArmCheckNames[check] : "unknown";
+}
+
+uint32_t sampleAgeUs(uint32_t nowUs, uint32_t sampleUs) {
+  int32_t age = (int32_t)(nowUs - sampleUs);
+  return age > 0 ? (uint32_t)age : 0;
+}
+
+bool preArmPasses(PreArmCheck check, const PreArmInputs &in, const PreArmLimits &limits) {
+  switch (check) {
+    case PREARM_IMU: {
+      float periodUs = in.nominalHz > 0 ? 1e6f / in.nominalHz : 0;
+      return in.sampleAgeUs < limits.maxSampleAgeUs || in.sampleAgeUs < 3 * periodUs;
+    }
+    case PREARM_CALIBRATION: return in.calibrated;
+    case PREARM_LOOP_RATE:
+      return in.nominalHz > 0 && fabsf(in.rateHz - in.nominalHz) <= limits.maxRateError * in.nominalHz;
+    case PREARM_LEVEL: return fabsf(in.pitch) <= limits.maxTilt && fabsf(in.roll) <= limits.maxTilt;
+    case PREARM_THROTTLE: return in.throttle <= limits.maxThrottle;
+    default: return false;
+  }
+}
+
+bool ArmingStateMachine::requestArm(uint8_t failing, uint32_t nowMs) {
+  if (state_ != ARM_DISARMED || failing) return false;
+  state_ = ARM_ARMING;
+  armingMs_ = nowMs;
+  return true;
+}
+
+void ArmingStateMachine::failsafe() {
+  if (state_ == ARM_ARMING || state_ == ARM_ARMED) state_ = ARM_FAILSAFE;
+}
+
+ArmState ArmingStateMachine::update(uint8_t failing, uint32_t nowMs) {
+  if (state_ == ARM_ARMING) {
+    if (failing) state_ = ARM_DISARMED;
+    else if (nowMs - armingMs_ >= holdMs_) state_ = ARM_ARMED;
+  } else if (state_ == ARM_ARMED && (failing & (1 << PREARM_IMU))) {
+    state_ = ARM_FAILSAFE;
+  }
+  return state_;
+}
+
+void scaleMotors(const uint16_t in[4], float gain, uint16_t out[4]) {
+  for (int i = 0; i < 4; i++) {
+    float v = in[i] * gain * ((float)MOTOR_OUTPUT_MAX / MOTOR_MAX);
+    out[i] = v > MOTOR_OUTPUT_MAX ? MOTOR_OUTPUT_MAX : (uint16_t)lrintf(v);
+  }
+}
+
+void fillTelemetrySample(TelemetrySample &s, uint32_t timeUs, const float ypr[3], const uint16_t motor[4], uint16_t loopUs) {
+  s.timeUs = timeUs;
+  for (int i = 0; i < 3; i++) {
+    s.ypr[i] = (int16_t)lrintf(ypr[i] * 18000.0f / (float)M_PI);
+  }
+  for (int i = 0; i < 4; i++) {
+    s.motor[i] = motor[i];
+  }
+  s.loopUs = loopUs;
+  s.droppedFrames = 0;
+}
+
+static int16_t saturate16(float v) {
+  return v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)lrintf(v);
+}
+
+void fillBlackboxRecord(BlackboxRecord &r, uint32_t timeUs, const ImuSample &imu, const uint16_t motor[4],
+                        const AttitudeController *controller) {
+  memset(&r, 0, sizeof(r));
+  r.timeUs = timeUs;
+  memcpy(r.gyro, imu.gyro, sizeof(r.gyro));
+  memcpy(r.accel, imu.accel, sizeof(r.accel));
+  memcpy(r.quat, imu.quat, sizeof(r.quat));
+  memcpy(r.motor, motor, sizeof(r.motor));
+  if (!controller) return;
+  for (int k = 0; k < 3; k++) {
+    r.setpoint[k] = saturate16(controller->setpoint()[k] * (float)(18000 / M_PI));
+    const PidController &pid = controller->ratePid(k);
+    r.pid[k][0] = saturate16(pid.p() * 10);
+    r.pid[k][1] = saturate16(pid.i() * 10);
+    r.pid[k][2] = saturate16(pid.d() * 10);
+  }
+}
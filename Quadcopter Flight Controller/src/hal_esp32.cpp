@@ -0,0 +1,469 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <driver/adc.h>
+#include <driver/ledc.h>
+#include <driver/rmt.h>
+#include <driver/timer.h>
+#include <esp_rom_gpio.h>
+#include <soc/gpio_sig_map.h>
+#include <esp_adc_cal.h>
+#include <esp_timer.h>
+#include "I2Cdev.h"
+#include "MPU6050.h"
+#include "hal_esp32.h"
+
+uint64_t EspTimerClock::nowUs() {
+  return esp_timer_get_time();
+}
+
+void EspTimerClock::delay(uint32_t ms) {
+  ::delay(ms);
+}
+
+void LedcMotors::begin() {
+  // Straight to the IDF driver: the Arduino ledc calls put channel pairs on
+  // separate timers
+  ledc_timer_config_t timer = {};
+  timer.speed_mode = LEDC_HIGH_SPEED_MODE;
+  timer.duty_resolution = (ledc_timer_bit_t)bits_;
+  timer.timer_num = LEDC_TIMER_0;
+  timer.freq_hz = freqHz_;
+  timer.clk_cfg = LEDC_AUTO_CLK;
+  if (ledc_timer_config(&timer) != ESP_OK) {
+    Serial.println("Motors: LEDC frequency and resolution do not fit");
+    return;
+  }
+  for (int i = 0; i < 4; i++) {
+    ledc_channel_config_t ch = {};
+    ch.gpio_num = pins_[i];
+    ch.speed_mode = LEDC_HIGH_SPEED_MODE;
+    ch.channel = (ledc_channel_t)channels_[i];
+    ch.timer_sel = LEDC_TIMER_0;
+    ch.duty = 0;
+    ledc_channel_config(&ch);
+  }
+  started_ = true;
+}
+
+void LedcMotors::write(const uint16_t output[4]) {
+  if (!started_) return;
+  uint32_t duty[4];
+  uint32_t full = (1u << bits_) - 1;
+  for (int i = 0; i < 4; i++) {
+    uint16_t o = output[i] > MOTOR_OUTPUT_MAX ? MOTOR_OUTPUT_MAX : output[i];
+    duty[i] = (o * full + MOTOR_OUTPUT_MAX / 2) / MOTOR_OUTPUT_MAX;
+  }
+  if (!memcmp(duty, duty_, sizeof(duty))) return;
+  memcpy(duty_, duty, sizeof(duty));
+  for (int i = 0; i < 4; i++) {
+    ledc_set_duty(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)channels_[i], duty[i]);
+  }
+  for (int i = 0; i < 4; i++) {
+    ledc_update_duty(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)channels_[i]);
+  }
+}
+
+void LedcMotors::stop() {
+  if (!started_) return;
+  // Unconditionally, since an interrupted write() may have left duty_ ahead
+  // of the hardware
+  for (int i = 0; i < 4; i++) {
+    duty_[i] = 0;
+    ledc_set_duty(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)channels_[i], 0);
+  }
+  for (int i = 0; i < 4; i++) {
+    ledc_update_duty(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)channels_[i]);
+  }
+}
+
+#define RMT_RX_CHANNEL(motor)   ((rmt_channel_t)(4 + (motor)))
+#define RMT_RX_IDLE_TICKS       8000    // 100 us: past the ~30 us gap before the reply
+#define RMT_RX_FILTER_TICKS     40      // glitches under 0.5 us
+#define RMT_RX_RING_BYTES       1024
+#define RMT_SETUP_TIMEOUT_MS    1000
+
+void RmtMotors::begin() {
+  // Everything RMT is set up from a task on core 0 so the driver's interrupt
+  // lands there, away from the control loop
+  xTaskCreatePinnedToCore(rmtTask, "rmt", 3072, this, 2, NULL, 0);
+  uint32_t start = clock_.millis();
+  while (state_.load() == 0 && clock_.millis() - start < RMT_SETUP_TIMEOUT_MS) clock_.delay(1);
+  // Gives up for good: a late result from the task is then ignored
+  int starting = 0;
+  state_.compare_exchange_strong(starting, -1);
+  if (state_.load() < 0) {
+    Serial.println("Motors: RMT setup failed");
+    return;
+  }
+  Serial.print("Motors: ");
+  Serial.println(motorProtocolName(protocol_));
+}
+
+void RmtMotors::rmtTask(void *arg) {
+  RmtMotors *self = static_cast<RmtMotors *>(arg);
+  bool ok = self->setup();
+  int starting = 0;
+  if (!self->state_.compare_exchange_strong(starting, ok ? 1 : -1)) ok = false;
+  if (ok && motorProtocolBidirectional(self->protocol_)) self->decodeReplies();
+  vTaskDelete(NULL);
+}
+
+bool RmtMotors::setup() {
+  bool bidirectional = motorProtocolBidirectional(protocol_);
+  for (int i = 0; i < 4; i++) {
+    gpio_num_t pin = (gpio_num_t)pins_[i];
+    rmt_config_t tx = RMT_DEFAULT_CONFIG_TX(pin, (rmt_channel_t)i);
+    tx.clk_div = 80000000 / MOTOR_RMT_TICK_HZ;
+    tx.tx_config.idle_output_en = true;
+    tx.tx_config.idle_level = bidirectional ? RMT_IDLE_LEVEL_HIGH : RMT_IDLE_LEVEL_LOW;
+    if (rmt_config(&tx) != ESP_OK || rmt_driver_install((rmt_channel_t)i, 0, 0) != ESP_OK) return false;
+    if (!bidirectional) continue;
+
+    rmt_config_t rx = RMT_DEFAULT_CONFIG_RX(pin, RMT_RX_CHANNEL(i));
+    rx.clk_div = 80000000 / MOTOR_RMT_TICK_HZ;
+    rx.rx_config.idle_threshold = RMT_RX_IDLE_TICKS;
+    rx.rx_config.filter_en = true;
+    rx.rx_config.filter_ticks_thresh = RMT_RX_FILTER_TICKS;
+    if (rmt_config(&rx) != ESP_OK || rmt_driver_install(RMT_RX_CHANNEL(i), RMT_RX_RING_BYTES, 0) != ESP_OK) {
+      return false;
+    }
+    // rmt_config() left the pin input only: make it open drain and route
+    // both the transmitter and the receiver through it
+    gpio_set_direction(pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_pull_mode(pin, GPIO_PULLUP_ONLY);
+    esp_rom_gpio_connect_out_signal(pin, RMT_SIG_OUT0_IDX + i, false, false);
+    esp_rom_gpio_connect_in_signal(pin, RMT_SIG_IN0_IDX + 4 + i, false);
+    rmt_rx_start(RMT_RX_CHANNEL(i), true);
+  }
+  return true;
+}
+
+// Each capture holds one frame, the gap and the reply; the receiver stops
+// at the idle line after the reply and starts again on the next frame
+void RmtMotors::decodeReplies() {
+  RingbufHandle_t rings[4];
+  for (int i = 0; i < 4; i++) rmt_get_ringbuf_handle(RMT_RX_CHANNEL(i), &rings[i]);
+  for (;;) {
+    for (int i = 0; i < 4; i++) {
+      size_t bytes = 0;
+      uint32_t *items = (uint32_t *)xRingbufferReceive(rings[i], &bytes, pdMS_TO_TICKS(i == 0 ? 20 : 2));
+      if (!items) continue;
+      uint32_t erpm;
+      if (dshotDecodeReply(protocol_, items, bytes / sizeof(uint32_t), erpm) == DSHOT_REPLY_OK) {
+        erpm_[i].store(erpm, std::memory_order_relaxed);
+        replies_.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        replyErrors_.fetch_add(1, std::memory_order_relaxed);
+      }
+      vRingbufferReturnItem(rings[i], items);
+    }
+  }
+}
+
+void RmtMotors::write(const uint16_t output[4]) {
+  if (state_.load(std::memory_order_relaxed) != 1) return;
+  if (stopped_.exchange(false)) {
+    for (int i = 0; i < 4; i++) esp_rom_gpio_connect_out_signal(pins_[i], RMT_SIG_OUT0_IDX + i, false, false);
+  }
+  uint32_t items[MOTOR_MAX_ITEMS];
+  for (int i = 0; i < 4; i++) {
+    size_t n = motorEncodeRmt(protocol_, output[i], items);
+    rmt_fill_tx_items((rmt_channel_t)i, (const rmt_item32_t *)items, n, 0);
+  }
+  for (int i = 0; i < 4; i++) {
+    rmt_tx_start((rmt_channel_t)i, true);
+  }
+}
+
+// Only register writes and the RMT spinlock, so safe from the failsafe
+// interrupt. The pins are handed to the GPIO matrix at the idle level, which
+// silences them at once, mid frame too, and keeps them silent if the
+// interrupted write() goes on to start the channels again. The next write()
+// gives them back to RMT.
+void RmtMotors::stop() {
+  if (state_.load(std::memory_order_relaxed) != 1) return;
+  uint32_t idle = motorProtocolBidirectional(protocol_) ? 1 : 0;
+  for (int i = 0; i < 4; i++) {
+    gpio_set_level((gpio_num_t)pins_[i], idle);
+    esp_rom_gpio_connect_out_signal(pins_[i], SIG_GPIO_OUT_IDX, false, false);
+  }
+  for (int i = 0; i < 4; i++) rmt_tx_stop((rmt_channel_t)i);
+  stopped_.store(true);
+}
+
+bool RmtMotors::readErpm(uint32_t erpm[4]) {
+  if (!motorProtocolBidirectional(protocol_) || state_.load(std::memory_order_relaxed) != 1) return false;
+  for (int i = 0; i < 4; i++) erpm[i] = erpm_[i].load(std::memory_order_relaxed);
+  return true;
+}
+
+bool Mpu6050Imu::begin() {
+  Wire.begin(sda_, scl_);
+  if (!dmp_) dmp_ = createDmpDevice(profile_);
+  MPU6050_Base &mpu = dmp_->mpu();
+  mpu.initialize();
+  mpu.setDLPFMode(3);
+
+  if (mpu.testConnection()) {
+    Serial.println("MPU6050 connected");
+  } else {
+    Serial.println("MPU6050 connection failed");
+  }
+
+  int devStatus = dmp_->initialize();
+  if (devStatus == 0) {
+    if (haveOffsets_) {
+      mpu.setXAccelOffset(offsets_[0]);
+      mpu.setYAccelOffset(offsets_[1]);
+      mpu.setZAccelOffset(offsets_[2]);
+      mpu.setXGyroOffset(offsets_[3]);
+      mpu.setYGyroOffset(offsets_[4]);
+      mpu.setZGyroOffset(offsets_[5]);
+    }
+    dmp_->selectFields(fields_);
+    mpu.setDMPEnabled(true);
+    dmpReady_ = true;
+    Serial.print("DMP Ready! ");
+    Serial.print(dmpProfileName(profile_));
+    Serial.print(", ");
+    Serial.print(dmp_->layout().size);
+    Serial.println(" byte packets");
+  } else {
+    Serial.print("DMP Init failed (code ");
+    Serial.print(devStatus);
+    Serial.println(")");
+  }
+  return dmpReady_;
+}
+
+void Mpu6050Imu::setOffsets(const int16_t offsets[6]) {
+  memcpy(offsets_, offsets, sizeof(offsets_));
+  haveOffsets_ = true;
+}
+
+bool Mpu6050Imu::calibrateOffsets(int16_t offsets[6]) {
+  if (!dmpReady_) return false;
+  MPU6050_Base &mpu = dmp_->mpu();
+  uint32_t start = clock_.millis();
+  // Reads the raw sensor registers, then resets the FIFO and the DMP
+  mpu.setDMPEnabled(false);
+  mpu.CalibrateMotion6();
+  mpu.setDMPEnabled(true);
+  setOffsets(mpu.GetActiveOffsets());
+  memcpy(offsets, offsets_, sizeof(offsets_));
+  Serial.print("Offsets calibrated in ");
+  Serial.print(clock_.millis() - start);
+  Serial.println(" ms");
+  return true;
+}
+
+bool Mpu6050Imu::read(ImuSample &s) {
+  if (!dmpReady_) return false;
+  if (!dmp_->readLatest(fifoBuffer_)) return false;
+
+  dmp_->decode(fifoBuffer_, s);
+  return true;
+}
+
+// ESP32 ADC DMA runs at 20 kHz at the slowest. A frame is 128 conversions,
+// alternating between the channels, so about 6 ms.
+#define BATTERY_SAMPLE_HZ    20000
+#define BATTERY_FRAME_BYTES  256
+#define BATTERY_FILTER       0.05f   // per frame; about 0.13 s time constant
+
+static int adc1Channel(int pin) {
+  switch (pin) {
+    case 36: return ADC1_CHANNEL_0;
+    case 37: return ADC1_CHANNEL_1;
+    case 38: return ADC1_CHANNEL_2;
+    case 39: return ADC1_CHANNEL_3;
+    case 32: return ADC1_CHANNEL_4;
+    case 33: return ADC1_CHANNEL_5;
+    case 34: return ADC1_CHANNEL_6;
+    case 35: return ADC1_CHANNEL_7;
+    default: return -1;
+  }
+}
+
+bool AdcDmaBattery::begin() {
+  int vch = adc1Channel(voltsPin_);
+  int ach = ampsPin_ >= 0 ? adc1Channel(ampsPin_) : -1;
+  if (vch < 0 || (ampsPin_ >= 0 && ach < 0)) {
+    Serial.println("Battery: pins must be ADC1 (GPIO 32-39)");
+    return false;
+  }
+
+  adc_digi_init_config_t init = {};
+  init.max_store_buf_size = 4 * BATTERY_FRAME_BYTES;
+  init.conv_num_each_intr = BATTERY_FRAME_BYTES;
+  init.adc1_chan_mask = BIT(vch) | (ach >= 0 ? BIT(ach) : 0);
+  if (adc_digi_initialize(&init) != ESP_OK) return false;
+
+  adc_digi_pattern_config_t pattern[2] = {};
+  uint32_t patterns = 0;
+  for (int ch : {vch, ach}) {
+    if (ch < 0) continue;
+    pattern[patterns].atten = ADC_ATTEN_DB_11;
+    pattern[patterns].channel = ch;
+    pattern[patterns].unit = 0;
+    pattern[patterns].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    patterns++;
+  }
+  adc_digi_configuration_t config = {};
+  config.conv_limit_en = true;    // required on the ESP32
+  config.conv_limit_num = 250;
+  config.pattern_num = patterns;
+  config.adc_pattern = pattern;
+  config.sample_freq_hz = BATTERY_SAMPLE_HZ;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if (adc_digi_controller_configure(&config) != ESP_OK || adc_digi_start() != ESP_OK) {
+    adc_digi_deinitialize();
+    Serial.println("Battery: ADC DMA setup failed");
+    return false;
+  }
+
+  // Core 0 with Wi-Fi, like the blackbox flush task
+  xTaskCreatePinnedToCore(sampleTask, "battery", 3072, this, 1, NULL, 0);
+  return true;
+}
+
+bool AdcDmaBattery::read(BatterySample &s) {
+  s.volts = volts_.load(std::memory_order_relaxed);
+  s.amps = amps_.load(std::memory_order_relaxed);
+  return s.volts > 0;
+}
+
+void AdcDmaBattery::sampleTask(void *arg) {
+  static_cast<AdcDmaBattery *>(arg)->run();
+}
+
+void AdcDmaBattery::run() {
+  esp_adc_cal_characteristics_t chars;
+  esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &chars);
+  int vch = adc1Channel(voltsPin_);
+  int ach = ampsPin_ >= 0 ? adc1Channel(ampsPin_) : -1;
+  uint8_t frame[BATTERY_FRAME_BYTES];
+  bool first = true;
+  float volts = 0, amps = 0;
+
+  for (;;) {
+    uint32_t length = 0;
+    // Blocks until a frame is in; ESP_ERR_INVALID_STATE means the task fell
+    // behind and the driver dropped data, which only costs some averaging
+    esp_err_t err = adc_digi_read_bytes(frame, sizeof(frame), &length, 100);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) continue;
+
+    uint32_t sum[2] = {0, 0}, count[2] = {0, 0};
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+      const adc_digi_output_data_t *d = (const adc_digi_output_data_t *)&frame[i];
+      int k = d->type1.channel == vch ? 0 : (d->type1.channel == ach ? 1 : -1);
+      if (k < 0) continue;
+      sum[k] += d->type1.data;
+      count[k]++;
+    }
+    if (count[0] == 0) continue;
+
+    float frameVolts = esp_adc_cal_raw_to_voltage(sum[0] / count[0], &chars) / 1000.0f * dividerRatio_;
+    float frameAmps = 0;
+    if (count[1]) {
+      float adcVolts = esp_adc_cal_raw_to_voltage(sum[1] / count[1], &chars) / 1000.0f;
+      frameAmps = (adcVolts - ampsZeroVolts_) * ampsPerVolt_;
+    }
+    if (first) {
+      volts = frameVolts;
+      amps = frameAmps;
+      first = false;
+    } else {
+      volts += (frameVolts - volts) * BATTERY_FILTER;
+      amps += (frameAmps - amps) * BATTERY_FILTER;
+    }
+    volts_.store(volts, std::memory_order_relaxed);
+    amps_.store(amps, std::memory_order_relaxed);
+  }
+}
+
+#define FAILSAFE_TIMER_GROUP  TIMER_GROUP_0
+#define FAILSAFE_TIMER        TIMER_0
+
+bool CommandWatchdog::begin(const FailsafeConfig &config) {
+  configure(config);
+  // 1 MHz count off the 80 MHz APB clock
+  timer_config_t timer = {};
+  timer.alarm_en = TIMER_ALARM_EN;
+  timer.counter_en = TIMER_PAUSE;
+  timer.intr_type = TIMER_INTR_LEVEL;
+  timer.counter_dir = TIMER_COUNT_UP;
+  timer.auto_reload = TIMER_AUTORELOAD_EN;
+  timer.divider = 80;
+  // Not an IRAM interrupt: it is held off while the flash cache is disabled
+  // (SPIFFS writes), which shows up in reactionUs
+  if (timer_init(FAILSAFE_TIMER_GROUP, FAILSAFE_TIMER, &timer) != ESP_OK ||
+      timer_set_counter_value(FAILSAFE_TIMER_GROUP, FAILSAFE_TIMER, 0) != ESP_OK ||
+      timer_set_alarm_value(FAILSAFE_TIMER_GROUP, FAILSAFE_TIMER, FAILSAFE_TICK_US) != ESP_OK ||
+      timer_enable_intr(FAILSAFE_TIMER_GROUP, FAILSAFE_TIMER) != ESP_OK ||
+      timer_isr_callback_add(FAILSAFE_TIMER_GROUP, FAILSAFE_TIMER, onTimer, this, 0) != ESP_OK ||
+      timer_start(FAILSAFE_TIMER_GROUP, FAILSAFE_TIMER) != ESP_OK) {
+    Serial.println("Failsafe: timer setup failed");
+    return false;
+  }
+  return true;
+}
+
+void CommandWatchdog::configure(const FailsafeConfig &config) {
+  timeoutUs_.store(config.timeoutUs);
+  rampUs_.store(config.rampUs);
+}
+
+FailsafeConfig CommandWatchdog::config() const {
+  return FailsafeConfig{timeoutUs_.load(), rampUs_.load()};
+}
+
+void CommandWatchdog::feed(bool active) {
+  lastUs_.store(clock_.micros());
+  active_.store(active);
+}
+
+void CommandWatchdog::clear() {
+  tripped_.store(false);
+}
+
+uint32_t CommandWatchdog::sinceUs() const {
+  return clock_.micros() - lastUs_.load(std::memory_order_relaxed);
+}
+
+FailsafeState CommandWatchdog::state() const {
+  if (tripped()) return FAILSAFE_CUT;
+  if (!active_.load(std::memory_order_relaxed)) return FAILSAFE_IDLE;
+  return sinceUs() < timeoutUs_.load(std::memory_order_relaxed) ? FAILSAFE_OK : FAILSAFE_RAMP;
+}
+
+float CommandWatchdog::gain() const {
+  if (tripped()) return 0;
+  if (!active_.load(std::memory_order_relaxed)) return 1;
+  return failsafeGain(config(), sinceUs());
+}
+
+bool CommandWatchdog::onTimer(void *arg) {
+  static_cast<CommandWatchdog *>(arg)->check();
+  return false;
+}
+
+void CommandWatchdog::check() {
+  if (!tripped_.load(std::memory_order_relaxed)) {
+    if (!active_.load(std::memory_order_relaxed)) return;
+    uint32_t since = clock_.micros() - lastUs_.load(std::memory_order_relaxed);
+    uint32_t cutoff = timeoutUs_.load(std::memory_order_relaxed) + rampUs_.load(std::memory_order_relaxed);
+    if (since < cutoff) return;
+    reactionUs_.store(since - cutoff, std::memory_order_relaxed);
+    trips_.fetch_add(1, std::memory_order_relaxed);
+    tripped_.store(true);
+  }
+  // Every tick while tripped, in case the control loop's last write() was
+  // still under way
+  motors_.stop();
+}
+
+#endif
@@ -2,94 +2,533 @@
 #include <Wire.h>
 #include <WebServer.h>
 #include <SPIFFS.h>
+#include <Preferences.h>
 #include "I2Cdev.h"
-#include "MPU6050_6Axis_MotionApps20.h"
+#include "dmp_device.h"
+#include "blackbox.h"
+#include "dmp_capture.h"
+#include "arming.h"
+#include "telemetry.h"
+#include "static_files.h"
+#include "flight_core.h"
+#include "hal_esp32.h"
 
 
 const char* ssid = "Darren’s iPhone";
 const char* password = "password";
 
-MPU6050 mpu;
-bool dmpReady = false;
-uint16_t packetSize;
-uint8_t fifoBuffer[64];
-
-float ypr[3];
-
 WebServer server(80);
 
-float yawOffset = 0;
-float pitchOffset = 0;
-float rollOffset = 0;
+uint32_t lastLoopUs = 0;
+uint16_t loopTimeUs = 0;
 
-int motorPWM[4] = {0, 0, 0, 0};
+uint16_t motorPWM[4] = {0, 0, 0, 0};
+
+// Motor command channel: the UI numbers commands per page session, and only
+// a command newer than the last applied one is accepted
+uint32_t cmdSession = 0;
+uint32_t cmdSeq = 0;
+uint32_t cmdStale = 0;
+uint32_t cmdReceivedUs = 0;
+uint32_t cmdLatencyUs = 0;
+bool cmdPending = false;
 const int motorPins[4] = {23, 17, 12, 25};
 const int pwmChannels[4] = {0, 1, 2, 3};
 
+// Hardware behind the hal.h interfaces; the flight logic is in flight_core.cpp
+EspTimerClock hwClock;
+// Motor signal, chosen at build time, e.g. -DMOTOR_PROTOCOL=MOTOR_DSHOT600
+// for ESCs. The default drives brushed motors with 13-bit PWM at 5 kHz.
+#ifndef MOTOR_PROTOCOL
+#define MOTOR_PROTOCOL MOTOR_PWM
+#endif
+LedcMotors pwmMotors(motorPins, pwmChannels);
+RmtMotors escMotors(motorPins, MOTOR_PROTOCOL, hwClock);
+MotorOutput &motors = MOTOR_PROTOCOL == MOTOR_PWM ? (MotorOutput &)pwmMotors : escMotors;
+// Without IMU samples the outputs are still refreshed this often, so
+// commands apply and ESCs keep receiving frames
+#define MOTOR_IDLE_WRITE_US 10000
+uint32_t lastMotorWriteUs = 0;
+// With bidirectional DShot the ESCs report eRPM, and gyro notches follow
+// each motor. Poles of the motors fitted, for eRPM to RPM.
+#ifndef MOTOR_POLES
+#define MOTOR_POLES 14
+#endif
+RpmNotchFilter rpmNotch;
+float motorRpm[4] = {0, 0, 0, 0};
+// Link-loss failsafe: the UI repeats its command every 200 ms while a motor
+// runs. Past the timeout the output ramps down, and at the cutoff a timer
+// interrupt stops the motors. Changed at runtime with /failsafe.
+#ifndef FAILSAFE_TIMEOUT_MS
+#define FAILSAFE_TIMEOUT_MS 500
+#endif
+#ifndef FAILSAFE_RAMP_MS
+#define FAILSAFE_RAMP_MS 500
+#endif
+CommandWatchdog watchdog(motors, hwClock);
+// Pre-arm limits: a sample within 100 ms, the rate within 10% of nominal,
+// within 25 degrees of level and every motor command at zero
+const PreArmLimits preArmLimits = {100000, 0.1f, 25 * (float)M_PI / 180, MOTOR_MIN};
+Mpu6050Imu imu(21, 22, hwClock);
+// Pack voltage on GPIO 34 through a 2:1 divider; no current sensor fitted
+// (pass its pin, amps per volt and zero-current volts to add one)
+AdcDmaBattery battery(34, 2.0f);
+
+// Motor outputs are tuned on a 1S pack at 3.8 V
+const SagCompensation sagCompensation = {3.8f, 3.3f, 1.25f};
+BatterySample batterySample = {0, 0};
+float motorGain = 1;
+
+// DMP profile, packet fields and output rate, kept in NVS and applied at boot
+Preferences dmpPrefs;
+// Measured DMP packet rate; its dt() is the controller's time step
+SampleRate sampleRate;
+
+AttitudeEstimator estimator;
+ImuSample imuSample;
+
+// Angle mode, switched with /stabilize while disarmed: the mean of the four
+// sliders is the throttle and the attitude controller holds level and the
+// heading it armed at. Gains are tuned in the simulator (tools/sitl).
+bool stabilize = false;
+AttitudeController attitude;
+float yawHold = 0;
+uint16_t stabilizedCmd[4] = {0, 0, 0, 0};
+ArmState lastArmState = ARM_DISARMED;
+// Relay autotune of one axis at a time in angle mode hover (/autotune);
+// the gains it proposes are applied and kept in NVS only when confirmed
+RelayAutotune autotune;
+Preferences gainPrefs;
+
+// Magnetometer hard/soft iron calibration, kept in NVS
+Preferences magPrefs;
+MagCalibrator magCalibrator;
+bool magCalibrating = false;
+
+// Sensor offset registers, calibrated only on request and kept in NVS
+Preferences imuPrefs;
+
+void loadSensorOffsets() {
+  int16_t offsets[6];
+  imuPrefs.begin("imu", true);
+  bool found = imuPrefs.getBytes("offsets", offsets, sizeof(offsets)) == sizeof(offsets);
+  imuPrefs.end();
+  if (found) imu.setOffsets(offsets);
+}
+
+void calibrateSensorOffsets() {
+  int16_t offsets[6];
+  if (!imu.calibrateOffsets(offsets)) return;
+  imuPrefs.begin("imu", false);
+  imuPrefs.putBytes("offsets", offsets, sizeof(offsets));
+  imuPrefs.end();
+}
+
 void calibrateOffsets() {
-  float yawSum = 0, pitchSum = 0, rollSum = 0;
+  armingSetCalibrated(false);
+  bool ok = calibrateLevel(imu, hwClock, estimator);
+  armingSetCalibrated(ok);
+  blackboxSetLevel(estimator.levelOffset());
+  if (ok) {
+    Serial.println("Calibration done");
+  } else {
+    Serial.println("Calibration failed: no IMU data");
+  }
+}
 
-  for (int i = 0; i < 20; i++) {
-    if (dmpReady){
-      if (mpu.dmpGetCurrentFIFOPacket(fifoBuffer)) {
-        Quaternion q;
-        VectorFloat gravity;
-  
-        mpu.dmpGetQuaternion(&q, fifoBuffer);
-        mpu.dmpGetGravity(&gravity, &q);
-        mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
-        
-        yawSum += ypr[0];
-        pitchSum += ypr[1];
-        rollSum += ypr[2];
-
-      }
-    }else{
-      i--;
+void loadAttitudeGains() {
+  AttitudeGains gains;
+  gainPrefs.begin("gains", true);
+  bool found = gainPrefs.getBytes("attitude", &gains, sizeof(gains)) == sizeof(gains);
+  gainPrefs.end();
+  if (found) attitude.setGains(gains);
+}
+
+void loadDmpSettings() {
+  dmpPrefs.begin("dmp", true);
+  DmpProfile profile = (DmpProfile)dmpPrefs.getUChar("profile", DMP_MOTIONAPPS20);
+  uint8_t fields = dmpPrefs.getUChar("fields", DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL);
+  dmpPrefs.end();
+  if (profile >= DMP_PROFILE_COUNT) profile = DMP_MOTIONAPPS20;
+  imu.configure(profile, fields);
+}
+
+// Applies a stored output rate once the DMP is up; without one the image's
+// own rate stays
+void applyDmpRate() {
+  DmpDevice *dmp = imu.dmp();
+  if (!dmp) return;
+  dmpPrefs.begin("dmp", true);
+  if (dmpPrefs.isKey("fifoDiv")) {
+    dmp->setRate(dmpPrefs.getUChar("sampleDiv", 4), dmpPrefs.getUShort("fifoDiv", 1));
+  }
+  dmpPrefs.end();
+  sampleRate.setNominal(dmp->rateHz());
+}
+
+bool imuHasMag() {
+  DmpDevice *dmp = imu.dmp();
+  return dmp && (dmp->layout().fields & DMP_FIELD_MAG);
+}
+
+void loadMagCalibration() {
+  MagCalibration cal;
+  magPrefs.begin("mag", true);
+  bool found = magPrefs.getBytes("cal", &cal, sizeof(cal)) == sizeof(cal);
+  magPrefs.end();
+  if (found) estimator.setMagCalibration(cal);
+}
+
+void sendMagStatus(const MagCalibration &cal) {
+  String json = "{\"aided\":" + String(estimator.magAided() ? "true" : "false") +
+                ",\"calibrating\":" + String(magCalibrating ? "true" : "false") +
+                ",\"samples\":" + String(magCalibrator.count()) + ",\"offset\":[" + String(cal.offset[0], 1) + "," +
+                String(cal.offset[1], 1) + "," + String(cal.offset[2], 1) + "],\"scale\":[" + String(cal.scale[0], 3) +
+                "," + String(cal.scale[1], 3) + "," + String(cal.scale[2], 3) + "],\"radius\":" + String(cal.radius, 1) + "}";
+  server.send(200, "application/json", json);
+}
+
+// For handlers that reset or reconfigure the sensor, reboot or stall the
+// loop: sends 409 and returns false unless disarmed
+bool requireDisarmed() {
+  if (armingState() == ARM_DISARMED) return true;
+  server.send(409, "text/plain", "Disarm first");
+  return false;
+}
+
+// GET /magcal reports the magnetometer calibration.
+// GET /magcal?start begins collecting samples: turn the frame slowly through
+// every orientation (each axis pointing up and down), away from steel.
+// GET /magcal?stop fits and stores the calibration, GET /magcal?clear drops it.
+// Starting and clearing only while disarmed.
+void handleMagCal() {
+  if (!imuHasMag()) {
+    server.send(503, "text/plain", "No magnetometer (needs DMP profile 41)");
+    return;
+  }
+  if ((server.hasArg("start") || server.hasArg("clear")) && !requireDisarmed()) return;
+  MagCalibration cal = {};
+  magPrefs.begin("mag", false);
+  magPrefs.getBytes("cal", &cal, sizeof(cal));
+  if (server.hasArg("start")) {
+    magCalibrator.begin();
+    magCalibrating = true;
+  } else if (server.hasArg("stop")) {
+    magCalibrating = false;
+    if (!magCalibrator.finish(cal)) {
+      magPrefs.end();
+      server.send(400, "text/plain", "Not enough rotation, start again");
+      return;
     }
+    magPrefs.putBytes("cal", &cal, sizeof(cal));
+    estimator.setMagCalibration(cal);
+  } else if (server.hasArg("clear")) {
+    magCalibrating = false;
+    magPrefs.remove("cal");
+    cal = MagCalibration{};
+    estimator.setMagCalibration(cal);
+  }
+  magPrefs.end();
+  sendMagStatus(cal);
+}
 
-    delay(50);
+void sendDmpStatus(DmpDevice *dmp) {
+  String json = "{\"profile\":\"" + String(dmpProfileName(dmp->profile())) + "\",\"fields\":" +
+                String(dmp->layout().fields) + ",\"packet\":" + String(dmp->layout().size) +
+                ",\"sampleDiv\":" + String(dmp->sampleDivisor()) + ",\"fifoDiv\":" + String(dmp->fifoDivisor()) +
+                ",\"rateHz\":" + String(sampleRate.nominalHz(), 1) + ",\"measuredHz\":" + String(sampleRate.hz(), 1) + "}";
+  server.send(200, "application/json", json);
+}
+
+// GET /dmp reports the DMP profile, packet layout and output rate.
+// GET /dmp?sampleDiv=4&fifoDiv=3 changes the rate on the fly (see
+// DmpDevice::setRate) and keeps it for the next boot.
+// GET /dmp?profile=612&fields=quat,gyro stores a new profile or packet and
+// reboots, as the DMP image is only loaded at boot. Omitted arguments keep
+// their value. Changes only while disarmed.
+void handleDmp() {
+  DmpDevice *dmp = imu.dmp();
+  if (!dmp) {
+    server.send(503, "text/plain", "No DMP");
+    return;
+  }
+  // Every change resets the DMP or reboots
+  bool changes = server.hasArg("sampleDiv") || server.hasArg("fifoDiv") || server.hasArg("profile") ||
+                 server.hasArg("fields");
+  if (changes && !requireDisarmed()) return;
+
+  if (server.hasArg("sampleDiv") || server.hasArg("fifoDiv")) {
+    long sampleDiv = server.hasArg("sampleDiv") ? server.arg("sampleDiv").toInt() : dmp->sampleDivisor();
+    long fifoDiv = server.hasArg("fifoDiv") ? server.arg("fifoDiv").toInt() : dmp->fifoDivisor();
+    if (sampleDiv < 0 || sampleDiv > 255 || fifoDiv < 0 || fifoDiv > 0xFFFF) {
+      server.send(400, "text/plain", "Divisor out of range");
+      return;
+    }
+    if (!dmp->setRate(sampleDiv, fifoDiv)) {
+      server.send(500, "text/plain", "DMP rate did not verify");
+      return;
+    }
+    sampleRate.setNominal(dmp->rateHz());
+    dmpPrefs.begin("dmp", false);
+    dmpPrefs.putUChar("sampleDiv", sampleDiv);
+    dmpPrefs.putUShort("fifoDiv", fifoDiv);
+    dmpPrefs.end();
   }
 
-  yawOffset = yawSum / 20.0;
-  pitchOffset = pitchSum / 20.0;
-  rollOffset = rollSum / 20.0;
-  Serial.println("Calibration done");
+  if (!server.hasArg("profile") && !server.hasArg("fields")) {
+    sendDmpStatus(dmp);
+    return;
+  }
+
+  dmpPrefs.begin("dmp", false);
+  if (server.hasArg("profile")) {
+    DmpProfile profile = dmpProfileFromName(server.arg("profile").c_str());
+    if (profile == DMP_PROFILE_COUNT) {
+      dmpPrefs.end();
+      server.send(400, "text/plain", "Unknown profile");
+      return;
+    }
+    dmpPrefs.putUChar("profile", profile);
+  }
+  if (server.hasArg("fields")) {
+    String f = server.arg("fields");
+    uint8_t fields = DMP_FIELD_QUAT;
+    if (f.indexOf("gyro") >= 0) fields |= DMP_FIELD_GYRO;
+    if (f.indexOf("accel") >= 0) fields |= DMP_FIELD_ACCEL;
+    dmpPrefs.putUChar("fields", fields);
+  }
+  dmpPrefs.end();
+  server.send(200, "text/plain", "Saved, rebooting");
+  hwClock.delay(100);
+  ESP.restart();
 }
 
 void handleData() {
+  const float *ypr = estimator.ypr();
   float yaw = ypr[0] * 180.0 / M_PI;
   float pitch = ypr[1] * 180.0 / M_PI;
   float roll = ypr[2] * 180.0 / M_PI;
 
-  String json = "{\"yaw\":" + String(yaw, 2)+ ",\"pitch\":" + String(pitch, 2) + ",\"roll\":" + String(roll, 2) + "}";
+  String json = "{\"yaw\":" + String(yaw, 2)+ ",\"pitch\":" + String(pitch, 2) + ",\"roll\":" + String(roll, 2) +
+                ",\"m\":[" + String(motorPWM[0]) + "," + String(motorPWM[1]) + "," + String(motorPWM[2]) + "," + String(motorPWM[3]) + "]" +
+                ",\"loopUs\":" + String(loopTimeUs) +
+                ",\"vbat\":" + String(batterySample.volts, 2) + ",\"ibat\":" + String(batterySample.amps, 2) +
+                ",\"motorGain\":" + String(motorGain, 3) +
+                ",\"arm\":\"" + String(armStateName(armingState())) + "\"" +
+                ",\"failsafe\":" + String(watchdog.state()) + ",\"linkAgeMs\":" + String(watchdog.sinceUs() / 1000) +
+                ",\"rpm\":[" + String(motorRpm[0], 0) + "," + String(motorRpm[1], 0) + "," + String(motorRpm[2], 0) + "," + String(motorRpm[3], 0) + "]" +
+                ",\"cmdLatencyUs\":" + String(cmdLatencyUs) + ",\"cmdStale\":" + String(cmdStale) + "}";
   server.send(200, "application/json", json);
 }
 
+void handleSetPWM() {
+  // Commands without seq (e.g. from curl) are always applied
+  if (server.hasArg("seq")) {
+    uint32_t session = strtoul(server.arg("sid").c_str(), NULL, 10);
+    uint32_t seq = strtoul(server.arg("seq").c_str(), NULL, 10);
+    if (session == cmdSession && (int32_t)(seq - cmdSeq) <= 0) {
+      cmdStale++;
+      server.send(200, "application/json", "{\"seq\":" + String(seq) + ",\"applied\":false}");
+      return;
+    }
+    cmdSession = session;
+    cmdSeq = seq;
+  }
+
+  uint16_t command[4];
+  bool running = false;
+  for (int i = 0; i < 4; i++) {
+    command[i] = motorPWM[i];
+    if (server.hasArg("m" + String(i + 1))) {
+      command[i] = constrain(server.arg("m" + String(i + 1)).toInt(), MOTOR_MIN, MOTOR_MAX);
+    }
+    running |= command[i] != 0;
+  }
+  // After a link loss the sliders may still be up: only an all-zero command
+  // brings the motors back
+  if (watchdog.tripped()) {
+    if (running) {
+      server.send(200, "application/json", "{\"seq\":" + String(cmdSeq) + ",\"applied\":false,\"failsafe\":true}");
+      return;
+    }
+    watchdog.clear();
+    armingRequest(false);
+  }
+  memcpy(motorPWM, command, sizeof(command));
+  armingPublishThrottle(motorPWM);
+  watchdog.feed(running);
+  cmdReceivedUs = hwClock.micros();
+  cmdPending = true;
+  server.send(200, "application/json", "{\"seq\":" + String(cmdSeq) + ",\"applied\":true,\"latencyUs\":" + String(cmdLatencyUs) + "}");
+}
 
-void setup() {
-  Serial.begin(115200);
-  Wire.begin(21, 22);
-  mpu.initialize();
-  mpu.setDLPFMode(3);
+void sendFailsafeStatus() {
+  FailsafeConfig c = watchdog.config();
+  String json = "{\"timeoutMs\":" + String(c.timeoutUs / 1000) + ",\"rampMs\":" + String(c.rampUs / 1000) +
+                ",\"state\":" + String(watchdog.state()) + ",\"linkAgeMs\":" + String(watchdog.sinceUs() / 1000) +
+                ",\"reactionUs\":" + String(watchdog.reactionUs()) + ",\"trips\":" + String(watchdog.trips()) + "}";
+  server.send(200, "application/json", json);
+}
 
-  if (mpu.testConnection()) {
-    Serial.println("MPU6050 connected");
-  } else {
-    Serial.println("MPU6050 connection failed");
+// GET /failsafe reports the failsafe settings and state.
+// GET /failsafe?timeout=500&ramp=500 sets the command timeout and the ramp
+// down after it, in ms, until the next boot.
+void handleFailsafe() {
+  if (server.hasArg("timeout") || server.hasArg("ramp")) {
+    FailsafeConfig c = watchdog.config();
+    if (server.hasArg("timeout")) c.timeoutUs = constrain(server.arg("timeout").toInt(), 50, 10000) * 1000;
+    if (server.hasArg("ramp")) c.rampUs = constrain(server.arg("ramp").toInt(), 0, 10000) * 1000;
+    watchdog.configure(c);
   }
-  
-  int devStatus = mpu.dmpInitialize();
-  if (devStatus == 0) {
-    mpu.setDMPEnabled(true);
-    dmpReady = true;
-    packetSize = mpu.dmpGetFIFOPacketSize();
-    Serial.println("DMP Ready!");
-  } else {
-    Serial.print("DMP Init failed (code ");
-    Serial.print(devStatus);
-    Serial.println(")");
+  sendFailsafeStatus();
+}
+
+void sendArmStatus() {
+  uint8_t failing = armingFailing();
+  String json = "{\"state\":\"" + String(armStateName(armingState())) + "\",\"failing\":[";
+  bool first = true;
+  for (int i = 0; i < PREARM_CHECK_COUNT; i++) {
+    if (!(failing & (1 << i))) continue;
+    if (!first) json += ",";
+    json += "\"" + String(preArmCheckName((PreArmCheck)i)) + "\"";
+    first = false;
   }
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+// GET /arm reports the arming state and the pre-arm checks failing.
+// GET /arm?arm=1 and /arm?disarm=1 hand a request to the arming task, which
+// refuses to arm while a check fails; poll /arm for the outcome.
+void handleArm() {
+  if (server.hasArg("disarm")) armingRequest(false);
+  else if (server.hasArg("arm")) armingRequest(true);
+  sendArmStatus();
+}
+
+// GET /stabilize reports the mode; /stabilize?on=1 or ?on=0 switches it,
+// only while disarmed
+void handleStabilize() {
+  if (server.hasArg("on")) {
+    if (!requireDisarmed()) return;
+    stabilize = server.arg("on").toInt() != 0;
+  }
+  server.send(200, "application/json", "{\"stabilize\":" + String(stabilize ? "true" : "false") + "}");
+}
+
+void appendGains(String &json, const AttitudeGains &g, int k) {
+  json += "{\"angleKp\":" + String(g.angleKp[k], 3) + ",\"maxRate\":" + String(g.maxRate[k], 3) +
+          ",\"kp\":" + String(g.rate[k].kp, 3) + ",\"ki\":" + String(g.rate[k].ki, 3) +
+          ",\"kd\":" + String(g.rate[k].kd, 4) + "}";
+}
+
+void sendAutotuneStatus() {
+  int k = autotune.axis();
+  String json = "{\"state\":\"" + String(autotuneStateName(autotune.state())) + "\",\"axis\":" + String(k) +
+                ",\"elapsedS\":" + String(autotune.elapsedS(), 2) + ",\"gains\":";
+  appendGains(json, attitude.gains(), k);
+  if (autotune.state() == AUTOTUNE_DONE) {
+    const AutotuneResult &r = autotune.result();
+    json += ",\"periodMs\":" + String(r.periodS * 1000, 1) + ",\"plantGain\":" + String(r.plantGain, 3) +
+            ",\"delayMs\":" + String(r.delayS * 1000, 1) + ",\"proposed\":";
+    appendGains(json, autotune.proposed(attitude.gains()), k);
+  }
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+// GET /autotune reports the autotune and, once done, the gains it proposes
+// for the axis next to the current ones.
+// GET /autotune?axis=roll (or pitch, yaw) starts one, armed in angle mode
+// with the throttle up; hold a steady hover. ?cancel=1 stops it.
+// GET /autotune?apply=1 applies the proposed gains and keeps them in NVS;
+// ?reset=1 goes back to the built-in gains.
+void handleAutotune() {
+  if (server.hasArg("axis")) {
+    String a = server.arg("axis");
+    int k = a == "yaw" ? 0 : a == "pitch" ? 1 : a == "roll" ? 2 : -1;
+    float throttle = motorPWM[0] + motorPWM[1] + motorPWM[2] + motorPWM[3];
+    if (k < 0) {
+      server.send(400, "text/plain", "axis is yaw, pitch or roll");
+      return;
+    }
+    if (!stabilize || armingState() != ARM_ARMED || throttle <= MOTOR_MIN) {
+      server.send(409, "text/plain", "Hover in angle mode first");
+      return;
+    }
+    autotune.begin(k, attitude.gains(), attitude.ratePid(k).i());
+  } else if (server.hasArg("cancel")) {
+    autotune.cancel();
+  } else if (server.hasArg("apply") || server.hasArg("reset")) {
+    if (server.hasArg("apply") && autotune.state() != AUTOTUNE_DONE) {
+      server.send(409, "text/plain", "No finished autotune");
+      return;
+    }
+    AttitudeGains gains = server.hasArg("apply") ? autotune.proposed(attitude.gains()) : DEFAULT_ATTITUDE_GAINS;
+    attitude.setGains(gains);
+    gainPrefs.begin("gains", false);
+    if (server.hasArg("apply")) gainPrefs.putBytes("attitude", &gains, sizeof(gains));
+    else gainPrefs.remove("attitude");
+    gainPrefs.end();
+  }
+  sendAutotuneStatus();
+}
+
+// GET /capture reports the DMP packet capture; ?on=1 starts one, ?on=0
+// stops it. ?download=1 sends the last capture once it has finished, for
+// tools/dmp_replay, only while disarmed: the transfer stalls the loop.
+void handleCapture() {
+  if (server.hasArg("download")) {
+    if (!requireDisarmed()) return;
+    if (dmpCaptureActive()) {
+      server.send(409, "text/plain", "Stop the capture first");
+      return;
+    }
+    File f = SPIFFS.open(DMP_CAPTURE_FILE, FILE_READ);
+    if (!f) {
+      server.send(404, "text/plain", "No capture");
+      return;
+    }
+    server.streamFile(f, "application/octet-stream");
+    f.close();
+    return;
+  }
+  if (server.hasArg("on")) {
+    DmpDevice *dmp = imu.dmp();
+    if (server.arg("on").toInt() == 0) {
+      dmpCaptureStop();
+    } else if (!dmp || !dmpCaptureStart(dmp->profile(), dmp->layout(), hwClock)) {
+      server.send(409, "text/plain", "No DMP, or a capture is still running");
+      return;
+    }
+  }
+  server.send(200, "application/json",
+              "{\"active\":" + String(dmpCaptureActive() ? "true" : "false") +
+                  ",\"written\":" + String(dmpCaptureWritten()) + ",\"dropped\":" + String(dmpCaptureDropped()) + "}");
+}
+
+void handleTelemetry() {
+  TelemetrySample samples[TELEMETRY_HISTORY];
+  uint32_t since = strtoul(server.arg("since").c_str(), NULL, 10);
+  uint32_t next;
+  size_t count = telemetryHistorySince(since, samples, TELEMETRY_HISTORY, next);
+
+  // Binary reply: uint32 next, then count packed TelemetrySample records
+  server.setContentLength(sizeof(next) + count * sizeof(TelemetrySample));
+  server.send(200, "application/octet-stream", "");
+  server.sendContent((const char *)&next, sizeof(next));
+  server.sendContent((const char *)samples, count * sizeof(TelemetrySample));
+}
+
+
+void setup() {
+  telemetryBegin();
+  loadDmpSettings();
+  loadSensorOffsets();
+  imu.begin();
+  applyDmpRate();
+  loadMagCalibration();
+  loadAttitudeGains();
 
   if (!SPIFFS.begin(true)) {
     Serial.println("SPIFFS mount failed!");
@@ -99,78 +538,185 @@ void setup() {
   WiFi.begin(ssid, password);
   Serial.print("Connecting to WiFi");
   while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
+    hwClock.delay(500);
     Serial.print(".");
   }
   Serial.println("\nConnected, IP address: ");
   Serial.println(WiFi.localIP());
 
 
-  // Serve index.html from SPIFFS
-  server.serveStatic("/", SPIFFS, "/index.html");
-  server.serveStatic("/style.css", SPIFFS, "/style.css");
-  server.serveStatic("/script.js", SPIFFS, "/script.js");
-
-  for (int i = 0; i < 4; i++) {
-    ledcSetup(pwmChannels[i], 5000, 8);           // 5kHz, 8-bit
-    ledcAttachPin(motorPins[i], pwmChannels[i]);
-    ledcWrite(pwmChannels[i], 0);
+  // Serve the gzipped web UI from SPIFFS
+  staticFilesBegin(server);
 
-  }
+  motors.begin();
+  battery.begin();
+  watchdog.begin(FailsafeConfig{FAILSAFE_TIMEOUT_MS * 1000UL, FAILSAFE_RAMP_MS * 1000UL});
+  armingBegin(preArmLimits, watchdog, hwClock);
 
   server.on("/data", handleData);
+  server.on("/telemetry", HTTP_GET, handleTelemetry);
+
+  // Only while disarmed: the transfer stalls the loop
+  server.on("/blackbox", HTTP_GET, []() {
+    if (!requireDisarmed()) return;
+    File f = SPIFFS.open(blackboxFileName(), FILE_READ);
+    if (!f) {
+      server.send(404, "text/plain", "No log");
+      return;
+    }
+    server.streamFile(f, "application/octet-stream");
+    f.close();
+  });
 
+  // Level calibration; ?sensors=1 first recalibrates the sensor offset
+  // registers and stores them. Only while disarmed, with the frame still and
+  // level.
   server.on("/recalibrate", HTTP_GET, []() {
+    if (!requireDisarmed()) return;
+    if (server.hasArg("sensors")) calibrateSensorOffsets();
     calibrateOffsets();
     server.send(200, "text/plain", "OK");
   });
 
-  server.on("/setPWM", HTTP_GET, []() {
-    for (int i = 0; i < 4; i++) {
-      if (server.hasArg("m" + String(i + 1))) {
-        motorPWM[i] = constrain(server.arg("m" + String(i + 1)).toInt(), 0, 255);
-      }
-    }
-    server.send(200, "text/plain", "OK");
-  });
+  server.on("/setPWM", HTTP_GET, handleSetPWM);
+  server.on("/dmp", HTTP_GET, handleDmp);
+  server.on("/magcal", HTTP_GET, handleMagCal);
+  server.on("/failsafe", HTTP_GET, handleFailsafe);
+  server.on("/arm", HTTP_GET, handleArm);
+  server.on("/stabilize", HTTP_GET, handleStabilize);
+  server.on("/autotune", HTTP_GET, handleAutotune);
+  server.on("/capture", HTTP_GET, handleCapture);
 
   server.begin();
 
   calibrateOffsets();
 
+  blackboxBegin(hwClock);
+
 }
 
-void updateAccel(){
-  if (!dmpReady) return;
+void filterGyro() {
+  uint32_t erpm[4];
+  if (!motors.readErpm(erpm)) return;
+  for (int i = 0; i < 4; i++) motorRpm[i] = erpmToRpm(erpm[i], MOTOR_POLES);
+  rpmNotch.update(motorRpm, sampleRate.hz());
+
+  float gyro[3];
+  for (int i = 0; i < 3; i++) gyro[i] = imuSample.gyro[i];
+  rpmNotch.apply(gyro);
+  for (int i = 0; i < 3; i++) imuSample.gyro[i] = (int16_t)constrain(lroundf(gyro[i]), -32768, 32767);
+}
+
+bool updateAccel(){
+  if (!imu.read(imuSample)) return false;
+  uint32_t sampleUs = hwClock.micros();
+  dmpCaptureLog(sampleUs, imu.packet());
+  sampleRate.sample(sampleUs);
+  filterGyro();
+  estimator.update(imuSample.quat);
+  if (imuHasMag()) {
+    if (magCalibrating) magCalibrator.addSample(imuSample.mag);
+    estimator.updateMag(imuSample.mag);
+  }
+  armingPublishSample(sampleUs, sampleRate.hz(), sampleRate.nominalHz(), estimator.ypr());
+  return true;
+}
 
-  if (mpu.dmpGetCurrentFIFOPacket(fifoBuffer)) {
-    Quaternion q;
-    VectorFloat gravity;
+void logBlackbox() {
+  BlackboxRecord rec;
+  // Setpoints and PID terms only in angle mode; they stay zero otherwise
+  if (stabilize) fillBlackboxRecord(rec, hwClock.micros(), imuSample, stabilizedCmd, &attitude);
+  else fillBlackboxRecord(rec, hwClock.micros(), imuSample, motorPWM);
+  blackboxLog(rec);
+}
 
-    mpu.dmpGetQuaternion(&q, fifoBuffer);
-    mpu.dmpGetGravity(&gravity, &q);
-    mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
+void sendTelemetry(bool newSample) {
+  TelemetrySample sample;
+  fillTelemetrySample(sample, hwClock.micros(), estimator.ypr(), motorPWM, loopTimeUs);
+  if (newSample) {
+    telemetryRecord(sample);
+  }
+  if (motorProtocolBidirectional(MOTOR_PROTOCOL)) {
+    TelemetryRpm rpm;
+    rpm.timeUs = sample.timeUs;
+    for (int i = 0; i < 4; i++) rpm.rpm[i] = (uint16_t)min(motorRpm[i], 65535.0f);
+    rpm.replyErrors = (uint16_t)escMotors.replyErrors();
+    rpm.notches = rpmNotch.active();
+    telemetrySetRpm(rpm);
+  }
+  TelemetryFailsafe failsafe;
+  failsafe.timeUs = sample.timeUs;
+  failsafe.linkAgeMs = (uint16_t)min(watchdog.sinceUs() / 1000, (uint32_t)0xFFFF);
+  failsafe.reactionUs = watchdog.reactionUs();
+  failsafe.trips = (uint16_t)watchdog.trips();
+  failsafe.state = watchdog.state();
+  telemetrySetFailsafe(failsafe);
+  telemetryUpdate(sample);
+}
 
-    ypr[0] -= yawOffset;
-    ypr[1] -= pitchOffset;
-    ypr[2] -= rollOffset;
+// One angle mode tick on the new sample, as the simulator runs it
+void stabilizeMotors(float gain) {
+  ArmState state = armingState();
+  if (state == ARM_ARMED && lastArmState != ARM_ARMED) yawHold = estimator.ypr()[0];
+  lastArmState = state;
+
+  float throttle = (motorPWM[0] + motorPWM[1] + motorPWM[2] + motorPWM[3]) / 4.0f;
+  // On the ground the integrators would only wind up
+  if (gain <= 0 || throttle <= MOTOR_MIN) {
+    autotune.cancel();
+    attitude.reset();
+    memset(stabilizedCmd, 0, sizeof(stabilizedCmd));
+    return;
+  }
+  const float setpoint[3] = {yawHold, 0, 0};
+  stabilizeTick(attitude, imuSample, estimator.ypr(), setpoint, throttle, sampleRate.dt(), gain, stabilizedCmd,
+                &autotune);
+}
 
+void writeMotors(bool newSample) {
+  // Same thrust for the same command as the pack sags
+  motorGain = battery.read(batterySample) ? sagCompensationGain(sagCompensation, batterySample.volts) : 1;
+  // The timer interrupt has already stopped the motors after a trip; keep
+  // the commands in line with that
+  if (watchdog.tripped()) {
+    memset(motorPWM, 0, sizeof(motorPWM));
+    armingPublishThrottle(motorPWM);
+  }
+  // Commands are kept while disarmed, so the throttle check sees them, but
+  // only reach the motors armed
+  float gain = armingState() == ARM_ARMED ? motorGain * watchdog.gain() : 0;
+  uint16_t motorOut[4];
+  if (stabilize) {
+    // The gain goes into the mixer, ahead of its limits. Without a new
+    // sample the last command stands, unless the motors must stop.
+    if (newSample || gain <= 0) stabilizeMotors(gain);
+    scaleMotors(stabilizedCmd, 1, motorOut);
+  } else {
+    scaleMotors(motorPWM, gain, motorOut);
+  }
+  motors.write(motorOut);
+  if (cmdPending) {
+    cmdLatencyUs = hwClock.micros() - cmdReceivedUs;
+    cmdPending = false;
   }
 }
 
 void loop() {
+  uint32_t now = hwClock.micros();
+  loopTimeUs = min(now - lastLoopUs, (uint32_t)0xFFFF);
+  lastLoopUs = now;
+
   server.handleClient();
 
-  for (int i = 0; i < 4; i++) {
-    ledcWrite(pwmChannels[i], motorPWM[i]);
+  // One motor update per control tick, all four at once
+  bool newSample = updateAccel();
+  if (newSample || now - lastMotorWriteUs > MOTOR_IDLE_WRITE_US) {
+    writeMotors(newSample);
+    lastMotorWriteUs = now;
+  }
+  if (newSample) {
+    logBlackbox();
   }
 
-  updateAccel();
-
-  Serial.print(ypr[0]);
-  Serial.print(" ");
-  Serial.print(ypr[1]);
-  Serial.print(" ");
-  Serial.println(ypr[2]);
-
+  sendTelemetry(newSample);
 }
\ No newline at end of file
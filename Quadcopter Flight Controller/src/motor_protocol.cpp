@@ -0,0 +1,166 @@
+#include "motor_protocol.h"
+
+static const char *const protocolNames[MOTOR_PROTOCOL_COUNT] = {
+  "PWM", "OneShot125", "Multishot", "DShot300", "DShot600", "DShot300 bidir", "DShot600 bidir"};
+
+const char *motorProtocolName(MotorProtocol protocol) {
+  return protocol < MOTOR_PROTOCOL_COUNT ? protocolNames[protocol] : "unknown";
+}
+
+bool motorProtocolBidirectional(MotorProtocol protocol) {
+  return protocol == MOTOR_DSHOT300_BIDIR || protocol == MOTOR_DSHOT600_BIDIR;
+}
+
+uint16_t dshotValue(uint16_t output) {
+  if (output == 0) return 0;
+  if (output > MOTOR_OUTPUT_MAX) output = MOTOR_OUTPUT_MAX;
+  return DSHOT_THROTTLE_MIN - 1 + output;
+}
+
+uint16_t dshotFrame(uint16_t value, bool telemetry, bool bidirectional) {
+  uint16_t v = (value & 0x7FF) << 1 | (telemetry ? 1 : 0);
+  uint16_t crc = v ^ (v >> 4) ^ (v >> 8);
+  if (bidirectional) crc = ~crc;
+  return v << 4 | (crc & 0x0F);
+}
+
+// Ticks of MOTOR_RMT_TICK_HZ
+#define US_TICKS(us)         ((us) * (MOTOR_RMT_TICK_HZ / 1000000))
+#define PULSE_GAP_TICKS      US_TICKS(1)
+
+struct DshotTiming {
+  uint16_t bit, one, zero;   // bit period and high times, 3/4 and 3/8 of it
+};
+
+static const DshotTiming dshot300 = {267, 200, 100};
+static const DshotTiming dshot600 = {133, 100, 50};
+
+static size_t encodePulse(uint32_t lowUs, uint32_t spanUs, uint16_t output, uint32_t items[]) {
+  if (output > MOTOR_OUTPUT_MAX) output = MOTOR_OUTPUT_MAX;
+  uint32_t high = US_TICKS(lowUs) + (uint32_t)output * US_TICKS(spanUs) / MOTOR_OUTPUT_MAX;
+  items[0] = motorRmtItem(high, PULSE_GAP_TICKS);
+  items[1] = 0;
+  return 2;
+}
+
+static size_t encodeDshot(const DshotTiming &t, uint16_t output, bool bidirectional, uint32_t items[]) {
+  uint16_t frame = dshotFrame(dshotValue(output), false, bidirectional);
+  for (int i = 0; i < 16; i++) {
+    uint16_t pulse = (frame & (0x8000 >> i)) ? t.one : t.zero;
+    items[i] = bidirectional ? motorRmtItemInverted(pulse, t.bit - pulse) : motorRmtItem(pulse, t.bit - pulse);
+  }
+  items[16] = 0;
+  return 17;
+}
+
+size_t motorEncodeRmt(MotorProtocol protocol, uint16_t output, uint32_t items[MOTOR_MAX_ITEMS]) {
+  switch (protocol) {
+    case MOTOR_ONESHOT125: return encodePulse(125, 125, output, items);
+    case MOTOR_MULTISHOT: return encodePulse(5, 20, output, items);
+    case MOTOR_DSHOT300: return encodeDshot(dshot300, output, false, items);
+    case MOTOR_DSHOT600: return encodeDshot(dshot600, output, false, items);
+    case MOTOR_DSHOT300_BIDIR: return encodeDshot(dshot300, output, true, items);
+    case MOTOR_DSHOT600_BIDIR: return encodeDshot(dshot600, output, true, items);
+    default: return 0;
+  }
+}
+
+#define REPLY_BITS       21
+#define REPLY_GAP_BITS   4      // a high run this long ends the frame
+#define ERPM_STOPPED     0xFFF
+
+// 4 bit nibble to 5 bit GCR code, and back (0xFF for codes not in the table)
+static const uint8_t gcrEncode[16] = {0x19, 0x1B, 0x12, 0x13, 0x1D, 0x15, 0x16, 0x17,
+                                      0x1A, 0x09, 0x0A, 0x0B, 0x1E, 0x0D, 0x0E, 0x0F};
+static const uint8_t gcrDecode[32] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x09, 0x0A, 0x0B, 0xFF, 0x0D, 0x0E, 0x0F,
+  0xFF, 0xFF, 0x02, 0x03, 0xFF, 0x05, 0x06, 0x07, 0xFF, 0x00, 0x08, 0x01, 0xFF, 0x04, 0x0C, 0xFF};
+
+float dshotReplyBitTicks(MotorProtocol protocol) {
+  float bitRate = protocol == MOTOR_DSHOT300_BIDIR ? 300000 : 600000;
+  return MOTOR_RMT_TICK_HZ / (bitRate * 5 / 4);
+}
+
+uint32_t dshotReplyBits(uint32_t erpm) {
+  uint32_t packed = ERPM_STOPPED;
+  if (erpm) {
+    uint32_t period = (60000000 + erpm / 2) / erpm;
+    uint32_t exponent = 0;
+    while (period > 0x1FF && exponent < 7) {
+      period = (period + 1) >> 1;
+      exponent++;
+    }
+    if (period <= 0x1FF) packed = exponent << 9 | period;
+  }
+  uint32_t value = packed << 4 | ((~(packed ^ (packed >> 4) ^ (packed >> 8))) & 0x0F);
+  uint32_t gcr = 0;
+  for (int i = 3; i >= 0; i--) gcr = gcr << 5 | gcrEncode[(value >> (4 * i)) & 0x0F];
+  // NRZI: a 1 is a level change. The start bit always is one.
+  uint32_t bits = 1u << (REPLY_BITS - 1);
+  for (int i = REPLY_BITS - 2; i >= 0; i--) {
+    bits |= (((gcr >> i) ^ (bits >> (i + 1))) & 1) << i;
+  }
+  return bits;
+}
+
+DshotReplyStatus dshotDecodeReply(MotorProtocol protocol, const uint32_t *items, size_t count, uint32_t &erpm) {
+  float bitTicks = dshotReplyBitTicks(protocol);
+  float gapTicks = REPLY_GAP_BITS * bitTicks;
+  bool inReply = false;
+  uint32_t value = 0;
+  int bits = 0;
+  bool ended = false;
+
+  // Walk the level runs, two per item, up to the zero duration that ends
+  // the capture
+  for (size_t i = 0; i < count && !ended; i++) {
+    for (int half = 0; half < 2; half++) {
+      uint32_t word = items[i] >> (16 * half);
+      uint32_t ticks = word & 0x7FFF;
+      bool high = word & 0x8000;
+      if (ticks == 0) {
+        ended = true;
+        break;
+      }
+      if (!inReply) {
+        inReply = high && ticks > gapTicks;
+        continue;
+      }
+      int len = (int)(ticks / bitTicks + 0.5f);
+      if (len < 1) return DSHOT_REPLY_FRAMING;
+      // The reply's last run merges with the idle line
+      if (bits + len > REPLY_BITS) {
+        if (!high) return DSHOT_REPLY_FRAMING;
+        len = REPLY_BITS - bits;
+      }
+      value = value << len | 1u << (len - 1);
+      bits += len;
+      if (bits == REPLY_BITS) {
+        ended = true;
+        break;
+      }
+    }
+  }
+  if (!inReply || bits == 0) return DSHOT_REPLY_MISSING;
+  if (bits < REPLY_BITS) {
+    // The capture ended on the idle level: the rest is one high run
+    int len = REPLY_BITS - bits;
+    value = value << len | 1u << (len - 1);
+  }
+
+  uint32_t gcr = (value ^ (value >> 1)) & 0xFFFFF;
+  uint32_t decoded = 0;
+  for (int i = 3; i >= 0; i--) {
+    uint8_t nibble = gcrDecode[(gcr >> (5 * i)) & 0x1F];
+    if (nibble == 0xFF) return DSHOT_REPLY_GCR;
+    decoded = decoded << 4 | nibble;
+  }
+  uint32_t sum = decoded ^ (decoded >> 8);
+  sum ^= sum >> 4;
+  if ((sum & 0x0F) != 0x0F) return DSHOT_REPLY_CHECKSUM;
+
+  uint32_t packed = decoded >> 4;
+  uint32_t period = (packed & 0x1FF) << (packed >> 9);
+  erpm = packed == ERPM_STOPPED || period == 0 ? 0 : (60000000 + period / 2) / period;
+  return DSHOT_REPLY_OK;
+}
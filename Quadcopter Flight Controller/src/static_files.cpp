@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include "static_files.h"
+#include "arming.h"
+
+struct StaticFile {
+  String path;   // URL path, e.g. "/script.js"
+  String etag;   // quoted, as sent in the header
+};
+
+static StaticFile files[STATIC_FILES_MAX];
+static int fileCount = 0;
+
+static const char *contentType(const String &path) {
+  if (path.endsWith(".html")) return "text/html";
+  if (path.endsWith(".css")) return "text/css";
+  if (path.endsWith(".js")) return "application/javascript";
+  if (path.endsWith(".json")) return "application/json";
+  if (path.endsWith(".glb")) return "model/gltf-binary";
+  if (path.endsWith(".png")) return "image/png";
+  return "text/plain";
+}
+
+static void sendFile(WebServer &server, const StaticFile &file) {
+  server.sendHeader("ETag", file.etag);
+  server.sendHeader("Cache-Control", "no-cache");
+
+  if (server.header("If-None-Match") == file.etag) {
+    server.send(304);
+    return;
+  }
+
+  File f = SPIFFS.open(file.path + ".gz", FILE_READ);
+  if (!f) {
+    server.send(404, "text/plain", "Not found");
+    return;
+  }
+  // The transfer runs inside loop(), so a large one would starve the IMU
+  // reads and motor writes past the pre-arm staleness limit
+  if (f.size() > STATIC_FILES_ARMED_MAX_BYTES && armingState() != ARM_DISARMED) {
+    f.close();
+    server.sendHeader("Retry-After", String(STATIC_FILES_RETRY_S));
+    server.send(503, "text/plain", "Armed, try again once disarmed");
+    return;
+  }
+  // streamFile adds Content-Encoding: gzip for .gz files
+  server.streamFile(f, contentType(file.path));
+  f.close();
+}
+
+void staticFilesBegin(WebServer &server) {
+  static const char *headerKeys[] = {"If-None-Match"};
+  server.collectHeaders(headerKeys, 1);
+
+  File manifest = SPIFFS.open("/etags.txt", FILE_READ);
+  if (!manifest) {
+    Serial.println("No /etags.txt, was the filesystem image built with data_gzip.py?");
+    return;
+  }
+
+  while (manifest.available() && fileCount < STATIC_FILES_MAX) {
+    String line = manifest.readStringUntil('\n');
+    line.trim();
+    int space = line.indexOf(' ');
+    if (space <= 0) continue;
+
+    StaticFile &file = files[fileCount];
+    file.path = "/" + line.substring(0, space);
+    file.etag = "\"" + line.substring(space + 1) + "\"";
+
+    int index = fileCount++;
+    server.on(file.path.c_str(), HTTP_GET, [&server, index]() { sendFile(server, files[index]); });
+    if (file.path == "/index.html") {
+      server.on("/", HTTP_GET, [&server, index]() { sendFile(server, files[index]); });
+    }
+  }
+  manifest.close();
+}
@@ -0,0 +1,79 @@
+#include <Arduino.h>
+#include "telemetry.h"
+
+static uint32_t periodUs;
+static uint32_t lastSendUs = 0;
+static uint8_t seq = 0;
+static uint16_t dropped = 0;
+
+static TelemetryRpm rpm;
+static bool rpmValid = false;
+static TelemetryFailsafe failsafe;
+static bool failsafeValid = false;
+
+static TelemetrySample history[TELEMETRY_HISTORY];
+static uint32_t historyNext = 0;
+
+void telemetryBegin(uint32_t baud, uint16_t rateHz) {
+  // Must be set before begin() so the UART driver allocates the larger ring
+  Serial.setTxBufferSize(TELEMETRY_TX_BUFFER);
+  Serial.begin(baud);
+  telemetrySetRate(rateHz);
+}
+
+void telemetrySetRate(uint16_t rateHz) {
+  periodUs = rateHz ? 1000000UL / rateHz : 0xFFFFFFFF;
+}
+
+static bool sendFrame(uint8_t type, const void *payload, size_t size) {
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t len = telemetryEncodeFrame(type, seq++, payload, size, frame);
+  if ((size_t)Serial.availableForWrite() < len) {
+    dropped++;
+    return false;
+  }
+  Serial.write(frame, len);
+  return true;
+}
+
+void telemetryUpdate(TelemetrySample &sample) {
+  if (sample.timeUs - lastSendUs < periodUs) return;
+  lastSendUs = sample.timeUs;
+
+  sample.droppedFrames = dropped;
+  if (!sendFrame(TELEMETRY_TYPE_SAMPLE, &sample, sizeof(sample))) return;
+  if (rpmValid && !sendFrame(TELEMETRY_TYPE_RPM, &rpm, sizeof(rpm))) return;
+  if (failsafeValid) sendFrame(TELEMETRY_TYPE_FAILSAFE, &failsafe, sizeof(failsafe));
+}
+
+void telemetrySetRpm(const TelemetryRpm &r) {
+  rpm = r;
+  rpmValid = true;
+}
+
+void telemetrySetFailsafe(const TelemetryFailsafe &f) {
+  failsafe = f;
+  failsafeValid = true;
+}
+
+uint16_t telemetryDropped() {
+  return dropped;
+}
+
+void telemetryRecord(const TelemetrySample &sample) {
+  history[historyNext % TELEMETRY_HISTORY] = sample;
+  historyNext++;
+}
+
+size_t telemetryHistorySince(uint32_t since, TelemetrySample *out, size_t maxCount, uint32_t &next) {
+  uint32_t oldest = historyNext > TELEMETRY_HISTORY ? historyNext - TELEMETRY_HISTORY : 0;
+  // A client that fell behind, or is ahead after a reboot, gets what we have
+  if (since < oldest || since > historyNext) since = oldest;
+
+  size_t count = 0;
+  for (uint32_t i = since; i < historyNext && count < maxCount; i++) {
+    out[count++] = history[i % TELEMETRY_HISTORY];
+  }
+  next = since + count;
+  return count;
+}
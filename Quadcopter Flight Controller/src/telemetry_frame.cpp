@@ -0,0 +1,92 @@
+#include "telemetry_frame.h"
+
+#include <string.h>
+
+uint16_t telemetryCrc16(const uint8_t *data, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t telemetryEncodeFrame(uint8_t type, uint8_t seq, const void *payload, size_t len, uint8_t *out) {
+  if (len > TELEMETRY_MAX_PAYLOAD) return 0;
+
+  uint8_t plain[TELEMETRY_MAX_PAYLOAD + 4];
+  plain[0] = type;
+  plain[1] = seq;
+  memcpy(plain + 2, payload, len);
+  uint16_t crc = telemetryCrc16(plain, len + 2);
+  plain[len + 2] = crc & 0xFF;
+  plain[len + 3] = crc >> 8;
+  size_t plainLen = len + 4;
+
+  // COBS: each code byte gives the distance to the next zero (or 0xFF for a
+  // full run of 254 non-zero bytes)
+  size_t pos = 0;
+  out[pos++] = 0;
+  size_t codePos = pos++;
+  uint8_t code = 1;
+  for (size_t i = 0; i < plainLen; i++) {
+    if (plain[i] == 0) {
+      out[codePos] = code;
+      codePos = pos++;
+      code = 1;
+    } else {
+      out[pos++] = plain[i];
+      if (++code == 0xFF) {
+        out[codePos] = code;
+        codePos = pos++;
+        code = 1;
+      }
+    }
+  }
+  out[codePos] = code;
+  out[pos++] = 0;
+  return pos;
+}
+
+bool TelemetryDecoder::push(uint8_t b) {
+  if (b != 0) {
+    if (rawLen_ < sizeof(raw_)) raw_[rawLen_++] = b;
+    else overflow_ = true;
+    return false;
+  }
+
+  // Delimiter: decode whatever was collected since the previous one
+  size_t len = rawLen_;
+  bool overflow = overflow_;
+  rawLen_ = 0;
+  overflow_ = false;
+  if (len == 0) return false;  // back-to-back delimiters
+  if (overflow) {
+    framingErrors_++;
+    return false;
+  }
+
+  size_t in = 0;
+  decodedLen_ = 0;
+  while (in < len) {
+    uint8_t code = raw_[in++];
+    if (in + code - 1 > len) {
+      framingErrors_++;
+      return false;
+    }
+    for (uint8_t i = 1; i < code; i++) decoded_[decodedLen_++] = raw_[in++];
+    if (code != 0xFF && in < len) decoded_[decodedLen_++] = 0;
+  }
+
+  if (decodedLen_ < 4) {
+    framingErrors_++;
+    return false;
+  }
+  uint16_t crc = decoded_[decodedLen_ - 2] | (decoded_[decodedLen_ - 1] << 8);
+  if (telemetryCrc16(decoded_, decodedLen_ - 2) != crc) {
+    crcErrors_++;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,113 @@
+// Unit tests for the DMP FIFO packet capture format (dmp_capture_format.h):
+// packets come back with their exact bytes, whatever the layout
+//
+// pio test -e native
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include "dmp_capture_format.h"
+
+void setUp() {}
+void tearDown() {}
+
+static DmpCapturePacket packets[DMP_CAPTURE_BLOCK_PACKETS];
+static DmpCapturePacket decoded[DMP_CAPTURE_BLOCK_PACKETS];
+static uint8_t payload[DMP_CAPTURE_MAX_PAYLOAD];
+
+// Packets of size bytes that move like a DMP's: small steps from one to the
+// next, or with random set any byte can take any value
+static void makePackets(uint8_t size, bool random) {
+  srand(size);
+  uint32_t t = 0xFFFFFF00u;   // across the micros() wrap
+  for (int p = 0; p < DMP_CAPTURE_BLOCK_PACKETS; p++) {
+    DmpCapturePacket &k = packets[p];
+    memset(&k, 0, sizeof(k));
+    k.timeUs = t;
+    t += 10000 + rand() % 50;
+    for (int i = 0; i < size; i++) {
+      k.data[i] = random ? rand() : (p ? packets[p - 1].data[i] : 0x40 + i) + (i & 1 ? rand() % 7 - 3 : 0);
+    }
+  }
+}
+
+static void roundTrip(uint8_t size, bool random) {
+  makePackets(size, random);
+  size_t bytes = dmpCaptureEncodeBlock(packets, DMP_CAPTURE_BLOCK_PACKETS, size, payload, sizeof(payload));
+  TEST_ASSERT_GREATER_THAN(0, bytes);
+  TEST_ASSERT_TRUE(dmpCaptureDecodeBlock(payload, bytes, DMP_CAPTURE_BLOCK_PACKETS, size, decoded));
+  for (int p = 0; p < DMP_CAPTURE_BLOCK_PACKETS; p++) {
+    TEST_ASSERT_EQUAL_UINT32(packets[p].timeUs, decoded[p].timeUs);
+    TEST_ASSERT_EQUAL_MEMORY(packets[p].data, decoded[p].data, size);
+  }
+  // Slowly moving packets compress; random ones still fit the worst case
+  if (!random) TEST_ASSERT_LESS_THAN(DMP_CAPTURE_BLOCK_PACKETS * (size + 4) * 3 / 4, bytes);
+}
+
+static void test_round_trip_every_profile_size() {
+  // Trimmed 6.12, 6.12, MotionApps 2.0, 4.1
+  const uint8_t sizes[] = {16, 22, 28, 42, 48};
+  for (uint8_t size : sizes) roundTrip(size, false);
+}
+
+static void test_round_trip_random_and_odd_sizes() {
+  for (uint8_t size = 16; size <= DMP_CAPTURE_MAX_PACKET; size++) roundTrip(size, true);
+}
+
+static void test_rejects_bad_input() {
+  makePackets(42, true);
+  size_t bytes = dmpCaptureEncodeBlock(packets, DMP_CAPTURE_BLOCK_PACKETS, 42, payload, sizeof(payload));
+  // Truncated, or with bytes left over
+  TEST_ASSERT_FALSE(dmpCaptureDecodeBlock(payload, bytes - 1, DMP_CAPTURE_BLOCK_PACKETS, 42, decoded));
+  TEST_ASSERT_FALSE(dmpCaptureDecodeBlock(payload, bytes, DMP_CAPTURE_BLOCK_PACKETS - 1, 42, decoded));
+  // Packet sizes outside 16 to DMP_CAPTURE_MAX_PACKET, and no room
+  TEST_ASSERT_EQUAL(0, dmpCaptureEncodeBlock(packets, 1, 15, payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL(0, dmpCaptureEncodeBlock(packets, 1, DMP_CAPTURE_MAX_PACKET + 1, payload, sizeof(payload)));
+  TEST_ASSERT_FALSE(dmpCaptureDecodeBlock(payload, bytes, 1, 15, decoded));
+  TEST_ASSERT_EQUAL(0, dmpCaptureEncodeBlock(packets, DMP_CAPTURE_BLOCK_PACKETS, 42, payload, 64));
+}
+
+static void test_header_valid() {
+  DmpCaptureBlockHeader h = {};
+  h.magic = DMP_CAPTURE_MAGIC;
+  h.version = DMP_CAPTURE_VERSION;
+  h.packetCount = DMP_CAPTURE_BLOCK_PACKETS;
+  h.payloadBytes = 1000;
+  h.profile = DMP_MOTIONAPPS20;
+  // MotionApps 2.0: gyro and accel padded to 32 bits
+  h.layout = {42, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL, 16, 4, 28, 4, 0};
+  TEST_ASSERT_TRUE(dmpCaptureHeaderValid(h));
+
+  DmpCaptureBlockHeader bad = h;
+  bad.magic ^= 1;
+  TEST_ASSERT_FALSE(dmpCaptureHeaderValid(bad));
+  bad = h;
+  bad.version++;
+  TEST_ASSERT_FALSE(dmpCaptureHeaderValid(bad));
+  bad = h;
+  bad.profile = DMP_PROFILE_COUNT;
+  TEST_ASSERT_FALSE(dmpCaptureHeaderValid(bad));
+  bad = h;
+  bad.packetCount = DMP_CAPTURE_BLOCK_PACKETS + 1;
+  TEST_ASSERT_FALSE(dmpCaptureHeaderValid(bad));
+  // A field reaching past the end of the packet
+  bad = h;
+  bad.layout.accel = 34;
+  TEST_ASSERT_FALSE(dmpCaptureHeaderValid(bad));
+  bad = h;
+  bad.layout.fields |= DMP_FIELD_MAG;
+  bad.layout.mag = 40;
+  TEST_ASSERT_FALSE(dmpCaptureHeaderValid(bad));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_every_profile_size);
+  RUN_TEST(test_round_trip_random_and_odd_sizes);
+  RUN_TEST(test_rejects_bad_input);
+  RUN_TEST(test_header_valid);
+  return UNITY_END();
+}
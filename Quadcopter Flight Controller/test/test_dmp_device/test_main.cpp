@@ -0,0 +1,263 @@
+// Tests of the DMP profiles behind DmpDevice, through the real driver
+// against the emulated MPU6050 on the simulated bus (tools/mpu6050_sim)
+//
+// pio test -e native_sim
+
+#include <math.h>
+#include <stdint.h>
+
+#include <unity.h>
+
+#include "I2Cdev.h"
+#include "MPU6050.h"
+#include "dmp_device.h"
+#include "flight_core.h"
+#include "mpu6050_emu.h"
+
+// Same motion as mpu6050_bench: level, roll, pitch, a yaw turn, level
+static const MotionKeyframe trajectory[] = {
+  {0, 0, 0, 0},
+  {1000, 0, 0, 0},
+  {2000, 0, 0, 30},
+  {3000, 0, -20, 30},
+  {5000, 90, -20, 30},
+  {7000, 90, 0, 0},
+};
+
+#define LOOP_US 2500
+
+static Mpu6050Emu *emu;
+static DmpDevice *dmp;
+
+// Emulated chip running the profile's image, and its DmpDevice initialized
+static void start(DmpProfile profile, const Mpu6050EmuConfig &config = Mpu6050EmuConfig(),
+                  const MotionKeyframe *frames = trajectory, size_t count = sizeof(trajectory) / sizeof(trajectory[0])) {
+  i2cdevSimReset();
+  emu = new Mpu6050Emu(config);
+  emu->setDmpImage(profile);
+  emu->setTrajectory(frames, count);
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, emu);
+  dmp = createDmpDevice(profile);
+  dmp->mpu().initialize();
+  TEST_ASSERT_EQUAL_UINT8(0, dmp->initialize());
+}
+
+void setUp() {
+  emu = nullptr;
+  dmp = nullptr;
+}
+
+void tearDown() {
+  delete dmp;
+  delete emu;
+}
+
+// Polls like the firmware loop for seconds and returns the largest attitude
+// error, in degrees, of the decoded packets against the trajectory
+static double maxAttitudeError(uint32_t seconds, uint32_t &packets) {
+  uint8_t packet[64];
+  double errMax = 0;
+  packets = 0;
+  uint64_t end = i2cdevSimNowUs() + (uint64_t)seconds * 1000000;
+  while (i2cdevSimNowUs() < end) {
+    uint64_t passStart = i2cdevSimNowUs();
+    if (dmp->readLatest(packet)) {
+      ImuSample s;
+      dmp->decode(packet, s);
+      float q[4], ypr[3], truth[3], tq[4], library[3];
+      for (int i = 0; i < 4; i++) q[i] = s.quat[i] / 16384.0f;
+      quaternionToYawPitchRoll(q, ypr);
+      // The flight core's conversion agrees with the library's
+      dmp->libraryYawPitchRoll(packet, library);
+      for (int i = 0; i < 3; i++) TEST_ASSERT_FLOAT_WITHIN(1e-3f, library[i], ypr[i]);
+
+      emu->quaternionAt(i2cdevSimNowUs(), tq);
+      quaternionToYawPitchRoll(tq, truth);
+      for (int i = 0; i < 3; i++) {
+        double err = fabs(ypr[i] - truth[i]) * 180.0 / M_PI;
+        if (err > 180) err = 360 - err;
+        if (err > errMax) errMax = err;
+      }
+      packets++;
+    }
+    uint64_t spent = i2cdevSimNowUs() - passStart;
+    if (spent < LOOP_US) i2cdevSimAdvanceUs(LOOP_US - spent);
+  }
+  return errMax;
+}
+
+static void checkProfile(DmpProfile profile, uint8_t size, uint8_t fields, uint32_t hz) {
+  start(profile);
+  TEST_ASSERT_EQUAL(profile, dmp->profile());
+  TEST_ASSERT_EQUAL_UINT8(size, dmp->layout().size);
+  TEST_ASSERT_EQUAL_HEX16(fields, dmp->layout().fields);
+  dmp->mpu().setDMPEnabled(true);
+  uint32_t packets;
+  double err = maxAttitudeError(4, packets);
+  TEST_ASSERT_EQUAL_UINT32(hz, emu->dmpRateHz());
+  TEST_ASSERT_UINT32_WITHIN(3, hz * 4, packets);
+  TEST_ASSERT_LESS_THAN(0.1, err);
+}
+
+static void test_motionapps20() {
+  checkProfile(DMP_MOTIONAPPS20, 42, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL, 100);
+}
+
+static void test_motionapps612() {
+  checkProfile(DMP_MOTIONAPPS612, 28, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL, 100);
+}
+
+static void test_motionapps41() {
+  checkProfile(DMP_MOTIONAPPS41, 48, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL | DMP_FIELD_MAG, 50);
+}
+
+static void test_motionapps612_trimmed() {
+  // Only 6.12 can drop fields from its packets; the quaternion always stays
+  start(DMP_MOTIONAPPS612);
+  TEST_ASSERT_EQUAL_HEX16(DMP_FIELD_QUAT | DMP_FIELD_GYRO, dmp->selectFields(DMP_FIELD_GYRO));
+  TEST_ASSERT_EQUAL_UINT8(22, dmp->layout().size);
+  TEST_ASSERT_EQUAL_HEX16(DMP_FIELD_QUAT, dmp->selectFields(0));
+  TEST_ASSERT_EQUAL_UINT8(16, dmp->layout().size);
+  dmp->mpu().setDMPEnabled(true);
+  uint32_t packets;
+  TEST_ASSERT_LESS_THAN(0.1, maxAttitudeError(2, packets));
+  TEST_ASSERT_EQUAL(16, emu->dmpPacketSize());
+
+  delete dmp;
+  delete emu;
+  start(DMP_MOTIONAPPS20);
+  TEST_ASSERT_EQUAL_HEX16(DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL, dmp->selectFields(DMP_FIELD_QUAT));
+  TEST_ASSERT_EQUAL_UINT8(42, dmp->layout().size);
+}
+
+static void test_profile_names() {
+  for (int p = 0; p < DMP_PROFILE_COUNT; p++) {
+    TEST_ASSERT_EQUAL(p, dmpProfileFromName(dmpProfileName((DmpProfile)p)));
+  }
+  TEST_ASSERT_EQUAL(DMP_MOTIONAPPS612, dmpProfileFromName("612"));
+  TEST_ASSERT_EQUAL(DMP_PROFILE_COUNT, dmpProfileFromName("MotionApps"));
+}
+
+static void test_rate_change() {
+  // MotionApps 2.0's output rate changed on the fly through the FIFO
+  // divisor, as measured by SampleRate from packet arrival
+  start(DMP_MOTIONAPPS20);
+  dmp->mpu().setDMPEnabled(true);
+  static const uint16_t fifoDivs[] = {0, 1, 3, 9, 1};
+  uint8_t packet[64];
+  SampleRate rate;
+  BusClock clock;
+  for (uint16_t fifoDiv : fifoDivs) {
+    TEST_ASSERT_TRUE(dmp->setRate(4, fifoDiv));
+    TEST_ASSERT_EQUAL_UINT8(4, dmp->sampleDivisor());
+    TEST_ASSERT_EQUAL_UINT16(fifoDiv, dmp->fifoDivisor());
+    TEST_ASSERT_EQUAL_FLOAT(200.0f / (1 + fifoDiv), dmp->rateHz());
+    TEST_ASSERT_TRUE(dmp->mpu().getDMPEnabled());
+    rate.setNominal(dmp->rateHz());
+    uint64_t end = i2cdevSimNowUs() + 2000000;
+    while (i2cdevSimNowUs() < end) {
+      uint64_t passStart = i2cdevSimNowUs();
+      if (dmp->readLatest(packet)) rate.sample(clock.micros());
+      uint64_t spent = i2cdevSimNowUs() - passStart;
+      if (spent < LOOP_US) i2cdevSimAdvanceUs(LOOP_US - spent);
+    }
+    TEST_ASSERT_EQUAL_UINT32(lrintf(rate.nominalHz()), emu->dmpRateHz());
+    TEST_ASSERT_FLOAT_WITHIN(rate.nominalHz() * 0.05f, rate.nominalHz(), rate.hz());
+  }
+}
+
+// Turns every axis through the field for MagCalibrator, then flies yaw
+// turns with some tilt (as dmp_bench)
+#define MAG_CAL_END_MS 43000
+static const MotionKeyframe magTrajectory[] = {
+  {0, 0, 0, 0},
+  {4000, 360, 0, 0},
+  {8000, 360, 0, 360},
+  {11000, 360, 85, 360},
+  {14000, 360, -85, 360},
+  {15000, 360, 0, 360},
+  {17000, 540, 0, 360},
+  {20000, 540, 85, 360},
+  {23000, 540, -85, 360},
+  {25000, 540, 25, 360},
+  {29000, 540, 25, 540},
+  {31000, 540, -25, 540},
+  {35000, 540, -25, 720},
+  {37000, 450, 0, 720},
+  {41000, 450, 0, 1080},
+  {MAG_CAL_END_MS, 540, 0, 1080},
+  {53000, 630, 10, 1075},
+  {63000, 450, -10, 1090},
+  {73000, 720, 0, 1080},
+  {83000, 540, 5, 1085},
+};
+
+static double yawErrorDeg(float yaw, float truth) {
+  double err = fabs(yaw - truth) * 180.0 / M_PI;
+  return err > 180 ? 360 - err : err;
+}
+
+static void test_mag_heading() {
+  // MotionApps 4.1 with a DMP whose yaw drifts: the magnetometer, once
+  // calibrated while the frame tumbles, holds the heading
+  Mpu6050EmuConfig config;
+  config.dmpYawDriftDps = 0.5f;
+  const size_t count = sizeof(magTrajectory) / sizeof(magTrajectory[0]);
+  start(DMP_MOTIONAPPS41, config, magTrajectory, count);
+  dmp->mpu().setDMPEnabled(true);
+
+  MagCalibrator calibrator;
+  MagCalibration cal = {};
+  bool calibrated = false;
+  AttitudeEstimator dmpOnly, aided;
+  uint8_t packet[64];
+  double errMax[2] = {0, 0};
+  uint64_t end = (uint64_t)magTrajectory[count - 1].timeMs * 1000;
+  while (i2cdevSimNowUs() < end) {
+    uint64_t passStart = i2cdevSimNowUs();
+    if (dmp->readLatest(packet)) {
+      ImuSample s;
+      dmp->decode(packet, s);
+      if (passStart < MAG_CAL_END_MS * 1000ull) {
+        calibrator.addSample(s.mag);
+      } else {
+        if (!calibrated) {
+          TEST_ASSERT_TRUE(calibrator.finish(cal));
+          aided.setMagCalibration(cal);
+          calibrated = true;
+        }
+        dmpOnly.update(s.quat);
+        aided.update(s.quat);
+        aided.updateMag(s.mag);
+        float truth[3], tq[4];
+        emu->quaternionAt(i2cdevSimNowUs(), tq);
+        quaternionToYawPitchRoll(tq, truth);
+        const AttitudeEstimator *est[2] = {&dmpOnly, &aided};
+        for (int k = 0; k < 2; k++) {
+          double err = yawErrorDeg(est[k]->ypr()[0], truth[0]);
+          if (err > errMax[k]) errMax[k] = err;
+        }
+      }
+    }
+    uint64_t spent = i2cdevSimNowUs() - passStart;
+    if (spent < LOOP_US) i2cdevSimAdvanceUs(LOOP_US - spent);
+  }
+  TEST_ASSERT_TRUE(calibrated);
+  // 0.3 uT per LSB; the emulator's distortion is in body axes like ImuSample
+  for (int k = 0; k < 3; k++) TEST_ASSERT_FLOAT_WITHIN(0.5f, config.magHardIronUt[k], cal.offset[k] * 0.3f);
+  TEST_ASSERT_TRUE(aided.magAided());
+  TEST_ASSERT_GREATER_THAN(10, errMax[0]);
+  TEST_ASSERT_LESS_THAN(3, errMax[1]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_motionapps20);
+  RUN_TEST(test_motionapps612);
+  RUN_TEST(test_motionapps41);
+  RUN_TEST(test_motionapps612_trimmed);
+  RUN_TEST(test_rate_change);
+  RUN_TEST(test_mag_heading);
+  RUN_TEST(test_profile_names);
+  return UNITY_END();
+}
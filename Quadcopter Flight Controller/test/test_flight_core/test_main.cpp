@@ -0,0 +1,651 @@
+// Unit tests for the hardware-independent flight core (flight_core.h) and
+// the records it builds for the telemetry link and the blackbox
+//
+// pio test -e native
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#include <unity.h>
+
+#include "blackbox_format.h"
+#include "flight_core.h"
+#include "telemetry_frame.h"
+
+#define DEG ((float)M_PI / 180)
+
+void setUp() {}
+void tearDown() {}
+
+// DMP quaternion (1.0 = 16384) for yaw, pitch, roll in radians, signed as
+// quaternionToYawPitchRoll reports them
+static void quatFromYpr(float yaw, float pitch, float roll, int16_t quat[4]) {
+  float cr = cosf(roll / 2), sr = sinf(roll / 2);
+  float cp = cosf(-pitch / 2), sp = sinf(-pitch / 2);
+  float cy = cosf(-yaw / 2), sy = sinf(-yaw / 2);
+  float q[4] = {
+    cr * cp * cy + sr * sp * sy,
+    sr * cp * cy - cr * sp * sy,
+    cr * sp * cy + sr * cp * sy,
+    cr * cp * sy - sr * sp * cy,
+  };
+  for (int k = 0; k < 4; k++) quat[k] = (int16_t)lrintf(q[k] * 16384.0f);
+}
+
+static void test_ypr_from_quaternion() {
+  const float level[4] = {1, 0, 0, 0};
+  float ypr[3];
+  quaternionToYawPitchRoll(level, ypr);
+  for (int k = 0; k < 3; k++) TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0, ypr[k]);
+
+  const float angles[][3] = {{30, 0, 0}, {0, 20, 0}, {0, 0, -25}, {-60, 10, 15}};
+  for (const auto &a : angles) {
+    int16_t quat[4];
+    quatFromYpr(a[0] * DEG, a[1] * DEG, a[2] * DEG, quat);
+    float q[4];
+    for (int k = 0; k < 4; k++) q[k] = quat[k] / 16384.0f;
+    quaternionToYawPitchRoll(q, ypr);
+    for (int k = 0; k < 3; k++) TEST_ASSERT_FLOAT_WITHIN(0.2f * DEG, a[k] * DEG, ypr[k]);
+  }
+}
+
+static void test_estimator_level_calibration() {
+  AttitudeEstimator estimator;
+  int16_t quat[4];
+  // The sensor sits 3 degrees nose up and 2 degrees right on the frame
+  quatFromYpr(10 * DEG, 3 * DEG, -2 * DEG, quat);
+  estimator.update(quat);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f * DEG, 3 * DEG, estimator.ypr()[1]);
+
+  TEST_ASSERT_FALSE(estimator.finishCalibration());
+  estimator.beginCalibration();
+  for (int i = 0; i < 20; i++) {
+    estimator.update(quat);
+    estimator.addCalibrationSample();
+  }
+  TEST_ASSERT_TRUE(estimator.finishCalibration());
+  TEST_ASSERT_FLOAT_WITHIN(0.1f * DEG, 3 * DEG, estimator.levelOffset()[1]);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f * DEG, -2 * DEG, estimator.levelOffset()[2]);
+  for (int k = 0; k < 3; k++) TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0, estimator.ypr()[k]);
+
+  // Angles after calibration are relative to the reference
+  quatFromYpr(10 * DEG, 8 * DEG, -2 * DEG, quat);
+  estimator.update(quat);
+  TEST_ASSERT_FLOAT_WITHIN(0.2f * DEG, 5 * DEG, estimator.ypr()[1]);
+  TEST_ASSERT_FLOAT_WITHIN(0.2f * DEG, 0, estimator.ypr()[2]);
+}
+
+static void test_pid_terms() {
+  PidController pid(PidGains{2, 10, 0, 0.5f, 0});
+  float out = pid.update(1, 0.5f, 0.01f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, pid.p());
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.05f, pid.i());
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.05f, out);
+
+  // The integral stops at iLimit, either way
+  for (int i = 0; i < 100; i++) pid.update(1, 0.5f, 0.01f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.5f, pid.i());
+  for (int i = 0; i < 300; i++) pid.update(-1, 0.5f, 0.01f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, -0.5f, pid.i());
+
+  pid.reset();
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, pid.update(1, 0.5f, 0));
+}
+
+static void test_pid_derivative_on_measurement() {
+  PidController pid(PidGains{0, 0, 0.1f, 0, 0});
+  // No derivative on the first sample, nor when only the setpoint steps
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0, pid.update(0, 0, 0.01f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0, pid.update(1, 0, 0.01f));
+  // A rising measurement pushes back
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, -1.0f, pid.update(1, 0.1f, 0.01f));
+
+  // The cutoff lets a step in rate through gradually
+  PidController filtered(PidGains{0, 0, 0.1f, 0, 20});
+  filtered.update(0, 0, 0.001f);
+  float first = filtered.update(0, 0.01f, 0.001f);
+  TEST_ASSERT_LESS_THAN(0, first);
+  TEST_ASSERT_GREATER_THAN(-0.5f, first);
+  float d = first;
+  for (int i = 2; i < 200; i++) d = filtered.update(0, 0.01f * i, 0.001f);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, -1.0f, d);
+}
+
+static void test_mix_quad_x_axes() {
+  // Motors front left, front right, rear right, rear left
+  uint16_t out[4];
+  const float pitch[3] = {0, 10, 0};
+  mixQuadX(100, pitch, out);
+  const uint16_t pitchUp[4] = {110, 110, 90, 90};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(pitchUp, out, 4);
+
+  const float roll[3] = {0, 0, 10};
+  mixQuadX(100, roll, out);
+  const uint16_t rollRight[4] = {110, 90, 90, 110};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(rollRight, out, 4);
+
+  const float yaw[3] = {10, 0, 0};
+  mixQuadX(100, yaw, out);
+  const uint16_t yawed[4] = {110, 90, 110, 90};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(yawed, out, 4);
+
+  const float none[3] = {0, 0, 0};
+  mixQuadX(100, none, out, 1.2f);
+  const uint16_t scaled[4] = {120, 120, 120, 120};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(scaled, out, 4);
+}
+
+static void test_mix_quad_x_limits() {
+  uint16_t out[4];
+  // Over MOTOR_MAX the set moves down together, keeping the correction
+  const float pitch[3] = {0, 20, 0};
+  mixQuadX(250, pitch, out);
+  const uint16_t shifted[4] = {MOTOR_MAX, MOTOR_MAX, MOTOR_MAX - 40, MOTOR_MAX - 40};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(shifted, out, 4);
+
+  // Below MOTOR_MIN a motor clamps
+  const float roll[3] = {0, 0, 30};
+  mixQuadX(10, roll, out);
+  const uint16_t clamped[4] = {40, MOTOR_MIN, MOTOR_MIN, 40};
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(clamped, out, 4);
+}
+
+static void test_telemetry_sample_round_trip() {
+  const float ypr[3] = {90 * DEG, -12.34f * DEG, 0.5f * DEG};
+  const uint16_t motor[4] = {0, 17, 128, MOTOR_MAX};
+  TelemetrySample s;
+  fillTelemetrySample(s, 123456789, ypr, motor, 2500);
+  TEST_ASSERT_EQUAL_UINT32(123456789, s.timeUs);
+  TEST_ASSERT_EQUAL_INT16(9000, s.ypr[0]);
+  TEST_ASSERT_EQUAL_INT16(-1234, s.ypr[1]);
+  TEST_ASSERT_EQUAL_INT16(50, s.ypr[2]);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(motor, s.motor, 4);
+  TEST_ASSERT_EQUAL_UINT16(2500, s.loopUs);
+  TEST_ASSERT_EQUAL_UINT16(0, s.droppedFrames);
+
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t len = telemetryEncodeFrame(TELEMETRY_TYPE_SAMPLE, 7, &s, sizeof(s), frame);
+  TEST_ASSERT_GREATER_THAN(sizeof(s), len);
+  TelemetryDecoder decoder;
+  int frames = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (!decoder.push(frame[i])) continue;
+    frames++;
+    TEST_ASSERT_EQUAL_UINT8(TELEMETRY_TYPE_SAMPLE, decoder.type());
+    TEST_ASSERT_EQUAL_UINT8(7, decoder.seq());
+    TEST_ASSERT_EQUAL(sizeof(s), decoder.payloadLength());
+    TEST_ASSERT_EQUAL_MEMORY(&s, decoder.payload(), sizeof(s));
+  }
+  TEST_ASSERT_EQUAL(1, frames);
+
+  // A flipped bit fails the CRC
+  frame[len / 2] ^= 0x10;
+  TelemetryDecoder corrupt;
+  for (size_t i = 0; i < len; i++) TEST_ASSERT_FALSE(corrupt.push(frame[i]));
+}
+
+static void test_blackbox_record_round_trip() {
+  AttitudeController controller;
+  const float setpoint[3] = {0, 5 * DEG, -3 * DEG};
+  const float ypr[3] = {0, 0, 0};
+  const float rates[3] = {0, 0.1f, 0};
+  float axis[3];
+  controller.update(setpoint, ypr, rates, 0.005f, axis);
+
+  ImuSample imu = {{16384, 0, 0, 0}, {-3, 40, 7}, {100, -200, 8192}, {0, 0, 0}};
+  const uint16_t motor[4] = {1000, 1010, 990, 1005};
+  BlackboxRecord records[BLACKBOX_BLOCK_RECORDS];
+  for (int i = 0; i < BLACKBOX_BLOCK_RECORDS; i++) {
+    imu.gyro[0] = (int16_t)(i * 37);
+    fillBlackboxRecord(records[i], 1000 * i, imu, motor, i & 1 ? &controller : nullptr);
+  }
+  TEST_ASSERT_EQUAL_INT16(500, records[1].setpoint[1]);
+  TEST_ASSERT_EQUAL_INT16(-300, records[1].setpoint[2]);
+  TEST_ASSERT_EQUAL_INT16(lrintf(controller.ratePid(1).p() * 10), records[1].pid[1][0]);
+  TEST_ASSERT_EQUAL_INT16(0, records[0].setpoint[1]);
+  TEST_ASSERT_EQUAL_INT16_ARRAY(imu.accel, records[0].accel, 3);
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(motor, records[0].motor, 4);
+
+  static uint8_t payload[BLACKBOX_MAX_PAYLOAD];
+  size_t bytes = blackboxEncodeBlock(records, BLACKBOX_BLOCK_RECORDS, payload, sizeof(payload));
+  TEST_ASSERT_GREATER_THAN(0, bytes);
+  BlackboxRecord decoded[BLACKBOX_BLOCK_RECORDS];
+  TEST_ASSERT_TRUE(blackboxDecodeBlock(payload, bytes, BLACKBOX_BLOCK_RECORDS, decoded));
+  TEST_ASSERT_EQUAL_MEMORY(records, decoded, sizeof(records));
+  TEST_ASSERT_FALSE(blackboxDecodeBlock(payload, bytes - 1, BLACKBOX_BLOCK_RECORDS, decoded));
+  TEST_ASSERT_EQUAL(0, blackboxEncodeBlock(records, BLACKBOX_BLOCK_RECORDS, payload, 16));
+}
+
+static void test_sag_compensation_holds_thrust() {
+  // Thrust taken as proportional to (duty * volts)^2: compensated, it stays
+  // within 1% of the thrust at the reference voltage down to minVolts
+  const SagCompensation c = {3.8f, 3.3f, 1.25f};
+  const uint16_t duty = 160;
+  for (int mv = 4200; mv > 3000; mv -= 100) {
+    float v = mv / 1000.0f;
+    float gain = sagCompensationGain(c, v);
+    uint16_t in[4] = {duty, duty, duty, duty}, out[4];
+    scaleMotors(in, gain, out);
+    float outDuty = out[0] * ((float)MOTOR_MAX / MOTOR_OUTPUT_MAX);
+    float thrust = (outDuty * v) * (outDuty * v) / ((duty * c.referenceVolts) * (duty * c.referenceVolts));
+    if (v >= c.minVolts) TEST_ASSERT_FLOAT_WITHIN(0.01f, 1, thrust);
+    else TEST_ASSERT_FLOAT_WITHIN(1e-6f, c.referenceVolts / c.minVolts, gain);
+  }
+}
+
+static void test_sag_compensation_limits() {
+  const SagCompensation c = {3.8f, 2.5f, 1.25f};
+  // No reading, no change
+  TEST_ASSERT_EQUAL_FLOAT(1, sagCompensationGain(c, 0));
+  TEST_ASSERT_EQUAL_FLOAT(1.25f, sagCompensationGain(c, 2.8f));
+  TEST_ASSERT_LESS_THAN(1, sagCompensationGain(c, 4.2f));
+
+  // Outputs saturate at MOTOR_OUTPUT_MAX
+  const uint16_t in[4] = {0, 100, 250, MOTOR_MAX};
+  uint16_t out[4];
+  scaleMotors(in, 1.25f, out);
+  TEST_ASSERT_EQUAL_UINT16(0, out[0]);
+  TEST_ASSERT_EQUAL_UINT16(lrintf(125.0f * MOTOR_OUTPUT_MAX / MOTOR_MAX), out[1]);
+  TEST_ASSERT_EQUAL_UINT16(MOTOR_OUTPUT_MAX, out[2]);
+  TEST_ASSERT_EQUAL_UINT16(MOTOR_OUTPUT_MAX, out[3]);
+}
+
+// Gain of the filter chain at hz, from the RMS of a settled sine through it
+static float notchGain(const float rpm[4], float sampleHz, float hz) {
+  RpmNotchFilter filter;
+  filter.update(rpm, sampleHz);
+  double in = 0, out = 0;
+  int settle = (int)sampleHz, total = 3 * (int)sampleHz;
+  for (int i = 0; i < total; i++) {
+    float x = sinf(2 * (float)M_PI * hz * i / sampleHz);
+    float gyro[3] = {x, -x, 0.5f * x};
+    filter.apply(gyro);
+    if (i < settle) continue;
+    in += x * x;
+    out += gyro[0] * gyro[0];
+  }
+  return sqrt(out / in);
+}
+
+static void test_rpm_notch() {
+  // Four motors near 12000 RPM (200 Hz) with a 1 kHz gyro: the first two
+  // harmonics are notched, the third is over the 450 Hz limit
+  const float rpm[4] = {12000, 11400, 12600, 13200};
+  const float sampleHz = 1000;
+  RpmNotchFilter filter;
+  filter.update(rpm, sampleHz);
+  TEST_ASSERT_EQUAL(8, filter.active());
+  TEST_ASSERT_LESS_THAN(0.1f, notchGain(rpm, sampleHz, rpm[0] / 60));
+  TEST_ASSERT_LESS_THAN(0.1f, notchGain(rpm, sampleHz, 2 * rpm[2] / 60));
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 1, notchGain(rpm, sampleHz, 10));
+}
+
+static void test_rpm_notch_off() {
+  // Stopped motors leave the gyro alone
+  const float stopped[4] = {0, 0, 0, 0};
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1, notchGain(stopped, 1000, 100));
+  // Idling, the fundamental is under minHz and only the harmonics are on
+  const float idle[4] = {2000, 2000, 0, 2100};
+  RpmNotchFilter filter;
+  filter.update(idle, 1000);
+  TEST_ASSERT_EQUAL(6, filter.active());
+  filter.update(stopped, 1000);
+  TEST_ASSERT_EQUAL(0, filter.active());
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 6000, erpmToRpm(42000, 14));
+}
+
+// Failsafe gain: full until the timeout, falling steadily to zero at the
+// cutoff and staying there
+static void test_failsafe_ramp() {
+  const FailsafeConfig c = {500000, 500000};
+  float previous = 1;
+  for (uint32_t us = 0; us <= 2000000; us += 1000) {
+    float gain = failsafeGain(c, us);
+    if (us < c.timeoutUs) TEST_ASSERT_EQUAL_FLOAT(1, gain);
+    else if (us >= c.timeoutUs + c.rampUs) TEST_ASSERT_EQUAL_FLOAT(0, gain);
+    else TEST_ASSERT_LESS_OR_EQUAL(previous, gain);
+    previous = gain;
+  }
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 0.5f, failsafeGain(c, c.timeoutUs + c.rampUs / 2));
+}
+
+static void test_failsafe_cut_without_ramp() {
+  const FailsafeConfig cut = {500000, 0};
+  TEST_ASSERT_EQUAL_FLOAT(1, failsafeGain(cut, 499999));
+  TEST_ASSERT_EQUAL_FLOAT(0, failsafeGain(cut, 500000));
+  TEST_ASSERT_EQUAL_FLOAT(0, failsafeGain(cut, UINT32_MAX));
+}
+
+static const PreArmLimits armLimits = {100000, 0.1f, 0.44f, 0};
+static const PreArmInputs armReady = {5000, true, 198, 200, 0.05f, -0.1f, 0};
+
+// Mask of the checks failing on in, as the arming task evaluates them
+static uint8_t failingChecks(const PreArmInputs &in) {
+  uint8_t mask = 0;
+  for (int c = 0; c < PREARM_CHECK_COUNT; c++) {
+    if (!preArmPasses((PreArmCheck)c, in, armLimits)) mask |= 1 << c;
+  }
+  return mask;
+}
+
+static void test_prearm_checks() {
+  TEST_ASSERT_EQUAL_HEX16(0, failingChecks(armReady));
+  // Each input out of range fails exactly its own check
+  PreArmInputs bad[PREARM_CHECK_COUNT] = {armReady, armReady, armReady, armReady, armReady};
+  bad[PREARM_IMU].sampleAgeUs = 200000;
+  bad[PREARM_CALIBRATION].calibrated = false;
+  bad[PREARM_LOOP_RATE].rateHz = 150;
+  bad[PREARM_LEVEL].roll = 0.6f;
+  bad[PREARM_THROTTLE].throttle = 40;
+  for (int c = 0; c < PREARM_CHECK_COUNT; c++) {
+    TEST_ASSERT_EQUAL_HEX16(1 << c, failingChecks(bad[c]));
+  }
+}
+
+static void test_sample_age() {
+  // A sample stamped just after the arming task read the clock is fresh,
+  // also across the micros() wrap; an old one is stale across it too
+  TEST_ASSERT_EQUAL_UINT32(0, sampleAgeUs(1000, 1200));
+  TEST_ASSERT_EQUAL_UINT32(0, sampleAgeUs(0xFFFFFFF0u, 50));
+  TEST_ASSERT_EQUAL_UINT32(356, sampleAgeUs(100, 0xFFFFFF00u));
+  TEST_ASSERT_EQUAL_UINT32(150000, sampleAgeUs(150000, 0));
+  PreArmInputs newer = armReady;
+  newer.sampleAgeUs = sampleAgeUs(1000, 1200);
+  TEST_ASSERT_EQUAL_HEX16(0, failingChecks(newer));
+}
+
+static void test_arming_sequence() {
+  PreArmInputs throttleUp = armReady, noImu = armReady;
+  throttleUp.throttle = 40;
+  noImu.sampleAgeUs = 200000;
+
+  ArmingStateMachine m(500);
+  TEST_ASSERT_FALSE(m.requestArm(failingChecks(throttleUp), 0));
+  TEST_ASSERT_EQUAL(ARM_DISARMED, m.state());
+  TEST_ASSERT_TRUE(m.requestArm(0, 1000));
+  TEST_ASSERT_FALSE(m.requestArm(0, 1001));
+  TEST_ASSERT_EQUAL(ARM_ARMING, m.update(0, 1400));
+  TEST_ASSERT_EQUAL(ARM_ARMED, m.update(0, 1500));
+  // Throttle going up once armed is flying, not a failure
+  TEST_ASSERT_EQUAL(ARM_ARMED, m.update(failingChecks(throttleUp), 1600));
+  // Losing the IMU is a failsafe, which only a disarm leaves
+  TEST_ASSERT_EQUAL(ARM_FAILSAFE, m.update(failingChecks(noImu), 1700));
+  TEST_ASSERT_EQUAL(ARM_FAILSAFE, m.update(0, 1800));
+  m.disarm();
+  TEST_ASSERT_EQUAL(ARM_DISARMED, m.state());
+}
+
+static void test_arming_aborts() {
+  PreArmInputs tilted = armReady;
+  tilted.roll = 0.6f;
+  ArmingStateMachine m(500);
+  // A check failing while arming aborts it
+  TEST_ASSERT_TRUE(m.requestArm(0, 2000));
+  TEST_ASSERT_EQUAL(ARM_DISARMED, m.update(failingChecks(tilted), 2100));
+  // and losing the link while arming is a failsafe
+  TEST_ASSERT_TRUE(m.requestArm(0, 3000));
+  m.failsafe();
+  TEST_ASSERT_EQUAL(ARM_FAILSAFE, m.state());
+  // Disarmed, a link loss changes nothing
+  m.disarm();
+  m.failsafe();
+  TEST_ASSERT_EQUAL(ARM_DISARMED, m.state());
+}
+
+// Runs the autotune on pitch against K e^(-theta s) / s, sampled at 1 kHz,
+// until it stops
+static void runAutotune(RelayAutotune &tune, float K, float theta) {
+  const float dt = 0.001f;
+  std::vector<float> pipe((int)lrintf(theta / dt), 0);
+  tune.begin(1, DEFAULT_ATTITUDE_GAINS, 0);
+  float rate = 0, angle = 0;
+  for (int i = 0; tune.running(); i++) {
+    float u = tune.update(-angle, rate, dt);
+    pipe.push_back(u);
+    rate += K * pipe[i] * dt;
+    angle += rate * dt;
+  }
+}
+
+static void test_autotune_fits_plant() {
+  // It should find K and theta again, to within the describing function's
+  // error, and propose gains from them
+  const float K = 8, theta = 0.03f;
+  RelayAutotune tune;
+  runAutotune(tune, K, theta);
+  TEST_ASSERT_EQUAL(AUTOTUNE_DONE, tune.state());
+  const AutotuneResult &r = tune.result();
+  TEST_ASSERT_FLOAT_WITHIN(0.15f * K, K, r.plantGain);
+  TEST_ASSERT_FLOAT_WITHIN(0.15f * theta, theta, r.delayS);
+  TEST_ASSERT_EQUAL(DEFAULT_AUTOTUNE.measureCycles, r.cycles);
+
+  // The proposal changes the tuned axis only, keeping its derivative
+  AttitudeGains g = tune.proposed(DEFAULT_ATTITUDE_GAINS);
+  TEST_ASSERT_EQUAL_FLOAT(r.rate.kp, g.rate[1].kp);
+  TEST_ASSERT_EQUAL_FLOAT(r.rate.ki, g.rate[1].ki);
+  TEST_ASSERT_EQUAL_FLOAT(DEFAULT_ATTITUDE_GAINS.rate[1].kd, g.rate[1].kd);
+  TEST_ASSERT_EQUAL_FLOAT(r.angleKp, g.angleKp[1]);
+  TEST_ASSERT_LESS_OR_EQUAL(DEFAULT_AUTOTUNE.headroom * 1.0001f, g.rate[1].kp * g.maxRate[1]);
+  TEST_ASSERT_EQUAL_MEMORY(&DEFAULT_ATTITUDE_GAINS.rate[2], &g.rate[2], sizeof(PidGains));
+  TEST_ASSERT_EQUAL_FLOAT(DEFAULT_ATTITUDE_GAINS.angleKp[0], g.angleKp[0]);
+}
+
+static void test_autotune_stops() {
+  RelayAutotune tune;
+  // Tipping past maxAngle aborts, and the output goes back to trim
+  tune.begin(2, DEFAULT_ATTITUDE_GAINS, 5);
+  TEST_ASSERT_TRUE(tune.running());
+  tune.update(0, 0, 0.001f);
+  TEST_ASSERT_EQUAL_FLOAT(5, tune.update(DEFAULT_AUTOTUNE.maxAngle * 1.1f, 0, 0.001f));
+  TEST_ASSERT_EQUAL(AUTOTUNE_FAILED, tune.state());
+
+  // No oscillation before the timeout fails too
+  tune.begin(2, DEFAULT_ATTITUDE_GAINS, 0);
+  for (int i = 0; i < 10000 && tune.running(); i++) tune.update(0, 0, 0.001f);
+  TEST_ASSERT_EQUAL(AUTOTUNE_FAILED, tune.state());
+  TEST_ASSERT_GREATER_THAN(DEFAULT_AUTOTUNE.timeoutS, tune.elapsedS());
+
+  // Cancelled, nothing is proposed
+  tune.begin(0, DEFAULT_ATTITUDE_GAINS, 0);
+  tune.cancel();
+  TEST_ASSERT_EQUAL(AUTOTUNE_IDLE, tune.state());
+  AttitudeGains g = tune.proposed(DEFAULT_ATTITUDE_GAINS);
+  TEST_ASSERT_EQUAL_MEMORY(&DEFAULT_ATTITUDE_GAINS, &g, sizeof(g));
+}
+
+static void test_sample_rate() {
+  SampleRate rate;
+  rate.setNominal(200);
+  // Nominal until a few intervals have arrived
+  uint32_t t = 0xFFFFF000u;   // across the micros() wrap
+  for (int i = 0; i < 5; i++, t += 10000) rate.sample(t);
+  TEST_ASSERT_EQUAL_FLOAT(200, rate.hz());
+  for (int i = 0; i < 100; i++, t += 10000) rate.sample(t);
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 100, rate.hz());
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.01f, rate.dt());
+
+  // A stall is not a rate change
+  t += 200000;
+  rate.sample(t);
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 100, rate.hz());
+
+  // A new nominal rate starts over
+  rate.setNominal(50);
+  TEST_ASSERT_EQUAL_FLOAT(50, rate.hz());
+  rate.setNominal(0);
+  TEST_ASSERT_EQUAL_FLOAT(100, rate.nominalHz());
+}
+
+// Readings of a field of the given radius turned through every direction,
+// bent by soft iron (per axis scale) and shifted by hard iron
+static void sweepField(MagCalibrator &calibrator, float radius, const float hard[3], const float soft[3], int axes) {
+  calibrator.begin();
+  for (int lat = -80; lat <= 80; lat += 10) {
+    for (int lon = 0; lon < 360; lon += 10) {
+      float f[3] = {cosf(lat * DEG) * cosf(lon * DEG), cosf(lat * DEG) * sinf(lon * DEG), sinf(lat * DEG)};
+      int16_t mag[3];
+      for (int k = 0; k < 3; k++) {
+        float v = k < axes ? f[k] : 0.1f * f[k];
+        mag[k] = (int16_t)lrintf(radius * v * soft[k] + hard[k]);
+      }
+      calibrator.addSample(mag);
+    }
+  }
+}
+
+static void test_mag_calibrator_fit() {
+  const float hard[3] = {40, -23, 13}, soft[3] = {1.08f, 0.95f, 1.0f};
+  MagCalibrator calibrator;
+  sweepField(calibrator, 160, hard, soft, 3);
+  MagCalibration cal;
+  TEST_ASSERT_TRUE(calibrator.finish(cal));
+  for (int k = 0; k < 3; k++) TEST_ASSERT_FLOAT_WITHIN(2, hard[k], cal.offset[k]);
+  TEST_ASSERT_FLOAT_WITHIN(8, 160, cal.radius);
+  // Corrected readings lie on the sphere
+  for (int lon = 0; lon < 360; lon += 45) {
+    float f[3] = {cosf(lon * DEG), 0, sinf(lon * DEG)};
+    float norm2 = 0;
+    for (int k = 0; k < 3; k++) {
+      float m = (lrintf(160 * f[k] * soft[k] + hard[k]) - cal.offset[k]) * cal.scale[k];
+      norm2 += m * m;
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.03f * cal.radius, cal.radius, sqrtf(norm2));
+  }
+}
+
+static void test_mag_calibrator_rejects() {
+  const float hard[3] = {0, 0, 0}, soft[3] = {1, 1, 1};
+  MagCalibrator calibrator;
+  MagCalibration cal;
+  // Too few samples
+  calibrator.begin();
+  const int16_t one[3] = {100, 0, 0};
+  for (int i = 0; i < 10; i++) calibrator.addSample(one);
+  TEST_ASSERT_FALSE(calibrator.finish(cal));
+  // Turned so z barely sees the field
+  sweepField(calibrator, 160, hard, soft, 2);
+  TEST_ASSERT_FALSE(calibrator.finish(cal));
+}
+
+static void test_mag_heading_holds_yaw() {
+  const MagCalibration cal = {{0, 0, 0}, {1, 1, 1}, 100};
+  const int16_t mag[3] = {60, 80, 0};     // horizontal field, airframe level and still
+  AttitudeEstimator estimator;
+  estimator.setMagCalibration(cal);
+  int16_t quat[4];
+  quatFromYpr(0, 0, 0, quat);
+  estimator.update(quat);
+  TEST_ASSERT_FALSE(estimator.magAided());
+  // A reading far off the calibrated field strength is ignored
+  const int16_t disturbed[3] = {200, 200, 0};
+  estimator.updateMag(disturbed);
+  TEST_ASSERT_FALSE(estimator.magAided());
+  estimator.updateMag(mag);
+  TEST_ASSERT_TRUE(estimator.magAided());
+  float yaw = estimator.ypr()[0];
+
+  // The DMP's yaw drifts 20 degrees while nothing moves: the heading pulls
+  // the estimate back
+  quatFromYpr(20 * DEG, 0, 0, quat);
+  for (int i = 0; i < 1000; i++) {
+    estimator.update(quat);
+    estimator.updateMag(mag);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.5f * DEG, yaw, estimator.ypr()[0]);
+
+  // Without a calibration the DMP's yaw stands
+  AttitudeEstimator plain;
+  plain.update(quat);
+  plain.updateMag(mag);
+  TEST_ASSERT_FALSE(plain.magAided());
+  TEST_ASSERT_FLOAT_WITHIN(0.2f * DEG, 20 * DEG, plain.ypr()[0]);
+}
+
+static void test_virtual_clock() {
+  VirtualClock clock(0xFFFFFFFFull - 500);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFu - 500, clock.micros());
+  clock.advance(1000);
+  // The 64-bit time keeps going where the Arduino views wrap
+  TEST_ASSERT_EQUAL_HEX64(0x100000000ull + 499, clock.nowUs());
+  TEST_ASSERT_EQUAL_UINT32(499, clock.micros());
+  TEST_ASSERT_EQUAL_UINT32(4294967, clock.millis());
+  uint32_t start = clock.micros() - 1000;
+  TEST_ASSERT_EQUAL_UINT32(1000, clock.micros() - start);
+
+  clock.delay(7);
+  TEST_ASSERT_EQUAL_HEX64(0x100000000ull + 7499, clock.nowUs());
+  VirtualClock late(1000ull * 0x100000000ull);
+  TEST_ASSERT_EQUAL_UINT32(0, late.millis());
+}
+
+// Imu that delivers a fixed sample on every nth read
+class StubImu : public Imu {
+public:
+  StubImu(const ImuSample &sample, int every) : sample_(sample), every_(every) {}
+  bool begin() override { return true; }
+  bool read(ImuSample &s) override {
+    reads++;
+    if (every_ == 0 || reads % every_) return false;
+    s = sample_;
+    return true;
+  }
+  int reads = 0;
+
+private:
+  ImuSample sample_;
+  int every_;
+};
+
+static void test_calibrate_level_on_clock() {
+  ImuSample sample = {};
+  quatFromYpr(0, 2 * DEG, 1 * DEG, sample.quat);
+  VirtualClock clock;
+  AttitudeEstimator estimator;
+  // Every other read has a sample: 20 of them take 40 reads, 50 ms apart
+  StubImu imu(sample, 2);
+  TEST_ASSERT_TRUE(calibrateLevel(imu, clock, estimator, 20, 50));
+  TEST_ASSERT_EQUAL(40, imu.reads);
+  TEST_ASSERT_EQUAL_UINT32(2000, clock.millis());
+  TEST_ASSERT_FLOAT_WITHIN(0.1f * DEG, 2 * DEG, estimator.levelOffset()[1]);
+
+  // No samples at all: gives up after four times as many attempts
+  StubImu dead(sample, 0);
+  VirtualClock other;
+  AttitudeEstimator fresh;
+  TEST_ASSERT_FALSE(calibrateLevel(dead, other, fresh, 20, 50));
+  TEST_ASSERT_EQUAL(80, dead.reads);
+  TEST_ASSERT_EQUAL_UINT32(4000, other.millis());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ypr_from_quaternion);
+  RUN_TEST(test_estimator_level_calibration);
+  RUN_TEST(test_mag_calibrator_fit);
+  RUN_TEST(test_mag_calibrator_rejects);
+  RUN_TEST(test_mag_heading_holds_yaw);
+  RUN_TEST(test_virtual_clock);
+  RUN_TEST(test_calibrate_level_on_clock);
+  RUN_TEST(test_sample_rate);
+  RUN_TEST(test_pid_terms);
+  RUN_TEST(test_pid_derivative_on_measurement);
+  RUN_TEST(test_mix_quad_x_axes);
+  RUN_TEST(test_mix_quad_x_limits);
+  RUN_TEST(test_sag_compensation_holds_thrust);
+  RUN_TEST(test_sag_compensation_limits);
+  RUN_TEST(test_rpm_notch);
+  RUN_TEST(test_rpm_notch_off);
+  RUN_TEST(test_failsafe_ramp);
+  RUN_TEST(test_failsafe_cut_without_ramp);
+  RUN_TEST(test_prearm_checks);
+  RUN_TEST(test_sample_age);
+  RUN_TEST(test_arming_sequence);
+  RUN_TEST(test_arming_aborts);
+  RUN_TEST(test_autotune_fits_plant);
+  RUN_TEST(test_autotune_stops);
+  RUN_TEST(test_telemetry_sample_round_trip);
+  RUN_TEST(test_blackbox_record_round_trip);
+  return UNITY_END();
+}
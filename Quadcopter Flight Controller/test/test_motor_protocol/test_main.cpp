@@ -0,0 +1,223 @@
+// Unit tests for the ESC signal encoders (motor_protocol.h): the DShot frame
+// and its checksum, the RMT items of every protocol read back by an
+// independent decode, and the bidirectional DShot eRPM reply decoder
+//
+// pio test -e native
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <unity.h>
+
+#include "motor_protocol.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Reads an RMT item sequence back: the DShot frame from the high times, or
+// the pulse width in ticks. Returns false if the items are malformed.
+static bool decodeRmt(const uint32_t *items, size_t n, uint16_t bitTicks, uint32_t &value) {
+  if (n == 0 || items[n - 1] != 0) return false;
+  value = 0;
+  for (size_t i = 0; i + 1 < n; i++) {
+    uint32_t high = items[i] & 0x7FFF, low = (items[i] >> 16) & 0x7FFF;
+    bool levels = (items[i] >> 15 & 1) == 1 && (items[i] >> 31) == 0;
+    if (!levels) return false;
+    if (!bitTicks) {
+      value += high;
+      continue;
+    }
+    if (high + low != bitTicks) return false;
+    value = value << 1 | (high > bitTicks / 2 ? 1 : 0);
+  }
+  return true;
+}
+
+static void test_dshot_reference_frame() {
+  // The frame from the DShot write-ups: throttle 1046, no telemetry
+  TEST_ASSERT_EQUAL_HEX16(0x82C6, dshotFrame(1046, false));
+  TEST_ASSERT_EQUAL_HEX16(0x82D7, dshotFrame(1046, true));
+  // and with the checksum inverted for bidirectional DShot
+  TEST_ASSERT_EQUAL_HEX16(0x82C9, dshotFrame(1046, false, true));
+}
+
+static void test_dshot_value_mapping() {
+  TEST_ASSERT_EQUAL_UINT16(0, dshotValue(0));
+  TEST_ASSERT_EQUAL_UINT16(DSHOT_THROTTLE_MIN, dshotValue(1));
+  TEST_ASSERT_EQUAL_UINT16(DSHOT_THROTTLE_MAX, dshotValue(MOTOR_OUTPUT_MAX));
+  TEST_ASSERT_EQUAL_UINT16(DSHOT_THROTTLE_MAX, dshotValue(MOTOR_OUTPUT_MAX + 100));
+}
+
+// Every output encodes to 16 bits of DShot with a valid checksum, stop at
+// 0 and the throttle rising with the output
+static void checkDshot(MotorProtocol protocol, uint16_t bitTicks) {
+  uint16_t previous = 0;
+  for (uint16_t out = 0; out <= MOTOR_OUTPUT_MAX; out++) {
+    uint32_t items[MOTOR_MAX_ITEMS], value;
+    size_t n = motorEncodeRmt(protocol, out, items);
+    TEST_ASSERT_EQUAL(17, n);
+    TEST_ASSERT_TRUE(decodeRmt(items, n, bitTicks, value));
+    // Checksum recomputed nibble by nibble
+    uint16_t data = value >> 4, crc = 0;
+    for (int k = 0; k < 3; k++) crc ^= (data >> (4 * k)) & 0xF;
+    TEST_ASSERT_EQUAL_HEX16(crc, value & 0xF);
+    TEST_ASSERT_EQUAL(0, data & 1);
+    uint16_t v = data >> 1;
+    if (out == 0) {
+      TEST_ASSERT_EQUAL_UINT16(0, v);
+    } else {
+      TEST_ASSERT_GREATER_OR_EQUAL(DSHOT_THROTTLE_MIN, v);
+      TEST_ASSERT_LESS_OR_EQUAL(DSHOT_THROTTLE_MAX, v);
+      TEST_ASSERT_GREATER_THAN(previous, v);
+    }
+    previous = v;
+  }
+}
+
+static void test_dshot300_encoding() {
+  checkDshot(MOTOR_DSHOT300, 267);
+}
+
+static void test_dshot600_encoding() {
+  checkDshot(MOTOR_DSHOT600, 133);
+}
+
+// A single pulse per update, minTicks at 0 to maxTicks at full output
+static void checkPulse(MotorProtocol protocol, uint32_t minTicks, uint32_t maxTicks) {
+  uint32_t previous = 0;
+  for (uint16_t out = 0; out <= MOTOR_OUTPUT_MAX; out++) {
+    uint32_t items[MOTOR_MAX_ITEMS], value;
+    size_t n = motorEncodeRmt(protocol, out, items);
+    TEST_ASSERT_EQUAL(2, n);
+    TEST_ASSERT_TRUE(decodeRmt(items, n, 0, value));
+    TEST_ASSERT_GREATER_OR_EQUAL(previous, value);
+    if (out == 0) TEST_ASSERT_EQUAL_UINT32(minTicks, value);
+    if (out == MOTOR_OUTPUT_MAX) TEST_ASSERT_EQUAL_UINT32(maxTicks, value);
+    previous = value;
+  }
+}
+
+static void test_oneshot125_encoding() {
+  checkPulse(MOTOR_ONESHOT125, 10000, 20000);
+}
+
+static void test_multishot_encoding() {
+  checkPulse(MOTOR_MULTISHOT, 400, 2000);
+}
+
+static void test_pwm_is_not_rmt() {
+  uint32_t items[MOTOR_MAX_ITEMS];
+  TEST_ASSERT_EQUAL(0, motorEncodeRmt(MOTOR_PWM, 1000, items));
+  TEST_ASSERT_FALSE(motorProtocolBidirectional(MOTOR_DSHOT600));
+  TEST_ASSERT_TRUE(motorProtocolBidirectional(MOTOR_DSHOT600_BIDIR));
+}
+
+// Line capture as the RMT receiver records it: the inverted frame for this
+// output, a gap of gapUs, then the reply's line bits (dshotReplyBits) with
+// the ESC's clock off by skew and each edge moved by up to jitter bits. No
+// ESC captures are kept in the repo, so the decoder is tested on these.
+static size_t synthesizeCapture(MotorProtocol protocol, uint16_t output, uint32_t bits, float gapUs, float skew,
+                                float jitter, uint32_t *items) {
+  size_t n = motorEncodeRmt(protocol, output, items) - 1;
+  uint32_t runs[24];
+  int count = 0;
+  float bitTicks = dshotReplyBitTicks(protocol) * (1 + skew);
+  int len = 0;
+  for (int i = 20; i >= 0; i--) {
+    if ((bits >> i) & 1 && len) {
+      runs[count++] = len;
+      len = 0;
+    }
+    len++;
+  }
+  runs[count++] = len;
+
+  // The gap joins the high end of the frame's last bit
+  uint32_t last = items[n - 1];
+  items[n - 1] = (last & 0xFFFF) | (((last >> 16 & 0x7FFF) + (uint32_t)(gapUs * MOTOR_RMT_TICK_HZ / 1e6f)) << 16) |
+                 1u << 31;
+  // Reply runs alternate low, high, ...; the last high run is the idle line,
+  // which the receiver ends with a zero duration
+  float edge = 0, previous = 0;
+  int at = 0;
+  for (int r = 0; r < count; r++) {
+    at += runs[r];
+    bool low = (r & 1) == 0;
+    uint32_t ticks = 0;
+    if (low || r < count - 1) {
+      edge = at * bitTicks + jitter * bitTicks * (2 * (rand() / (float)RAND_MAX) - 1);
+      ticks = (uint32_t)(edge - previous);
+      previous = edge;
+    }
+    if (low) items[n] = ticks;
+    else items[n++] |= (ticks | 0x8000) << 16;
+  }
+  if (count & 1) items[n++] |= 0x8000u << 16;
+  items[n++] = 0;
+  return n;
+}
+
+static const MotorProtocol bidirectional[] = {MOTOR_DSHOT300_BIDIR, MOTOR_DSHOT600_BIDIR};
+
+// Stopped, then 1000 to 200000 eRPM (under 100 to over 28000 RPM on a 14
+// pole motor), each with a random output, gap, clock error and edge jitter
+static void test_erpm_reply_round_trip() {
+  srand(1);
+  for (MotorProtocol p : bidirectional) {
+    for (uint32_t erpm = 0; erpm <= 200000; erpm = erpm ? erpm * 1.01f : 1000) {
+      for (int trial = 0; trial < 8; trial++) {
+        uint32_t items[64], got = 0;
+        float skew = 0.03f * (2 * (rand() / (float)RAND_MAX) - 1);
+        size_t n = synthesizeCapture(p, rand() % (MOTOR_OUTPUT_MAX + 1), dshotReplyBits(erpm), 25 + rand() % 10, skew,
+                                     0.15f, items);
+        TEST_ASSERT_EQUAL(DSHOT_REPLY_OK, dshotDecodeReply(p, items, n, got));
+        // The 9-bit mantissa rounds the period: up to 1/256 off
+        if (erpm == 0) TEST_ASSERT_EQUAL_UINT32(0, got);
+        else TEST_ASSERT_FLOAT_WITHIN(erpm * 0.004f, erpm, got);
+      }
+    }
+  }
+}
+
+// Every single line bit of the reply flipped. The checksum only covers
+// nibbles, so an error spread over two may still get through; nine in ten
+// are caught.
+static void test_erpm_reply_corruption_rejected() {
+  for (MotorProtocol p : bidirectional) {
+    int corrupted = 0, rejected = 0;
+    for (uint32_t erpm = 1000; erpm <= 200000; erpm = erpm * 1.01f) {
+      for (int bit = 0; bit < 21; bit++) {
+        uint32_t items[64], got;
+        size_t n = synthesizeCapture(p, 1000, dshotReplyBits(erpm) ^ (1u << bit), 30, 0, 0, items);
+        corrupted++;
+        if (dshotDecodeReply(p, items, n, got) != DSHOT_REPLY_OK) rejected++;
+      }
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(corrupted * 9, rejected * 10);
+  }
+}
+
+static void test_erpm_reply_missing() {
+  for (MotorProtocol p : bidirectional) {
+    // A frame with no reply after it
+    uint32_t items[MOTOR_MAX_ITEMS], got;
+    size_t n = motorEncodeRmt(p, 1000, items);
+    TEST_ASSERT_EQUAL(DSHOT_REPLY_MISSING, dshotDecodeReply(p, items, n, got));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_dshot_reference_frame);
+  RUN_TEST(test_dshot_value_mapping);
+  RUN_TEST(test_dshot300_encoding);
+  RUN_TEST(test_dshot600_encoding);
+  RUN_TEST(test_oneshot125_encoding);
+  RUN_TEST(test_multishot_encoding);
+  RUN_TEST(test_pwm_is_not_rmt);
+  RUN_TEST(test_erpm_reply_round_trip);
+  RUN_TEST(test_erpm_reply_corruption_rejected);
+  RUN_TEST(test_erpm_reply_missing);
+  return UNITY_END();
+}
@@ -0,0 +1,167 @@
+// Tests of the I2Cdev MPU6050 driver against the emulated chip on the
+// simulated bus (tools/mpu6050_sim)
+//
+// pio test -e native_sim
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include "I2Cdev.h"
+#include "MPU6050_6Axis_MotionApps20.h"
+#include "mpu6050_emu.h"
+
+// Level, then a roll, a pitch and a yaw turn, then back to level
+static const MotionKeyframe trajectory[] = {
+  {0, 0, 0, 0},
+  {1000, 0, 0, 0},
+  {2000, 0, 0, 30},
+  {3000, 0, -20, 30},
+  {5000, 90, -20, 30},
+  {7000, 90, 0, 0},
+};
+
+static Mpu6050Emu *emu;
+static MPU6050 *mpu;
+
+void setUp() {
+  i2cdevSimReset();
+  emu = new Mpu6050Emu();
+  emu->setTrajectory(trajectory, sizeof(trajectory) / sizeof(trajectory[0]));
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, emu);
+  mpu = new MPU6050();
+  mpu->initialize();
+}
+
+void tearDown() {
+  delete mpu;
+  delete emu;
+}
+
+struct PollResult {
+  uint32_t calls = 0;
+  uint32_t packets = 0;
+  double errMax = 0;    // degrees
+};
+
+// Calls dmpGetCurrentFIFOPacket() once per simulated loop pass, comparing
+// the attitude it returns with the trajectory at that moment
+static PollResult poll(uint32_t loopUs, uint32_t seconds) {
+  PollResult r;
+  uint8_t fifoBuffer[64];
+  uint64_t end = i2cdevSimNowUs() + (uint64_t)seconds * 1000000;
+  while (i2cdevSimNowUs() < end) {
+    uint64_t passStart = i2cdevSimNowUs();
+    r.calls++;
+    if (mpu->dmpGetCurrentFIFOPacket(fifoBuffer)) {
+      Quaternion q;
+      VectorFloat gravity;
+      float ypr[3], truth[3], tq[4];
+      mpu->dmpGetQuaternion(&q, fifoBuffer);
+      mpu->dmpGetGravity(&gravity, &q);
+      mpu->dmpGetYawPitchRoll(ypr, &q, &gravity);
+      emu->quaternionAt(i2cdevSimNowUs(), tq);
+      Quaternion trueQ(tq[0], tq[1], tq[2], tq[3]);
+      mpu->dmpGetGravity(&gravity, &trueQ);
+      mpu->dmpGetYawPitchRoll(truth, &trueQ, &gravity);
+      for (int i = 0; i < 3; i++) {
+        double err = fabs(ypr[i] - truth[i]) * 180.0 / M_PI;
+        if (err > 180) err = 360 - err;
+        if (err > r.errMax) r.errMax = err;
+      }
+      r.packets++;
+    }
+    uint64_t spent = i2cdevSimNowUs() - passStart;
+    if (spent < loopUs) i2cdevSimAdvanceUs(loopUs - spent);
+  }
+  return r;
+}
+
+static void test_connection() {
+  TEST_ASSERT_TRUE(mpu->testConnection());
+  // Nothing answers at the other address
+  uint8_t id;
+  TEST_ASSERT_EQUAL(-1, I2Cdev::readByte(MPU6050_ADDRESS_AD0_HIGH, MPU6050_RA_WHO_AM_I, &id));
+  TEST_ASSERT_EQUAL_UINT32(1, i2cdevSimStats().nacks);
+}
+
+static void test_dmp_initialize() {
+  TEST_ASSERT_EQUAL_UINT8(0, mpu->dmpInitialize());
+  TEST_ASSERT_EQUAL_UINT32(100, emu->dmpRateHz());
+  TEST_ASSERT_EQUAL(42, emu->dmpPacketSize());
+  TEST_ASSERT_EQUAL(42, mpu->dmpGetFIFOPacketSize());
+}
+
+static void test_packets_follow_trajectory() {
+  TEST_ASSERT_EQUAL_UINT8(0, mpu->dmpInitialize());
+  mpu->setDMPEnabled(true);
+  PollResult r = poll(2500, 8);
+  // A packet every 10 ms, polled every 2.5
+  TEST_ASSERT_UINT32_WITHIN(5, 800, r.packets);
+  TEST_ASSERT_LESS_THAN(0.1, r.errMax);
+  TEST_ASSERT_EQUAL_UINT32(0, emu->stats().overflows);
+}
+
+static void test_fifo_overflow_recovers() {
+  TEST_ASSERT_EQUAL_UINT8(0, mpu->dmpInitialize());
+  mpu->setDMPEnabled(true);
+  // Polled slower than the FIFO fills: it overflows, misaligned, and the
+  // driver still returns a fresh packet on every call after the first
+  PollResult r = poll(300000, 3);
+  TEST_ASSERT_GREATER_THAN(0, emu->stats().overflows);
+  TEST_ASSERT_GREATER_THAN(0, emu->stats().fifoResets);
+  TEST_ASSERT_EQUAL_UINT32(r.calls - 1, r.packets);
+  TEST_ASSERT_LESS_THAN(0.1, r.errMax);
+}
+
+// Mean of the raw sensor outputs over a level, still stretch, 1 g taken
+// off accel z
+static void meanMotion(double mean[6]) {
+  int32_t sum[6] = {0, 0, 0, 0, 0, 0};
+  const int samples = 200;
+  for (int i = 0; i < samples; i++) {
+    int16_t v[6];
+    mpu->getMotion6(&v[0], &v[1], &v[2], &v[3], &v[4], &v[5]);
+    for (int k = 0; k < 6; k++) sum[k] += v[k];
+    i2cdevSimAdvanceUs(1000);
+  }
+  for (int k = 0; k < 6; k++) mean[k] = sum[k] / (double)samples;
+  mean[2] -= 16384;
+}
+
+static void test_calibrate_motion6() {
+  emu->setTrajectory(nullptr, 0);
+  double before[6], after[6];
+  meanMotion(before);
+  // The emulated biases are well off zero
+  TEST_ASSERT_GREATER_THAN(100, fabs(before[2]));
+  TEST_ASSERT_GREATER_THAN(20, fabs(before[3]));
+
+  uint64_t t0 = i2cdevSimNowUs();
+  mpu->CalibrateMotion6(3);
+  // Well under a second
+  TEST_ASSERT_LESS_THAN(500000, i2cdevSimNowUs() - t0);
+  meanMotion(after);
+  // Within the offset registers' resolution: a step is 16 accel LSB and 4 gyro LSB
+  for (int k = 0; k < 3; k++) TEST_ASSERT_FLOAT_WITHIN(16, 0, after[k]);
+  for (int k = 3; k < 6; k++) TEST_ASSERT_FLOAT_WITHIN(2, 0, after[k]);
+
+  // Starting again from what it found, the offsets stay put
+  int16_t found[6];
+  memcpy(found, mpu->GetActiveOffsets(), sizeof(found));
+  mpu->CalibrateMotion6(1);
+  int16_t *again = mpu->GetActiveOffsets();
+  for (int k = 0; k < 6; k++) TEST_ASSERT_INT_WITHIN(4, found[k], again[k]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_connection);
+  RUN_TEST(test_dmp_initialize);
+  RUN_TEST(test_packets_follow_trajectory);
+  RUN_TEST(test_fifo_overflow_recovers);
+  RUN_TEST(test_calibrate_motion6);
+  return UNITY_END();
+}
@@ -0,0 +1,425 @@
+// Host-side blackbox log decoder.
+//
+// Memory-maps a log written by src/blackbox.cpp, splits it into chunks of
+// blocks and decodes them on all cores. Writes an optional CSV in log order and
+// prints per-axis statistics and setpoint step responses. Angles are in the
+// calibrated frame the setpoints are in: each block header's level reference
+// is subtracted, as the estimator does. The magnetometer's yaw correction is
+// not logged, so yaw is the DMP's.
+//
+// Usage: blackbox_decode [--csv out.csv] [--threads N] [--step DEG] [--window MS] log.bbl
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blackbox_format.h"
+#include "flight_core.h"
+
+#define BLOCKS_PER_CHUNK 1024
+#define CHUNK_WINDOW     64   // chunks allowed in flight ahead of the CSV writer
+
+struct BlockRef {
+  size_t offset;          // start of payload
+  uint32_t payloadBytes;
+  uint16_t recordCount;
+  uint32_t droppedRecords;
+  int16_t level[3];       // centidegrees, 0 in version 1 logs
+};
+
+// Mergeable running statistics (Welford / Chan et al.)
+struct Stat {
+  uint64_t n = 0;
+  double mean = 0, m2 = 0;
+  double min = INFINITY, max = -INFINITY;
+
+  void add(double x) {
+    n++;
+    double d = x - mean;
+    mean += d / n;
+    m2 += d * (x - mean);
+    if (x < min) min = x;
+    if (x > max) max = x;
+  }
+
+  void merge(const Stat &o) {
+    if (o.n == 0) return;
+    if (n == 0) {
+      *this = o;
+      return;
+    }
+    double d = o.mean - mean;
+    uint64_t total = n + o.n;
+    mean += d * o.n / total;
+    m2 += o.m2 + d * d * (double)n * o.n / total;
+    n = total;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+  }
+
+  double stddev() const { return n > 1 ? sqrt(m2 / (n - 1)) : 0; }
+};
+
+enum {
+  STAT_GYRO_X, STAT_GYRO_Y, STAT_GYRO_Z,
+  STAT_ACCEL_X, STAT_ACCEL_Y, STAT_ACCEL_Z,
+  STAT_YAW, STAT_PITCH, STAT_ROLL,
+  STAT_M1, STAT_M2, STAT_M3, STAT_M4,
+  STAT_LOOP_US,
+  STAT_COUNT
+};
+
+static const char *statNames[STAT_COUNT] = {
+  "gyro_x", "gyro_y", "gyro_z",
+  "accel_x", "accel_y", "accel_z",
+  "yaw_deg", "pitch_deg", "roll_deg",
+  "motor1", "motor2", "motor3", "motor4",
+  "loop_us",
+};
+
+struct StepResult {
+  int axis;
+  uint32_t timeUs;
+  double amplitude;   // degrees
+  double riseMs;      // 10% -> 90%, NAN if never reached
+  double overshootPct;
+  double settleMs;    // last exit from the +/-5% band
+};
+
+struct ChunkResult {
+  std::string csv;
+  Stat stats[STAT_COUNT];
+  std::vector<StepResult> steps;
+  uint64_t records = 0;
+  bool corrupt = false;
+};
+
+struct Options {
+  const char *csvPath = nullptr;
+  const char *logPath = nullptr;
+  unsigned threads = 0;
+  double stepDeg = 5.0;
+  double windowMs = 1000.0;
+};
+
+// Angles in degrees, through the firmware's own conversion so the two cannot
+// disagree
+static void quatToYpr(const int16_t *qi, float *q, float *ypr) {
+  for (int i = 0; i < 4; i++) q[i] = qi[i] / 16384.0f;
+  quaternionToYawPitchRoll(q, ypr);
+  for (int i = 0; i < 3; i++) ypr[i] *= 180.0f / (float)M_PI;
+}
+
+static void appendInt(std::string &out, long v) {
+  char buf[24];
+  auto r = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, r.ptr);
+}
+
+static void appendFloat(std::string &out, float v) {
+  char buf[32];
+  auto r = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::fixed, 4);
+  out.append(buf, r.ptr);
+}
+
+static void appendCsvRow(std::string &out, const BlackboxRecord &r, const float *q, const float *ypr) {
+  appendInt(out, r.timeUs);
+  for (int i = 0; i < 3; i++) { out += ','; appendInt(out, r.gyro[i]); }
+  for (int i = 0; i < 3; i++) { out += ','; appendInt(out, r.accel[i]); }
+  for (int i = 0; i < 4; i++) { out += ','; appendFloat(out, q[i]); }
+  for (int i = 0; i < 3; i++) { out += ','; appendFloat(out, ypr[i]); }
+  for (int i = 0; i < 3; i++) { out += ','; appendInt(out, r.setpoint[i]); }
+  for (int a = 0; a < 3; a++) {
+    for (int t = 0; t < 3; t++) { out += ','; appendInt(out, r.pid[a][t]); }
+  }
+  for (int i = 0; i < 4; i++) { out += ','; appendInt(out, r.motor[i]); }
+  out += '\n';
+}
+
+static const char *csvHeader =
+  "time_us,gyro_x,gyro_y,gyro_z,accel_x,accel_y,accel_z,qw,qx,qy,qz,yaw,pitch,roll,"
+  "sp_yaw,sp_pitch,sp_roll,yaw_p,yaw_i,yaw_d,pitch_p,pitch_i,pitch_d,roll_p,roll_i,roll_d,"
+  "m1,m2,m3,m4\n";
+
+// Walks the block headers. Payloads are not touched, so this is cheap even
+// for multi-GB logs. On a bad header it scans forward for the next magic.
+static std::vector<BlockRef> indexBlocks(const uint8_t *data, size_t size, uint64_t &skippedBytes) {
+  std::vector<BlockRef> blocks;
+  size_t pos = 0;
+  skippedBytes = 0;
+  while (pos + BLACKBOX_V1_HEADER_BYTES <= size) {
+    BlackboxBlockHeader h = {};
+    memcpy(&h, data + pos, std::min(sizeof(h), size - pos));
+    // Version 1 logs have no level reference: angles stay uncorrected
+    size_t headerBytes = h.version == 1 ? BLACKBOX_V1_HEADER_BYTES : sizeof(h);
+    if (h.version == 1) memset(h.level, 0, sizeof(h.level));
+    bool valid = h.magic == BLACKBOX_MAGIC && (h.version == 1 || h.version == BLACKBOX_VERSION) &&
+                 h.recordCount > 0 && h.recordCount <= BLACKBOX_BLOCK_RECORDS &&
+                 h.payloadBytes <= BLACKBOX_MAX_PAYLOAD &&
+                 pos + headerBytes + h.payloadBytes <= size;
+    if (!valid) {
+      pos++;
+      skippedBytes++;
+      continue;
+    }
+    blocks.push_back({pos + headerBytes, h.payloadBytes, h.recordCount, h.droppedRecords,
+                      {h.level[0], h.level[1], h.level[2]}});
+    pos += headerBytes + h.payloadBytes;
+  }
+  skippedBytes += size - pos;
+  return blocks;
+}
+
+static void analyzeSteps(const std::vector<BlackboxRecord> &recs, const std::vector<float> &angles,
+                         size_t ownCount, const Options &opt, std::vector<StepResult> &out) {
+  const int16_t threshold = (int16_t)(opt.stepDeg * 100);
+  const uint32_t windowUs = (uint32_t)(opt.windowMs * 1000);
+
+  for (int axis = 0; axis < 3; axis++) {
+    for (size_t k = 1; k < ownCount; k++) {
+      int d = recs[k].setpoint[axis] - recs[k - 1].setpoint[axis];
+      if (abs(d) < threshold) continue;
+
+      uint32_t t0 = recs[k].timeUs;
+      double y0 = angles[(k - 1) * 3 + axis];
+      double target = recs[k].setpoint[axis] / 100.0;
+      double amp = target - y0;
+      if (fabs(amp) < 1e-6) continue;
+
+      double t10 = NAN, t90 = NAN, peak = 0, settle = 0;
+      bool complete = false;
+      for (size_t j = k; j < recs.size(); j++) {
+        uint32_t dt = recs[j].timeUs - t0;
+        if (dt > windowUs) {
+          complete = true;
+          break;
+        }
+        if (j > k && recs[j].setpoint[axis] != recs[k].setpoint[axis]) break;  // interrupted
+        double frac = (angles[j * 3 + axis] - y0) / amp;
+        if (std::isnan(t10) && frac >= 0.1) t10 = dt / 1000.0;
+        if (std::isnan(t90) && frac >= 0.9) t90 = dt / 1000.0;
+        if (frac - 1.0 > peak) peak = frac - 1.0;
+        if (fabs(frac - 1.0) > 0.05) settle = dt / 1000.0;
+      }
+      if (!complete) continue;
+      out.push_back({axis, t0, amp, t90 - t10, peak * 100.0, settle});
+    }
+  }
+}
+
+static void decodeChunk(const uint8_t *data, const std::vector<BlockRef> &blocks, size_t first, size_t last,
+                        const Options &opt, bool wantCsv, ChunkResult &res) {
+  std::vector<BlackboxRecord> recs;
+  std::vector<const BlockRef *> recBlock;   // per record, for its level reference
+  recs.reserve((last - first) * BLACKBOX_BLOCK_RECORDS);
+  recBlock.reserve(recs.capacity());
+  BlackboxRecord tmp[BLACKBOX_BLOCK_RECORDS];
+
+  for (size_t b = first; b < last; b++) {
+    const BlockRef &ref = blocks[b];
+    if (!blackboxDecodeBlock(data + ref.offset, ref.payloadBytes, ref.recordCount, tmp)) {
+      res.corrupt = true;
+      continue;
+    }
+    recs.insert(recs.end(), tmp, tmp + ref.recordCount);
+    recBlock.insert(recBlock.end(), ref.recordCount, &ref);
+  }
+  size_t ownCount = recs.size();
+
+  // Read ahead into the next chunk so steps near the end get a full window
+  if (ownCount > 0) {
+    uint32_t lastOwn = recs[ownCount - 1].timeUs;
+    for (size_t b = last; b < blocks.size(); b++) {
+      const BlockRef &ref = blocks[b];
+      if (!blackboxDecodeBlock(data + ref.offset, ref.payloadBytes, ref.recordCount, tmp)) break;
+      recs.insert(recs.end(), tmp, tmp + ref.recordCount);
+      recBlock.insert(recBlock.end(), ref.recordCount, &ref);
+      if (recs.back().timeUs - lastOwn > (uint32_t)(opt.windowMs * 1000)) break;
+    }
+  }
+
+  std::vector<float> angles(recs.size() * 3);
+  if (wantCsv) res.csv.reserve(ownCount * 160);
+  for (size_t k = 0; k < recs.size(); k++) {
+    float q[4];
+    quatToYpr(recs[k].quat, q, &angles[k * 3]);
+    // Into the calibrated frame the setpoints are in, as the estimator does
+    for (int i = 0; i < 3; i++) angles[k * 3 + i] -= recBlock[k]->level[i] / 100.0f;
+    if (k >= ownCount) continue;
+
+    const BlackboxRecord &r = recs[k];
+    for (int i = 0; i < 3; i++) res.stats[STAT_GYRO_X + i].add(r.gyro[i]);
+    for (int i = 0; i < 3; i++) res.stats[STAT_ACCEL_X + i].add(r.accel[i]);
+    for (int i = 0; i < 3; i++) res.stats[STAT_YAW + i].add(angles[k * 3 + i]);
+    for (int i = 0; i < 4; i++) res.stats[STAT_M1 + i].add(r.motor[i]);
+    if (k > 0) res.stats[STAT_LOOP_US].add((uint32_t)(r.timeUs - recs[k - 1].timeUs));
+    if (wantCsv) appendCsvRow(res.csv, r, q, &angles[k * 3]);
+  }
+  res.records = ownCount;
+  analyzeSteps(recs, angles, ownCount, opt, res.steps);
+}
+
+static bool parseArgs(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--csv") && i + 1 < argc) opt.csvPath = argv[++i];
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc) opt.threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--step") && i + 1 < argc) opt.stepDeg = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--window") && i + 1 < argc) opt.windowMs = atof(argv[++i]);
+    else if (argv[i][0] != '-' && !opt.logPath) opt.logPath = argv[i];
+    else return false;
+  }
+  return opt.logPath != nullptr;
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--csv out.csv] [--threads N] [--step DEG] [--window MS] log.bbl\n", argv[0]);
+    return 2;
+  }
+  if (opt.threads == 0) opt.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  auto start = std::chrono::steady_clock::now();
+
+  int fd = open(opt.logPath, O_RDONLY);
+  if (fd < 0) {
+    perror(opt.logPath);
+    return 1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  size_t size = st.st_size;
+  if (size == 0) {
+    fprintf(stderr, "%s: empty log\n", opt.logPath);
+    return 1;
+  }
+  const uint8_t *data = (const uint8_t *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  madvise((void *)data, size, MADV_SEQUENTIAL);
+
+  uint64_t skipped;
+  std::vector<BlockRef> blocks = indexBlocks(data, size, skipped);
+  size_t chunkCount = (blocks.size() + BLOCKS_PER_CHUNK - 1) / BLOCKS_PER_CHUNK;
+
+  FILE *csv = nullptr;
+  if (opt.csvPath) {
+    csv = fopen(opt.csvPath, "w");
+    if (!csv) {
+      perror(opt.csvPath);
+      return 1;
+    }
+    fputs(csvHeader, csv);
+  }
+
+  // Workers claim chunks in order; the main thread writes CSV in log order and
+  // folds statistics, keeping at most CHUNK_WINDOW chunks buffered
+  std::vector<ChunkResult> results(chunkCount);
+  std::vector<char> done(chunkCount, 0);
+  std::atomic<size_t> nextChunk{0};
+  size_t consumed = 0;
+  std::mutex mtx;
+  std::condition_variable cv;
+
+  auto worker = [&]() {
+    for (;;) {
+      size_t c = nextChunk.fetch_add(1);
+      if (c >= chunkCount) return;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return c < consumed + CHUNK_WINDOW; });
+      }
+      size_t first = c * BLOCKS_PER_CHUNK;
+      size_t last = std::min(first + BLOCKS_PER_CHUNK, blocks.size());
+      decodeChunk(data, blocks, first, last, opt, csv != nullptr, results[c]);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        done[c] = 1;
+      }
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned i = 0; i < opt.threads; i++) pool.emplace_back(worker);
+
+  Stat stats[STAT_COUNT];
+  std::vector<StepResult> steps;
+  uint64_t records = 0;
+  size_t corruptChunks = 0;
+  for (size_t c = 0; c < chunkCount; c++) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [&] { return done[c] != 0; });
+    }
+    ChunkResult &r = results[c];
+    if (csv) fwrite(r.csv.data(), 1, r.csv.size(), csv);
+    for (int i = 0; i < STAT_COUNT; i++) stats[i].merge(r.stats[i]);
+    steps.insert(steps.end(), r.steps.begin(), r.steps.end());
+    records += r.records;
+    if (r.corrupt) corruptChunks++;
+    r = ChunkResult();
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      consumed = c + 1;
+    }
+    cv.notify_all();
+  }
+  for (auto &t : pool) t.join();
+  if (csv) fclose(csv);
+
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("log: %s (%.1f MB, %zu blocks, %llu records)\n", opt.logPath, size / 1e6, blocks.size(),
+         (unsigned long long)records);
+  printf("dropped on target: %u records\n", blocks.empty() ? 0 : blocks.back().droppedRecords);
+  if (skipped || corruptChunks) {
+    printf("warning: %llu unreadable bytes, %zu chunks with corrupt blocks\n",
+           (unsigned long long)skipped, corruptChunks);
+  }
+
+  printf("\n%-10s %12s %12s %12s %12s\n", "field", "mean", "stddev", "min", "max");
+  for (int i = 0; i < STAT_COUNT; i++) {
+    printf("%-10s %12.3f %12.3f %12.3f %12.3f\n", statNames[i], stats[i].mean, stats[i].stddev(),
+           stats[i].n ? stats[i].min : 0, stats[i].n ? stats[i].max : 0);
+  }
+
+  static const char *axisNames[3] = {"yaw", "pitch", "roll"};
+  printf("\nstep responses (>= %.1f deg, %.0f ms window)\n", opt.stepDeg, opt.windowMs);
+  for (int axis = 0; axis < 3; axis++) {
+    Stat rise, overshoot, settle;
+    for (const StepResult &s : steps) {
+      if (s.axis != axis) continue;
+      if (!std::isnan(s.riseMs)) rise.add(s.riseMs);
+      overshoot.add(s.overshootPct);
+      settle.add(s.settleMs);
+    }
+    printf("%-6s steps %5llu  rise %7.1f ms  overshoot %6.1f %%  settle %7.1f ms\n", axisNames[axis],
+           (unsigned long long)overshoot.n, rise.mean, overshoot.mean, settle.mean);
+  }
+
+  printf("\ndecoded in %.3f s on %u threads: %.1f MB/s, %.2f M records/s\n", secs, opt.threads,
+         size / 1e6 / secs, records / 1e6 / secs);
+
+  munmap((void *)data, size);
+  close(fd);
+  return corruptChunks ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+// Host microbenchmark for the flight core.
+//
+// Feeds a synthetic DMP quaternion stream through each stage of the control
+// loop (attitude estimate, three PID axes, quad X mix, telemetry sample and
+// frame encoding) and reports the time per call of each stage and of the
+// whole pass. Then times encoding four DShot600 motors and decoding four
+// bidirectional DShot eRPM replies. No ESC captures are kept in the repo, so
+// the replies are synthesized in the RMT receive layout: the inverted frame,
+// the gap, then the reply with clock error and edge jitter.
+//
+// Usage: core_bench [iterations]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "flight_core.h"
+#include "motor_protocol.h"
+#include "telemetry_frame.h"
+
+#define DEFAULT_ITERATIONS 2000000
+#define STREAM_LENGTH      4096   // distinct input samples, cycled
+
+// Keeps results alive so the optimizer cannot drop a stage
+static volatile uint32_t sink;
+
+static std::vector<ImuSample> makeStream() {
+  std::vector<ImuSample> stream(STREAM_LENGTH);
+  for (size_t i = 0; i < stream.size(); i++) {
+    // Slow wobble of +-20 degrees in pitch and roll with a little yaw
+    float t = i * 0.01f;
+    float roll = 0.35f * sinf(t), pitch = 0.35f * cosf(0.7f * t), yaw = 0.1f * t;
+    float cr = cosf(roll / 2), sr = sinf(roll / 2);
+    float cp = cosf(pitch / 2), sp = sinf(pitch / 2);
+    float cy = cosf(yaw / 2), sy = sinf(yaw / 2);
+    float q[4] = {
+      cr * cp * cy + sr * sp * sy,
+      sr * cp * cy - cr * sp * sy,
+      cr * sp * cy + sr * cp * sy,
+      cr * cp * sy - sr * sp * cy,
+    };
+    ImuSample &s = stream[i];
+    for (int k = 0; k < 4; k++) s.quat[k] = (int16_t)lrintf(q[k] * 16384.0f);
+    for (int k = 0; k < 3; k++) s.gyro[k] = (int16_t)(i * (k + 1));
+    for (int k = 0; k < 3; k++) s.accel[k] = (int16_t)(8192 - i * k);
+  }
+  return stream;
+}
+
+template<typename F>
+static double timePerCall(long iterations, F &&body) {
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++) {
+    body(i);
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return secs * 1e9 / iterations;
+}
+
+static void motorEncoders(long iterations) {
+  uint16_t outputs[4] = {0, 700, 1400, 2000};
+  double t = timePerCall(iterations, [&](long i) {
+    uint32_t items[MOTOR_MAX_ITEMS];
+    for (int m = 0; m < 4; m++) {
+      motorEncodeRmt(MOTOR_DSHOT600, (outputs[m] + i) % (MOTOR_OUTPUT_MAX + 1), items);
+      sink += items[m];
+    }
+  });
+  printf("\n%-22s %8.1f ns\n", "dshot600 encode x4", t);
+}
+
+// Line capture as the RMT receiver records it: the inverted frame for this
+// output, a gap of gapUs, then the reply's line bits (dshotReplyBits) with
+// the ESC's clock off by skew and each edge moved by up to jitter bits
+static size_t synthesizeCapture(MotorProtocol protocol, uint16_t output, uint32_t bits, float gapUs, float skew,
+                                float jitter, uint32_t *items) {
+  size_t n = motorEncodeRmt(protocol, output, items) - 1;
+  uint32_t runs[24];
+  int count = 0;
+  float bitTicks = dshotReplyBitTicks(protocol) * (1 + skew);
+  int len = 0;
+  for (int i = 20; i >= 0; i--) {
+    if ((bits >> i) & 1 && len) {
+      runs[count++] = len;
+      len = 0;
+    }
+    len++;
+  }
+  runs[count++] = len;
+
+  // The gap joins the high end of the frame's last bit
+  uint32_t last = items[n - 1];
+  items[n - 1] = (last & 0xFFFF) | (((last >> 16 & 0x7FFF) + (uint32_t)(gapUs * MOTOR_RMT_TICK_HZ / 1e6f)) << 16) |
+                 1u << 31;
+  // Reply runs alternate low, high, ...; the last high run is the idle line,
+  // which the receiver ends with a zero duration
+  float edge = 0, previous = 0;
+  int at = 0;
+  for (int r = 0; r < count; r++) {
+    at += runs[r];
+    bool low = (r & 1) == 0;
+    uint32_t ticks = 0;
+    if (low || r < count - 1) {
+      edge = at * bitTicks + jitter * bitTicks * (2 * (rand() / (float)RAND_MAX) - 1);
+      ticks = (uint32_t)(edge - previous);
+      previous = edge;
+    }
+    if (low) items[n] = ticks;
+    else items[n++] |= (ticks | 0x8000) << 16;
+  }
+  if (count & 1) items[n++] |= 0x8000u << 16;
+  items[n++] = 0;
+  return n;
+}
+
+static void erpmDecoder(long iterations) {
+  uint32_t items[4][64];
+  size_t n[4];
+  for (int m = 0; m < 4; m++) {
+    n[m] = synthesizeCapture(MOTOR_DSHOT600_BIDIR, 1000, dshotReplyBits(40000 + 10000 * m), 30, 0.02f, 0.2f, items[m]);
+  }
+  double t = timePerCall(iterations / 4, [&](long i) {
+    for (int m = 0; m < 4; m++) {
+      uint32_t erpm;
+      dshotDecodeReply(MOTOR_DSHOT600_BIDIR, items[m], n[m], erpm);
+      sink += erpm + i;
+    }
+  });
+  printf("%-22s %8.1f ns\n", "erpm decode x4", t);
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+  if (iterations <= 0) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<ImuSample> stream = makeStream();
+  AttitudeEstimator estimator;
+  PidController pid[3] = {
+    PidController(PidGains{2.0f, 0.5f, 0.02f, 50, 0}),
+    PidController(PidGains{4.0f, 1.0f, 0.05f, 50, 0}),
+    PidController(PidGains{4.0f, 1.0f, 0.05f, 50, 0}),
+  };
+  const float dt = 0.005f;
+  float axis[3] = {0, 0, 0};
+  uint16_t motor[4] = {0, 0, 0, 0};
+  TelemetrySample sample;
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+
+  auto estimate = [&](long i) {
+    estimator.update(stream[i & (STREAM_LENGTH - 1)].quat);
+    sink += (uint32_t)(estimator.ypr()[1] * 1000);
+  };
+  auto control = [&](long i) {
+    const float *ypr = estimator.ypr();
+    float target = (i & 1023) < 512 ? 0.1f : -0.1f;
+    for (int k = 0; k < 3; k++) axis[k] = pid[k].update(target, ypr[k], dt);
+    sink += (uint32_t)axis[0];
+  };
+  auto mix = [&](long i) {
+    mixQuadX(128 + (i & 63), axis, motor, 1.1f);
+    sink += motor[0];
+  };
+  auto encode = [&](long i) {
+    fillTelemetrySample(sample, (uint32_t)i, estimator.ypr(), motor, 2500);
+    sink += telemetryEncodeFrame(TELEMETRY_TYPE_SAMPLE, (uint8_t)i, &sample, sizeof(sample), frame);
+  };
+
+  double tEstimate = timePerCall(iterations, estimate);
+  double tControl = timePerCall(iterations, control);
+  double tMix = timePerCall(iterations, mix);
+  double tEncode = timePerCall(iterations, encode);
+  double tLoop = timePerCall(iterations, [&](long i) {
+    estimate(i);
+    control(i);
+    mix(i);
+    encode(i);
+  });
+
+  printf("%ld iterations\n", iterations);
+  printf("%-22s %8.1f ns\n", "attitude estimate", tEstimate);
+  printf("%-22s %8.1f ns\n", "pid x3", tControl);
+  printf("%-22s %8.1f ns\n", "quad x mix", tMix);
+  printf("%-22s %8.1f ns\n", "telemetry encode", tEncode);
+  printf("%-22s %8.1f ns (%.0f kHz)\n", "full pass", tLoop, 1e6 / tLoop);
+  motorEncoders(iterations);
+  erpmDecoder(iterations);
+  return 0;
+}
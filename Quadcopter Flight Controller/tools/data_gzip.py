@@ -0,0 +1,87 @@
+# PlatformIO pre-script: stages a gzipped copy of data/ for the SPIFFS image.
+#
+# Only runs for the filesystem targets (buildfs/uploadfs). It first builds the
+# self-hosted three.js bundle in web/, which fails if it is over its size
+# budget. Every file in data/ and web/dist/ is then written to
+# .pio/data_gz/<name>.gz (gzip -9, mtime 0 so unchanged inputs give
+# byte-identical outputs) and listed in etags.txt as "<name> <etag>", where the
+# etag is a hash of the uncompressed file. The filesystem image is then built
+# from the staging folder instead of data/.
+
+import gzip
+import hashlib
+import os
+import subprocess
+import sys
+
+from SCons.Script import COMMAND_LINE_TARGETS
+
+Import("env")
+
+FS_TARGETS = ("buildfs", "uploadfs", "uploadfsota")
+
+SRC_DIR = env.subst("$PROJECT_DATA_DIR")
+WEB_DIR = os.path.join(env.subst("$PROJECT_DIR"), "web")
+OUT_DIR = os.path.join(env.subst("$PROJECT_WORKSPACE_DIR"), "data_gz")
+
+
+def build_web():
+    npm = "npm.cmd" if sys.platform == "win32" else "npm"
+    try:
+        if not os.path.isdir(os.path.join(WEB_DIR, "node_modules")):
+            subprocess.check_call([npm, "install", "--no-audit", "--no-fund"], cwd=WEB_DIR)
+        subprocess.check_call([npm, "run", "build", "--silent"], cwd=WEB_DIR)
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.stderr.write("data_gzip: web bundle build failed (%s)\n" % e)
+        env.Exit(1)
+
+
+def sources():
+    dirs = [SRC_DIR, os.path.join(WEB_DIR, "dist")]
+    for d in dirs:
+        if not os.path.isdir(d):
+            continue
+        for name in sorted(os.listdir(d)):
+            path = os.path.join(d, name)
+            if os.path.isfile(path) and not name.startswith("."):
+                yield name, path
+
+
+def stage():
+    os.makedirs(OUT_DIR, exist_ok=True)
+    wanted = {"etags.txt"}
+    manifest = []
+    total_raw = total_gz = 0
+
+    for name, src in sources():
+        with open(src, "rb") as f:
+            raw = f.read()
+        out_name = name + ".gz"
+        dst = os.path.join(OUT_DIR, out_name)
+        wanted.add(out_name)
+
+        if not os.path.exists(dst) or os.path.getmtime(dst) < os.path.getmtime(src):
+            with open(dst, "wb") as f:
+                with gzip.GzipFile(filename="", mode="wb", compresslevel=9, fileobj=f, mtime=0) as gz:
+                    gz.write(raw)
+
+        gz_size = os.path.getsize(dst)
+        total_raw += len(raw)
+        total_gz += gz_size
+        manifest.append("%s %s" % (name, hashlib.sha1(raw).hexdigest()[:16]))
+        print("data_gzip: %-20s %8d -> %8d bytes" % (name, len(raw), gz_size))
+
+    # Drop outputs whose source was removed
+    for name in os.listdir(OUT_DIR):
+        if name not in wanted:
+            os.remove(os.path.join(OUT_DIR, name))
+
+    with open(os.path.join(OUT_DIR, "etags.txt"), "w") as f:
+        f.write("\n".join(manifest) + "\n")
+    print("data_gzip: total %d -> %d bytes" % (total_raw, total_gz))
+
+
+if any(t in COMMAND_LINE_TARGETS for t in FS_TARGETS):
+    build_web()
+    stage()
+    env.Replace(PROJECT_DATA_DIR=OUT_DIR)
@@ -0,0 +1,308 @@
+// Host comparison of the DMP profiles behind DmpDevice.
+//
+// Runs each profile, and the trimmed 6.12 packets, through the real driver
+// against the emulated MPU6050 on the simulated bus (see tools/mpu6050_sim).
+// For each it reports the packet size and DMP rate, dmpInitialize() cost, I2C
+// bytes and bus time per packet when polled like the firmware loop, host CPU
+// time to decode a packet into yaw/pitch/roll, and the attitude error against
+// the trajectory. Everything except the decode column is deterministic.
+// It then changes the MotionApps 2.0 output rate on the fly with
+// DmpDevice::setRate() and reports the rate SampleRate measures.
+// Last, with MotionApps 4.1 and a DMP whose yaw drifts, it fits the
+// magnetometer calibration while the frame tumbles and compares the yaw error
+// with and without AttitudeEstimator::updateMag().
+//
+// Usage: dmp_bench [--seconds N] [--loop-us N] [--bus-hz N]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "I2Cdev.h"
+#include "MPU6050.h"
+#include "dmp_device.h"
+#include "flight_core.h"
+#include "mpu6050_emu.h"
+
+#define DECODE_ITERATIONS 1000000
+
+struct Options {
+  uint32_t seconds = 10;
+  uint32_t loopUs = 2500;
+  uint32_t busHz = 400000;
+};
+
+struct Variant {
+  const char *name;
+  DmpProfile profile;
+  uint8_t fields;
+};
+
+static const Variant variants[] = {
+  {"MotionApps20", DMP_MOTIONAPPS20, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL},
+  {"MotionApps41", DMP_MOTIONAPPS41, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL | DMP_FIELD_MAG},
+  {"MotionApps612", DMP_MOTIONAPPS612, DMP_FIELD_QUAT | DMP_FIELD_GYRO | DMP_FIELD_ACCEL},
+  {"MotionApps612 quat+gyro", DMP_MOTIONAPPS612, DMP_FIELD_QUAT | DMP_FIELD_GYRO},
+  {"MotionApps612 quat", DMP_MOTIONAPPS612, DMP_FIELD_QUAT},
+};
+
+// Same motion as mpu6050_bench: level, roll, pitch, a yaw turn, level
+static const MotionKeyframe trajectory[] = {
+  {0, 0, 0, 0},
+  {1000, 0, 0, 0},
+  {2000, 0, 0, 30},
+  {3000, 0, -20, 30},
+  {5000, 90, -20, 30},
+  {7000, 90, 0, 0},
+};
+
+// Keeps decode results alive so the optimizer cannot drop them
+static volatile float sink;
+
+static void packetToYpr(const DmpDevice &dmp, const uint8_t *packet, float ypr[3]) {
+  ImuSample s;
+  dmp.decode(packet, s);
+  float q[4];
+  for (int i = 0; i < 4; i++) q[i] = s.quat[i] / 16384.0f;
+  quaternionToYawPitchRoll(q, ypr);
+}
+
+static bool run(const Variant &v, const Options &opt) {
+  i2cdevSimReset();
+  i2cdevSimSetClock(opt.busHz);
+  Mpu6050EmuConfig config;
+  config.dmpImage = v.profile;
+  Mpu6050Emu emu(config);
+  emu.setTrajectory(trajectory, sizeof(trajectory) / sizeof(trajectory[0]));
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, &emu);
+
+  DmpDevice *dmp = createDmpDevice(v.profile);
+  dmp->mpu().initialize();
+  uint64_t t0 = i2cdevSimNowUs();
+  uint8_t status = dmp->initialize();
+  double initMs = (i2cdevSimNowUs() - t0) / 1000.0;
+  if (status != 0) {
+    printf("%-24s dmpInitialize failed (code %u)\n", v.name, status);
+    delete dmp;
+    return false;
+  }
+  uint8_t fields = dmp->selectFields(v.fields);
+  if ((fields & v.fields) != v.fields || (fields & ~v.fields & ~DMP_FIELD_MAG)) {
+    printf("%-24s could not select fields 0x%02x (got 0x%02x)\n", v.name, v.fields, fields);
+  }
+  dmp->mpu().setDMPEnabled(true);
+
+  // Poll once per loop pass like the firmware, comparing with the trajectory
+  uint8_t packet[64];
+  uint32_t packets = 0;
+  double errSum = 0, errMax = 0;
+  i2cdevSimResetStats();
+  uint64_t end = i2cdevSimNowUs() + (uint64_t)opt.seconds * 1000000;
+  while (i2cdevSimNowUs() < end) {
+    uint64_t passStart = i2cdevSimNowUs();
+    if (dmp->readLatest(packet)) {
+      float ypr[3], truth[3], tq[4];
+      packetToYpr(*dmp, packet, ypr);
+      emu.quaternionAt(i2cdevSimNowUs(), tq);
+      quaternionToYawPitchRoll(tq, truth);
+      for (int i = 0; i < 3; i++) {
+        double err = fabs(ypr[i] - truth[i]) * 180.0 / M_PI;
+        if (err > 180) err = 360 - err;
+        errSum += err / 3;
+        if (err > errMax) errMax = err;
+      }
+      packets++;
+    }
+    uint64_t spent = i2cdevSimNowUs() - passStart;
+    if (spent < opt.loopUs) i2cdevSimAdvanceUs(opt.loopUs - spent);
+  }
+  I2CdevSimStats bus = i2cdevSimStats();
+
+  // Decode cost on the host for the last packet
+  auto h0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < DECODE_ITERATIONS; i++) {
+    float ypr[3];
+    packet[15] = (uint8_t)i;   // a fresh input each pass
+    packetToYpr(*dmp, packet, ypr);
+    sink = ypr[0];
+  }
+  double decodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - h0).count() /
+                    DECODE_ITERATIONS;
+
+  uint32_t n = packets ? packets : 1;
+  printf("%-24s %6u %6u %8.1f %8.1f %8.1f %8.1f %8.1f %8.3f %8.3f\n", v.name, dmp->layout().size, emu.dmpRateHz(),
+         initMs, (double)(bus.bytesRead + bus.bytesWritten) / n, (double)bus.busUs / n,
+         (double)(bus.readTransactions + bus.writeTransactions) / n, decodeNs, errSum / n, errMax);
+  delete dmp;
+  return true;
+}
+
+static bool rateSweep(const Options &opt) {
+  i2cdevSimReset();
+  i2cdevSimSetClock(opt.busHz);
+  Mpu6050Emu emu;
+  emu.setTrajectory(trajectory, sizeof(trajectory) / sizeof(trajectory[0]));
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, &emu);
+  DmpDevice *dmp = createDmpDevice(DMP_MOTIONAPPS20);
+  dmp->mpu().initialize();
+  if (dmp->initialize() != 0) return false;
+  dmp->mpu().setDMPEnabled(true);
+
+  printf("\n%-24s %8s %8s %10s %10s %8s\n", "MotionApps20 rate", "sdiv", "fdiv", "set Hz", "measured", "chip Hz");
+  static const uint16_t fifoDivs[] = {0, 1, 3, 9, 1};
+  uint8_t packet[64];
+  SampleRate rate;
+  BusClock clock;
+  for (uint16_t fifoDiv : fifoDivs) {
+    dmp->setRate(4, fifoDiv);
+    rate.setNominal(dmp->rateHz());
+    uint64_t end = i2cdevSimNowUs() + 2000000;
+    while (i2cdevSimNowUs() < end) {
+      uint64_t passStart = i2cdevSimNowUs();
+      if (dmp->readLatest(packet)) rate.sample(clock.micros());
+      uint64_t spent = i2cdevSimNowUs() - passStart;
+      if (spent < opt.loopUs) i2cdevSimAdvanceUs(opt.loopUs - spent);
+    }
+    printf("%-24s %8u %8u %10.1f %10.1f %8u\n", "", dmp->sampleDivisor(), dmp->fifoDivisor(), rate.nominalHz(),
+           rate.hz(), emu.dmpRateHz());
+  }
+  delete dmp;
+  return true;
+}
+
+// Turns every axis through the field for MagCalibrator, then flies yaw
+// turns with some tilt
+#define MAG_CAL_END_MS 43000
+static const MotionKeyframe magTrajectory[] = {
+  {0, 0, 0, 0},
+  {4000, 360, 0, 0},
+  {8000, 360, 0, 360},
+  {11000, 360, 85, 360},
+  {14000, 360, -85, 360},
+  {15000, 360, 0, 360},
+  {17000, 540, 0, 360},
+  {20000, 540, 85, 360},
+  {23000, 540, -85, 360},
+  {25000, 540, 25, 360},
+  {29000, 540, 25, 540},
+  {31000, 540, -25, 540},
+  {35000, 540, -25, 720},
+  {37000, 450, 0, 720},
+  {41000, 450, 0, 1080},
+  {MAG_CAL_END_MS, 540, 0, 1080},
+  {53000, 630, 10, 1075},
+  {63000, 450, -10, 1090},
+  {73000, 720, 0, 1080},
+  {83000, 540, 5, 1085},
+  {103000, 600, 0, 1080},
+};
+
+static double yawErrorDeg(float yaw, float truth) {
+  double err = fabs(yaw - truth) * 180.0 / M_PI;
+  return err > 180 ? 360 - err : err;
+}
+
+static bool magHeading(const Options &opt) {
+  i2cdevSimReset();
+  i2cdevSimSetClock(opt.busHz);
+  Mpu6050EmuConfig config;
+  config.dmpImage = DMP_MOTIONAPPS41;
+  config.dmpYawDriftDps = 0.5f;
+  Mpu6050Emu emu(config);
+  emu.setTrajectory(magTrajectory, sizeof(magTrajectory) / sizeof(magTrajectory[0]));
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, &emu);
+  DmpDevice *dmp = createDmpDevice(DMP_MOTIONAPPS41);
+  dmp->mpu().initialize();
+  if (dmp->initialize() != 0) return false;
+  dmp->mpu().setDMPEnabled(true);
+
+  MagCalibrator calibrator;
+  MagCalibration cal = {};
+  bool calibrated = false;
+  AttitudeEstimator dmpOnly, aided;
+  uint8_t packet[64];
+  uint32_t packets = 0;
+  double errSum[2] = {0, 0}, errMax[2] = {0, 0};
+  uint64_t end = (uint64_t)magTrajectory[sizeof(magTrajectory) / sizeof(magTrajectory[0]) - 1].timeMs * 1000;
+  while (i2cdevSimNowUs() < end) {
+    uint64_t passStart = i2cdevSimNowUs();
+    if (dmp->readLatest(packet)) {
+      ImuSample s;
+      dmp->decode(packet, s);
+      if (passStart < MAG_CAL_END_MS * 1000ull) {
+        calibrator.addSample(s.mag);
+      } else {
+        if (!calibrated) {
+          if (!calibrator.finish(cal)) break;
+          aided.setMagCalibration(cal);
+          calibrated = true;
+        }
+        dmpOnly.update(s.quat);
+        aided.update(s.quat);
+        aided.updateMag(s.mag);
+        float truth[3], tq[4];
+        emu.quaternionAt(i2cdevSimNowUs(), tq);
+        quaternionToYawPitchRoll(tq, truth);
+        const AttitudeEstimator *est[2] = {&dmpOnly, &aided};
+        for (int k = 0; k < 2; k++) {
+          double err = yawErrorDeg(est[k]->ypr()[0], truth[0]);
+          errSum[k] += err;
+          if (err > errMax[k]) errMax[k] = err;
+        }
+        packets++;
+      }
+    }
+    uint64_t spent = i2cdevSimNowUs() - passStart;
+    if (spent < opt.loopUs) i2cdevSimAdvanceUs(opt.loopUs - spent);
+  }
+  delete dmp;
+
+  printf("\nMotionApps41 heading, DMP yaw drifting %.1f deg/s\n", config.dmpYawDriftDps);
+  if (!calibrated) {
+    printf("  magnetometer calibration failed after %d samples\n", calibrator.count());
+    return false;
+  }
+  // 0.3 uT per LSB; the emulator's distortion is in body axes like ImuSample
+  printf("  calibration from %d samples: hard iron %.1f %.1f %.1f uT (set %.1f %.1f %.1f), "
+         "scale %.3f %.3f %.3f\n", calibrator.count(), cal.offset[0] * 0.3, cal.offset[1] * 0.3,
+         cal.offset[2] * 0.3, config.magHardIronUt[0], config.magHardIronUt[1], config.magHardIronUt[2],
+         cal.scale[0], cal.scale[1], cal.scale[2]);
+  uint32_t n = packets ? packets : 1;
+  printf("  yaw error over %u packets: DMP only mean %.2f max %.2f deg, with updateMag mean %.2f max %.2f deg\n",
+         packets, errSum[0] / n, errMax[0], errSum[1] / n, errMax[1]);
+  return true;
+}
+
+static bool parseArgs(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) return false;
+    uint32_t v = strtoul(argv[i + 1], NULL, 10);
+    if (!strcmp(argv[i], "--seconds")) opt.seconds = v;
+    else if (!strcmp(argv[i], "--loop-us")) opt.loopUs = v;
+    else if (!strcmp(argv[i], "--bus-hz")) opt.busHz = v;
+    else return false;
+    i++;
+  }
+  return opt.seconds > 0 && opt.busHz > 0;
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--seconds N] [--loop-us N] [--bus-hz N]\n", argv[0]);
+    return 1;
+  }
+
+  printf("bus %u Hz, %u us loop, %u s per profile\n\n", opt.busHz, opt.loopUs, opt.seconds);
+  printf("%-24s %6s %6s %8s %8s %8s %8s %8s %8s %8s\n", "", "packet", "Hz", "init ms", "B/pkt", "bus us",
+         "xfer", "dec ns", "err deg", "max deg");
+  bool ok = true;
+  for (const Variant &v : variants) ok &= run(v, opt);
+  ok &= rateSweep(opt);
+  ok &= magHeading(opt);
+  return ok ? 0 : 1;
+}
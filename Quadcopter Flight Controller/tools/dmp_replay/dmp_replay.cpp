@@ -0,0 +1,308 @@
+// Host replay of DMP FIFO packet captures (src/dmp_capture.cpp, /capture).
+//
+// Decodes a capture back to the exact packets the firmware read and runs
+// them, as fast as the host goes, through the MotionApps library's decode
+// (dmpGetQuaternion, dmpGetGravity, dmpGetYawPitchRoll) and through the
+// firmware's path (DmpDevice::decode into AttitudeEstimator, with the
+// magnetometer when the packets carry it). Reports the capture (packets,
+// drops, rate, gaps, bytes per packet), the largest difference between the
+// two attitudes, the host time per packet on each path and how much faster
+// than the flight it replayed. Two digests make it a regression check: one of
+// the packets, which only changes with the capture, and one of both paths'
+// output, which changes when the decode or the estimator does. With
+// --digest the run fails unless the output digest matches.
+//
+// --record writes a capture from the emulated MPU6050 (tools/mpu6050_sim)
+// through the same encoder the firmware uses, for trying the tool without
+// hardware, and checks that it reads back bit for bit.
+//
+// Usage: dmp_replay [--csv out.csv] [--repeat N] [--digest HEX] capture.cap
+//        dmp_replay --record out.cap [--profile 20|612|41] [--seconds N]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "I2Cdev.h"
+#include "MPU6050.h"
+#include "dmp_capture_format.h"
+#include "dmp_device.h"
+#include "flight_core.h"
+#include "mpu6050_emu.h"
+
+struct Capture {
+  DmpProfile profile = DMP_PROFILE_COUNT;
+  DmpLayout layout = {};
+  std::vector<DmpCapturePacket> packets;
+  uint32_t dropped = 0;
+  uint32_t blocks = 0;
+  size_t bytes = 0;
+};
+
+static bool loadCapture(const char *path, Capture &c) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  std::vector<uint8_t> payload(DMP_CAPTURE_MAX_PAYLOAD);
+  DmpCapturePacket block[DMP_CAPTURE_BLOCK_PACKETS];
+  DmpCaptureBlockHeader h;
+  bool ok = true;
+  while (fread(&h, sizeof(h), 1, f) == 1) {
+    if (!dmpCaptureHeaderValid(h)) {
+      fprintf(stderr, "%s: bad block header at block %u\n", path, c.blocks);
+      ok = false;
+      break;
+    }
+    if (c.blocks == 0) {
+      c.profile = (DmpProfile)h.profile;
+      c.layout = h.layout;
+    } else if (h.profile != c.profile || memcmp(&h.layout, &c.layout, sizeof(c.layout))) {
+      fprintf(stderr, "%s: block %u changes the packet layout\n", path, c.blocks);
+      ok = false;
+      break;
+    }
+    if (fread(payload.data(), 1, h.payloadBytes, f) != h.payloadBytes ||
+        !dmpCaptureDecodeBlock(payload.data(), h.payloadBytes, h.packetCount, h.layout.size, block)) {
+      // A capture cut off by a reset ends in a partial block: keep the rest
+      fprintf(stderr, "%s: block %u truncated or corrupt, stopping there\n", path, c.blocks);
+      break;
+    }
+    c.packets.insert(c.packets.end(), block, block + h.packetCount);
+    c.dropped = h.droppedPackets;
+    c.bytes += sizeof(h) + h.payloadBytes;
+    c.blocks++;
+  }
+  fclose(f);
+  if (ok && c.packets.empty()) {
+    fprintf(stderr, "%s: no packets\n", path);
+    ok = false;
+  }
+  return ok;
+}
+
+// FNV-1a, 64 bit
+static void digest(uint64_t &h, const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 0x100000001B3ull;
+  }
+}
+
+#define DIGEST_SEED 0xCBF29CE484222325ull
+
+static double angleDiffDeg(float a, float b) {
+  double d = fabs(a - b) * 180.0 / M_PI;
+  return d > 180 ? 360 - d : d;
+}
+
+static int replay(const char *path, const char *csvPath, int repeat, const char *expect) {
+  Capture c;
+  if (!loadCapture(path, c)) return 2;
+  DmpDevice *dmp = createDmpDevice(c.profile);
+  dmp->useLayout(c.layout);
+  bool hasMag = c.layout.fields & DMP_FIELD_MAG;
+
+  size_t n = c.packets.size();
+  uint64_t packetDigest = DIGEST_SEED;
+  uint32_t maxGapUs = 0;
+  for (size_t i = 0; i < n; i++) {
+    digest(packetDigest, &c.packets[i].timeUs, sizeof(uint32_t));
+    digest(packetDigest, c.packets[i].data, c.layout.size);
+    if (i > 0) {
+      uint32_t gap = c.packets[i].timeUs - c.packets[i - 1].timeUs;
+      if (gap > maxGapUs) maxGapUs = gap;
+    }
+  }
+  double spanS = (uint32_t)(c.packets[n - 1].timeUs - c.packets[0].timeUs) / 1e6;
+  printf("%s: %s, %u byte packets, %zu packets in %u blocks, %u dropped\n", path, dmpProfileName(c.profile),
+         c.layout.size, n, c.blocks, c.dropped);
+  printf("  %.1f s at %.1f Hz, longest gap %.1f ms, %.1f bytes per packet stored\n", spanS,
+         spanS > 0 ? (n - 1) / spanS : 0.0, maxGapUs / 1000.0, (double)c.bytes / n);
+
+  FILE *csv = nullptr;
+  if (csvPath) {
+    csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      delete dmp;
+      return 2;
+    }
+    fprintf(csv, "time_us,lib_yaw,lib_pitch,lib_roll,yaw,pitch,roll,gyro_x,gyro_y,gyro_z,accel_x,accel_y,accel_z\n");
+  }
+
+  // The first pass checks and records; the rest only add to the timing
+  std::vector<float> libYpr(n * 3), estYpr(n * 3);
+  double libS = 0, estS = 0;
+  for (int r = 0; r < repeat; r++) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) dmp->libraryYawPitchRoll(c.packets[i].data, &libYpr[i * 3]);
+    auto t1 = std::chrono::steady_clock::now();
+    AttitudeEstimator estimator;
+    ImuSample s;
+    for (size_t i = 0; i < n; i++) {
+      dmp->decode(c.packets[i].data, s);
+      estimator.update(s.quat);
+      if (hasMag) estimator.updateMag(s.mag);
+      memcpy(&estYpr[i * 3], estimator.ypr(), 3 * sizeof(float));
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    libS += std::chrono::duration<double>(t1 - t0).count();
+    estS += std::chrono::duration<double>(t2 - t1).count();
+  }
+
+  uint64_t outputDigest = DIGEST_SEED;
+  double maxDiff[3] = {0, 0, 0};
+  ImuSample s;
+  for (size_t i = 0; i < n; i++) {
+    digest(outputDigest, &libYpr[i * 3], 3 * sizeof(float));
+    digest(outputDigest, &estYpr[i * 3], 3 * sizeof(float));
+    for (int k = 0; k < 3; k++) {
+      double d = angleDiffDeg(libYpr[i * 3 + k], estYpr[i * 3 + k]);
+      if (d > maxDiff[k]) maxDiff[k] = d;
+    }
+    if (csv) {
+      dmp->decode(c.packets[i].data, s);
+      fprintf(csv, "%u,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%d,%d,%d,%d,%d,%d\n", c.packets[i].timeUs, libYpr[i * 3],
+              libYpr[i * 3 + 1], libYpr[i * 3 + 2], estYpr[i * 3], estYpr[i * 3 + 1], estYpr[i * 3 + 2], s.gyro[0],
+              s.gyro[1], s.gyro[2], s.accel[0], s.accel[1], s.accel[2]);
+    }
+  }
+  if (csv) fclose(csv);
+  delete dmp;
+
+  double total = (double)n * repeat;
+  printf("  library vs estimator, max difference: yaw %.3f%s, pitch %.3f, roll %.3f deg\n", maxDiff[0],
+         hasMag ? " (magnetometer heading)" : "", maxDiff[1], maxDiff[2]);
+  printf("  library path   %7.1f ns/packet, %6.2f M packets/s\n", libS * 1e9 / total, total / libS / 1e6);
+  printf("  estimator path %7.1f ns/packet, %6.2f M packets/s\n", estS * 1e9 / total, total / estS / 1e6);
+  if (spanS > 0) printf("  replayed %.0fx faster than the flight\n", spanS * repeat / (libS + estS));
+  printf("  packet digest %016llx, output digest %016llx\n", (unsigned long long)packetDigest,
+         (unsigned long long)outputDigest);
+
+  if (expect && strtoull(expect, NULL, 16) != outputDigest) {
+    printf("output digest differs from %s\n", expect);
+    return 1;
+  }
+  return 0;
+}
+
+// Same motion as dmp_bench: level, roll, pitch, a yaw turn, level
+static const MotionKeyframe trajectory[] = {
+  {0, 0, 0, 0},
+  {1000, 0, 0, 0},
+  {2000, 0, 0, 30},
+  {3000, 0, -20, 30},
+  {5000, 90, -20, 30},
+  {7000, 90, 0, 0},
+};
+
+#define RECORD_LOOP_US 2500
+
+static bool writeBlock(FILE *f, DmpProfile profile, const DmpLayout &layout, const DmpCapturePacket *block,
+                       uint16_t count) {
+  static uint8_t payload[DMP_CAPTURE_MAX_PAYLOAD];
+  DmpCaptureBlockHeader h;
+  h.magic = DMP_CAPTURE_MAGIC;
+  h.version = DMP_CAPTURE_VERSION;
+  h.packetCount = count;
+  h.payloadBytes = dmpCaptureEncodeBlock(block, count, layout.size, payload, sizeof(payload));
+  h.droppedPackets = 0;
+  h.profile = profile;
+  h.layout = layout;
+  return h.payloadBytes && fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(payload, 1, h.payloadBytes, f) == h.payloadBytes;
+}
+
+static int record(const char *path, DmpProfile profile, uint32_t seconds) {
+  i2cdevSimReset();
+  Mpu6050EmuConfig config;
+  config.dmpImage = profile;
+  Mpu6050Emu emu(config);
+  emu.setTrajectory(trajectory, sizeof(trajectory) / sizeof(trajectory[0]));
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, &emu);
+
+  DmpDevice *dmp = createDmpDevice(profile);
+  dmp->mpu().initialize();
+  uint8_t status = dmp->initialize();
+  if (status != 0) {
+    fprintf(stderr, "dmpInitialize failed (code %u)\n", status);
+    delete dmp;
+    return 1;
+  }
+  dmp->mpu().setDMPEnabled(true);
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    delete dmp;
+    return 2;
+  }
+  // Polled once per loop pass like the firmware, stamped when read
+  BusClock clock;
+  DmpCapturePacket block[DMP_CAPTURE_BLOCK_PACKETS];
+  std::vector<DmpCapturePacket> sent;
+  uint16_t count = 0;
+  bool ok = true;
+  uint64_t end = clock.nowUs() + (uint64_t)seconds * 1000000;
+  while (ok && clock.nowUs() < end) {
+    uint64_t passStart = clock.nowUs();
+    if (dmp->readLatest(block[count].data)) {
+      block[count].timeUs = clock.micros();
+      sent.push_back(block[count]);
+      if (++count == DMP_CAPTURE_BLOCK_PACKETS) {
+        ok = writeBlock(f, profile, dmp->layout(), block, count);
+        count = 0;
+      }
+    }
+    uint64_t spent = clock.nowUs() - passStart;
+    if (spent < RECORD_LOOP_US) i2cdevSimAdvanceUs(RECORD_LOOP_US - spent);
+  }
+  if (ok && count) ok = writeBlock(f, profile, dmp->layout(), block, count);
+  ok &= fclose(f) == 0;
+  uint8_t size = dmp->layout().size;
+  printf("%s: %zu %s packets of %u bytes\n", path, sent.size(), dmpProfileName(profile), size);
+  delete dmp;
+
+  Capture c;
+  if (!ok || !loadCapture(path, c)) return 1;
+  bool same = c.packets.size() == sent.size();
+  for (size_t i = 0; same && i < sent.size(); i++) {
+    same = c.packets[i].timeUs == sent[i].timeUs && !memcmp(c.packets[i].data, sent[i].data, size);
+  }
+  printf("  %s\n", same ? "reads back bit for bit" : "READS BACK DIFFERENT");
+  return same ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  const char *csvPath = nullptr, *expect = nullptr, *recordPath = nullptr, *path = nullptr;
+  int repeat = 1;
+  uint32_t seconds = 10;
+  DmpProfile profile = DMP_MOTIONAPPS20;
+  bool usage = false;
+  for (int i = 1; i < argc && !usage; i++) {
+    if (!strcmp(argv[i], "--csv") && i + 1 < argc) csvPath = argv[++i];
+    else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--digest") && i + 1 < argc) expect = argv[++i];
+    else if (!strcmp(argv[i], "--record") && i + 1 < argc) recordPath = argv[++i];
+    else if (!strcmp(argv[i], "--profile") && i + 1 < argc) profile = dmpProfileFromName(argv[++i]);
+    else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) seconds = strtoul(argv[++i], NULL, 10);
+    else if (argv[i][0] != '-' && !path) path = argv[i];
+    else usage = true;
+  }
+  if (usage || (!path == !recordPath) || repeat < 1 || profile == DMP_PROFILE_COUNT) {
+    fprintf(stderr,
+            "usage: %s [--csv out.csv] [--repeat N] [--digest HEX] capture.cap\n"
+            "       %s --record out.cap [--profile 20|612|41] [--seconds N]\n",
+            argv[0], argv[0]);
+    return 2;
+  }
+  if (recordPath) return record(recordPath, profile, seconds);
+  return replay(path, csvPath, repeat, expect);
+}
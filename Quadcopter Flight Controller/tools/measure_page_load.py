@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Measures how many bytes and how long a page load takes from the flight controller.
+
+Usage: measure_page_load.py http://<esp32-ip>/ [--runs N]
+
+Does a cold load (no cache) and a warm load (If-None-Match with the ETags from
+the cold load) of the page and every asset it references, including models
+and workers the scripts load by path, and reports wire bytes and wall time
+for each. Run it disarmed and armed: while armed the large assets should
+come back 503.
+"""
+
+import argparse
+import gzip
+import re
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+
+
+def fetch(url, etag=None):
+    headers = {"Accept-Encoding": "gzip"}
+    if etag:
+        headers["If-None-Match"] = etag
+    req = urllib.request.Request(url, headers=headers)
+    start = time.perf_counter()
+    try:
+        with urllib.request.urlopen(req, timeout=30) as resp:
+            body = resp.read()
+            status = resp.status
+            resp_headers = resp.headers
+    except urllib.error.HTTPError as e:
+        body = e.read()
+        status = e.code
+        resp_headers = e.headers
+    elapsed = time.perf_counter() - start
+    return status, body, resp_headers, elapsed
+
+
+def assets(text, base, urls):
+    """Adds the same-host assets text references to urls: tags in HTML, and
+    models and workers loaded by path from scripts."""
+    found = re.findall(r'(?:href|src)="([^"]+)"', text)
+    extra = re.findall(r'["\'](/[\w.\-]+\.(?:glb|js))["\']', text)
+    for ref in found + extra:
+        url = urllib.parse.urljoin(base, ref)
+        if urllib.parse.urlparse(url).netloc == urllib.parse.urlparse(base).netloc and url not in urls:
+            urls.append(url)
+
+
+def text_of(body, headers):
+    if headers.get("Content-Encoding") == "gzip":
+        body = gzip.decompress(body)
+    return body.decode("utf-8", "replace")
+
+
+def load(base, etags):
+    rows = []
+    total_start = time.perf_counter()
+    status, body, headers, elapsed = fetch(base, etags.get(base))
+    rows.append((base, status, len(body), headers.get("Content-Encoding", ""), elapsed))
+    etags[base] = headers.get("ETag", etags.get(base))
+
+    # The asset list grows as scripts are fetched; a warm load reuses it
+    urls = etags.setdefault("__assets__", [])
+    if status == 200:
+        assets(text_of(body, headers), base, urls)
+
+    i = 0
+    while i < len(urls):
+        url = urls[i]
+        i += 1
+        status, body, headers, elapsed = fetch(url, etags.get(url))
+        rows.append((url, status, len(body), headers.get("Content-Encoding", ""), elapsed))
+        etags[url] = headers.get("ETag", etags.get(url))
+        if status == 200 and url.endswith(".js"):
+            assets(text_of(body, headers), base, urls)
+    return rows, time.perf_counter() - total_start
+
+
+def report(title, rows, total):
+    print(title)
+    for url, status, size, enc, elapsed in rows:
+        print("  %-40s %3d %9d B %-5s %7.1f ms" % (urllib.parse.urlparse(url).path, status, size, enc, elapsed * 1000))
+    print("  total %d B in %.1f ms\n" % (sum(r[2] for r in rows), total * 1000))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("url")
+    parser.add_argument("--runs", type=int, default=1)
+    args = parser.parse_args()
+
+    for run in range(args.runs):
+        etags = {}
+        rows, total = load(args.url, etags)
+        report("cold load %d" % (run + 1), rows, total)
+        rows, total = load(args.url, etags)
+        report("warm load %d (If-None-Match)" % (run + 1), rows, total)
+
+
+if __name__ == "__main__":
+    main()
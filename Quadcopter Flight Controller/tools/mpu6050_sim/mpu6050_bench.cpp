@@ -0,0 +1,224 @@
+// Host benchmark of the MPU6050 driver against the emulated chip.
+//
+// Runs the real I2Cdev MPU6050 / MotionApps 2.0 sources over the simulated
+// bus (I2CDEV_HOST_SIM) and reports bus transactions, bytes and virtual bus
+// time for dmpInitialize(), packet reads with dmpGetCurrentFIFOPacket() at a
+// fast and a slow polling interval, and the driver's offset calibration
+// (the older PID search against CalibrateMotion6).
+// Everything except the host time column is deterministic.
+//
+// Usage: mpu6050_bench [--seconds N] [--loop-us N] [--slow-loop-us N] [--bus-hz N]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "I2Cdev.h"
+#include "MPU6050_6Axis_MotionApps20.h"
+#include "mpu6050_emu.h"
+
+struct Options {
+  uint32_t seconds = 10;
+  uint32_t loopUs = 2500;        // one pass of the firmware loop
+  uint32_t slowLoopUs = 300000;  // slow enough to overflow the FIFO
+  uint32_t busHz = 400000;
+};
+
+// Level, then a roll, a pitch and a yaw turn, then back to level
+static const MotionKeyframe trajectory[] = {
+  {0, 0, 0, 0},
+  {1000, 0, 0, 0},
+  {2000, 0, 0, 30},
+  {3000, 0, -20, 30},
+  {5000, 90, -20, 30},
+  {7000, 90, 0, 0},
+};
+
+struct Measure {
+  I2CdevSimStats bus;
+  uint64_t virtualUs;
+  double hostUs;
+};
+
+template<typename F>
+static Measure measure(F &&body) {
+  i2cdevSimResetStats();
+  uint64_t v0 = i2cdevSimNowUs();
+  auto h0 = std::chrono::steady_clock::now();
+  body();
+  Measure m;
+  m.hostUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - h0).count();
+  m.virtualUs = i2cdevSimNowUs() - v0;
+  m.bus = i2cdevSimStats();
+  return m;
+}
+
+static void printHeader() {
+  printf("%-28s %9s %9s %10s %10s %10s %10s\n", "", "reads", "writes", "bytes in", "bytes out", "bus ms", "host ms");
+}
+
+static void printRow(const char *name, const Measure &m) {
+  printf("%-28s %9u %9u %10llu %10llu %10.1f %10.2f\n", name, m.bus.readTransactions, m.bus.writeTransactions,
+         (unsigned long long)m.bus.bytesRead, (unsigned long long)m.bus.bytesWritten, m.bus.busUs / 1000.0,
+         m.hostUs / 1000.0);
+}
+
+struct PollResult {
+  uint32_t calls = 0;
+  uint32_t packets = 0;
+  double errSum = 0;
+  double errMax = 0;
+};
+
+// Calls dmpGetCurrentFIFOPacket() once per simulated loop pass and compares
+// the attitude it returns with the trajectory at that moment
+static PollResult poll(MPU6050 &mpu, Mpu6050Emu &emu, uint32_t loopUs, uint32_t seconds) {
+  PollResult r;
+  uint8_t fifoBuffer[64];
+  uint64_t end = i2cdevSimNowUs() + (uint64_t)seconds * 1000000;
+  while (i2cdevSimNowUs() < end) {
+    uint64_t passStart = i2cdevSimNowUs();
+    r.calls++;
+    if (mpu.dmpGetCurrentFIFOPacket(fifoBuffer)) {
+      Quaternion q;
+      VectorFloat gravity;
+      float ypr[3], truth[3], tq[4];
+      mpu.dmpGetQuaternion(&q, fifoBuffer);
+      mpu.dmpGetGravity(&gravity, &q);
+      mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
+
+      // Truth goes through the same conversion, so only staleness and
+      // quantization show up as error
+      emu.quaternionAt(i2cdevSimNowUs(), tq);
+      Quaternion trueQ(tq[0], tq[1], tq[2], tq[3]);
+      mpu.dmpGetGravity(&gravity, &trueQ);
+      mpu.dmpGetYawPitchRoll(truth, &trueQ, &gravity);
+      for (int i = 0; i < 3; i++) {
+        double err = fabs(ypr[i] - truth[i]) * 180.0 / M_PI;
+        if (err > 180) err = 360 - err;
+        r.errSum += err / 3;
+        if (err > r.errMax) r.errMax = err;
+      }
+      r.packets++;
+    }
+    // The rest of the loop pass takes whatever the read left over
+    uint64_t spent = i2cdevSimNowUs() - passStart;
+    if (spent < loopUs) i2cdevSimAdvanceUs(loopUs - spent);
+  }
+  return r;
+}
+
+static void printPoll(const char *name, const PollResult &r, const Measure &m, const Mpu6050EmuStats &before,
+                      const Mpu6050EmuStats &after) {
+  printRow(name, m);
+  printf("  %u calls, %u packets (%.1f%%), %.1f transactions and %.0f bytes per packet, %.0f us bus per call\n",
+         r.calls, r.packets, 100.0 * r.packets / r.calls,
+         (double)(m.bus.readTransactions + m.bus.writeTransactions) / (r.packets ? r.packets : 1),
+         (double)(m.bus.bytesRead + m.bus.bytesWritten) / (r.packets ? r.packets : 1),
+         (double)m.bus.busUs / r.calls);
+  printf("  attitude error vs now: mean %.2f deg, max %.2f deg; FIFO overflows %u, resets %u\n",
+         r.packets ? r.errSum / r.packets : 0.0, r.errMax, after.overflows - before.overflows,
+         after.fifoResets - before.fifoResets);
+}
+
+template<typename F>
+static void calibration(const char *name, MPU6050 &mpu, F &&body) {
+  mpu.setXAccelOffset(0);
+  mpu.setYAccelOffset(0);
+  mpu.setZAccelOffset(0);
+  mpu.setXGyroOffset(0);
+  mpu.setYGyroOffset(0);
+  mpu.setZGyroOffset(0);
+  Measure m = measure(body);
+  printRow(name, m);
+
+  int32_t sum[6] = {0, 0, 0, 0, 0, 0};
+  const int samples = 200;
+  for (int i = 0; i < samples; i++) {
+    int16_t v[6];
+    mpu.getMotion6(&v[0], &v[1], &v[2], &v[3], &v[4], &v[5]);
+    for (int k = 0; k < 6; k++) sum[k] += v[k];
+    i2cdevSimAdvanceUs(1000);
+  }
+  int16_t *offsets = mpu.GetActiveOffsets();
+  printf("  virtual time %.1f ms\n", m.virtualUs / 1000.0);
+  printf("  offsets   accel %6d %6d %6d   gyro %6d %6d %6d\n",
+         offsets[0], offsets[1], offsets[2], offsets[3], offsets[4], offsets[5]);
+  printf("  residual  accel %6.1f %6.1f %6.1f   gyro %6.1f %6.1f %6.1f  (LSB, 1 g on z removed)\n",
+         sum[0] / (double)samples, sum[1] / (double)samples, sum[2] / (double)samples - 16384,
+         sum[3] / (double)samples, sum[4] / (double)samples, sum[5] / (double)samples);
+}
+
+static bool parseArgs(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) return false;
+    uint32_t v = strtoul(argv[i + 1], NULL, 10);
+    if (!strcmp(argv[i], "--seconds")) opt.seconds = v;
+    else if (!strcmp(argv[i], "--loop-us")) opt.loopUs = v;
+    else if (!strcmp(argv[i], "--slow-loop-us")) opt.slowLoopUs = v;
+    else if (!strcmp(argv[i], "--bus-hz")) opt.busHz = v;
+    else return false;
+    i++;
+  }
+  return opt.seconds > 0 && opt.busHz > 0;
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--seconds N] [--loop-us N] [--slow-loop-us N] [--bus-hz N]\n", argv[0]);
+    return 1;
+  }
+
+  i2cdevSimReset();
+  i2cdevSimSetClock(opt.busHz);
+  Mpu6050Emu emu;
+  emu.setTrajectory(trajectory, sizeof(trajectory) / sizeof(trajectory[0]));
+  i2cdevSimAttach(MPU6050_DEFAULT_ADDRESS, &emu);
+
+  MPU6050 mpu;
+  printf("bus %u Hz, %u s per polling run\n\n", opt.busHz, opt.seconds);
+  printHeader();
+
+  Measure m = measure([&] { mpu.initialize(); });
+  printRow("initialize", m);
+  if (!mpu.testConnection()) {
+    fprintf(stderr, "emulated MPU6050 did not answer WHO_AM_I\n");
+    return 1;
+  }
+
+  uint8_t status = 0;
+  m = measure([&] { status = mpu.dmpInitialize(); });
+  printRow("dmpInitialize", m);
+  if (status != 0) {
+    fprintf(stderr, "dmpInitialize failed (code %u)\n", status);
+    return 1;
+  }
+  printf("  virtual time %.1f ms, DMP rate %u Hz\n", m.virtualUs / 1000.0, emu.dmpRateHz());
+
+  mpu.setDMPEnabled(true);
+  for (uint32_t loopUs : {opt.loopUs, opt.slowLoopUs}) {
+    PollResult r;
+    Mpu6050EmuStats before = emu.stats();
+    m = measure([&] { r = poll(mpu, emu, loopUs, opt.seconds); });
+    char name[64];
+    snprintf(name, sizeof(name), "packets, %u us loop", loopUs);
+    printPoll(name, r, m, before, emu.stats());
+  }
+
+  // Offset calibration on a level, still sensor, each run starting from
+  // cleared offsets
+  mpu.setDMPEnabled(false);
+  emu.setTrajectory(nullptr, 0);
+  calibration("PID search, 6 loops", mpu, [&] {
+    // What CalibrateAccel(6) and CalibrateGyro(6) used to run
+    mpu.PID(MPU6050_RA_ACCEL_XOUT_H, 0.315f, 21.0f, 6);
+    mpu.PID(MPU6050_RA_GYRO_XOUT_H, 0.315f, 94.5f, 6);
+  });
+  calibration("CalibrateMotion6(3)", mpu, [&] { mpu.CalibrateMotion6(3); });
+  return 0;
+}
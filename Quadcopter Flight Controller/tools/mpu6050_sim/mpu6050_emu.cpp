@@ -0,0 +1,430 @@
+#include "mpu6050_emu.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "MPU6050.h"
+
+#define FIFO_SIZE         1024
+#define ACCEL_DMP_LSB_G   8192.0f     // DMP packet accel, 1 g
+#define GYRO_DMP_LSB_DPS  16.4f       // DMP packet gyro, 2000 dps range
+#define ACCEL_OFFS_LSB_G  2048.0f     // accel offset registers use the 16 g scale
+#define GYRO_OFFS_LSB_DPS 32.8f       // gyro offset registers use the 1000 dps scale
+#define TEMP_RAW_25C      -3920       // (25 - 36.53) * 340
+#define MAG_LSB_UT        (1 / 0.3f)  // AK8975, 0.3 uT per LSB
+#define DMP612_CFG_15     2727        // raw accel/gyro FIFO code, 6.12 image
+
+static const float DEG = (float)M_PI / 180.0f;
+
+static void putBe16(uint8_t *p, int16_t v) {
+  p[0] = (uint8_t)((uint16_t)v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void putBe32(uint8_t *p, int32_t v) {
+  p[0] = (uint8_t)((uint32_t)v >> 24);
+  p[1] = (uint8_t)((uint32_t)v >> 16);
+  p[2] = (uint8_t)((uint32_t)v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static int16_t saturate16(float v) {
+  if (v > 32767.0f) return 32767;
+  if (v < -32768.0f) return -32768;
+  return (int16_t)lrintf(v);
+}
+
+Mpu6050Emu::Mpu6050Emu(const Mpu6050EmuConfig &config) : config_(config) {
+  memset(memory_, 0, sizeof(memory_));
+  resetRegisters();
+}
+
+void Mpu6050Emu::setTrajectory(const MotionKeyframe *frames, size_t count) {
+  trajectory_.assign(frames, frames + count);
+}
+
+void Mpu6050Emu::resetRegisters() {
+  memset(regs_, 0, sizeof(regs_));
+  regs_[MPU6050_RA_PWR_MGMT_1] = 1 << MPU6050_PWR1_SLEEP_BIT;
+  regs_[MPU6050_RA_WHO_AM_I] = 0x68;
+  fifoHead_ = 0;
+  fifoCount_ = 0;
+  wasRunning_ = false;
+}
+
+bool Mpu6050Emu::running() const {
+  return !(regs_[MPU6050_RA_PWR_MGMT_1] & (1 << MPU6050_PWR1_SLEEP_BIT));
+}
+
+uint32_t Mpu6050Emu::sampleRateHz() const {
+  uint8_t dlpf = regs_[MPU6050_RA_CONFIG] & 0x07;
+  uint32_t gyroRate = (dlpf == 0 || dlpf == 7) ? 8000 : 1000;
+  return gyroRate / (1 + regs_[MPU6050_RA_SMPLRT_DIV]);
+}
+
+uint32_t Mpu6050Emu::dmpRateHz() const {
+  // FIFO rate divisor, big endian, where dmpInitialize() puts it
+  uint16_t divisor = (memory_[2][0x16] << 8) | memory_[2][0x17];
+  uint32_t rate = sampleRateHz() / (1 + divisor);
+  return rate ? rate : 1;
+}
+
+size_t Mpu6050Emu::dmpPacketSize() const {
+  switch (config_.dmpImage) {
+    case DMP_MOTIONAPPS612: {
+      // 0xC0 and 0xC4 start the accel and gyro copies; 0xA3 is a no-op
+      const uint8_t *cfg = &memory_[DMP612_CFG_15 >> 8][DMP612_CFG_15 & 0xFF];
+      return 16 + (cfg[1] == 0xC0 ? 6 : 0) + (cfg[4] == 0xC4 ? 6 : 0);
+    }
+    case DMP_MOTIONAPPS41:
+      return 48;
+    default:
+      return 42;
+  }
+}
+
+void Mpu6050Emu::attitudeAt(uint64_t tUs, float ypr[3]) const {
+  ypr[0] = ypr[1] = ypr[2] = 0;
+  if (trajectory_.empty()) return;
+
+  double tMs = tUs / 1000.0;
+  const MotionKeyframe *a = &trajectory_.front();
+  const MotionKeyframe *b = a;
+  for (size_t i = 1; i < trajectory_.size() && trajectory_[i - 1].timeMs <= tMs; i++) {
+    a = &trajectory_[i - 1];
+    b = &trajectory_[i];
+  }
+  float f = 0;
+  if (b->timeMs > a->timeMs) {
+    f = (float)((tMs - a->timeMs) / (b->timeMs - a->timeMs));
+    f = f < 0 ? 0 : (f > 1 ? 1 : f);
+  }
+  ypr[0] = a->yaw + (b->yaw - a->yaw) * f;
+  ypr[1] = a->pitch + (b->pitch - a->pitch) * f;
+  ypr[2] = a->roll + (b->roll - a->roll) * f;
+}
+
+void Mpu6050Emu::quaternionAt(uint64_t tUs, float quat[4]) const {
+  Motion m;
+  motionAt(tUs, m);
+  memcpy(quat, m.quat, sizeof(m.quat));
+}
+
+void Mpu6050Emu::motionAt(uint64_t tUs, Motion &m) const {
+  float ypr[3], later[3];
+  attitudeAt(tUs, ypr);
+  attitudeAt(tUs + 1000, later);
+
+  // The library reports yaw and pitch with the opposite sign of the usual
+  // Z-Y-X Euler angles, so build the quaternion from those
+  float psi = -ypr[0] * DEG / 2, theta = -ypr[1] * DEG / 2, phi = ypr[2] * DEG / 2;
+  float cy = cosf(psi), sy = sinf(psi);
+  float cp = cosf(theta), sp = sinf(theta);
+  float cr = cosf(phi), sr = sinf(phi);
+  float w = cr * cp * cy + sr * sp * sy;
+  float x = sr * cp * cy - cr * sp * sy;
+  float y = cr * sp * cy + sr * cp * sy;
+  float z = cr * cp * sy - sr * sp * cy;
+  m.quat[0] = w; m.quat[1] = x; m.quat[2] = y; m.quat[3] = z;
+
+  m.up[0] = 2 * (x * z - w * y);
+  m.up[1] = 2 * (w * x + y * z);
+  m.up[2] = w * w - x * x - y * y + z * z;
+
+  m.rateDps[0] = (later[2] - ypr[2]) * 1000.0f;
+  m.rateDps[1] = -(later[1] - ypr[1]) * 1000.0f;
+  m.rateDps[2] = -(later[0] - ypr[0]) * 1000.0f;
+}
+
+// Deterministic noise: depends only on the seed, sample and channel, never on
+// how often or when the driver polls
+float Mpu6050Emu::noise(uint64_t sampleIndex, int channel) const {
+  uint64_t h = sampleIndex * 0x9E3779B97F4A7C15ull ^ ((uint64_t)channel << 32) ^ config_.seed;
+  float sum = 0;
+  for (int i = 0; i < 4; i++) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    sum += (h & 0xFFFFFF) / (float)0x1000000 - 0.5f;
+  }
+  return sum * 1.732f;   // unit variance
+}
+
+int16_t Mpu6050Emu::offsetRegister(uint8_t reg) const {
+  return (int16_t)((regs_[reg] << 8) | regs_[reg + 1]);
+}
+
+void Mpu6050Emu::sensorOutputs(uint64_t sampleIndex, int16_t accel[3], int16_t gyro[3]) const {
+  Motion m;
+  uint64_t tUs = sampleIndex * 1000000ull / sampleRateHz();
+  motionAt(tUs, m);
+
+  float accelLsb = 16384.0f / (1 << ((regs_[MPU6050_RA_ACCEL_CONFIG] >> 3) & 3));
+  float gyroLsb = 131.0f / (1 << ((regs_[MPU6050_RA_GYRO_CONFIG] >> 3) & 3));
+  for (int i = 0; i < 3; i++) {
+    // Bit 0 of the accel offsets is reserved
+    float aOffs = (offsetRegister(MPU6050_RA_XA_OFFS_H + 2 * i) & ~1) / ACCEL_OFFS_LSB_G;
+    float gOffs = offsetRegister(MPU6050_RA_XG_OFFS_USRH + 2 * i) / GYRO_OFFS_LSB_DPS;
+    float a = m.up[i] + config_.accelBiasG[i] + aOffs + config_.accelNoiseG * noise(sampleIndex, i);
+    float g = m.rateDps[i] + config_.gyroBiasDps[i] + gOffs + config_.gyroNoiseDps * noise(sampleIndex, 3 + i);
+    accel[i] = saturate16(a * accelLsb);
+    gyro[i] = saturate16(g * gyroLsb);
+  }
+}
+
+void Mpu6050Emu::pushFifo(const uint8_t *data, size_t len) {
+  if (fifoCount_ + len > FIFO_SIZE) {
+    // The chip keeps writing and the oldest bytes are lost
+    size_t lost = fifoCount_ + len - FIFO_SIZE;
+    fifoHead_ = (fifoHead_ + lost) % FIFO_SIZE;
+    fifoCount_ -= lost;
+    stats_.overflows++;
+    stats_.bytesLost += lost;
+    regs_[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT;
+  }
+  for (size_t i = 0; i < len; i++) {
+    fifo_[(fifoHead_ + fifoCount_) % FIFO_SIZE] = data[i];
+    fifoCount_++;
+  }
+}
+
+void Mpu6050Emu::pushDmpPacket(uint64_t tUs) {
+  uint64_t sampleIndex = tUs * sampleRateHz() / 1000000;
+  Motion m;
+  motionAt(tUs, m);
+  int16_t accel[3], gyro[3];
+  sensorOutputs(sampleIndex, accel, gyro);
+
+  float accelLsb = 16384.0f / (1 << ((regs_[MPU6050_RA_ACCEL_CONFIG] >> 3) & 3));
+  float gyroLsb = 131.0f / (1 << ((regs_[MPU6050_RA_GYRO_CONFIG] >> 3) & 3));
+
+  uint8_t packet[48] = {};
+  size_t size = dmpPacketSize();
+  // Yaw drift turns the reported attitude about the earth's z axis
+  float half = -config_.dmpYawDriftDps * DEG * (tUs / 1e6f) / 2;
+  float c = cosf(half), s = sinf(half);
+  const float *q = m.quat;
+  float drifted[4] = {c * q[0] - s * q[3], c * q[1] - s * q[2], c * q[2] + s * q[1], c * q[3] + s * q[0]};
+  for (int i = 0; i < 4; i++) {
+    putBe32(packet + 4 * i, (int32_t)lrint(drifted[i] * 1073741824.0));
+  }
+  if (config_.dmpImage == DMP_MOTIONAPPS612) {
+    // Raw sensor words packed after the quaternion, accel first
+    const uint8_t *cfg = &memory_[DMP612_CFG_15 >> 8][DMP612_CFG_15 & 0xFF];
+    size_t n = 16;
+    if (cfg[1] == 0xC0) {
+      for (int i = 0; i < 3; i++) { putBe16(packet + n, accel[i]); n += 2; }
+    }
+    if (cfg[4] == 0xC4) {
+      for (int i = 0; i < 3; i++) { putBe16(packet + n, gyro[i]); n += 2; }
+    }
+  } else {
+    // 32 bit slots with the value in the high half
+    size_t accelAt = config_.dmpImage == DMP_MOTIONAPPS41 ? 34 : 28;
+    for (int i = 0; i < 3; i++) {
+      putBe16(packet + 16 + 4 * i, saturate16(gyro[i] / gyroLsb * GYRO_DMP_LSB_DPS));
+      putBe16(packet + accelAt + 4 * i, saturate16(accel[i] / accelLsb * ACCEL_DMP_LSB_G));
+    }
+    if (config_.dmpImage == DMP_MOTIONAPPS41 && magSlaveOn()) {
+      // Earth field into the body frame: conjugate rotation by the attitude
+      float w = m.quat[0], x = -m.quat[1], y = -m.quat[2], z = -m.quat[3];
+      const float *v = config_.magFieldUt;
+      float tx = 2 * (y * v[2] - z * v[1]), ty = 2 * (z * v[0] - x * v[2]), tz = 2 * (x * v[1] - y * v[0]);
+      float body[3] = {v[0] + w * tx + (y * tz - z * ty), v[1] + w * ty + (z * tx - x * tz),
+                       v[2] + w * tz + (x * ty - y * tx)};
+      for (int i = 0; i < 3; i++) {
+        body[i] = body[i] * config_.magSoftIron[i] + config_.magHardIronUt[i] +
+                  config_.magNoiseUt * noise(sampleIndex, 6 + i);
+      }
+      // AK8975 axes: x and y swapped, z flipped
+      float ak[3] = {body[1], body[0], -body[2]};
+      for (int i = 0; i < 3; i++) putBe16(packet + 28 + 2 * i, saturate16(ak[i] * MAG_LSB_UT));
+    }
+  }
+  pushFifo(packet, size);
+  stats_.dmpPackets++;
+  regs_[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_DMP_INT_BIT;
+}
+
+// The I2C master reads the AK8975 as slave 0, as MotionApps 4.1 sets it up
+bool Mpu6050Emu::magSlaveOn() const {
+  return (regs_[MPU6050_RA_USER_CTRL] & (1 << MPU6050_USERCTRL_I2C_MST_EN_BIT)) &&
+         (regs_[MPU6050_RA_I2C_SLV0_CTRL] & 0x80) && regs_[MPU6050_RA_I2C_SLV0_ADDR] == (0x80 | config_.magAddress);
+}
+
+void Mpu6050Emu::pushRawSample(uint64_t sampleIndex) {
+  int16_t accel[3], gyro[3];
+  sensorOutputs(sampleIndex, accel, gyro);
+  uint8_t enable = regs_[MPU6050_RA_FIFO_EN];
+  uint8_t bytes[14];
+  size_t n = 0;
+  // Same order as the sensor registers: accel, temperature, gyro x, y, z
+  if (enable & 0x08) {
+    for (int i = 0; i < 3; i++) { putBe16(bytes + n, accel[i]); n += 2; }
+  }
+  if (enable & 0x80) { putBe16(bytes + n, TEMP_RAW_25C); n += 2; }
+  for (int i = 0; i < 3; i++) {
+    if (enable & (0x40 >> i)) { putBe16(bytes + n, gyro[i]); n += 2; }
+  }
+  if (n) {
+    pushFifo(bytes, n);
+    stats_.rawSamples++;
+  }
+}
+
+void Mpu6050Emu::advance(uint64_t nowUs) {
+  if (nowUs < nowUs_) return;
+  nowUs_ = nowUs;
+
+  uint8_t userCtrl = regs_[MPU6050_RA_USER_CTRL];
+  bool fifoOn = running() && (userCtrl & (1 << MPU6050_USERCTRL_FIFO_EN_BIT));
+  bool dmpOn = fifoOn && (userCtrl & (1 << MPU6050_USERCTRL_DMP_EN_BIT));
+  bool rawOn = fifoOn && !dmpOn && regs_[MPU6050_RA_FIFO_EN];
+
+  if (!dmpOn && !rawOn) {
+    wasRunning_ = false;
+    return;
+  }
+
+  uint32_t rate = dmpOn ? dmpRateHz() : sampleRateHz();
+  uint64_t periodNs = 1000000000ull / rate;
+  uint64_t nowNs = nowUs * 1000;
+  if (!wasRunning_) {
+    nextItemNs_ = nowNs + periodNs;
+    wasRunning_ = true;
+  }
+
+  uint64_t due = nextItemNs_ <= nowNs ? (nowNs - nextItemNs_) / periodNs + 1 : 0;
+  if (due == 0) return;
+
+  // Only the last FIFO_SIZE bytes survive; skip anything older than that
+  size_t itemBytes = dmpPacketSize();
+  if (!dmpOn) {
+    uint8_t enable = regs_[MPU6050_RA_FIFO_EN];
+    itemBytes = ((enable & 0x08) ? 6 : 0) + ((enable & 0x80) ? 2 : 0) +
+                2 * (((enable >> 6) & 1) + ((enable >> 5) & 1) + ((enable >> 4) & 1));
+  }
+  uint64_t keep = FIFO_SIZE / itemBytes + 2;
+  if (due > keep) {
+    uint64_t skipped = due - keep;
+    stats_.overflows++;
+    stats_.bytesLost += fifoCount_ + skipped * itemBytes;
+    if (dmpOn) stats_.dmpPackets += skipped; else stats_.rawSamples += skipped;
+    regs_[MPU6050_RA_INT_STATUS] |= 1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT;
+    fifoHead_ = 0;
+    fifoCount_ = 0;
+    nextItemNs_ += skipped * periodNs;
+    due = keep;
+  }
+
+  for (uint64_t i = 0; i < due; i++) {
+    uint64_t tUs = nextItemNs_ / 1000;
+    if (dmpOn) {
+      pushDmpPacket(tUs);
+    } else {
+      pushRawSample(tUs * sampleRateHz() / 1000000);
+    }
+    nextItemNs_ += periodNs;
+  }
+}
+
+uint8_t Mpu6050Emu::readRegister(uint8_t reg) {
+  switch (reg) {
+    case MPU6050_RA_FIFO_COUNTH:
+      return fifoCount_ >> 8;
+    case MPU6050_RA_FIFO_COUNTL:
+      return fifoCount_ & 0xFF;
+    case MPU6050_RA_FIFO_R_W: {
+      if (fifoCount_ == 0) return 0;
+      uint8_t b = fifo_[fifoHead_];
+      fifoHead_ = (fifoHead_ + 1) % FIFO_SIZE;
+      fifoCount_--;
+      return b;
+    }
+    case MPU6050_RA_MEM_R_W: {
+      uint8_t bank = regs_[MPU6050_RA_BANK_SEL] & 0x1F;
+      uint8_t b = memory_[bank][regs_[MPU6050_RA_MEM_START_ADDR]++];
+      return b;
+    }
+    case MPU6050_RA_INT_STATUS: {
+      uint8_t status = regs_[MPU6050_RA_INT_STATUS];
+      regs_[MPU6050_RA_INT_STATUS] = 0;
+      return status;
+    }
+    default:
+      if (reg >= MPU6050_RA_ACCEL_XOUT_H && reg <= MPU6050_RA_GYRO_ZOUT_L) {
+        return latched_[reg - MPU6050_RA_ACCEL_XOUT_H];
+      }
+      return regs_[reg & 0x7F];
+  }
+}
+
+void Mpu6050Emu::writeRegister(uint8_t reg, uint8_t value) {
+  switch (reg) {
+    case MPU6050_RA_PWR_MGMT_1:
+      if (value & (1 << MPU6050_PWR1_DEVICE_RESET_BIT)) {
+        resetRegisters();
+      } else {
+        regs_[reg] = value;
+      }
+      break;
+    case MPU6050_RA_USER_CTRL:
+      if (value & (1 << MPU6050_USERCTRL_FIFO_RESET_BIT)) {
+        fifoHead_ = 0;
+        fifoCount_ = 0;
+        stats_.fifoResets++;
+      }
+      if (value & (1 << MPU6050_USERCTRL_DMP_RESET_BIT)) {
+        wasRunning_ = false;
+      }
+      // Reset bits clear themselves
+      regs_[reg] = value & 0xF0;
+      break;
+    case MPU6050_RA_MEM_R_W: {
+      uint8_t bank = regs_[MPU6050_RA_BANK_SEL] & 0x1F;
+      memory_[bank][regs_[MPU6050_RA_MEM_START_ADDR]++] = value;
+      break;
+    }
+    case MPU6050_RA_FIFO_R_W:
+    case MPU6050_RA_FIFO_COUNTH:
+    case MPU6050_RA_FIFO_COUNTL:
+    case MPU6050_RA_INT_STATUS:
+      break;
+    default:
+      regs_[reg & 0x7F] = value;
+      break;
+  }
+}
+
+bool Mpu6050Emu::read(uint8_t regAddr, uint8_t *data, uint8_t length) {
+  if (regAddr > MPU6050_RA_WHO_AM_I) return false;
+
+  // A burst over the sensor registers sees one consistent sample
+  if (regAddr <= MPU6050_RA_GYRO_ZOUT_L && regAddr + length > MPU6050_RA_ACCEL_XOUT_H) {
+    uint32_t rate = sampleRateHz();
+    int16_t accel[3], gyro[3];
+    sensorOutputs(nowUs_ * rate / 1000000, accel, gyro);
+    for (int i = 0; i < 3; i++) {
+      putBe16(latched_ + 2 * i, accel[i]);
+      putBe16(latched_ + 8 + 2 * i, gyro[i]);
+    }
+    putBe16(latched_ + 6, TEMP_RAW_25C);
+  }
+
+  // FIFO_R_W and MEM_R_W stream from the same register; everything else
+  // auto-increments
+  bool stream = regAddr == MPU6050_RA_FIFO_R_W || regAddr == MPU6050_RA_MEM_R_W;
+  for (uint8_t i = 0; i < length; i++) {
+    data[i] = readRegister(stream ? regAddr : (uint8_t)(regAddr + i));
+  }
+  return true;
+}
+
+bool Mpu6050Emu::write(uint8_t regAddr, const uint8_t *data, uint8_t length) {
+  if (regAddr > MPU6050_RA_WHO_AM_I) return false;
+  bool stream = regAddr == MPU6050_RA_FIFO_R_W || regAddr == MPU6050_RA_MEM_R_W;
+  for (uint8_t i = 0; i < length; i++) {
+    writeRegister(stream ? regAddr : (uint8_t)(regAddr + i), data[i]);
+  }
+  return true;
+}
@@ -0,0 +1,142 @@
+#ifndef _MPU6050_EMU_H_
+#define _MPU6050_EMU_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "I2Cdev.h"
+#include "dmp_device.h"
+
+// Emulated MPU6050 for the simulated I2Cdev bus (I2CDEV_HOST_SIM).
+//
+// Models what the I2Cdev MPU6050 driver relies on:
+//   - the register file with its reset values, WHO_AM_I, self-clearing reset
+//     bits and the clear-on-read INT_STATUS
+//   - accel and gyro offset registers, applied to the sensor outputs with the
+//     chip's scaling so the driver's PID calibration converges as on hardware
+//   - sample rate from SMPLRT_DIV and the DLPF setting
+//   - DMP memory banks (BANK_SEL, MEM_START_ADDR, MEM_R_W) and the FIFO rate
+//     divisor dmpInitialize() writes at bank 2, offset 0x16
+//   - the 1024 byte FIFO, fed with DMP packets in the layout of the loaded
+//     image while the DMP runs, or with raw sensor words selected in FIFO_EN
+//     otherwise. The 6.12 layout follows the CFG_15 code in DMP memory, so
+//     packets trimmed through DmpDevice::selectFields() come out trimmed. On
+//     overflow the oldest bytes are lost and FIFO_OFLOW is raised, which
+//     leaves the FIFO misaligned exactly as on the chip.
+//
+// The motion comes from a scripted trajectory of attitude keyframes. The DMP
+// itself is not emulated: the packet quaternion is the trajectory attitude,
+// Euler angle rates stand in for body rates. The packet quaternion can be
+// made to drift in yaw like a 6-axis DMP without a heading reference. The
+// magnetometer in 4.1 packets reads a fixed earth field turned into the body
+// frame, bent by hard and soft iron on the airframe, in the AK8975's axes;
+// it only shows up once the driver has set the MPU6050's I2C master to read
+// the AK8975 as slave 0, as on the chip. Which image was loaded is not worked
+// out from the upload; set it to match the driver.
+
+// Attitude in degrees, signed like MPU6050::dmpGetYawPitchRoll. Pitch and
+// roll come back exactly; that function derives yaw from the quaternion in a
+// way that mixes in pitch and roll, so yaw only matches while level.
+struct MotionKeyframe {
+  uint32_t timeMs;
+  float yaw;
+  float pitch;
+  float roll;
+};
+
+struct Mpu6050EmuConfig {
+  float gyroBiasDps[3] = {1.5f, -0.8f, 0.4f};
+  float accelBiasG[3] = {0.02f, -0.03f, 0.05f};
+  float gyroNoiseDps = 0.05f;
+  float accelNoiseG = 0.002f;
+  float magFieldUt[3] = {22.0f, 0.0f, -42.0f};  // earth frame, z up
+  // Airframe distortion in body axes: field * softIron + hardIron
+  float magHardIronUt[3] = {12.0f, -7.0f, 4.0f};
+  float magSoftIron[3] = {1.08f, 0.95f, 1.0f};
+  float magNoiseUt = 0.3f;
+  uint8_t magAddress = 0x0E;     // AK8975 on the aux bus
+  float dmpYawDriftDps = 0;      // packet quaternion yaw error growth
+  DmpProfile dmpImage = DMP_MOTIONAPPS20;
+  uint32_t seed = 1;
+};
+
+struct Mpu6050EmuStats {
+  uint32_t dmpPackets;      // packets written to the FIFO
+  uint32_t rawSamples;      // non-DMP sample sets written to the FIFO
+  uint32_t overflows;       // times the FIFO overflowed
+  uint64_t bytesLost;       // bytes pushed out of a full FIFO
+  uint32_t fifoResets;
+};
+
+class Mpu6050Emu : public I2CdevSimDevice {
+public:
+  explicit Mpu6050Emu(const Mpu6050EmuConfig &config = Mpu6050EmuConfig());
+
+  // The last keyframe is held once the trajectory ends. Empty means level.
+  void setTrajectory(const MotionKeyframe *frames, size_t count);
+  void setDmpImage(DmpProfile image) { config_.dmpImage = image; }
+
+  bool read(uint8_t regAddr, uint8_t *data, uint8_t length) override;
+  bool write(uint8_t regAddr, const uint8_t *data, uint8_t length) override;
+  void advance(uint64_t nowUs) override;
+
+  const Mpu6050EmuStats &stats() const { return stats_; }
+  uint16_t fifoCount() const { return fifoCount_; }
+  uint32_t sampleRateHz() const;
+  uint32_t dmpRateHz() const;
+  size_t dmpPacketSize() const;
+
+  // Attitude (yaw, pitch, roll in degrees) the trajectory gives at t, and the
+  // matching quaternion (w, x, y, z) the DMP would report
+  void attitudeAt(uint64_t tUs, float ypr[3]) const;
+  void quaternionAt(uint64_t tUs, float quat[4]) const;
+
+private:
+  struct Motion {
+    float quat[4];      // w, x, y, z
+    float up[3];        // unit vector away from the ground, body frame
+    float rateDps[3];   // x, y, z
+  };
+
+  void resetRegisters();
+  void motionAt(uint64_t tUs, Motion &m) const;
+  void sensorOutputs(uint64_t sampleIndex, int16_t accel[3], int16_t gyro[3]) const;
+  float noise(uint64_t sampleIndex, int channel) const;
+  int16_t offsetRegister(uint8_t reg) const;
+  uint8_t readRegister(uint8_t reg);
+  void writeRegister(uint8_t reg, uint8_t value);
+  void pushFifo(const uint8_t *data, size_t len);
+  void pushDmpPacket(uint64_t tUs);
+  void pushRawSample(uint64_t sampleIndex);
+  bool magSlaveOn() const;
+  bool running() const;
+
+  Mpu6050EmuConfig config_;
+  std::vector<MotionKeyframe> trajectory_;
+
+  uint8_t regs_[128];
+  uint8_t memory_[32][256];
+  uint8_t fifo_[1024];
+  uint16_t fifoHead_ = 0;     // next byte to read
+  uint16_t fifoCount_ = 0;
+
+  uint64_t nowUs_ = 0;
+  uint64_t nextItemNs_ = 0;   // when the next packet or sample is written
+  bool wasRunning_ = false;
+
+  // Sensor registers latched at the start of a burst read
+  uint8_t latched_[14];
+  Mpu6050EmuStats stats_ = {};
+};
+
+// The simulated bus's virtual clock as a hal.h Clock, so flight core code
+// runs on the same timeline as the MPU6050 library and the emulated chip
+class BusClock : public Clock {
+public:
+  uint64_t nowUs() override { return i2cdevSimNowUs(); }
+  void delay(uint32_t ms) override { i2cdevSimAdvanceUs((uint64_t)ms * 1000); }
+};
+
+#endif /* _MPU6050_EMU_H_ */
@@ -0,0 +1,196 @@
+#include "quad_model.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "flight_core.h"
+
+#define GRAVITY 9.80665f
+
+// Motor positions on the diagonals (x forward, y left), in the mixer's order
+static const float motorX[4] = {1, 1, -1, -1};
+static const float motorY[4] = {1, -1, -1, 1};
+// Drag torque about z per N of thrust: counter-clockwise props push the
+// body clockwise
+static const float motorYaw[4] = {-1, 1, -1, 1};
+
+// DMP packet scales (gyro in flight_core.h)
+#define QUAT_ONE         16384
+#define ACCEL_LSB_PER_G  8192
+
+static void rotate(const float q[4], const float v[3], float out[3]) {
+  // out = q v q*, body to world
+  float w = q[0], x = q[1], y = q[2], z = q[3];
+  float tx = 2 * (y * v[2] - z * v[1]), ty = 2 * (z * v[0] - x * v[2]), tz = 2 * (x * v[1] - y * v[0]);
+  out[0] = v[0] + w * tx + (y * tz - z * ty);
+  out[1] = v[1] + w * ty + (z * tx - x * tz);
+  out[2] = v[2] + w * tz + (x * ty - y * tx);
+}
+
+static void rotateInverse(const float q[4], const float v[3], float out[3]) {
+  const float conj[4] = {q[0], -q[1], -q[2], -q[3]};
+  rotate(conj, v, out);
+}
+
+static int16_t clamp16(float v) {
+  return v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)lrintf(v);
+}
+
+QuadModel::QuadModel(const QuadParams &params, uint32_t seed) : p_(params), rng_(seed) {
+  reset(0);
+}
+
+void QuadModel::reset(float heightM) {
+  memset(pos_, 0, sizeof(pos_));
+  memset(vel_, 0, sizeof(vel_));
+  memset(rate_, 0, sizeof(rate_));
+  memset(speed_, 0, sizeof(speed_));
+  memset(target_, 0, sizeof(target_));
+  memset(phase_, 0, sizeof(phase_));
+  memset(wind_, 0, sizeof(wind_));
+  memset(gyroLp_, 0, sizeof(gyroLp_));
+  memset(accelLp_, 0, sizeof(accelLp_));
+  pos_[2] = heightM;
+  q_[0] = 1;
+  q_[1] = q_[2] = q_[3] = 0;
+  for (int i = 0; i < 4; i++) efficiency_[i] = 1;
+  specificForce_[0] = specificForce_[1] = 0;
+  specificForce_[2] = GRAVITY;
+  for (int k = 0; k < 2; k++) accelLp_[k][2] = GRAVITY;
+  grounded_ = heightM <= 0;
+}
+
+void QuadModel::setMotors(const uint16_t output[4]) {
+  for (int i = 0; i < 4; i++) {
+    float u = output[i] > MOTOR_OUTPUT_MAX ? 1.0f : (float)output[i] / MOTOR_OUTPUT_MAX;
+    target_[i] = u * p_.volts / p_.referenceVolts;
+  }
+}
+
+void QuadModel::setWind(const float wind[3]) {
+  memcpy(wind_, wind, sizeof(wind_));
+}
+
+void QuadModel::setMotorEfficiency(int motor, float efficiency) {
+  if (motor >= 0 && motor < 4) efficiency_[motor] = efficiency;
+}
+
+float QuadModel::thrust(float speed) const {
+  return p_.maxThrustN * ((1 - p_.thrustLinear) * speed * speed + p_.thrustLinear * speed);
+}
+
+float QuadModel::hoverOutput() const {
+  // Solve (1 - a) s^2 + a s = weight / 4 / maxThrust for the speed
+  float a = p_.thrustLinear, c = p_.massKg * GRAVITY / 4 / p_.maxThrustN;
+  float s = (-a + sqrtf(a * a + 4 * (1 - a) * c)) / (2 * (1 - a));
+  return s * p_.referenceVolts / p_.volts;
+}
+
+float QuadModel::noise(float sigma) {
+  return sigma * normal_(rng_);
+}
+
+void QuadModel::step(float dt) {
+  float k = 1 - expf(-dt / p_.motorTauS);
+  float t[4], total = 0;
+  float torque[3] = {0, 0, 0};
+  float vib[3] = {0, 0, 0};
+  float d = p_.armM * (float)M_SQRT1_2;
+  for (int i = 0; i < 4; i++) {
+    speed_[i] += (target_[i] - speed_[i]) * k;
+    t[i] = thrust(speed_[i]) * efficiency_[i];
+    total += t[i];
+    torque[0] += motorY[i] * d * t[i];
+    torque[1] -= motorX[i] * d * t[i];
+    torque[2] += motorYaw[i] * p_.torquePerThrust * t[i];
+
+    phase_[i] = fmodf(phase_[i] + 2 * (float)M_PI * speed_[i] * p_.maxRpm / 60 * dt, 2 * (float)M_PI);
+    float a = speed_[i] * speed_[i];
+    vib[0] += a * sinf(phase_[i]);
+    vib[1] += a * cosf(phase_[i] + i);
+    vib[2] += 0.3f * a * sinf(2 * phase_[i]);
+  }
+
+  // Air drag at the centre of pressure, in the body frame
+  float air[3] = {wind_[0] - vel_[0], wind_[1] - vel_[1], wind_[2] - vel_[2]};
+  float airBody[3];
+  rotateInverse(q_, air, airBody);
+  float drag[3];
+  for (int j = 0; j < 3; j++) drag[j] = p_.dragPerSpeed * airBody[j];
+  torque[0] += -p_.pressureHeightM * drag[1];
+  torque[1] += p_.pressureHeightM * drag[0];
+  for (int j = 0; j < 3; j++) torque[j] -= p_.rotationalDrag * rate_[j];
+
+  float forceBody[3] = {drag[0], drag[1], drag[2] + total};
+  for (int j = 0; j < 3; j++) specificForce_[j] = forceBody[j] / p_.massKg;
+
+  if (held_) {
+    memset(vel_, 0, sizeof(vel_));
+    memset(rate_, 0, sizeof(rate_));
+    specificForce_[0] = specificForce_[1] = 0;
+    specificForce_[2] = GRAVITY;
+  } else {
+    float force[3];
+    rotate(q_, forceBody, force);
+    force[2] -= p_.massKg * GRAVITY;
+
+    // Euler's equations in the body frame
+    const float *I = p_.inertia;
+    float h[3] = {I[0] * rate_[0], I[1] * rate_[1], I[2] * rate_[2]};
+    float gyroscopic[3] = {rate_[1] * h[2] - rate_[2] * h[1], rate_[2] * h[0] - rate_[0] * h[2],
+                           rate_[0] * h[1] - rate_[1] * h[0]};
+    for (int j = 0; j < 3; j++) {
+      vel_[j] += force[j] / p_.massKg * dt;
+      rate_[j] += (torque[j] - gyroscopic[j]) / I[j] * dt;
+    }
+
+    if (grounded_ && vel_[2] > 0) grounded_ = false;
+    if (grounded_) {
+      memset(vel_, 0, sizeof(vel_));
+      memset(rate_, 0, sizeof(rate_));
+    }
+    for (int j = 0; j < 3; j++) pos_[j] += vel_[j] * dt;
+    if (pos_[2] <= 0) {
+      pos_[2] = 0;
+      memset(vel_, 0, sizeof(vel_));
+      memset(rate_, 0, sizeof(rate_));
+      grounded_ = true;
+    }
+
+    float w = q_[0], x = q_[1], y = q_[2], z = q_[3];
+    float half = 0.5f * dt;
+    q_[0] += half * (-x * rate_[0] - y * rate_[1] - z * rate_[2]);
+    q_[1] += half * (w * rate_[0] + y * rate_[2] - z * rate_[1]);
+    q_[2] += half * (w * rate_[1] + z * rate_[0] - x * rate_[2]);
+    q_[3] += half * (w * rate_[2] + x * rate_[1] - y * rate_[0]);
+    float n = 1 / sqrtf(q_[0] * q_[0] + q_[1] * q_[1] + q_[2] * q_[2] + q_[3] * q_[3]);
+    for (int j = 0; j < 4; j++) q_[j] *= n;
+  }
+
+  // The chip's low-pass filter, as two first order stages
+  float lp = 1 - expf(-2 * (float)M_PI * p_.dlpfHz * dt);
+  const float dps = 180 / (float)M_PI;
+  for (int j = 0; j < 3; j++) {
+    float g = rate_[j] * dps + p_.vibrationDps * vib[j];
+    float a = specificForce_[j] / GRAVITY + p_.vibrationG * vib[j];
+    gyroLp_[0][j] += (g - gyroLp_[0][j]) * lp;
+    gyroLp_[1][j] += (gyroLp_[0][j] - gyroLp_[1][j]) * lp;
+    accelLp_[0][j] += (a - accelLp_[0][j]) * lp;
+    accelLp_[1][j] += (accelLp_[0][j] - accelLp_[1][j]) * lp;
+  }
+}
+
+void QuadModel::sample(ImuSample &s) {
+  // Attitude error as a small random rotation
+  float half = p_.quatNoiseDeg * (float)M_PI / 180 / 2;
+  float e[3] = {noise(half), noise(half), noise(half)};
+  float q[4] = {q_[0] - q_[1] * e[0] - q_[2] * e[1] - q_[3] * e[2], q_[1] + q_[0] * e[0] + q_[2] * e[2] - q_[3] * e[1],
+                q_[2] + q_[0] * e[1] + q_[3] * e[0] - q_[1] * e[2], q_[3] + q_[0] * e[2] + q_[1] * e[1] - q_[2] * e[0]};
+  float n = 1 / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  for (int j = 0; j < 4; j++) s.quat[j] = clamp16(q[j] * n * QUAT_ONE);
+  for (int j = 0; j < 3; j++) {
+    s.gyro[j] = clamp16((gyroLp_[1][j] + noise(p_.gyroNoiseDps)) * GYRO_LSB_PER_DPS);
+    s.accel[j] = clamp16((accelLp_[1][j] + noise(p_.accelNoiseG)) * ACCEL_LSB_PER_G);
+    s.mag[j] = 0;
+  }
+}
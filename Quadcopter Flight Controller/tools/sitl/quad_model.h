@@ -0,0 +1,104 @@
+#ifndef _QUAD_MODEL_H_
+#define _QUAD_MODEL_H_
+
+#include <stdint.h>
+
+#include <random>
+
+#include "hal.h"
+
+// Rigid body model of the quad for software-in-the-loop runs.
+//
+// World frame x forward, y left, z up; the body frame the same when level,
+// and the IMU is mounted in body axes. Motors sit on the diagonals in the
+// mixer's order (front left, front right, rear right, rear left); front left
+// and rear right turn counter-clockwise seen from above, so their drag
+// torque yaws the body clockwise.
+//
+// Each motor's speed follows its output with a first order lag, scaled by
+// the pack voltage; thrust is a blend of speed and speed squared, and drag
+// torque is proportional to thrust. Air drag acts on the velocity relative
+// to the wind at a centre of pressure above the centre of mass, so gusts
+// also tip the airframe. The IMU reports what the DMP would: the attitude
+// quaternion with a little noise, and the gyro and accelerometer with noise
+// and motor vibration through the chip's 42 Hz low-pass filter.
+
+struct QuadParams {
+  float massKg = 0.045f;
+  float armM = 0.046f;              // centre to motor
+  float inertia[3] = {1.6e-5f, 1.6e-5f, 2.9e-5f};  // kg m^2, body x, y, z
+  float maxThrustN = 0.22f;         // per motor, full output at referenceVolts
+  float thrustLinear = 0.15f;       // share of thrust linear in speed
+  float torquePerThrust = 0.006f;   // m: yaw drag torque per N of thrust
+  float motorTauS = 0.035f;         // motor speed time constant
+  float maxRpm = 40000;             // at full output, for the vibration tone
+  float dragPerSpeed = 0.03f;       // N per m/s of airspeed
+  float pressureHeightM = 0.01f;    // centre of pressure above the CoM
+  float rotationalDrag = 2e-6f;     // N m per rad/s
+  float volts = 3.8f;
+  float referenceVolts = 3.8f;
+
+  float quatNoiseDeg = 0.05f;
+  float gyroNoiseDps = 0.1f;
+  float accelNoiseG = 0.005f;
+  float vibrationDps = 3.0f;        // per motor at full speed, before the DLPF
+  float vibrationG = 0.3f;
+  float dlpfHz = 42;
+};
+
+class QuadModel {
+public:
+  explicit QuadModel(const QuadParams &params = QuadParams(), uint32_t seed = 1);
+
+  // Level and still at this height, motors stopped
+  void reset(float heightM);
+  // Outputs as written to MotorOutput, 0 to MOTOR_OUTPUT_MAX
+  void setMotors(const uint16_t output[4]);
+  // Wind in the world frame, m/s
+  void setWind(const float wind[3]);
+  // Thrust left on motor i, 1 = healthy
+  void setMotorEfficiency(int motor, float efficiency);
+  // Pack voltage under load; motor speed scales with it
+  void setVolts(float volts) { p_.volts = volts; }
+  // Held in place (on the bench), e.g. during level calibration
+  void setHeld(bool held) { held_ = held; }
+
+  void step(float dt);
+
+  // The DMP's view, for ImuSample
+  void sample(ImuSample &s);
+
+  const float *position() const { return pos_; }
+  const float *velocity() const { return vel_; }
+  const float *quaternion() const { return q_; }
+  const float *bodyRates() const { return rate_; }
+  float motorSpeed(int i) const { return speed_[i]; }
+  bool grounded() const { return grounded_; }
+  const QuadParams &params() const { return p_; }
+
+  // Per motor output (0 to 1 of MOTOR_OUTPUT_MAX) that holds the weight
+  float hoverOutput() const;
+
+private:
+  float thrust(float speed) const;
+  float noise(float sigma);
+
+  QuadParams p_;
+  std::mt19937 rng_;
+  std::normal_distribution<float> normal_{0, 1};
+
+  float pos_[3], vel_[3];
+  float q_[4];          // body to world, w, x, y, z
+  float rate_[3];       // body rates, rad/s
+  float speed_[4];      // motor speed, 0 to 1 of full speed at referenceVolts
+  float target_[4];
+  float efficiency_[4];
+  float phase_[4];      // motor angle, for the vibration
+  float wind_[3];
+  float specificForce_[3];  // body frame, m/s^2
+  float gyroLp_[2][3], accelLp_[2][3];
+  bool held_ = false;
+  bool grounded_ = false;
+};
+
+#endif /* _QUAD_MODEL_H_ */
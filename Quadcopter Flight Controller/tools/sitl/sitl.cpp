@@ -0,0 +1,410 @@
+#include "sitl.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#define DEG (180 / (float)M_PI)
+#define CRASH_TILT_DEG 80       // past this the airframe is lost
+#define STEP_MIN_DEG   2        // smaller setpoint changes are not scored as steps
+
+// ---------------------------------------------------------------------------
+// Scenario scripts
+
+bool loadScenario(const char *path, Scenario &scenario, std::string &error) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    error = std::string("cannot open ") + path;
+    return false;
+  }
+  scenario = Scenario();
+  const char *base = strrchr(path, '/');
+  scenario.name = base ? base + 1 : path;
+  size_t dot = scenario.name.rfind('.');
+  if (dot != std::string::npos) scenario.name.erase(dot);
+
+  char line[256];
+  int lineNo = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f)) {
+    lineNo++;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    char word[32], arg[32];
+    float t, a, b, c;
+    int n;
+    if (sscanf(line, " %31s", word) != 1) continue;
+
+    if (!strcmp(word, "duration")) {
+      ok = sscanf(line, " duration %f", &scenario.durationS) == 1 && scenario.durationS > 0;
+    } else if (!strcmp(word, "height")) {
+      ok = sscanf(line, " height %f", &scenario.heightM) == 1 && scenario.heightM > 0;
+    } else if (!strcmp(word, "throttle")) {
+      if (sscanf(line, " throttle %31s", arg) != 1) {
+        ok = false;
+      } else if (!strcmp(arg, "hover")) {
+        scenario.hoverPilot = true;
+      } else {
+        scenario.hoverPilot = false;
+        ok = sscanf(arg, "%f", &scenario.throttle) == 1;
+      }
+    } else if (!strcmp(word, "at")) {
+      ScenarioEvent e;
+      memset(&e, 0, sizeof(e));
+      if (sscanf(line, " at %f setpoint %31s %f", &t, arg, &a) == 3) {
+        e.kind = ScenarioEvent::SETPOINT;
+        e.index = !strcmp(arg, "yaw") ? 0 : !strcmp(arg, "pitch") ? 1 : !strcmp(arg, "roll") ? 2 : -1;
+        e.value[0] = a;
+        ok = e.index >= 0;
+      } else if (sscanf(line, " at %f wind %f %f %f", &t, &a, &b, &c) == 4) {
+        e.kind = ScenarioEvent::WIND;
+        e.value[0] = a;
+        e.value[1] = b;
+        e.value[2] = c;
+      } else if (sscanf(line, " at %f motor %d %f", &t, &n, &a) == 3) {
+        e.kind = ScenarioEvent::MOTOR;
+        e.index = n - 1;
+        e.value[0] = a;
+        ok = n >= 1 && n <= 4 && a >= 0;
+      } else if (sscanf(line, " at %f autotune %31s", &t, arg) == 2) {
+        e.kind = ScenarioEvent::AUTOTUNE;
+        e.index = !strcmp(arg, "yaw") ? 0 : !strcmp(arg, "pitch") ? 1 : !strcmp(arg, "roll") ? 2 : -1;
+        ok = e.index >= 0;
+      } else if (sscanf(line, " at %f volts %f", &t, &a) == 2) {
+        e.kind = ScenarioEvent::VOLTS;
+        e.value[0] = a;
+        ok = a > 0;
+      } else {
+        ok = false;
+      }
+      e.timeS = t;
+      if (ok) scenario.events.push_back(e);
+    } else if (!strcmp(word, "expect")) {
+      ScenarioExpectation x;
+      char op[4];
+      ok = sscanf(line, " expect %31s %3s %f", arg, op, &x.value) == 3 && (!strcmp(op, "<") || !strcmp(op, ">"));
+      float unused;
+      if (ok && !sitlMetric(SitlResult(), arg, unused)) ok = false;
+      x.metric = arg;
+      x.below = op[0] == '<';
+      if (ok) scenario.expects.push_back(x);
+    } else {
+      ok = false;
+    }
+  }
+  fclose(f);
+  if (!ok) {
+    error = std::string(path) + ":" + std::to_string(lineNo) + ": cannot parse";
+    return false;
+  }
+  std::stable_sort(scenario.events.begin(), scenario.events.end(),
+                   [](const ScenarioEvent &a, const ScenarioEvent &b) { return a.timeS < b.timeS; });
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// The hardware, simulated. Time only moves when the flight code waits or a
+// loop pass ends; physics runs in fixed steps and the DMP latches a packet at
+// its output rate.
+
+namespace {
+
+class SimWorld {
+public:
+  SimWorld(const SitlConfig &config)
+      : model(config.quad, config.seed), stepUs_(1e6 / config.physicsHz), samplePeriodUs_(1e6 / config.dmpRateHz) {}
+
+  void advance(double us) {
+    double end = nowUs_ + us;
+    while (physicsUs_ + stepUs_ <= end) {
+      model.step((float)(stepUs_ * 1e-6));
+      physicsUs_ += stepUs_;
+      steps++;
+      if (physicsUs_ >= nextSampleUs_) {
+        model.sample(packet);
+        fresh = true;
+        nextSampleUs_ += samplePeriodUs_;
+      }
+    }
+    nowUs_ = end;
+  }
+
+  double nowUs() const { return nowUs_; }
+
+  QuadModel model;
+  ImuSample packet;
+  bool fresh = false;
+  uint64_t steps = 0;
+
+private:
+  double stepUs_, samplePeriodUs_;
+  double nowUs_ = 0, physicsUs_ = 0, nextSampleUs_ = 0;
+};
+
+class SimClock : public Clock {
+public:
+  explicit SimClock(SimWorld &world) : world_(world) {}
+  uint64_t nowUs() override { return (uint64_t)world_.nowUs(); }
+  void delay(uint32_t ms) override { world_.advance(ms * 1000.0); }
+
+private:
+  SimWorld &world_;
+};
+
+class SimImu : public Imu {
+public:
+  explicit SimImu(SimWorld &world) : world_(world) {}
+  bool begin() override { return true; }
+  bool read(ImuSample &s) override {
+    if (!world_.fresh) return false;
+    s = world_.packet;
+    world_.fresh = false;
+    return true;
+  }
+
+private:
+  SimWorld &world_;
+};
+
+class SimMotors : public MotorOutput {
+public:
+  explicit SimMotors(SimWorld &world) : world_(world) {}
+  void begin() override {}
+  void write(const uint16_t output[4]) override { world_.model.setMotors(output); }
+
+private:
+  SimWorld &world_;
+};
+
+// A setpoint step being scored
+struct StepTrack {
+  bool active = false;
+  float from, to;       // degrees
+  float startS;
+  float peak;           // furthest past the target, degrees, in the step's direction
+  float lastOutS;       // last time outside the settling band
+};
+
+}  // namespace
+
+static void finishStep(StepTrack &s, float endS, SitlResult &r) {
+  if (!s.active) return;
+  s.active = false;
+  float size = fabsf(s.to - s.from);
+  float overshoot = s.peak > 0 ? s.peak / size * 100 : 0;
+  float settling = s.lastOutS - s.startS;
+  // Never inside the band: count the whole window
+  if (s.lastOutS >= endS) settling = endS - s.startS;
+  if (overshoot > r.overshootPct) r.overshootPct = overshoot;
+  if (settling > r.settlingS) r.settlingS = settling;
+}
+
+SitlResult runSitl(const Scenario &scenario, const SitlConfig &config, FILE *trace) {
+  auto wallStart = std::chrono::steady_clock::now();
+  SitlResult r;
+
+  SimWorld world(config);
+  SimClock clock(world);
+  SimImu imu(world);
+  SimMotors motors(world);
+  QuadModel &model = world.model;
+
+  AttitudeEstimator estimator;
+  AttitudeController controller(config.gains);
+  RelayAutotune tuner;
+  r.tunedGains = config.gains;
+  SampleRate sampleRate;
+  sampleRate.setNominal(config.dmpRateHz);
+
+  // Power up on the bench: held level with the motors off while setup()
+  // calibrates, then let go at the scenario's height
+  model.reset(scenario.heightM);
+  model.setHeld(true);
+  motors.begin();
+  imu.begin();
+  calibrateLevel(imu, clock, estimator);
+  model.setHeld(false);
+  double startUs = world.nowUs();
+
+  // Yaw setpoints are relative to the heading at release, as the firmware
+  // holds the heading it armed at
+  float yawHold = estimator.ypr()[0];
+  float setpointDeg[3] = {0, 0, 0};
+  float truthYaw0;
+  {
+    float ypr[3];
+    quaternionToYawPitchRoll(model.quaternion(), ypr);
+    truthYaw0 = ypr[0];
+  }
+  float hoverDuty = model.hoverOutput() * MOTOR_MAX;
+
+  if (trace) {
+    fprintf(trace, "t,sp_yaw,sp_pitch,sp_roll,est_yaw,est_pitch,est_roll,yaw,pitch,roll,height,m1,m2,m3,m4\n");
+  }
+
+  StepTrack steps[3];
+  size_t nextEvent = 0;
+  uint16_t command[4] = {0, 0, 0, 0}, lastCommand[4] = {0, 0, 0, 0};
+  double errorSq[3] = {0, 0, 0}, noiseSq = 0;
+  uint64_t saturated = 0;
+  float t = 0;
+
+  while (t < scenario.durationS) {
+    world.advance(config.loopUs);
+    t = (float)((world.nowUs() - startUs) * 1e-6);
+
+    for (; nextEvent < scenario.events.size() && scenario.events[nextEvent].timeS <= t; nextEvent++) {
+      const ScenarioEvent &e = scenario.events[nextEvent];
+      switch (e.kind) {
+      case ScenarioEvent::SETPOINT: {
+        // A step is scored until the next setpoint change on any axis, so
+        // the coupling from another axis' step does not count as settling
+        int k = e.index;
+        for (int j = 0; j < 3; j++) finishStep(steps[j], t, r);
+        if (fabsf(e.value[0] - setpointDeg[k]) >= STEP_MIN_DEG) {
+          steps[k].active = true;
+          steps[k].from = setpointDeg[k];
+          steps[k].to = e.value[0];
+          steps[k].startS = t;
+          steps[k].peak = 0;
+          steps[k].lastOutS = t;
+        }
+        setpointDeg[k] = e.value[0];
+        break;
+      }
+      case ScenarioEvent::WIND:
+        model.setWind(e.value);
+        break;
+      case ScenarioEvent::MOTOR:
+        model.setMotorEfficiency(e.index, e.value[0]);
+        break;
+      case ScenarioEvent::VOLTS:
+        model.setVolts(e.value[0]);
+        break;
+      case ScenarioEvent::AUTOTUNE:
+        tuner.begin(e.index, controller.gains(), controller.ratePid(e.index).i());
+        r.autotune[e.index] = AUTOTUNE_RUNNING;
+        break;
+      }
+    }
+
+    // The firmware's control tick, once per IMU packet
+    ImuSample s;
+    if (!imu.read(s)) continue;
+    sampleRate.sample(clock.micros());
+    estimator.update(s.quat);
+
+    float throttle = scenario.throttle;
+    const float *q = model.quaternion();
+    float up = 1 - 2 * (q[1] * q[1] + q[2] * q[2]);    // cosine of the tilt
+    if (scenario.hoverPilot) {
+      // A pilot on the throttle, holding height by eye
+      float climb = 0.4f * (scenario.heightM - model.position()[2]) - 0.6f * model.velocity()[2];
+      throttle = hoverDuty * (1 + climb) / std::max(up, 0.5f);
+    }
+    float setpoint[3] = {yawHold + setpointDeg[0] / DEG, setpointDeg[1] / DEG, setpointDeg[2] / DEG};
+    float gain = sagCompensationGain(config.sag, model.params().volts);
+    stabilizeTick(controller, s, estimator.ypr(), setpoint, throttle, sampleRate.dt(), gain, command, &tuner);
+    int tuned = tuner.axis();
+    if (r.autotune[tuned] == AUTOTUNE_RUNNING && !tuner.running()) {
+      r.autotune[tuned] = tuner.state();
+      r.autotuneResult[tuned] = tuner.result();
+      r.tunedGains = tuner.proposed(r.tunedGains);
+    }
+    uint16_t output[4];
+    scaleMotors(command, 1, output);
+    motors.write(output);
+
+    // Score against the true attitude
+    float truth[3];
+    quaternionToYawPitchRoll(q, truth);
+    truth[0] = remainderf(truth[0] - truthYaw0, 2 * (float)M_PI);
+    for (int k = 0; k < 3; k++) {
+      float deg = truth[k] * DEG;
+      float error = k == 0 ? remainderf(setpointDeg[k] - deg, 360) : setpointDeg[k] - deg;
+      errorSq[k] += error * error;
+      if (fabsf(error) > r.maxErrorDeg[k]) r.maxErrorDeg[k] = fabsf(error);
+      StepTrack &st = steps[k];
+      if (st.active) {
+        float past = (st.to > st.from ? 1 : -1) * -error;
+        if (past > st.peak) st.peak = past;
+        float band = std::max(0.05f * fabsf(st.to - st.from), 1.0f);
+        if (fabsf(error) > band) st.lastOutS = t;
+      }
+    }
+    float tilt = acosf(std::max(-1.0f, std::min(1.0f, up))) * DEG;
+    if (tilt > r.maxTiltDeg) r.maxTiltDeg = tilt;
+
+    bool limit = false;
+    for (int i = 0; i < 4; i++) {
+      limit |= command[i] >= MOTOR_MAX || (command[i] <= MOTOR_MIN && throttle > MOTOR_MIN);
+      if (r.controlTicks > 0) {
+        float d = (float)command[i] - lastCommand[i];
+        noiseSq += d * d;
+      }
+      lastCommand[i] = command[i];
+    }
+    saturated += limit;
+    r.controlTicks++;
+
+    if (trace) {
+      const float *ypr = estimator.ypr();
+      fprintf(trace, "%.4f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.3f,%u,%u,%u,%u\n", t, setpointDeg[0],
+              setpointDeg[1], setpointDeg[2], remainderf(ypr[0] - yawHold, 2 * (float)M_PI) * DEG, ypr[1] * DEG,
+              ypr[2] * DEG, truth[0] * DEG, truth[1] * DEG, truth[2] * DEG, model.position()[2], command[0],
+              command[1], command[2], command[3]);
+    }
+
+    if (model.grounded() || tilt > CRASH_TILT_DEG) {
+      r.crashed = true;
+      r.crashTimeS = t;
+      break;
+    }
+  }
+
+  for (int k = 0; k < 3; k++) finishStep(steps[k], t, r);
+  if (r.controlTicks > 0) {
+    for (int k = 0; k < 3; k++) r.rmsErrorDeg[k] = (float)sqrt(errorSq[k] / r.controlTicks);
+    r.saturation = (float)saturated / r.controlTicks;
+  }
+  if (r.controlTicks > 1) r.motorNoise = (float)sqrt(noiseSq / ((r.controlTicks - 1) * 4));
+  r.physicsSteps = world.steps;
+  r.simS = world.nowUs() * 1e-6;
+  r.wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  return r;
+}
+
+bool sitlMetric(const SitlResult &r, const std::string &name, float &value) {
+  static const char *const axes[3] = {"yaw", "pitch", "roll"};
+  for (int k = 0; k < 3; k++) {
+    if (name == std::string("rms_") + axes[k]) return value = r.rmsErrorDeg[k], true;
+    if (name == std::string("max_") + axes[k]) return value = r.maxErrorDeg[k], true;
+  }
+  if (name == "crashed") value = r.crashed;
+  else if (name == "tilt_max") value = r.maxTiltDeg;
+  else if (name == "overshoot") value = r.overshootPct;
+  else if (name == "settling") value = r.settlingS;
+  else if (name == "saturation") value = r.saturation;
+  else if (name == "motor_noise") value = r.motorNoise;
+  else if (name == "autotune_failed") {
+    value = 0;
+    for (int k = 0; k < 3; k++) value += r.autotune[k] == AUTOTUNE_FAILED || r.autotune[k] == AUTOTUNE_RUNNING;
+  }
+  else return false;
+  return true;
+}
+
+bool sitlCheck(const Scenario &scenario, const SitlResult &result) {
+  bool ok = true;
+  for (const ScenarioExpectation &x : scenario.expects) {
+    float value = 0;
+    sitlMetric(result, x.metric, value);
+    if (x.below ? value < x.value : value > x.value) continue;
+    printf("  FAIL %s: expected %s %s %g, got %g\n", scenario.name.c_str(), x.metric.c_str(), x.below ? "<" : ">",
+           x.value, value);
+    ok = false;
+  }
+  return ok;
+}
@@ -0,0 +1,102 @@
+#ifndef _SITL_H_
+#define _SITL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "flight_core.h"
+#include "quad_model.h"
+
+// Software-in-the-loop flights: the flight core (estimator, attitude
+// controller, mixer, level calibration) runs against QuadModel through the
+// hal.h interfaces, in virtual time. A run is self-contained (no globals,
+// its own random numbers), so runs can go on several threads at once.
+
+// A scripted flight. Text format, one command per line, # for comments:
+//   duration S
+//   height M                       start height, default 10
+//   throttle hover | DUTY          hover holds the start height like a
+//                                  pilot on the throttle; DUTY is fixed
+//   at T setpoint yaw|pitch|roll DEG
+//   at T wind X Y Z                m/s, world frame
+//   at T motor N EFFICIENCY        motor 1-4, 1 = healthy
+//   at T volts V                   pack voltage
+//   at T autotune yaw|pitch|roll   relay autotune of the axis
+//   expect METRIC < VALUE          (or >), checked by sitlCheck
+struct ScenarioEvent {
+  float timeS;
+  enum Kind { SETPOINT, WIND, MOTOR, VOLTS, AUTOTUNE } kind;
+  int index;          // axis (0 yaw, 1 pitch, 2 roll) or motor 0-3
+  float value[3];
+};
+
+struct ScenarioExpectation {
+  std::string metric;
+  bool below;
+  float value;
+};
+
+struct Scenario {
+  std::string name;
+  float durationS = 10;
+  float heightM = 10;
+  bool hoverPilot = true;
+  float throttle = 0;
+  std::vector<ScenarioEvent> events;      // in time order
+  std::vector<ScenarioExpectation> expects;
+};
+
+// Returns false with a message in error on a malformed script
+bool loadScenario(const char *path, Scenario &scenario, std::string &error);
+
+struct SitlConfig {
+  QuadParams quad;
+  AttitudeGains gains = DEFAULT_ATTITUDE_GAINS;
+  SagCompensation sag = {3.8f, 3.3f, 1.25f};   // as main.cpp
+  float dmpRateHz = 200;
+  uint32_t loopUs = 500;      // one loop() pass: how late a packet is read
+  float physicsHz = 4000;
+  uint32_t seed = 1;
+};
+
+struct SitlResult {
+  bool crashed = false;
+  float crashTimeS = 0;
+  float rmsErrorDeg[3] = {0, 0, 0};   // yaw, pitch, roll, true attitude
+  float maxErrorDeg[3] = {0, 0, 0};
+  float maxTiltDeg = 0;
+  // Worst over the setpoint steps of at least 2 degrees, each up to the
+  // next setpoint change
+  float overshootPct = 0;
+  float settlingS = 0;          // to within 5% of the step (1 degree at least)
+  float saturation = 0;         // share of control ticks with a motor at its limit
+  float motorNoise = 0;         // RMS tick to tick motor command change, duty units
+  // Autotunes in the scenario: outcome per axis (AUTOTUNE_IDLE if not
+  // tuned) and the gains with every finished one applied, as the firmware
+  // proposes them
+  AutotuneState autotune[3] = {AUTOTUNE_IDLE, AUTOTUNE_IDLE, AUTOTUNE_IDLE};
+  AutotuneResult autotuneResult[3] = {};
+  AttitudeGains tunedGains = {};
+  uint64_t physicsSteps = 0;
+  uint64_t controlTicks = 0;
+  double simS = 0;
+  double wallS = 0;
+};
+
+// Flies the scenario. trace, if given, gets a CSV row per control tick.
+SitlResult runSitl(const Scenario &scenario, const SitlConfig &config, FILE *trace = nullptr);
+
+// Value of a metric by the names expect lines use: crashed, rms_yaw,
+// rms_pitch, rms_roll, max_yaw, max_pitch, max_roll, tilt_max, overshoot,
+// settling, saturation, motor_noise, autotune_failed (autotunes that did
+// not finish). False for an unknown name.
+bool sitlMetric(const SitlResult &result, const std::string &name, float &value);
+
+// Checks the scenario's expectations, printing each failure. Returns true
+// if all hold.
+bool sitlCheck(const Scenario &scenario, const SitlResult &result);
+
+#endif /* _SITL_H_ */
@@ -0,0 +1,112 @@
+// Software-in-the-loop simulator.
+//
+// Flies each scenario script (see sitl.h for the format, and
+// tools/sitl/scenarios) with the firmware's estimator, attitude controller
+// and mixer against the rigid body model, in virtual time, and reports the
+// attitude error against the model's true attitude, step overshoot and
+// settling, motor saturation and command noise. Then the speed: physics
+// steps per second of wall time and how much faster than real time the
+// flight ran. Exits non-zero if a scenario crashes where it should not or
+// misses one of its expect lines.
+//
+// Scenarios that autotune print what each axis identified and the gains
+// proposed. With --apply-autotune the first scenario must autotune, and the
+// rest fly with its proposed gains: the check before tuning the airframe.
+//
+// Usage: sitl [--seed N] [--dmp-hz N] [--trace out.csv] [--apply-autotune] scenario.txt...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "sitl.h"
+
+static void printAutotune(const SitlResult &r) {
+  static const char *const axes[3] = {"yaw", "pitch", "roll"};
+  for (int k = 0; k < 3; k++) {
+    if (r.autotune[k] == AUTOTUNE_IDLE) continue;
+    const AutotuneResult &a = r.autotuneResult[k];
+    if (r.autotune[k] != AUTOTUNE_DONE) {
+      printf("  autotune %-5s %s\n", axes[k], autotuneStateName(r.autotune[k]));
+      continue;
+    }
+    printf("  autotune %-5s period %.0f ms, K %.2f rad/s^2 per unit, delay %.1f ms -> angleKp %.2f maxRate %.1f rate kp %.2f ki %.2f\n",
+           axes[k], a.periodS * 1000, a.plantGain, a.delayS * 1000, a.angleKp, a.maxRate, a.rate.kp,
+           a.rate.ki);
+  }
+}
+
+int main(int argc, char **argv) {
+  SitlConfig config;
+  const char *tracePath = nullptr;
+  bool applyAutotune = false;
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seed") && i + 1 < argc) config.seed = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--dmp-hz") && i + 1 < argc) config.dmpRateHz = strtof(argv[++i], NULL);
+    else if (!strcmp(argv[i], "--trace") && i + 1 < argc) tracePath = argv[++i];
+    else if (!strcmp(argv[i], "--apply-autotune")) applyAutotune = true;
+    else if (argv[i][0] == '-') paths.clear(), i = argc;
+    else paths.push_back(argv[i]);
+  }
+  if (paths.empty() || config.dmpRateHz <= 0) {
+    fprintf(stderr, "usage: %s [--seed N] [--dmp-hz N] [--trace out.csv] [--apply-autotune] scenario.txt...\n",
+            argv[0]);
+    return 2;
+  }
+
+  FILE *trace = nullptr;
+  if (tracePath) {
+    trace = fopen(tracePath, "w");
+    if (!trace) {
+      perror(tracePath);
+      return 2;
+    }
+  }
+
+  printf("%-16s %5s %6s %6s %6s %6s %7s %6s %6s %6s %10s %7s\n", "scenario", "crash", "rmsY", "rmsP", "rmsR",
+         "tilt", "over%", "settle", "sat%", "noise", "steps/s", "xreal");
+  bool ok = true;
+  double steps = 0, wall = 0, sim = 0;
+  for (const char *path : paths) {
+    Scenario scenario;
+    std::string error;
+    if (!loadScenario(path, scenario, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 2;
+    }
+    // One trace per run: the first scenario's
+    SitlResult r = runSitl(scenario, config, trace);
+    if (trace) {
+      fclose(trace);
+      trace = nullptr;
+    }
+    char crash[16] = "-";
+    if (r.crashed) snprintf(crash, sizeof(crash), "%.2fs", r.crashTimeS);
+    printf("%-16s %5s %6.2f %6.2f %6.2f %6.1f %7.1f %6.2f %6.1f %6.2f %10.0f %7.0f\n", scenario.name.c_str(), crash,
+           r.rmsErrorDeg[0], r.rmsErrorDeg[1], r.rmsErrorDeg[2], r.maxTiltDeg, r.overshootPct, r.settlingS,
+           r.saturation * 100, r.motorNoise, r.physicsSteps / r.wallS, r.simS / r.wallS);
+    ok &= sitlCheck(scenario, r);
+    printAutotune(r);
+    if (applyAutotune && path == paths[0]) {
+      bool tuned = false;
+      for (int k = 0; k < 3; k++) tuned |= r.autotune[k] == AUTOTUNE_DONE;
+      if (!tuned) {
+        fprintf(stderr, "%s: no autotune finished, nothing to apply\n", path);
+        return 1;
+      }
+      config.gains = r.tunedGains;
+      printf("flying the rest with the proposed gains\n");
+    }
+    steps += r.physicsSteps;
+    wall += r.wallS;
+    sim += r.simS;
+  }
+  printf("total: %.1f s simulated in %.3f s, %.0f physics steps/s, %.0fx real time\n", sim, wall, steps / wall,
+         sim / wall);
+  printf("%s\n", ok ? "all scenarios passed" : "scenario checks FAILED");
+  return ok ? 0 : 1;
+}
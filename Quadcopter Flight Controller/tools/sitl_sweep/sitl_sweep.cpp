@@ -0,0 +1,336 @@
+// Batch gain sweeps over the software-in-the-loop simulator.
+//
+// A sweep file lists the scenarios to fly (tools/sitl/scenarios), the
+// controller and sensor settings to vary and how many noise seeds to fly
+// each with. Settings vary on a grid, at random within ranges (Monte
+// Carlo), or both: every grid point is flown with each random draw. Every
+// configuration, scenario and seed is one independent flight, and the
+// flights run on a work-stealing thread pool (work_pool.h).
+//
+// Per configuration it keeps the worst step overshoot, settling time and
+// motor saturation over its flights, the mean motor command noise and
+// attitude error, and whether any flight crashed, and ranks configurations
+// by a cost that adds those up (a crash ranks last). --out writes one CSV
+// row per configuration for plotting; --scaling reflies the batch on 1, 2,
+// 4... threads and reports the speedup.
+//
+// Sweep file, one command per line, # for comments:
+//   scenario PATH                  flown by every configuration
+//   seeds N                        noise seeds per flight, default 1
+//   grid PARAM V1 V2...            values to try
+//   range PARAM LO HI              drawn uniformly per sample
+//   samples N                      random draws, default 1
+//   seed N                         for the draws, default 1
+// PARAM is dlpf_hz (the chip's gyro/accel low-pass), dmp_hz, loop_us, or
+// FIELD.AXIS with FIELD one of angle_kp, max_rate, kp, ki, kd, i_limit,
+// d_cutoff and AXIS one of yaw, pitch, roll or rp (pitch and roll alike).
+//
+// Usage: sitl_sweep [--threads N] [--out results.csv] [--scaling] sweep.txt
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sitl.h"
+#include "work_pool.h"
+
+struct Axis {
+  std::string param;
+  std::vector<float> values;    // grid
+  float lo, hi;                 // range
+  bool random;
+};
+
+struct Sweep {
+  std::vector<Scenario> scenarios;
+  std::vector<Axis> axes;       // grid axes first, then ranges
+  int seeds = 1;
+  int samples = 1;
+  uint32_t seed = 1;
+};
+
+// A configuration's settings, in the order of Sweep::axes
+typedef std::vector<float> Point;
+
+static bool applyParam(SitlConfig &c, const std::string &param, float v) {
+  if (param == "dlpf_hz") return c.quad.dlpfHz = v, v > 0;
+  if (param == "dmp_hz") return c.dmpRateHz = v, v > 0;
+  if (param == "loop_us") return c.loopUs = (uint32_t)v, v > 0;
+
+  size_t dot = param.find('.');
+  if (dot == std::string::npos) return false;
+  std::string field = param.substr(0, dot), axis = param.substr(dot + 1);
+  int first, last;
+  if (axis == "yaw") first = last = 0;
+  else if (axis == "pitch") first = last = 1;
+  else if (axis == "roll") first = last = 2;
+  else if (axis == "rp") first = 1, last = 2;
+  else return false;
+
+  for (int k = first; k <= last; k++) {
+    AttitudeGains &g = c.gains;
+    if (field == "angle_kp") g.angleKp[k] = v;
+    else if (field == "max_rate") g.maxRate[k] = v;
+    else if (field == "kp") g.rate[k].kp = v;
+    else if (field == "ki") g.rate[k].ki = v;
+    else if (field == "kd") g.rate[k].kd = v;
+    else if (field == "i_limit") g.rate[k].iLimit = v;
+    else if (field == "d_cutoff") g.rate[k].dCutoffHz = v;
+    else return false;
+  }
+  return true;
+}
+
+static bool loadSweep(const char *path, Sweep &sweep) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  std::vector<Axis> grid, ranges;
+  char line[512];
+  int lineNo = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f)) {
+    lineNo++;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    char *word = strtok(line, " \t\r\n");
+    if (!word) continue;
+    char *arg = strtok(NULL, " \t\r\n");
+    if (!arg) {
+      ok = false;
+      break;
+    }
+
+    SitlConfig probe;
+    if (!strcmp(word, "scenario")) {
+      Scenario s;
+      std::string error;
+      ok = loadScenario(arg, s, error);
+      if (!ok) fprintf(stderr, "%s\n", error.c_str());
+      else sweep.scenarios.push_back(s);
+    } else if (!strcmp(word, "seeds")) {
+      sweep.seeds = atoi(arg);
+      ok = sweep.seeds > 0;
+    } else if (!strcmp(word, "samples")) {
+      sweep.samples = atoi(arg);
+      ok = sweep.samples > 0;
+    } else if (!strcmp(word, "seed")) {
+      sweep.seed = strtoul(arg, NULL, 10);
+    } else if (!strcmp(word, "grid")) {
+      Axis a;
+      a.param = arg;
+      a.random = false;
+      for (char *v; (v = strtok(NULL, " \t\r\n"));) a.values.push_back(strtof(v, NULL));
+      ok = !a.values.empty() && applyParam(probe, a.param, a.values[0]);
+      grid.push_back(a);
+    } else if (!strcmp(word, "range")) {
+      Axis a;
+      a.param = arg;
+      a.random = true;
+      char *lo = strtok(NULL, " \t\r\n"), *hi = strtok(NULL, " \t\r\n");
+      ok = lo && hi;
+      if (ok) {
+        a.lo = strtof(lo, NULL);
+        a.hi = strtof(hi, NULL);
+        ok = a.hi >= a.lo && applyParam(probe, a.param, a.hi);
+      }
+      ranges.push_back(a);
+    } else {
+      ok = false;
+    }
+  }
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "%s:%d: cannot parse\n", path, lineNo);
+    return false;
+  }
+  if (sweep.scenarios.empty()) {
+    fprintf(stderr, "%s: no scenario\n", path);
+    return false;
+  }
+  sweep.axes = grid;
+  sweep.axes.insert(sweep.axes.end(), ranges.begin(), ranges.end());
+  if (ranges.empty()) sweep.samples = 1;
+  return true;
+}
+
+// Grid points in row-major order, each repeated with every random draw.
+// Drawn here, up front, so the batch is the same on any thread count.
+static std::vector<Point> makePoints(const Sweep &sweep) {
+  size_t gridPoints = 1;
+  for (const Axis &a : sweep.axes) {
+    if (!a.random) gridPoints *= a.values.size();
+  }
+  std::mt19937 rng(sweep.seed);
+  std::uniform_real_distribution<float> unit(0, 1);
+  std::vector<Point> points;
+  for (size_t g = 0; g < gridPoints; g++) {
+    for (int s = 0; s < sweep.samples; s++) {
+      Point p(sweep.axes.size());
+      size_t rest = g;
+      for (size_t k = sweep.axes.size(); k-- > 0;) {
+        const Axis &a = sweep.axes[k];
+        if (a.random) continue;
+        p[k] = a.values[rest % a.values.size()];
+        rest /= a.values.size();
+      }
+      for (size_t k = 0; k < sweep.axes.size(); k++) {
+        const Axis &a = sweep.axes[k];
+        if (a.random) p[k] = a.lo + (a.hi - a.lo) * unit(rng);
+      }
+      points.push_back(p);
+    }
+  }
+  return points;
+}
+
+struct Score {
+  bool crashed = false;
+  float overshootPct = 0;
+  float settlingS = 0;
+  float saturation = 0;
+  float motorNoise = 0;     // mean
+  float rmsErrorDeg = 0;    // mean over axes and flights
+  float cost = 0;
+};
+
+// Ranking only: a percent of overshoot weighs like 0.1 s of settling,
+// 1% of the time saturated, 0.2 duty units of command noise or 0.1 degree
+// of attitude error
+static float cost(const Score &s) {
+  if (s.crashed) return INFINITY;
+  return s.overshootPct / 10 + s.settlingS + 10 * s.saturation + s.motorNoise / 2 + s.rmsErrorDeg;
+}
+
+static std::vector<Score> score(const std::vector<SitlResult> &results, size_t points, size_t flightsPerPoint) {
+  std::vector<Score> scores(points);
+  for (size_t p = 0; p < points; p++) {
+    Score &s = scores[p];
+    for (size_t f = 0; f < flightsPerPoint; f++) {
+      const SitlResult &r = results[p * flightsPerPoint + f];
+      s.crashed |= r.crashed;
+      s.overshootPct = std::max(s.overshootPct, r.overshootPct);
+      s.settlingS = std::max(s.settlingS, r.settlingS);
+      s.saturation = std::max(s.saturation, r.saturation);
+      s.motorNoise += r.motorNoise / flightsPerPoint;
+      s.rmsErrorDeg += (r.rmsErrorDeg[0] + r.rmsErrorDeg[1] + r.rmsErrorDeg[2]) / 3 / flightsPerPoint;
+    }
+    s.cost = cost(s);
+  }
+  return scores;
+}
+
+// Flies the whole batch; returns the wall time in seconds
+static double runBatch(const Sweep &sweep, const std::vector<Point> &points, WorkPool &pool,
+                       std::vector<SitlResult> &results) {
+  size_t perPoint = sweep.scenarios.size() * sweep.seeds;
+  results.assign(points.size() * perPoint, SitlResult());
+  auto start = std::chrono::steady_clock::now();
+  pool.run(results.size(), [&](size_t i) {
+    size_t p = i / perPoint, rest = i % perPoint;
+    SitlConfig config;
+    for (size_t k = 0; k < sweep.axes.size(); k++) applyParam(config, sweep.axes[k].param, points[p][k]);
+    config.seed = (uint32_t)(rest % sweep.seeds) + 1;
+    results[i] = runSitl(sweep.scenarios[rest / sweep.seeds], config);
+  });
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool writeCsv(const char *path, const Sweep &sweep, const std::vector<Point> &points,
+                     const std::vector<Score> &scores) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "config");
+  for (const Axis &a : sweep.axes) fprintf(f, ",%s", a.param.c_str());
+  fprintf(f, ",crashed,overshoot_pct,settling_s,saturation,motor_noise,rms_deg,cost\n");
+  for (size_t p = 0; p < points.size(); p++) {
+    const Score &s = scores[p];
+    fprintf(f, "%zu", p);
+    for (float v : points[p]) fprintf(f, ",%g", v);
+    fprintf(f, ",%d,%.2f,%.3f,%.4f,%.3f,%.3f,%.3f\n", s.crashed, s.overshootPct, s.settlingS, s.saturation,
+            s.motorNoise, s.rmsErrorDeg, s.cost);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  const char *outPath = nullptr, *sweepPath = nullptr;
+  bool scaling = false, ok = true;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--out") && i + 1 < argc) outPath = argv[++i];
+    else if (!strcmp(argv[i], "--scaling")) scaling = true;
+    else if (argv[i][0] != '-' && !sweepPath) sweepPath = argv[i];
+    else ok = false;
+  }
+  if (!ok || !sweepPath) {
+    fprintf(stderr, "usage: %s [--threads N] [--out results.csv] [--scaling] sweep.txt\n", argv[0]);
+    return 2;
+  }
+  if (threads == 0) threads = 1;
+
+  Sweep sweep;
+  if (!loadSweep(sweepPath, sweep)) return 2;
+  std::vector<Point> points = makePoints(sweep);
+  size_t perPoint = sweep.scenarios.size() * sweep.seeds;
+  printf("%zu configurations x %zu scenarios x %d seeds = %zu flights on %u threads\n", points.size(),
+         sweep.scenarios.size(), sweep.seeds, points.size() * perPoint, threads);
+
+  std::vector<SitlResult> results;
+  WorkPool pool(threads);
+  double wall = runBatch(sweep, points, pool, results);
+  double sim = 0, cpu = 0;
+  uint64_t steps = 0;
+  for (const SitlResult &r : results) {
+    sim += r.simS;
+    cpu += r.wallS;
+    steps += r.physicsSteps;
+  }
+  printf("%.2f s wall, %.0f flights/s, %.0fx real time, %.2g physics steps/s, %llu steals\n", wall,
+         results.size() / wall, sim / wall, steps / wall, (unsigned long long)pool.steals());
+
+  std::vector<Score> scores = score(results, points.size(), perPoint);
+  std::vector<size_t> order(points.size());
+  for (size_t p = 0; p < order.size(); p++) order[p] = p;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a].cost < scores[b].cost; });
+  size_t crashed = std::count_if(scores.begin(), scores.end(), [](const Score &s) { return s.crashed; });
+  printf("%zu of %zu configurations crashed\n\nbest:\n", crashed, points.size());
+  for (size_t n = 0; n < order.size() && n < 5; n++) {
+    const Score &s = scores[order[n]];
+    printf("  #%-5zu cost %6.2f  over %5.1f%%  settle %5.2f s  sat %5.1f%%  noise %5.2f  rms %5.2f deg |", order[n],
+           s.cost, s.overshootPct, s.settlingS, s.saturation * 100, s.motorNoise, s.rmsErrorDeg);
+    for (size_t k = 0; k < sweep.axes.size(); k++) printf(" %s=%g", sweep.axes[k].param.c_str(), points[order[n]][k]);
+    printf("\n");
+  }
+  if (outPath && !writeCsv(outPath, sweep, points, scores)) return 2;
+
+  if (scaling) {
+    // Same batch, same results, on more and more threads
+    printf("\nscaling (%.1f s of flight time per batch):\n", sim);
+    double base = 0;
+    std::vector<SitlResult> again;
+    for (unsigned n = 1;; n = std::min(n * 2, threads)) {
+      WorkPool p(n);
+      double t = runBatch(sweep, points, p, again);
+      if (n == 1) base = t;
+      printf("  %3u threads %8.2f s  speedup %5.2f  efficiency %3.0f%%  steals %llu\n", n, t, base / t,
+             base / t / n * 100, (unsigned long long)p.steals());
+      if (n == threads) break;
+    }
+  }
+  return 0;
+}
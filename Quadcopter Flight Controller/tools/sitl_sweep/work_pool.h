@@ -0,0 +1,83 @@
+#ifndef _WORK_POOL_H_
+#define _WORK_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool for batches of independent jobs.
+//
+// Each worker starts with a contiguous share of the job indices in its own
+// deque and takes from the back of it; a worker that runs dry steals from
+// the front of another's, so the long jobs at the end of one share do not
+// leave the other cores idle. Jobs cannot add jobs, so a worker that finds
+// every deque empty is done. The jobs here are whole simulated flights,
+// milliseconds each, so a mutex per deque costs nothing measurable.
+class WorkPool {
+public:
+  explicit WorkPool(unsigned threads) : threads_(threads ? threads : 1) {}
+
+  unsigned threads() const { return threads_; }
+  // Jobs taken from another worker's deque in the last run()
+  uint64_t steals() const { return steals_; }
+
+  // Calls job(i) for every i in [0, count) and returns when all are done
+  void run(size_t count, const std::function<void(size_t)> &job) {
+    std::vector<Queue> queues(threads_);
+    for (unsigned w = 0; w < threads_; w++) {
+      size_t begin = count * w / threads_, end = count * (w + 1) / threads_;
+      for (size_t i = begin; i < end; i++) queues[w].jobs.push_back(i);
+    }
+    steals_ = 0;
+
+    std::vector<std::thread> workers;
+    for (unsigned w = 1; w < threads_; w++) workers.emplace_back([&, w] { work(queues, w, job); });
+    work(queues, 0, job);
+    for (std::thread &t : workers) t.join();
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  void work(std::vector<Queue> &queues, unsigned self, const std::function<void(size_t)> &job) {
+    for (;;) {
+      size_t i;
+      if (take(queues[self], i, false)) {
+        job(i);
+        continue;
+      }
+      bool stolen = false;
+      for (unsigned k = 1; k < threads_ && !stolen; k++) stolen = take(queues[(self + k) % threads_], i, true);
+      if (!stolen) return;
+      steals_++;
+      job(i);
+    }
+  }
+
+  static bool take(Queue &q, size_t &i, bool front) {
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.jobs.empty()) return false;
+    if (front) {
+      i = q.jobs.front();
+      q.jobs.pop_front();
+    } else {
+      i = q.jobs.back();
+      q.jobs.pop_back();
+    }
+    return true;
+  }
+
+  unsigned threads_;
+  std::atomic<uint64_t> steals_{0};
+};
+
+#endif /* _WORK_POOL_H_ */
@@ -0,0 +1,240 @@
+// Host-side reader for the binary serial telemetry in src/telemetry.cpp.
+//
+// Usage:
+//   telemetry_reader [--baud N] [--csv] /dev/ttyUSB0
+//   telemetry_reader --pty [--rate HZ] [--seconds S] [--csv]
+//
+// --pty opens a pseudo-terminal and runs a stand-in for the flight controller
+// on the master side: it writes sample, motor RPM and failsafe frames at the
+// given rate mixed with Serial.println-style text, and the reader decodes them from the
+// slave side exactly as it would from a real serial port.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "telemetry_frame.h"
+
+struct Options {
+  const char *device = nullptr;
+  bool pty = false;
+  bool csv = false;
+  int baud = 115200;
+  int rateHz = 50;
+  double seconds = 0;  // 0 = run until interrupted (device) or 5 s (pty)
+};
+
+static speed_t baudConstant(int baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return 0;
+  }
+}
+
+static bool configurePort(int fd, int baud) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) return false;
+  cfmakeraw(&tio);
+  speed_t speed = baudConstant(baud);
+  if (speed) {
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+  }
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 1;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+// Fake flight controller writing to the pty master
+static void standIn(int fd, int rateHz, std::atomic<bool> &stop) {
+  const char *banner = "MPU6050 connected\r\nDMP Ready!\r\nCalibration done\r\n";
+  write(fd, banner, strlen(banner));
+
+  auto period = std::chrono::microseconds(1000000 / rateHz);
+  auto next = std::chrono::steady_clock::now();
+  auto start = next;
+  uint8_t seq = 0;
+  while (!stop) {
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TelemetrySample s;
+    s.timeUs = (uint32_t)(t * 1e6);
+    s.ypr[0] = (int16_t)(9000 * sin(t * 0.5));
+    s.ypr[1] = (int16_t)(1500 * sin(t * 2.0));
+    s.ypr[2] = (int16_t)(1500 * cos(t * 2.0));
+    for (int i = 0; i < 4; i++) s.motor[i] = 100 + i;
+    s.loopUs = 2500;
+    s.droppedFrames = 0;
+
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    size_t len = telemetryEncodeFrame(TELEMETRY_TYPE_SAMPLE, seq++, &s, sizeof(s), frame);
+    write(fd, frame, len);
+
+    TelemetryRpm r;
+    r.timeUs = s.timeUs;
+    for (int i = 0; i < 4; i++) r.rpm[i] = (uint16_t)(12000 + 3000 * sin(t + i));
+    r.replyErrors = 0;
+    r.notches = 12;
+    len = telemetryEncodeFrame(TELEMETRY_TYPE_RPM, seq++, &r, sizeof(r), frame);
+    write(fd, frame, len);
+
+    TelemetryFailsafe f;
+    f.timeUs = s.timeUs;
+    f.linkAgeMs = (uint16_t)(fmod(t, 0.2) * 1000);
+    f.reactionUs = 0;
+    f.trips = 0;
+    f.state = 1;
+    len = telemetryEncodeFrame(TELEMETRY_TYPE_FAILSAFE, seq++, &f, sizeof(f), frame);
+    write(fd, frame, len);
+    if (seq % 100 == 0) {
+      const char *text = "Recalibrating...\r\n";
+      write(fd, text, strlen(text));
+    }
+
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+}
+
+static bool parseArgs(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--pty")) opt.pty = true;
+    else if (!strcmp(argv[i], "--csv")) opt.csv = true;
+    else if (!strcmp(argv[i], "--baud") && i + 1 < argc) opt.baud = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--rate") && i + 1 < argc) opt.rateHz = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) opt.seconds = atof(argv[++i]);
+    else if (argv[i][0] != '-' && !opt.device) opt.device = argv[i];
+    else return false;
+  }
+  if (opt.rateHz <= 0) return false;
+  return opt.pty || opt.device;
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--baud N] [--csv] [--seconds S] DEVICE\n"
+                    "       %s --pty [--rate HZ] [--seconds S] [--csv]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  int master = -1;
+  const char *device = opt.device;
+  if (opt.pty) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+      perror("posix_openpt");
+      return 1;
+    }
+    device = ptsname(master);
+    if (opt.seconds == 0) opt.seconds = 5;
+    fprintf(stderr, "stand-in flight controller on %s at %d Hz\n", device, opt.rateHz);
+  }
+
+  int fd = open(device, O_RDONLY | O_NOCTTY);
+  if (fd < 0 || !configurePort(fd, opt.baud)) {
+    perror(device);
+    return 1;
+  }
+
+  std::atomic<bool> stop{false};
+  std::thread fake;
+  if (opt.pty) {
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    fake = std::thread(standIn, master, opt.rateHz, std::ref(stop));
+  }
+
+  if (opt.csv) printf("time_us,yaw,pitch,roll,m1,m2,m3,m4,loop_us,dropped,rpm1,rpm2,rpm3,rpm4,link_age_ms,failsafe\n");
+
+  TelemetryDecoder decoder;
+  uint64_t frames = 0, lost = 0, bytes = 0;
+  int lastSeq = -1;
+  // Latest motor speeds, printed with each sample; zero until the first RPM
+  // frame, which only comes from bidirectional DShot
+  TelemetryRpm rpm = {};
+  TelemetryFailsafe failsafe = {};
+  uint16_t trips = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto lastReport = start;
+
+  for (;;) {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    if (opt.seconds > 0 && elapsed >= opt.seconds) break;
+
+    uint8_t buf[256];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      perror("read");
+      break;
+    }
+    bytes += n;
+
+    for (ssize_t i = 0; i < n; i++) {
+      if (!decoder.push(buf[i])) continue;
+      // Every frame type shares the sequence counter
+      if (lastSeq >= 0) lost += (uint8_t)(decoder.seq() - lastSeq - 1);
+      lastSeq = decoder.seq();
+
+      if (decoder.type() == TELEMETRY_TYPE_RPM && decoder.payloadLength() == sizeof(TelemetryRpm)) {
+        memcpy(&rpm, decoder.payload(), sizeof(rpm));
+        continue;
+      }
+      if (decoder.type() == TELEMETRY_TYPE_FAILSAFE && decoder.payloadLength() == sizeof(TelemetryFailsafe)) {
+        memcpy(&failsafe, decoder.payload(), sizeof(failsafe));
+        if (failsafe.trips != trips) {
+          fprintf(stderr, "failsafe tripped, motors stopped %u us after the cutoff\n", failsafe.reactionUs);
+          trips = failsafe.trips;
+        }
+        continue;
+      }
+      if (decoder.type() != TELEMETRY_TYPE_SAMPLE || decoder.payloadLength() != sizeof(TelemetrySample)) continue;
+
+      TelemetrySample s;
+      memcpy(&s, decoder.payload(), sizeof(s));
+      frames++;
+
+      if (opt.csv) {
+        printf("%u,%.2f,%.2f,%.2f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", s.timeUs, s.ypr[0] / 100.0,
+               s.ypr[1] / 100.0, s.ypr[2] / 100.0, s.motor[0], s.motor[1], s.motor[2], s.motor[3], s.loopUs,
+               s.droppedFrames, rpm.rpm[0], rpm.rpm[1], rpm.rpm[2], rpm.rpm[3], failsafe.linkAgeMs, failsafe.state);
+      }
+    }
+
+    if (!opt.csv && now - lastReport >= std::chrono::seconds(1)) {
+      fprintf(stderr, "%.0f s: %llu frames (%.1f/s), %llu lost, %u crc errors, %u framing errors\n", elapsed,
+              (unsigned long long)frames, frames / elapsed, (unsigned long long)lost, decoder.crcErrors(),
+              decoder.framingErrors());
+      lastReport = now;
+    }
+  }
+
+  stop = true;
+  if (fake.joinable()) fake.join();
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "total: %llu frames in %.1f s (%.1f/s, %.0f B/s), %llu lost, %u crc errors, %u framing errors\n",
+          (unsigned long long)frames, elapsed, frames / elapsed, bytes / elapsed, (unsigned long long)lost,
+          decoder.crcErrors(), decoder.framingErrors());
+
+  close(fd);
+  if (master >= 0) close(master);
+  return 0;
+}
@@ -0,0 +1,41 @@
+// Bundles three-entry.js into dist/three.min.js, builds the low-detail drone
+// model, and enforces the gzipped size budgets from package.json. Run by
+// tools/data_gzip.py before the SPIFFS image is built, or by hand with
+// `npm run build`.
+import { build } from 'esbuild';
+import { execFileSync } from 'node:child_process';
+import { readFileSync } from 'node:fs';
+import { gzipSync } from 'node:zlib';
+
+const pkg = JSON.parse(readFileSync(new URL('./package.json', import.meta.url)));
+
+await build({
+  entryPoints: [new URL('./three-entry.js', import.meta.url).pathname],
+  outfile: new URL('./dist/three.min.js', import.meta.url).pathname,
+  bundle: true,
+  minify: true,
+  treeShaking: true,
+  format: 'iife',
+  globalName: 'THREE',
+  target: 'es2019',
+  legalComments: 'none',
+});
+
+// Simplified (10% of triangles), meshopt-compressed copy of the model that
+// the UI shows while the full one downloads
+execFileSync(new URL('./node_modules/.bin/gltfpack', import.meta.url).pathname, [
+  '-i', new URL('../data/droneModel.glb', import.meta.url).pathname,
+  '-o', new URL('./dist/droneModel.lod.glb', import.meta.url).pathname,
+  '-si', '0.1',
+  '-cc',
+], { stdio: 'inherit' });
+
+let failed = false;
+for (const [name, budget] of Object.entries(pkg.sizeBudget)) {
+  const raw = readFileSync(new URL(`./dist/${name}`, import.meta.url));
+  const gz = gzipSync(raw, { level: 9 }).length;
+  const ok = gz <= budget;
+  console.log(`${name}: ${raw.length} B, ${gz} B gzipped (budget ${budget} B) ${ok ? 'ok' : 'OVER BUDGET'}`);
+  if (!ok) failed = true;
+}
+if (failed) process.exit(1);
@@ -0,0 +1,18 @@
+// Only the three.js pieces data/script.js and data/model.js use. esbuild drops
+// everything else, and the result is exposed as the same global THREE the CDN
+// build provided.
+export {
+  Scene,
+  PerspectiveCamera,
+  WebGLRenderer,
+  Mesh,
+  Group,
+  BoxGeometry,
+  MeshNormalMaterial,
+  AmbientLight,
+  DirectionalLight,
+  Box3,
+  Vector3,
+} from 'three';
+export { GLTFLoader } from 'three/examples/jsm/loaders/GLTFLoader.js';
+export { MeshoptDecoder } from 'three/examples/jsm/libs/meshopt_decoder.module.js';